@@ -0,0 +1,289 @@
+#ifndef AHO_CORASICK_H_
+#define AHO_CORASICK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "string_view.h"
+
+// Multi-pattern matcher compiled to a fully resolved DFA. Bytes are first
+// mapped to equivalence classes (every byte that appears in no pattern
+// shares class 0), so a row is classes_count entries wide instead of 256.
+// Transitions store the premultiplied row offset of the target state
+// (state * classes_count) so the scan loop is one load and one add per byte;
+// AC_REPORT_FLAG marks targets that end at least one pattern.
+#define AC_REPORT_FLAG (0x80000000u)
+#define AC_OFFSET_MASK (0x7fffffffu)
+#define AC_BLOCK_SIZE ((size_t)1 << 20)  // ac_count_fd reads this much at once
+
+typedef struct {
+  size_t patterns_count;
+  size_t *pattern_lengths;
+  size_t *pattern_alias;  // first pattern with identical text
+  size_t states_count;
+  size_t classes_count;
+  unsigned char byte_class[256];
+  uint32_t *delta;
+  int64_t *output;      // pattern ending in the state, -1 if none
+  uint32_t *report;     // state itself or nearest suffix state with output
+  uint32_t *dict_link;  // next suffix state with output, 0 if none
+} aho_corasick;
+
+err_t ac_init(aho_corasick **ac, const string_view *patterns,
+              size_t patterns_count);
+void ac_free(aho_corasick *ac);
+
+err_t ac_count(const aho_corasick *ac, const unsigned char *data, size_t len,
+               size_t *counts);
+// The same over everything read from fd, AC_BLOCK_SIZE at a time, for
+// inputs that cannot be mapped (pipes, devices). The automaton's state
+// carries over from block to block, so matches across block boundaries are
+// found once.
+err_t ac_count_fd(const aho_corasick *ac, int fd, size_t *counts);
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+err_t ac_init(aho_corasick **ac, const string_view *patterns,
+              size_t patterns_count) {
+  if (ac == NULL || (patterns == NULL && patterns_count != 0)) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  aho_corasick *m = NULL;
+  size_t i = 0, j = 0, total_len = 1, max_states = 0, k = 0;
+  uint32_t *fail = NULL, *queue = NULL;
+  size_t head = 0, tail = 0;
+  int seen[256] = {0};
+
+  for (i = 0; i < patterns_count; ++i) {
+    total_len += patterns[i].len;
+    for (j = 0; j < patterns[i].len; ++j) {
+      seen[(unsigned char)patterns[i].data[j]] = 1;
+    }
+  }
+  if (total_len > AC_OFFSET_MASK / 256) {
+    return INVALID_INPUT_DATA;
+  }
+  max_states = total_len;
+
+  m = (aho_corasick *)calloc(1, sizeof(aho_corasick));
+  if (m == NULL) {
+    return MEMORY_ALLOCATION_ERROR;
+  }
+
+  m->classes_count = 1;
+  for (i = 0; i < 256; ++i) {
+    m->byte_class[i] = seen[i] ? (unsigned char)m->classes_count++ : 0;
+  }
+  k = m->classes_count;
+
+  m->patterns_count = patterns_count;
+  m->pattern_lengths = (size_t *)malloc((patterns_count + 1) * sizeof(size_t));
+  m->pattern_alias = (size_t *)malloc((patterns_count + 1) * sizeof(size_t));
+  m->delta = (uint32_t *)calloc(max_states * k, sizeof(uint32_t));
+  m->output = (int64_t *)malloc(max_states * sizeof(int64_t));
+  m->report = (uint32_t *)calloc(max_states, sizeof(uint32_t));
+  m->dict_link = (uint32_t *)calloc(max_states, sizeof(uint32_t));
+  fail = (uint32_t *)calloc(max_states, sizeof(uint32_t));
+  queue = (uint32_t *)malloc(max_states * sizeof(uint32_t));
+  if (m->pattern_lengths == NULL || m->pattern_alias == NULL ||
+      m->delta == NULL || m->output == NULL || m->report == NULL ||
+      m->dict_link == NULL || fail == NULL || queue == NULL) {
+    free(fail);
+    free(queue);
+    ac_free(m);
+    return MEMORY_ALLOCATION_ERROR;
+  }
+  for (i = 0; i < max_states; ++i) {
+    m->output[i] = -1;
+  }
+
+  // trie: delta holds plain state numbers here, 0 means "no child"
+  m->states_count = 1;
+  for (i = 0; i < patterns_count; ++i) {
+    uint32_t state = 0;
+    m->pattern_lengths[i] = patterns[i].len;
+    m->pattern_alias[i] = i;
+    if (patterns[i].len == 0) {
+      continue;
+    }
+    for (j = 0; j < patterns[i].len; ++j) {
+      unsigned char c = (unsigned char)patterns[i].data[j];
+      uint32_t *next = &m->delta[state * k + m->byte_class[c]];
+      if (*next == 0) {
+        *next = (uint32_t)m->states_count++;
+      }
+      state = *next;
+    }
+    if (m->output[state] == -1) {
+      m->output[state] = (int64_t)i;
+    } else {
+      m->pattern_alias[i] = (size_t)m->output[state];
+    }
+  }
+
+  // BFS over the trie: fail links, dictionary links, missing transitions
+  for (j = 0; j < k; ++j) {
+    uint32_t child = m->delta[j];
+    if (child != 0) {
+      fail[child] = 0;
+      queue[tail++] = child;
+    }
+  }
+  while (head < tail) {
+    uint32_t state = queue[head++];
+    uint32_t f = fail[state];
+    m->dict_link[state] = (m->output[f] >= 0) ? f : m->dict_link[f];
+    for (j = 0; j < k; ++j) {
+      uint32_t child = m->delta[state * k + j];
+      if (child != 0) {
+        fail[child] = m->delta[f * k + j];
+        queue[tail++] = child;
+      } else {
+        m->delta[state * k + j] = m->delta[f * k + j];
+      }
+    }
+  }
+
+  for (i = 0; i < m->states_count; ++i) {
+    m->report[i] = (m->output[i] >= 0) ? (uint32_t)i : m->dict_link[i];
+  }
+  for (i = 0; i < m->states_count * k; ++i) {
+    uint32_t target = m->delta[i];
+    m->delta[i] = target * (uint32_t)k;
+    if (m->report[target] != 0) {
+      m->delta[i] |= AC_REPORT_FLAG;
+    }
+  }
+
+  free(fail);
+  free(queue);
+
+  *ac = m;
+  return EXIT_SUCCESS;
+}
+
+void ac_free(aho_corasick *ac) {
+  if (ac == NULL) {
+    return;
+  }
+  free(ac->pattern_lengths);
+  free(ac->pattern_alias);
+  free(ac->delta);
+  free(ac->output);
+  free(ac->report);
+  free(ac->dict_link);
+  free(ac);
+}
+
+// Runs [data, data + len), the bytes at offset base of the whole input,
+// through the automaton from *state, adding to counts. next_allowed holds
+// per pattern the offset its next match may start at.
+static void ac_scan(const aho_corasick *ac, const unsigned char *data,
+                    size_t len, size_t base, uint32_t *state,
+                    size_t *next_allowed, size_t *counts) {
+  const uint32_t *delta = ac->delta;
+  const unsigned char *byte_class = ac->byte_class;
+  const size_t k = ac->classes_count;
+  uint32_t s = *state;
+
+  for (size_t pos = 0; pos < len; ++pos) {
+    s = delta[(s & AC_OFFSET_MASK) + byte_class[data[pos]]];
+    if (!(s & AC_REPORT_FLAG)) {
+      continue;
+    }
+    uint32_t out = ac->report[(s & AC_OFFSET_MASK) / k];
+    size_t end = base + pos + 1;
+    while (out != 0) {
+      size_t p = (size_t)ac->output[out];
+      size_t start = end - ac->pattern_lengths[p];
+      if (start >= next_allowed[p]) {
+        counts[p]++;
+        next_allowed[p] = end;
+      }
+      out = ac->dict_link[out];
+    }
+  }
+  *state = s;
+}
+
+// counts[i] gets the number of non-overlapping occurrences of pattern i, the
+// same figure a strstr loop that skips past each match would give.
+err_t ac_count(const aho_corasick *ac, const unsigned char *data, size_t len,
+               size_t *counts) {
+  if (ac == NULL || counts == NULL || (data == NULL && len != 0)) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  size_t *next_allowed = NULL;
+  uint32_t s = 0;
+
+  memset(counts, 0, ac->patterns_count * sizeof(size_t));
+  if (ac->patterns_count == 0) {
+    return EXIT_SUCCESS;
+  }
+  next_allowed = (size_t *)calloc(ac->patterns_count, sizeof(size_t));
+  if (next_allowed == NULL) {
+    return MEMORY_ALLOCATION_ERROR;
+  }
+
+  ac_scan(ac, data, len, 0, &s, next_allowed, counts);
+  for (size_t i = 0; i < ac->patterns_count; ++i) {
+    counts[i] = counts[ac->pattern_alias[i]];
+  }
+
+  free(next_allowed);
+  return EXIT_SUCCESS;
+}
+
+err_t ac_count_fd(const aho_corasick *ac, int fd, size_t *counts) {
+  if (ac == NULL || counts == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  unsigned char *block = NULL;
+  size_t *next_allowed = NULL;
+  size_t base = 0;
+  uint32_t s = 0;
+  err_t err = 0;
+
+  memset(counts, 0, ac->patterns_count * sizeof(size_t));
+  if (ac->patterns_count == 0) {
+    return EXIT_SUCCESS;
+  }
+  next_allowed = (size_t *)calloc(ac->patterns_count, sizeof(size_t));
+  block = (unsigned char *)malloc(AC_BLOCK_SIZE);
+  if (next_allowed == NULL || block == NULL) {
+    free(next_allowed);
+    free(block);
+    return MEMORY_ALLOCATION_ERROR;
+  }
+
+  while (1) {
+    ssize_t n = read(fd, block, AC_BLOCK_SIZE);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      err = OPENING_THE_FILE_ERROR;
+      break;
+    }
+    if (n == 0) {
+      break;
+    }
+    ac_scan(ac, block, (size_t)n, base, &s, next_allowed, counts);
+    base += (size_t)n;
+  }
+  for (size_t i = 0; i < ac->patterns_count; ++i) {
+    counts[i] = counts[ac->pattern_alias[i]];
+  }
+
+  free(block);
+  free(next_allowed);
+  return err;
+}
+
+#endif  // AHO_CORASICK_H_
@@ -0,0 +1,445 @@
+#ifndef AUDIT_LOG_H_
+#define AUDIT_LOG_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "errors.h"
+
+// Asynchronous audit trail: who ran which command, when, and with what
+// result. audit_log_record only copies the event into a bounded lock-free
+// ring (Vyukov's sequence-numbered slots, any number of producers); a
+// background writer drains the ring into a buffer and appends it to the
+// log file with one write() per batch, every flush_ms or as soon as the
+// ring is half full. Nothing on the recording path waits for the disk.
+//
+// When the ring is full the overflow policy decides: BLOCK waits for the
+// writer, DROP discards the event and only counts it in the stats, COUNT
+// discards it too but leaves an AUDIT_LOST record with the number lost in
+// the log, so readers see the gap.
+//
+// The file starts with an audit_log_header and holds records of
+// audit_record + command bytes, padded to 8 bytes and covered by a CRC-32C;
+// readers stop at the first record that does not check out (a torn tail).
+// The file is opened O_APPEND and each batch is whole records, so several
+// processes can share one log. Records are synced only on close.
+#define AUDIT_LOG_MAGIC "AUDITLG1"
+#define AUDIT_LOG_VERSION 1
+#define AUDIT_RECORD_MAGIC (0x54445541u)  // "AUDT"
+#define AUDIT_COMMAND_MAX 256
+#define AUDIT_LOGIN_MAX 8
+#define AUDIT_DEFAULT_CAPACITY ((size_t)4096)
+#define AUDIT_DEFAULT_FLUSH_MS 50
+#define AUDIT_BATCH_BYTES ((size_t)64 << 10)
+
+typedef enum {
+  AUDIT_OVERFLOW_BLOCK,
+  AUDIT_OVERFLOW_DROP,
+  AUDIT_OVERFLOW_COUNT,
+} audit_overflow;
+
+typedef enum {
+  AUDIT_COMMAND,
+  AUDIT_LOST,  // value events were dropped before this record
+} audit_record_type;
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+} audit_log_header;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t crc;     // crc32c of everything after this field, up to size
+  uint16_t size;    // whole record, a multiple of 8
+  uint16_t type;    // audit_record_type
+  uint16_t length;  // command bytes
+  uint16_t reserved;
+  int32_t result;
+  uint32_t uid;
+  int64_t time_ns;  // CLOCK_REALTIME
+  uint64_t value;   // AUDIT_LOST: events lost
+  char login[AUDIT_LOGIN_MAX];
+} audit_record;
+
+typedef struct {
+  size_t capacity;  // events, rounded up to a power of two
+  audit_overflow overflow;
+  unsigned int flush_ms;
+} audit_options;
+
+typedef struct {
+  uint64_t dropped;  // events discarded by DROP or COUNT
+  uint64_t written;  // records in the file, AUDIT_LOST ones included
+  uint64_t writes;   // write() batches
+  uint64_t bytes;
+} audit_stats;
+
+typedef struct {
+  uint64_t sequence;
+  int64_t time_ns;
+  uint32_t uid;
+  int32_t result;
+  uint16_t length;
+  char login[AUDIT_LOGIN_MAX];
+  char command[AUDIT_COMMAND_MAX];
+} audit_slot;
+
+typedef struct {
+  int fd;
+  audit_options opts;
+  audit_slot *slots;
+  size_t mask;
+  uint64_t head __attribute__((aligned(64)));  // next slot to claim
+  uint64_t tail __attribute__((aligned(64)));  // next slot to drain
+  uint64_t lost;  // dropped, not yet reported in the log (COUNT)
+  int sleeping;   // writer waits on wake
+  unsigned char *batch;
+  pthread_t writer;
+  int has_writer;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  int stop;
+  err_t error;  // first write error
+  audit_stats stats;
+} audit_log;
+
+// opts may be NULL for the defaults.
+err_t audit_log_open(audit_log *log, const char *path,
+                     const audit_options *opts);
+// Queues one event; commands longer than AUDIT_COMMAND_MAX are cut.
+err_t audit_log_record(audit_log *log, const char *login, uint32_t uid,
+                       const char *command, int32_t result);
+// Writes out everything queued, syncs and stops the writer; returns the
+// first write error.
+err_t audit_log_close(audit_log *log);
+
+// Checks one record at data (at most len bytes); its size, or 0 if it is
+// torn or not a record.
+size_t audit_record_check(const void *data, size_t len);
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "crc32c.h"
+
+static size_t audit_record_size(size_t length) {
+  return (sizeof(audit_record) + length + 7) & ~(size_t)7;
+}
+
+static uint32_t audit_record_crc(const audit_record *record) {
+  return crc32c(&record->size,
+                record->size - offsetof(audit_record, size));
+}
+
+size_t audit_record_check(const void *data, size_t len) {
+  audit_record record;
+
+  if (len < sizeof(record)) {
+    return 0;
+  }
+  memcpy(&record, data, sizeof(record));
+  if (record.magic != AUDIT_RECORD_MAGIC ||
+      record.size != audit_record_size(record.length) || record.size > len ||
+      record.length > AUDIT_COMMAND_MAX ||
+      record.crc != crc32c((const unsigned char *)data +
+                               offsetof(audit_record, size),
+                           record.size - offsetof(audit_record, size))) {
+    return 0;
+  }
+  return record.size;
+}
+
+static err_t audit_write_all(int fd, const void *data, size_t len) {
+  const unsigned char *p = (const unsigned char *)data;
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      if (n == 0) {
+        errno = EIO;
+      }
+      return OPENING_THE_FILE_ERROR;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+  return EXIT_SUCCESS;
+}
+
+static size_t audit_append(audit_log *log, size_t used, uint16_t type,
+                           const audit_slot *slot, uint64_t value) {
+  audit_record *record = (audit_record *)(log->batch + used);
+  uint16_t length = (slot != NULL) ? slot->length : 0;
+
+  memset(record, 0, audit_record_size(length));
+  record->magic = AUDIT_RECORD_MAGIC;
+  record->size = (uint16_t)audit_record_size(length);
+  record->type = type;
+  record->length = length;
+  record->value = value;
+  if (slot != NULL) {
+    record->result = slot->result;
+    record->uid = slot->uid;
+    record->time_ns = slot->time_ns;
+    memcpy(record->login, slot->login, AUDIT_LOGIN_MAX);
+    memcpy(record + 1, slot->command, length);
+  } else {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    record->time_ns = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  }
+  record->crc = audit_record_crc(record);
+  ++log->stats.written;
+  return used + record->size;
+}
+
+// Moves what the ring holds into the file, batch by batch. Returns whether
+// there was anything.
+static int audit_drain(audit_log *log) {
+  size_t used = 0;
+  int drained = 0;
+  uint64_t lost = 0;
+  uint64_t tail = log->tail;
+
+  while (1) {
+    audit_slot *slot = &log->slots[tail & log->mask];
+    int ready = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) ==
+                tail + 1;
+    if (ready) {
+      used = audit_append(log, used, AUDIT_COMMAND, slot, 0);
+      __atomic_store_n(&slot->sequence, tail + log->mask + 1,
+                       __ATOMIC_RELEASE);
+      ++tail;
+      __atomic_store_n(&log->tail, tail, __ATOMIC_RELEASE);
+      drained = 1;
+    }
+    if (!ready || used + audit_record_size(AUDIT_COMMAND_MAX) * 2 >
+                      AUDIT_BATCH_BYTES) {
+      lost = __atomic_exchange_n(&log->lost, 0, __ATOMIC_ACQ_REL);
+      if (lost != 0) {
+        used = audit_append(log, used, AUDIT_LOST, NULL, lost);
+      }
+      if (used > 0) {
+        err_t err = audit_write_all(log->fd, log->batch, used);
+        if (err != 0 && log->error == 0) {
+          log->error = err;
+        }
+        ++log->stats.writes;
+        log->stats.bytes += used;
+        used = 0;
+      }
+      if (!ready) {
+        return drained || lost != 0;
+      }
+    }
+  }
+}
+
+static void *audit_writer_main(void *arg) {
+  audit_log *log = (audit_log *)arg;
+
+  while (1) {
+    struct timespec until;
+    int stop = 0;
+
+    if (audit_drain(log)) {
+      continue;
+    }
+    pthread_mutex_lock(&log->lock);
+    stop = log->stop;
+    if (!stop) {
+      __atomic_store_n(&log->sleeping, 1, __ATOMIC_SEQ_CST);
+      clock_gettime(CLOCK_REALTIME, &until);
+      until.tv_nsec += (long)log->opts.flush_ms * 1000000;
+      until.tv_sec += until.tv_nsec / 1000000000;
+      until.tv_nsec %= 1000000000;
+      pthread_cond_timedwait(&log->wake, &log->lock, &until);
+      __atomic_store_n(&log->sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+    pthread_mutex_unlock(&log->lock);
+    if (stop) {
+      audit_drain(log);
+      return NULL;
+    }
+  }
+}
+
+static void audit_wake(audit_log *log) {
+  if (__atomic_load_n(&log->sleeping, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&log->lock);
+    pthread_cond_signal(&log->wake);
+    pthread_mutex_unlock(&log->lock);
+  }
+}
+
+err_t audit_log_open(audit_log *log, const char *path,
+                     const audit_options *opts) {
+  if (log == NULL || path == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  struct stat st;
+  size_t capacity = 2;
+  err_t err = 0;
+
+  memset(log, 0, sizeof(*log));
+  log->opts.capacity = AUDIT_DEFAULT_CAPACITY;
+  log->opts.flush_ms = AUDIT_DEFAULT_FLUSH_MS;
+  if (opts != NULL) {
+    log->opts.overflow = opts->overflow;
+    if (opts->capacity != 0) {
+      log->opts.capacity = opts->capacity;
+    }
+    if (opts->flush_ms != 0) {
+      log->opts.flush_ms = opts->flush_ms;
+    }
+  }
+  while (capacity < log->opts.capacity) {
+    capacity *= 2;
+  }
+  log->opts.capacity = capacity;
+  log->mask = capacity - 1;
+
+  log->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+  if (log->fd == -1) {
+    return OPENING_THE_FILE_ERROR;
+  }
+  // Whoever finds the file empty writes the header.
+  flock(log->fd, LOCK_EX);
+  if (fstat(log->fd, &st) == -1) {
+    err = OPENING_THE_FILE_ERROR;
+  } else if (st.st_size == 0) {
+    audit_log_header header = {AUDIT_LOG_MAGIC, AUDIT_LOG_VERSION, 0};
+    err = audit_write_all(log->fd, &header, sizeof(header));
+  }
+  flock(log->fd, LOCK_UN);
+
+  log->slots = (audit_slot *)calloc(capacity, sizeof(*log->slots));
+  log->batch = (unsigned char *)malloc(AUDIT_BATCH_BYTES);
+  if (err == 0 && (log->slots == NULL || log->batch == NULL)) {
+    err = MEMORY_ALLOCATION_ERROR;
+  }
+  if (err == 0) {
+    for (size_t i = 0; i < capacity; ++i) {
+      log->slots[i].sequence = i;
+    }
+    pthread_mutex_init(&log->lock, NULL);
+    pthread_cond_init(&log->wake, NULL);
+    if (pthread_create(&log->writer, NULL, audit_writer_main, log) != 0) {
+      pthread_mutex_destroy(&log->lock);
+      pthread_cond_destroy(&log->wake);
+      err = MEMORY_ALLOCATION_ERROR;
+    } else {
+      log->has_writer = 1;
+    }
+  }
+  if (err != 0) {
+    free(log->slots);
+    free(log->batch);
+    close(log->fd);
+    log->fd = -1;
+  }
+  return err;
+}
+
+err_t audit_log_record(audit_log *log, const char *login, uint32_t uid,
+                       const char *command, int32_t result) {
+  if (log == NULL || command == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  struct timespec ts;
+  uint64_t pos = __atomic_load_n(&log->head, __ATOMIC_RELAXED);
+  audit_slot *slot = NULL;
+  size_t length = strnlen(command, AUDIT_COMMAND_MAX);
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  while (1) {
+    slot = &log->slots[pos & log->mask];
+    uint64_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+    int64_t diff = (int64_t)(sequence - pos);
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&log->head, &pos, pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (diff < 0) {  // full: the writer has not freed this slot yet
+      if (log->opts.overflow != AUDIT_OVERFLOW_BLOCK) {
+        __atomic_fetch_add(&log->stats.dropped, 1, __ATOMIC_RELAXED);
+        if (log->opts.overflow == AUDIT_OVERFLOW_COUNT) {
+          __atomic_fetch_add(&log->lost, 1, __ATOMIC_RELAXED);
+        }
+        audit_wake(log);
+        return EXIT_SUCCESS;
+      }
+      audit_wake(log);
+      sched_yield();
+      pos = __atomic_load_n(&log->head, __ATOMIC_RELAXED);
+    } else {
+      pos = __atomic_load_n(&log->head, __ATOMIC_RELAXED);
+    }
+  }
+
+  slot->time_ns = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  slot->uid = uid;
+  slot->result = result;
+  slot->length = (uint16_t)length;
+  memset(slot->login, 0, AUDIT_LOGIN_MAX);
+  if (login != NULL) {
+    memcpy(slot->login, login, strnlen(login, AUDIT_LOGIN_MAX));
+  }
+  memcpy(slot->command, command, length);
+  __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+
+  // Past half full the writer should not wait for its timer.
+  if (pos + 1 - __atomic_load_n(&log->tail, __ATOMIC_RELAXED) >
+      log->opts.capacity / 2) {
+    audit_wake(log);
+  }
+  return EXIT_SUCCESS;
+}
+
+err_t audit_log_close(audit_log *log) {
+  if (log == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  err_t err = 0;
+  if (log->has_writer) {
+    pthread_mutex_lock(&log->lock);
+    log->stop = 1;
+    pthread_cond_signal(&log->wake);
+    pthread_mutex_unlock(&log->lock);
+    pthread_join(log->writer, NULL);
+    pthread_mutex_destroy(&log->lock);
+    pthread_cond_destroy(&log->wake);
+    log->has_writer = 0;
+  }
+  err = log->error;
+  if (log->fd != -1) {
+    if (fdatasync(log->fd) == -1 && err == 0) {
+      err = OPENING_THE_FILE_ERROR;
+    }
+    close(log->fd);
+    log->fd = -1;
+  }
+  free(log->slots);
+  free(log->batch);
+  log->slots = NULL;
+  log->batch = NULL;
+  return err;
+}
+
+#endif  // AUDIT_LOG_H_
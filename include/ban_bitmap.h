@@ -0,0 +1,172 @@
+#ifndef BAN_BITMAP_H_
+#define BAN_BITMAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "errors.h"
+
+// One bit per user record, shared by every shell using the same records
+// file: a POSIX shared memory object named after the file's device, inode
+// and birth time, or the file path + ".<birth time>.bans" where shm_open is
+// unavailable. Bits are set and tested with atomic operations on the
+// mapping itself, so a ban is visible to all shells as soon as it is set,
+// without locks or messages. The object lives until reboot (or until
+// unlinked), so bans outlive the shells that set them.
+//
+// The birth time keeps a records file that is deleted and recreated, even
+// on the same inode, from picking up the old file's bans; appending records
+// does not change it. On filesystems that do not report birth times it is
+// 0 and only device and inode tell files apart. Define _GNU_SOURCE before
+// the first #include (statx).
+//
+// The whole BAN_BITMAP_MAX_RECORDS range is reserved up front and the
+// object grows under it with posix_fallocate, which never shrinks it, so
+// shells growing it concurrently cannot lose each other's bits.
+#define BAN_BITMAP_MAX_RECORDS ((uint64_t)1 << 32)
+#define BAN_BITMAP_GROWTH ((size_t)4096)  // bytes, 32768 records
+
+typedef struct {
+  int fd;
+  uint64_t *words;
+  size_t size;  // bytes of the object we know are backed
+} ban_bitmap;
+
+err_t ban_bitmap_open(ban_bitmap *bans, const char *records_path);
+void ban_bitmap_close(ban_bitmap *bans);
+
+int ban_bitmap_test(ban_bitmap *bans, size_t record);
+err_t ban_bitmap_set(ban_bitmap *bans, size_t record);
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Birth time of path as one number, 0 if the filesystem does not say.
+static unsigned long long ban_bitmap_birth(const char *path) {
+  struct statx stx;
+
+  if (statx(AT_FDCWD, path, 0, STATX_BTIME, &stx) != 0 ||
+      !(stx.stx_mask & STATX_BTIME)) {
+    return 0;
+  }
+  return (unsigned long long)stx.stx_btime.tv_sec * 1000000000ull +
+         stx.stx_btime.tv_nsec;
+}
+
+err_t ban_bitmap_open(ban_bitmap *bans, const char *records_path) {
+  if (bans == NULL || records_path == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  struct stat st;
+  char name[96];
+  unsigned long long birth = 0;
+  void *data = NULL;
+
+  bans->fd = -1;
+  bans->words = NULL;
+  bans->size = 0;
+  if (stat(records_path, &st) == -1) {
+    return OPENING_THE_FILE_ERROR;
+  }
+  birth = ban_bitmap_birth(records_path);
+  snprintf(name, sizeof(name), "/user_bans.%llx.%llx.%llx",
+           (unsigned long long)st.st_dev, (unsigned long long)st.st_ino,
+           birth);
+  bans->fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (bans->fd == -1) {
+    size_t len = strlen(records_path) + sizeof(".0123456789abcdef.bans");
+    char *path = (char *)malloc(len);
+    if (path == NULL) {
+      return MEMORY_ALLOCATION_ERROR;
+    }
+    snprintf(path, len, "%s.%llx.bans", records_path, birth);
+    bans->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    free(path);
+    if (bans->fd == -1) {
+      return OPENING_THE_FILE_ERROR;
+    }
+  }
+
+  data = mmap(NULL, BAN_BITMAP_MAX_RECORDS / 8, PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_NORESERVE, bans->fd, 0);
+  if (data == MAP_FAILED) {
+    close(bans->fd);
+    bans->fd = -1;
+    return MEMORY_MAPPING_ERROR;
+  }
+  bans->words = (uint64_t *)data;
+  if (fstat(bans->fd, &st) == 0) {
+    bans->size = (size_t)st.st_size;
+  }
+  return EXIT_SUCCESS;
+}
+
+void ban_bitmap_close(ban_bitmap *bans) {
+  if (bans == NULL) {
+    return;
+  }
+  if (bans->words != NULL) {
+    munmap(bans->words, BAN_BITMAP_MAX_RECORDS / 8);
+  }
+  if (bans->fd != -1) {
+    close(bans->fd);
+  }
+  bans->fd = -1;
+  bans->words = NULL;
+  bans->size = 0;
+}
+
+// Whether the byte holding record's bit is backed, checking the object
+// again if another shell may have grown it. Touching the reservation past
+// the object's end would raise SIGBUS.
+static int ban_bitmap_covers(ban_bitmap *bans, size_t record) {
+  struct stat st;
+
+  if (record / 8 < bans->size) {
+    return 1;
+  }
+  if (fstat(bans->fd, &st) == 0) {
+    bans->size = (size_t)st.st_size;
+  }
+  return record / 8 < bans->size;
+}
+
+int ban_bitmap_test(ban_bitmap *bans, size_t record) {
+  if (bans == NULL || bans->words == NULL || record >= BAN_BITMAP_MAX_RECORDS ||
+      !ban_bitmap_covers(bans, record)) {
+    return 0;
+  }
+  return (__atomic_load_n(&bans->words[record / 64], __ATOMIC_ACQUIRE) >>
+          (record % 64)) &
+         1;
+}
+
+err_t ban_bitmap_set(ban_bitmap *bans, size_t record) {
+  if (bans == NULL || bans->words == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+  if (record >= BAN_BITMAP_MAX_RECORDS) {
+    return INDEX_OUT_OF_BOUNDS;
+  }
+  if (!ban_bitmap_covers(bans, record)) {
+    size_t size = (record / 8 / BAN_BITMAP_GROWTH + 1) * BAN_BITMAP_GROWTH;
+    int error = posix_fallocate(bans->fd, 0, (off_t)size);
+    if (error != 0) {
+      errno = error;
+      return OPENING_THE_FILE_ERROR;
+    }
+    bans->size = size;
+  }
+  __atomic_fetch_or(&bans->words[record / 64], (uint64_t)1 << (record % 64),
+                    __ATOMIC_RELEASE);
+  return EXIT_SUCCESS;
+}
+
+#endif  // BAN_BITMAP_H_
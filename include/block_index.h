@@ -0,0 +1,449 @@
+#ifndef BLOCK_INDEX_H_
+#define BLOCK_INDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "errors.h"
+#include "scan_kernels.h"
+
+// Sidecar index of per-block scan results: every block_size bytes of the
+// file get a CRC-32C plus the fused reductions (xor8..xor64, xorodd, one
+// counter per indexed mask). Block sizes are multiples of 4096, so blocks
+// never cut a word and the stored partials combine into whole-file totals.
+//
+// On disk: block_index_header, then one record per block holding the first
+// BLOCK_RECORD_SIZE(masks_count) bytes of block_record. Native byte order;
+// the index is a cache for this machine, not an interchange format.
+#define BLOCK_INDEX_MAGIC "SCANIDX1"
+#define BLOCK_INDEX_VERSION (1)
+#define BLOCK_INDEX_DEFAULT_BLOCK ((size_t)1 << 20)
+#define BLOCK_INDEX_BLOCK_ALIGN ((size_t)4096)
+#define BLOCK_RECORD_SIZE(masks_count) \
+  (offsetof(block_record, mask_counts) + (masks_count) * sizeof(uint64_t))
+
+typedef struct {
+  uint32_t crc;
+  uint32_t xorodd;
+  uint8_t xor8;
+  uint8_t reserved;
+  uint16_t xor16;
+  uint32_t xor32;
+  uint64_t xor64;
+  uint64_t mask_counts[SCAN_MAX_MASKS];
+} block_record;
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t masks_count;
+  uint64_t block_size;
+  uint64_t file_size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint32_t masks[SCAN_MAX_MASKS];
+} block_index_header;
+
+typedef struct {
+  block_index_header header;
+  size_t blocks_count;
+  block_record *records;
+  unsigned char *dirty;  // records to write back on save
+  int rewrite;           // block count changed: save the whole index
+} block_index;
+
+// Byte range [begin, end) of the file the caller knows was modified.
+typedef struct {
+  uint64_t begin;
+  uint64_t end;
+} block_range;
+
+err_t block_index_build(block_index *idx, const scan_kernels *kernels,
+                        const unsigned char *data, const struct stat *st,
+                        size_t block_size, const uint32_t *masks,
+                        size_t masks_count, size_t threads);
+err_t block_index_refresh(block_index *idx, const scan_kernels *kernels,
+                          const unsigned char *data, const struct stat *st,
+                          const block_range *ranges, size_t ranges_count,
+                          size_t threads, size_t *recomputed_placeholder);
+
+err_t block_index_load(block_index *idx, const char *path);
+err_t block_index_save(block_index *idx, const char *path);
+void block_index_free(block_index *idx);
+
+void block_index_totals(const block_index *idx, scan_totals *totals);
+uint32_t block_index_crc32c(const block_index *idx);
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "crc32c.h"
+#include "parallel_scan.h"
+
+// dirty[] values while refreshing
+#define BLOCK_KEEP (0)
+#define BLOCK_CHECK (1)  // recompute only if the CRC changed
+#define BLOCK_FORCE (2)  // recompute unconditionally
+
+typedef struct {
+  block_index *idx;
+  const scan_kernels *kernels;
+  scan_plan plan;
+} block_index_job;
+
+// per-thread count of recomputed blocks, one cache line each
+typedef union {
+  size_t recomputed;
+  unsigned char pad[64];
+} block_index_partial;
+
+static void block_index_scan_block(const unsigned char *data, size_t len,
+                                   size_t chunk_index, void *partial,
+                                   void *ctx) {
+  block_index_job *job = (block_index_job *)ctx;
+  block_record *record = &job->idx->records[chunk_index];
+  unsigned char *action = &job->idx->dirty[chunk_index];
+  scan_totals totals;
+  uint32_t crc = 0;
+
+  if (*action == BLOCK_KEEP) {
+    return;
+  }
+  crc = crc32c(data, len);
+  if (*action == BLOCK_CHECK && crc == record->crc) {
+    *action = BLOCK_KEEP;
+    return;
+  }
+
+  memset(&totals, 0, sizeof(totals));
+  job->kernels->fused(&job->plan, data, len, &totals);
+  memset(record, 0, sizeof(*record));
+  record->crc = crc;
+  record->xorodd = totals.xorodd;
+  record->xor8 = totals.xor8;
+  record->xor16 = totals.xor16;
+  record->xor32 = totals.xor32;
+  record->xor64 = totals.xor64;
+  memcpy(record->mask_counts, totals.mask_counts,
+         job->plan.masks_count * sizeof(uint64_t));
+
+  *action = BLOCK_FORCE;
+  ((block_index_partial *)partial)->recomputed++;
+}
+
+static err_t block_index_run(block_index *idx, const scan_kernels *kernels,
+                             const unsigned char *data, size_t threads,
+                             size_t *recomputed_placeholder) {
+  block_index_job job;
+  block_index_partial *partials = NULL;
+  err_t err = 0;
+
+  threads = (threads == 0) ? 1 : threads;
+  partials = (block_index_partial *)calloc(threads, sizeof(*partials));
+  if (partials == NULL) {
+    return MEMORY_ALLOCATION_ERROR;
+  }
+
+  memset(&job, 0, sizeof(job));
+  job.idx = idx;
+  job.kernels = kernels;
+  job.plan.xor_widths = 1;
+  job.plan.xorodd = 1;
+  job.plan.masks_count = idx->header.masks_count;
+  memcpy(job.plan.masks, idx->header.masks, sizeof(job.plan.masks));
+
+  err = parallel_scan(data, idx->header.file_size, idx->header.block_size,
+                      threads, block_index_scan_block, &job, partials,
+                      sizeof(*partials));
+
+  *recomputed_placeholder = 0;
+  for (size_t t = 0; t < threads; ++t) {
+    *recomputed_placeholder += partials[t].recomputed;
+  }
+  free(partials);
+  return err;
+}
+
+static err_t block_index_resize(block_index *idx, size_t blocks_count) {
+  block_record *records = NULL;
+  unsigned char *dirty = NULL;
+
+  // one spare slot keeps the allocations non-empty for empty files
+  records = (block_record *)realloc(idx->records,
+                                    (blocks_count + 1) * sizeof(block_record));
+  if (records == NULL) {
+    return MEMORY_ALLOCATION_ERROR;
+  }
+  idx->records = records;
+  dirty = (unsigned char *)realloc(idx->dirty, blocks_count + 1);
+  if (dirty == NULL) {
+    return MEMORY_ALLOCATION_ERROR;
+  }
+  idx->dirty = dirty;
+
+  if (blocks_count > idx->blocks_count) {
+    memset(idx->records + idx->blocks_count, 0,
+           (blocks_count - idx->blocks_count) * sizeof(block_record));
+  }
+  if (blocks_count != idx->blocks_count) {
+    idx->rewrite = 1;
+  }
+  idx->blocks_count = blocks_count;
+  return EXIT_SUCCESS;
+}
+
+static void block_index_stamp(block_index *idx, const struct stat *st) {
+  idx->header.file_size = (uint64_t)st->st_size;
+  idx->header.mtime_sec = (int64_t)st->st_mtim.tv_sec;
+  idx->header.mtime_nsec = (int64_t)st->st_mtim.tv_nsec;
+}
+
+err_t block_index_build(block_index *idx, const scan_kernels *kernels,
+                        const unsigned char *data, const struct stat *st,
+                        size_t block_size, const uint32_t *masks,
+                        size_t masks_count, size_t threads) {
+  if (idx == NULL || kernels == NULL || st == NULL ||
+      (masks == NULL && masks_count != 0)) {
+    return DEREFERENCING_NULL_PTR;
+  }
+  if (block_size == 0 || block_size % BLOCK_INDEX_BLOCK_ALIGN != 0 ||
+      masks_count > SCAN_MAX_MASKS) {
+    return INVALID_INPUT_DATA;
+  }
+
+  size_t recomputed = 0;
+  err_t err = 0;
+
+  memset(idx, 0, sizeof(*idx));
+  memcpy(idx->header.magic, BLOCK_INDEX_MAGIC, sizeof(idx->header.magic));
+  idx->header.version = BLOCK_INDEX_VERSION;
+  idx->header.masks_count = (uint32_t)masks_count;
+  idx->header.block_size = block_size;
+  if (masks_count > 0) {
+    memcpy(idx->header.masks, masks, masks_count * sizeof(uint32_t));
+  }
+  block_index_stamp(idx, st);
+
+  err = block_index_resize(
+      idx, parallel_scan_chunks((size_t)st->st_size, block_size));
+  if (err != 0) {
+    block_index_free(idx);
+    return err;
+  }
+  memset(idx->dirty, BLOCK_FORCE, idx->blocks_count);
+  idx->rewrite = 1;
+
+  return block_index_run(idx, kernels, data, threads, &recomputed);
+}
+
+// Brings the index up to date with the file. Blocks whose extent changed
+// (the old or new tail block and anything past it) are always recomputed. With
+// ranges, only blocks overlapping them are looked at besides; without, an
+// unchanged size and mtime means nothing to do, otherwise every block is
+// re-checksummed and only those with a different CRC are re-reduced.
+err_t block_index_refresh(block_index *idx, const scan_kernels *kernels,
+                          const unsigned char *data, const struct stat *st,
+                          const block_range *ranges, size_t ranges_count,
+                          size_t threads, size_t *recomputed_placeholder) {
+  if (idx == NULL || kernels == NULL || st == NULL ||
+      recomputed_placeholder == NULL || (ranges == NULL && ranges_count != 0)) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  const uint64_t block_size = idx->header.block_size;
+  const uint64_t new_size = (uint64_t)st->st_size;
+  const size_t old_blocks = idx->blocks_count;
+  int resized = new_size != idx->header.file_size;
+  int touched = resized || st->st_mtim.tv_sec != idx->header.mtime_sec ||
+                st->st_mtim.tv_nsec != idx->header.mtime_nsec;
+  size_t i = 0, first_reshaped = 0;
+  err_t err = 0;
+
+  err = block_index_resize(idx, parallel_scan_chunks(new_size, block_size));
+  if (err != 0) {
+    return err;
+  }
+
+  memset(idx->dirty, (ranges_count == 0 && touched) ? BLOCK_CHECK : BLOCK_KEEP,
+         idx->blocks_count);
+  for (size_t r = 0; r < ranges_count; ++r) {
+    uint64_t end = (ranges[r].end < new_size) ? ranges[r].end : new_size;
+    if (ranges[r].begin >= end) {
+      continue;
+    }
+    for (i = ranges[r].begin / block_size; i <= (end - 1) / block_size; ++i) {
+      idx->dirty[i] = BLOCK_FORCE;
+    }
+  }
+  if (resized) {
+    // The last block both before and after is the one whose extent moved:
+    // the old tail when growing, the new (possibly partial) tail when
+    // shrinking.
+    first_reshaped =
+        (old_blocks < idx->blocks_count) ? old_blocks : idx->blocks_count;
+    first_reshaped = (first_reshaped == 0) ? 0 : first_reshaped - 1;
+    for (i = first_reshaped; i < idx->blocks_count; ++i) {
+      idx->dirty[i] = BLOCK_FORCE;
+    }
+  }
+
+  block_index_stamp(idx, st);
+  return block_index_run(idx, kernels, data, threads, recomputed_placeholder);
+}
+
+err_t block_index_load(block_index *idx, const char *path) {
+  if (idx == NULL || path == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  FILE *fp = NULL;
+  size_t record_size = 0, blocks_count = 0;
+  err_t err = 0;
+
+  memset(idx, 0, sizeof(*idx));
+  fp = fopen(path, "rb");
+  if (fp == NULL) {
+    return OPENING_THE_FILE_ERROR;
+  }
+
+  if (fread(&idx->header, sizeof(idx->header), 1, fp) != 1 ||
+      memcmp(idx->header.magic, BLOCK_INDEX_MAGIC, sizeof(idx->header.magic)) !=
+          0 ||
+      idx->header.version != BLOCK_INDEX_VERSION ||
+      idx->header.masks_count > SCAN_MAX_MASKS ||
+      idx->header.block_size == 0 ||
+      idx->header.block_size % BLOCK_INDEX_BLOCK_ALIGN != 0) {
+    fclose(fp);
+    return INVALID_INPUT_DATA;
+  }
+
+  record_size = BLOCK_RECORD_SIZE(idx->header.masks_count);
+  blocks_count =
+      parallel_scan_chunks(idx->header.file_size, idx->header.block_size);
+  err = block_index_resize(idx, blocks_count);
+  if (err != 0) {
+    fclose(fp);
+    block_index_free(idx);
+    return err;
+  }
+  memset(idx->records, 0, blocks_count * sizeof(block_record));
+  for (size_t i = 0; i < blocks_count; ++i) {
+    if (fread(&idx->records[i], record_size, 1, fp) != 1) {
+      fclose(fp);
+      block_index_free(idx);
+      return INVALID_INPUT_DATA;
+    }
+  }
+
+  fclose(fp);
+  idx->rewrite = 0;
+  return EXIT_SUCCESS;
+}
+
+// Unchanged block count: patch the header and the dirty records in place.
+// Otherwise write a fresh index next to the old one and rename it over.
+err_t block_index_save(block_index *idx, const char *path) {
+  if (idx == NULL || path == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  const size_t record_size = BLOCK_RECORD_SIZE(idx->header.masks_count);
+  char tmp_path[4096];
+  FILE *fp = NULL;
+  int fd = -1;
+  size_t i = 0;
+
+  if (!idx->rewrite) {
+    fd = open(path, O_WRONLY);
+    if (fd == -1) {
+      return OPENING_THE_FILE_ERROR;
+    }
+    // records before the header: if we die in between, the old mtime in the
+    // header makes the next refresh re-check every CRC
+    for (i = 0; i < idx->blocks_count; ++i) {
+      if (idx->dirty[i] == BLOCK_KEEP) {
+        continue;
+      }
+      if (pwrite(fd, &idx->records[i], record_size,
+                 (off_t)(sizeof(idx->header) + i * record_size)) !=
+          (ssize_t)record_size) {
+        close(fd);
+        return OPENING_THE_FILE_ERROR;
+      }
+    }
+    if (pwrite(fd, &idx->header, sizeof(idx->header), 0) !=
+        (ssize_t)sizeof(idx->header)) {
+      close(fd);
+      return OPENING_THE_FILE_ERROR;
+    }
+    close(fd);
+    return EXIT_SUCCESS;
+  }
+
+  if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >=
+      (int)sizeof(tmp_path)) {
+    return INVALID_INPUT_DATA;
+  }
+  fp = fopen(tmp_path, "wb");
+  if (fp == NULL) {
+    return OPENING_THE_FILE_ERROR;
+  }
+  fwrite(&idx->header, sizeof(idx->header), 1, fp);
+  for (i = 0; i < idx->blocks_count; ++i) {
+    fwrite(&idx->records[i], record_size, 1, fp);
+  }
+  if (ferror(fp) || fclose(fp) != 0 || rename(tmp_path, path) != 0) {
+    unlink(tmp_path);
+    return OPENING_THE_FILE_ERROR;
+  }
+  idx->rewrite = 0;
+  return EXIT_SUCCESS;
+}
+
+void block_index_free(block_index *idx) {
+  if (idx == NULL) {
+    return;
+  }
+  free(idx->records);
+  free(idx->dirty);
+  idx->records = NULL;
+  idx->dirty = NULL;
+  idx->blocks_count = 0;
+}
+
+// mask_counts follow header.masks order.
+void block_index_totals(const block_index *idx, scan_totals *totals) {
+  memset(totals, 0, sizeof(*totals));
+  for (size_t i = 0; i < idx->blocks_count; ++i) {
+    const block_record *record = &idx->records[i];
+    totals->xor8 ^= record->xor8;
+    totals->xor16 ^= record->xor16;
+    totals->xor32 ^= record->xor32;
+    totals->xor64 ^= record->xor64;
+    totals->xorodd ^= record->xorodd;
+    for (size_t m = 0; m < idx->header.masks_count; ++m) {
+      totals->mask_counts[m] += record->mask_counts[m];
+    }
+  }
+}
+
+// Whole-file CRC-32C, joined from the per-block CRCs without rereading.
+uint32_t block_index_crc32c(const block_index *idx) {
+  uint64_t block_size = idx->header.block_size;
+  uint64_t last = (idx->blocks_count == 0)
+                      ? 0
+                      : idx->header.file_size -
+                            (idx->blocks_count - 1) * block_size;
+  uint32_t crc = 0;
+  for (size_t i = 0; i < idx->blocks_count; ++i) {
+    crc = crc32c_combine(crc, idx->records[i].crc,
+                         (i + 1 == idx->blocks_count) ? last : block_size);
+  }
+  return crc;
+}
+
+#endif  // BLOCK_INDEX_H_
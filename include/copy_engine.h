@@ -0,0 +1,398 @@
+#ifndef COPY_ENGINE_H_
+#define COPY_ENGINE_H_
+
+#include <stdint.h>
+
+#include "errors.h"
+
+// Copies file data without bouncing it through user space where the kernel
+// allows it. Paths are tried fastest first and each one falls through to the
+// next when the kernel or filesystem rejects it before moving any byte:
+//   reflink          FICLONE, shares extents (whole files only, btrfs/xfs)
+//   copy_file_range  in-kernel copy, may offload to the filesystem/device
+//   splice           file -> pipe -> file, page references instead of copies
+//   buffer           pread/pwrite through an aligned COPY_ENGINE_BUFFER_SIZE
+// splice stands in for sendfile: both move pages the same way, but splice
+// takes an explicit output offset, so ranges never share a file position.
+//
+// Whole-file copies between regular files are sparse aware: only the data
+// extents reported by SEEK_DATA/SEEK_HOLE are copied, each one fallocate()d
+// first so it lands contiguously, and holes stay holes in the destination.
+// I/O errors return OPENING_THE_FILE_ERROR with errno left set. Define
+// _GNU_SOURCE before the first #include (copy_file_range, splice).
+#define COPY_ENGINE_BUFFER_SIZE ((size_t)1 << 20)
+#define COPY_ENGINE_ALIGN ((size_t)4096)
+#define COPY_ENGINE_TO_EOF UINT64_MAX
+
+typedef enum {
+  COPY_PATH_REFLINK,
+  COPY_PATH_COPY_FILE_RANGE,
+  COPY_PATH_SPLICE,
+  COPY_PATH_BUFFER,
+  COPY_PATH_COUNT
+} copy_path;
+
+typedef struct {
+  copy_path path;  // slowest path that had to move data
+  uint64_t bytes;  // data copied
+  uint64_t holes;  // bytes of holes skipped instead of written as zeros
+} copy_stats;
+
+const char *copy_path_name(copy_path path);
+err_t copy_path_parse(const char *name, copy_path *path_placeholder);
+
+// Copies up to len bytes (COPY_ENGINE_TO_EOF for all) from in_fd at in_off to
+// out_fd at out_off, starting with the `first` path. File positions are left
+// untouched, so disjoint ranges of the same pair may be copied concurrently.
+// A pipe or socket ignores its offset: in_fd is read and out_fd written in
+// order.
+err_t copy_engine_range(int in_fd, uint64_t in_off, int out_fd,
+                        uint64_t out_off, uint64_t len, copy_path first,
+                        copy_stats *stats);
+// Replaces the contents of out_fd with the whole of in_fd. Moves in_fd's file
+// position while it looks for holes.
+err_t copy_engine_fd(int in_fd, int out_fd, copy_path first,
+                     copy_stats *stats);
+// Creates or truncates dst with src's permission bits and copies into it.
+err_t copy_engine_file(const char *src, const char *dst, copy_path first,
+                       copy_stats *stats);
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char *const copy_path_names[COPY_PATH_COUNT] = {
+    "reflink", "copy_file_range", "splice", "buffer"};
+
+const char *copy_path_name(copy_path path) {
+  return (path < COPY_PATH_COUNT) ? copy_path_names[path] : "unknown";
+}
+
+err_t copy_path_parse(const char *name, copy_path *path_placeholder) {
+  if (name == NULL || path_placeholder == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+  for (int path = 0; path < COPY_PATH_COUNT; ++path) {
+    if (strcmp(name, copy_path_names[path]) == 0) {
+      *path_placeholder = (copy_path)path;
+      return EXIT_SUCCESS;
+    }
+  }
+  return INVALID_CLI_ARGUMENT;
+}
+
+// Errors that mean "this path does not apply to these files", as opposed to
+// a failing device.
+static int copy_engine_unsupported(int error) {
+  return error == EXDEV || error == EINVAL || error == ENOSYS ||
+         error == EOPNOTSUPP || error == EBADF || error == ETXTBSY;
+}
+
+static uint64_t copy_engine_step(uint64_t left) {
+  return (left < ((uint64_t)1 << 30)) ? left : ((uint64_t)1 << 30);
+}
+
+// Each tier advances *in_off, *out_off (either may be NULL for a pipe, which
+// is read or written in order) and *left, stops early at EOF, and returns 1
+// when it cannot run on these files so the caller moves on to the next tier.
+static int copy_engine_copy_file_range(int in_fd, loff_t *in_off, int out_fd,
+                                       loff_t *out_off, uint64_t *left,
+                                       err_t *err) {
+  while (*left > 0) {
+    ssize_t n = copy_file_range(in_fd, in_off, out_fd, out_off,
+                                copy_engine_step(*left), 0);
+    if (n == 0) {
+      break;  // EOF
+    } else if (n > 0) {
+      *left -= (uint64_t)n;
+    } else if (errno != EINTR) {
+      if (copy_engine_unsupported(errno)) {
+        return 1;
+      }
+      *err = OPENING_THE_FILE_ERROR;
+      return 0;
+    }
+  }
+  return 0;
+}
+
+static int copy_engine_splice(int in_fd, loff_t *in_off, int out_fd,
+                              loff_t *out_off, uint64_t *left, err_t *err) {
+  int pipe_fds[2];
+  int fallback = 0;
+
+  if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+    return 1;
+  }
+  fcntl(pipe_fds[1], F_SETPIPE_SZ, (int)COPY_ENGINE_BUFFER_SIZE);
+
+  while (*left > 0 && !fallback && *err == 0) {
+    ssize_t filled = splice(in_fd, in_off, pipe_fds[1], NULL,
+                            copy_engine_step(*left), SPLICE_F_MOVE);
+    if (filled == 0) {
+      break;  // EOF
+    }
+    if (filled < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (copy_engine_unsupported(errno)) {
+        fallback = 1;
+      } else {
+        *err = OPENING_THE_FILE_ERROR;
+      }
+      break;
+    }
+    // The pipe already holds these bytes, so they must reach out_fd here:
+    // a failure from now on is an error, not a fallback.
+    while (filled > 0) {
+      ssize_t drained = splice(pipe_fds[0], NULL, out_fd, out_off,
+                               (size_t)filled, SPLICE_F_MOVE | SPLICE_F_MORE);
+      if (drained <= 0) {
+        if (drained < 0 && errno == EINTR) {
+          continue;
+        }
+        *err = OPENING_THE_FILE_ERROR;
+        break;
+      }
+      filled -= drained;
+      *left -= (uint64_t)drained;
+    }
+  }
+
+  close(pipe_fds[0]);
+  close(pipe_fds[1]);
+  return fallback;
+}
+
+static void copy_engine_buffer(int in_fd, loff_t *in_off, int out_fd,
+                               loff_t *out_off, uint64_t *left, err_t *err) {
+  unsigned char *buffer =
+      aligned_alloc(COPY_ENGINE_ALIGN, COPY_ENGINE_BUFFER_SIZE);
+  if (buffer == NULL) {
+    *err = MEMORY_ALLOCATION_ERROR;
+    return;
+  }
+
+  while (*left > 0 && *err == 0) {
+    size_t want = (*left < COPY_ENGINE_BUFFER_SIZE) ? (size_t)*left
+                                                    : COPY_ENGINE_BUFFER_SIZE;
+    ssize_t n = (in_off == NULL) ? read(in_fd, buffer, want)
+                                 : pread(in_fd, buffer, want, *in_off);
+    if (n == 0) {
+      break;  // EOF
+    }
+    if (n < 0) {
+      if (errno != EINTR) {
+        *err = OPENING_THE_FILE_ERROR;
+      }
+      continue;
+    }
+    for (ssize_t written = 0; written < n;) {
+      ssize_t m = (out_off == NULL)
+                      ? write(out_fd, buffer + written, (size_t)(n - written))
+                      : pwrite(out_fd, buffer + written, (size_t)(n - written),
+                               *out_off + written);
+      if (m < 0 && errno == EINTR) {
+        continue;
+      }
+      if (m <= 0) {
+        *err = OPENING_THE_FILE_ERROR;
+        break;
+      }
+      written += m;
+    }
+    if (in_off != NULL) {
+      *in_off += n;
+    }
+    if (out_off != NULL) {
+      *out_off += n;
+    }
+    *left -= (uint64_t)n;
+  }
+
+  free(buffer);
+}
+
+err_t copy_engine_range(int in_fd, uint64_t in_off, int out_fd,
+                        uint64_t out_off, uint64_t len, copy_path first,
+                        copy_stats *stats) {
+  if (stats == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  loff_t in_pos = (loff_t)in_off;
+  loff_t out_pos = (loff_t)out_off;
+  loff_t *in_ptr = &in_pos;
+  loff_t *out_ptr = &out_pos;
+  uint64_t left = len;
+  err_t err = 0;
+  copy_path path = (first == COPY_PATH_REFLINK) ? COPY_PATH_COPY_FILE_RANGE
+                                                : first;
+
+  if (lseek(in_fd, 0, SEEK_CUR) == -1 && errno == ESPIPE) {
+    in_ptr = NULL;
+  }
+  if (lseek(out_fd, 0, SEEK_CUR) == -1 && errno == ESPIPE) {
+    out_ptr = NULL;
+  }
+
+  if (path == COPY_PATH_COPY_FILE_RANGE) {
+    if (!copy_engine_copy_file_range(in_fd, in_ptr, out_fd, out_ptr, &left,
+                                     &err)) {
+      goto done;
+    }
+    path = COPY_PATH_SPLICE;
+  }
+  if (path == COPY_PATH_SPLICE) {
+    if (!copy_engine_splice(in_fd, in_ptr, out_fd, out_ptr, &left, &err)) {
+      goto done;
+    }
+    path = COPY_PATH_BUFFER;
+  }
+  copy_engine_buffer(in_fd, in_ptr, out_fd, out_ptr, &left, &err);
+
+done:
+  stats->path = path;
+  stats->bytes = len - left;
+  stats->holes = 0;
+  return err;
+}
+
+// Sizes the (empty) destination first so the holes exist from the start,
+// then copies extent by extent. Filesystems without SEEK_DATA report the
+// whole file as a single data extent.
+static err_t copy_engine_extents(int in_fd, int out_fd, uint64_t size,
+                                 copy_path first, copy_stats *stats) {
+  copy_stats extent;
+  uint64_t offset = 0;
+  err_t err = 0;
+
+  stats->path = (first == COPY_PATH_REFLINK) ? COPY_PATH_COPY_FILE_RANGE
+                                             : first;
+  stats->bytes = 0;
+  stats->holes = 0;
+  if (ftruncate(out_fd, (off_t)size) == -1) {
+    return OPENING_THE_FILE_ERROR;
+  }
+
+  while (offset < size && err == 0) {
+    off_t data = lseek(in_fd, (off_t)offset, SEEK_DATA);
+    off_t hole = 0;
+    if (data == -1 && errno == ENXIO) {
+      break;  // only a hole up to EOF is left
+    }
+    if (data == -1) {
+      data = (off_t)offset;
+      hole = (off_t)size;
+    } else {
+      hole = lseek(in_fd, data, SEEK_HOLE);
+      if (hole == -1 || (uint64_t)hole > size) {
+        hole = (off_t)size;
+      }
+    }
+    if ((uint64_t)data >= size) {
+      break;
+    }
+
+    uint64_t len = (uint64_t)(hole - data);
+    if (fallocate(out_fd, 0, data, (off_t)len) == -1 && errno == ENOSPC) {
+      return OPENING_THE_FILE_ERROR;
+    }
+    err = copy_engine_range(in_fd, (uint64_t)data, out_fd, (uint64_t)data,
+                            len, first, &extent);
+    stats->bytes += extent.bytes;
+    if (extent.path > stats->path) {
+      stats->path = extent.path;
+    }
+    first = extent.path;  // no use retrying paths this pair already refused
+    if (err == 0 && extent.bytes < len) {
+      break;  // the source shrank while we copied it
+    }
+    offset = (uint64_t)hole;
+  }
+
+  stats->holes = size - stats->bytes;
+  return err;
+}
+
+err_t copy_engine_fd(int in_fd, int out_fd, copy_path first,
+                     copy_stats *stats) {
+  if (stats == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  struct stat st;
+  struct stat out_st;
+
+  if (fstat(in_fd, &st) == -1 || fstat(out_fd, &out_st) == -1) {
+    return OPENING_THE_FILE_ERROR;
+  }
+  if (st.st_dev == out_st.st_dev && st.st_ino == out_st.st_ino) {
+    return INVALID_INPUT_DATA;  // truncating out_fd would destroy the source
+  }
+  if (first == COPY_PATH_REFLINK && S_ISREG(st.st_mode) &&
+      ioctl(out_fd, FICLONE, in_fd) == 0) {
+    stats->path = COPY_PATH_REFLINK;
+    stats->bytes = (uint64_t)st.st_size;
+    stats->holes = 0;  // shared extents, holes included; nothing skipped
+    return EXIT_SUCCESS;
+  }
+  if (ftruncate(out_fd, 0) == -1 && errno != EINVAL) {
+    return OPENING_THE_FILE_ERROR;
+  }
+  if (S_ISREG(st.st_mode) && S_ISREG(out_st.st_mode) && st.st_size > 0) {
+    return copy_engine_extents(in_fd, out_fd, (uint64_t)st.st_size, first,
+                               stats);
+  }
+  // Pseudo-files report size 0 but still have data; in-kernel copies see
+  // them as empty, so only the buffer loop reads them correctly.
+  if (S_ISREG(st.st_mode) && st.st_size == 0) {
+    first = COPY_PATH_BUFFER;
+  }
+  return copy_engine_range(in_fd, 0, out_fd, 0, COPY_ENGINE_TO_EOF, first,
+                           stats);
+}
+
+err_t copy_engine_file(const char *src, const char *dst, copy_path first,
+                       copy_stats *stats) {
+  if (src == NULL || dst == NULL || stats == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  struct stat st;
+  int in_fd = -1;
+  int out_fd = -1;
+  err_t err = 0;
+
+  in_fd = open(src, O_RDONLY | O_CLOEXEC);
+  if (in_fd == -1) {
+    return OPENING_THE_FILE_ERROR;
+  }
+  if (fstat(in_fd, &st) == -1) {
+    close(in_fd);
+    return OPENING_THE_FILE_ERROR;
+  }
+  posix_fadvise(in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  out_fd = open(dst, O_WRONLY | O_CREAT | O_CLOEXEC, st.st_mode & 07777);
+  if (out_fd == -1) {
+    close(in_fd);
+    return OPENING_THE_FILE_ERROR;
+  }
+
+  err = copy_engine_fd(in_fd, out_fd, first, stats);
+
+  close(in_fd);
+  if (close(out_fd) == -1 && err == 0) {
+    err = OPENING_THE_FILE_ERROR;
+  }
+  return err;
+}
+
+#endif  // COPY_ENGINE_H_
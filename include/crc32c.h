@@ -0,0 +1,230 @@
+#ifndef CRC32C_H_
+#define CRC32C_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32C (Castagnoli, reflected polynomial 0x82F63B78), the variant x86
+// computes in hardware with SSE4.2. crc32c_update continues a finished CRC:
+// crc32c_update(crc32c(a), b) == crc32c(a followed by b), and
+// crc32c_combine(crc32c(a), crc32c(b), len(b)) gives the same value without
+// touching a again, so pieces checksummed in parallel can be joined in order.
+uint32_t crc32c(const void *data, size_t len);
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t len);
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+
+// Table-driven (slicing-by-8) path, whatever the CPU supports.
+uint32_t crc32c_update_portable(uint32_t crc, const void *data, size_t len);
+const char *crc32c_impl_name(void);
+
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#define CRC32C_X86 1
+#include <immintrin.h>
+#endif
+
+#define CRC32C_POLY (0x82F63B78u)
+// The hardware path runs three independent crc32 streams over adjacent
+// LONG (then SHORT) byte runs, hiding the instruction's 3-cycle latency, and
+// folds them together with the zero-shift tables below.
+#define CRC32C_LONG (8192)
+#define CRC32C_SHORT (256)
+
+static uint32_t crc32c_table[8][256];
+static uint32_t crc32c_x2n[32];  // x^(2^n) mod P
+static uint32_t crc32c_long_shift[4][256];
+static uint32_t crc32c_short_shift[4][256];
+static uint32_t (*crc32c_impl)(uint32_t, const unsigned char *, size_t);
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+// a * b mod P, both in reflected bit order (x^0 is the top bit).
+static uint32_t crc32c_multmodp(uint32_t a, uint32_t b) {
+  uint32_t m = 1u << 31, p = 0;
+  for (;;) {
+    if (a & m) {
+      p ^= b;
+      if ((a & (m - 1)) == 0) {
+        break;
+      }
+    }
+    m >>= 1;
+    b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+  }
+  return p;
+}
+
+// x^(n * 2^k) mod P
+static uint32_t crc32c_x2nmodp(uint64_t n, unsigned k) {
+  uint32_t p = 1u << 31;  // x^0
+  while (n) {
+    if (n & 1) {
+      p = crc32c_multmodp(crc32c_x2n[k & 31], p);
+    }
+    n >>= 1;
+    k++;
+  }
+  return p;
+}
+
+static void crc32c_shift_table(uint32_t table[4][256], size_t len) {
+  uint32_t op = crc32c_x2nmodp(len, 3);
+  for (uint32_t n = 0; n < 256; ++n) {
+    for (int k = 0; k < 4; ++k) {
+      table[k][n] = crc32c_multmodp(op, n << (8 * k));
+    }
+  }
+}
+
+// Multiplies a raw register by the x^(8 * len) the table was built for,
+// i.e. feeds it len zero bytes.
+static inline uint32_t crc32c_shift(uint32_t table[4][256], uint32_t crc) {
+  return table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff] ^
+         table[2][(crc >> 16) & 0xff] ^ table[3][crc >> 24];
+}
+
+// Raw (not pre/post-inverted) register updates from here on.
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len) {
+  uint64_t word = 0;
+  while (len > 0 && ((uintptr_t)p & 7) != 0) {
+    crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    len--;
+  }
+  for (; len >= 8; len -= 8, p += 8) {
+    memcpy(&word, p, 8);
+    word ^= crc;
+    crc = crc32c_table[7][word & 0xff] ^ crc32c_table[6][(word >> 8) & 0xff] ^
+          crc32c_table[5][(word >> 16) & 0xff] ^
+          crc32c_table[4][(word >> 24) & 0xff] ^
+          crc32c_table[3][(word >> 32) & 0xff] ^
+          crc32c_table[2][(word >> 40) & 0xff] ^
+          crc32c_table[1][(word >> 48) & 0xff] ^ crc32c_table[0][word >> 56];
+  }
+  while (len-- > 0) {
+    crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#ifdef CRC32C_X86
+__attribute__((target("sse4.2"))) static inline uint64_t crc32c_hw_word(
+    uint64_t crc, const unsigned char *p) {
+  uint64_t word = 0;
+  memcpy(&word, p, 8);
+  return _mm_crc32_u64(crc, word);
+}
+
+__attribute__((target("sse4.2"))) static uint32_t crc32c_hw(
+    uint32_t crc, const unsigned char *p, size_t len) {
+  uint64_t crc0 = crc, crc1 = 0, crc2 = 0;
+  const unsigned char *end = NULL;
+
+  while (len > 0 && ((uintptr_t)p & 7) != 0) {
+    crc0 = _mm_crc32_u8((uint32_t)crc0, *p++);
+    len--;
+  }
+
+  while (len >= 3 * CRC32C_LONG) {
+    crc1 = crc2 = 0;
+    end = p + CRC32C_LONG;
+    do {
+      crc0 = crc32c_hw_word(crc0, p);
+      crc1 = crc32c_hw_word(crc1, p + CRC32C_LONG);
+      crc2 = crc32c_hw_word(crc2, p + 2 * CRC32C_LONG);
+      p += 8;
+    } while (p < end);
+    crc0 = crc32c_shift(crc32c_long_shift, (uint32_t)crc0) ^ (uint32_t)crc1;
+    crc0 = crc32c_shift(crc32c_long_shift, (uint32_t)crc0) ^ (uint32_t)crc2;
+    p += 2 * CRC32C_LONG;
+    len -= 3 * CRC32C_LONG;
+  }
+
+  while (len >= 3 * CRC32C_SHORT) {
+    crc1 = crc2 = 0;
+    end = p + CRC32C_SHORT;
+    do {
+      crc0 = crc32c_hw_word(crc0, p);
+      crc1 = crc32c_hw_word(crc1, p + CRC32C_SHORT);
+      crc2 = crc32c_hw_word(crc2, p + 2 * CRC32C_SHORT);
+      p += 8;
+    } while (p < end);
+    crc0 = crc32c_shift(crc32c_short_shift, (uint32_t)crc0) ^ (uint32_t)crc1;
+    crc0 = crc32c_shift(crc32c_short_shift, (uint32_t)crc0) ^ (uint32_t)crc2;
+    p += 2 * CRC32C_SHORT;
+    len -= 3 * CRC32C_SHORT;
+  }
+
+  for (; len >= 8; len -= 8, p += 8) {
+    crc0 = crc32c_hw_word(crc0, p);
+  }
+  while (len-- > 0) {
+    crc0 = _mm_crc32_u8((uint32_t)crc0, *p++);
+  }
+  return (uint32_t)crc0;
+}
+#endif
+
+static void crc32c_init(void) {
+  uint32_t p = 1u << 30;  // x^1
+
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc >> 1) ^ (CRC32C_POLY & (0u - (crc & 1)));
+    }
+    crc32c_table[0][i] = crc;
+  }
+  for (uint32_t i = 0; i < 256; ++i) {
+    for (int k = 1; k < 8; ++k) {
+      uint32_t prev = crc32c_table[k - 1][i];
+      crc32c_table[k][i] = crc32c_table[0][prev & 0xff] ^ (prev >> 8);
+    }
+  }
+
+  for (int n = 0; n < 32; ++n) {
+    crc32c_x2n[n] = p;
+    p = crc32c_multmodp(p, p);
+  }
+  crc32c_shift_table(crc32c_long_shift, CRC32C_LONG);
+  crc32c_shift_table(crc32c_short_shift, CRC32C_SHORT);
+
+  crc32c_impl = crc32c_sw;
+#ifdef CRC32C_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2")) {
+    crc32c_impl = crc32c_hw;
+  }
+#endif
+}
+
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t len) {
+  pthread_once(&crc32c_once, crc32c_init);
+  return ~crc32c_impl(~crc, (const unsigned char *)data, len);
+}
+
+uint32_t crc32c_update_portable(uint32_t crc, const void *data, size_t len) {
+  pthread_once(&crc32c_once, crc32c_init);
+  return ~crc32c_sw(~crc, (const unsigned char *)data, len);
+}
+
+uint32_t crc32c(const void *data, size_t len) {
+  return crc32c_update(0, data, len);
+}
+
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2) {
+  pthread_once(&crc32c_once, crc32c_init);
+  return crc32c_multmodp(crc32c_x2nmodp(len2, 3), crc1) ^ crc2;
+}
+
+const char *crc32c_impl_name(void) {
+  pthread_once(&crc32c_once, crc32c_init);
+#ifdef CRC32C_X86
+  if (crc32c_impl == crc32c_hw) {
+    return "sse4.2";
+  }
+#endif
+  return "table";
+}
+
+#endif  // CRC32C_H_
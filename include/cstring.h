@@ -9,9 +9,13 @@
 
 typedef char *String;
 
+#define STRING_HASH_NONE (0)
+
 typedef struct {
   size_t length;
   size_t capacity;
+  size_t hash;    // valid only while hash_kind != STRING_HASH_NONE
+  int hash_kind;  // which hash function produced `hash`
 } String_metadata_t;
 
 #define __cstring_string_to_base(str) (&((String_metadata_t *)(str))[-1])
@@ -20,6 +24,11 @@ typedef struct {
 #define string_len(str) (str ? __cstring_string_to_base(str)->length : 0)
 #define string_cap(str) (str ? __cstring_string_to_base(str)->capacity : 0)
 
+// Every mutating string_* function drops the cached hash. Code that writes
+// through the raw `char *` (str[i] = c) must call string_hash_reset itself.
+#define __cstring_hash_invalidate(str) \
+  (__cstring_string_to_base(str)->hash_kind = STRING_HASH_NONE)
+
 String string_init();
 String string_from(const char *str);
 
@@ -43,6 +52,11 @@ int string_c_str(const char *haystack, const String needle);
 
 int string_grow(String *str, size_t new_size);
 
+int string_hash_cached(const String str, int hash_kind,
+                       size_t *hash_placeholder);
+void string_hash_store(String str, int hash_kind, size_t hash);
+void string_hash_reset(String str);
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -58,6 +72,8 @@ String string_init() {
   str_p->length = 0;
 
   str_p->capacity = STRING_BASE_CAPACITY;
+  str_p->hash = 0;
+  str_p->hash_kind = STRING_HASH_NONE;
   return __cstring_base_to_string(str_p);
 }
 
@@ -70,6 +86,8 @@ String string_from(const char *str) {
   }
   str_p->length = length;
   str_p->capacity = length;
+  str_p->hash = 0;
+  str_p->hash_kind = STRING_HASH_NONE;
   memcpy(__cstring_base_to_string(str_p), str, length * sizeof(char));
   return __cstring_base_to_string(str_p);
 }
@@ -98,12 +116,13 @@ int string_add(String *str, char c) {
 
   (*str)[string_len(*str)] = c;
   __cstring_string_to_base(*str)->length++;
+  __cstring_hash_invalidate(*str);
 
   return EXIT_SUCCESS;
 }
 
 void string_print(String str) {
-  int i;
+  size_t i;
   if (string_len(str) == 0) {
     return;
   }
@@ -112,10 +131,13 @@ void string_print(String str) {
   }
 }
 
+// 0 means equal. Strings of equal length whose cached hashes of the same kind
+// differ are rejected without scanning, so the sign of a non-zero result is
+// only meaningful for ordering via string_lex_cmp.
 int string_cmp(String str1, String str2) {
   size_t len1, len2;
   // printf("STRING.H compare: %s %s\n", str1, str2);
-  int i;
+  size_t i;
   len1 = string_len(str1);
   len2 = string_len(str2);
 
@@ -126,6 +148,14 @@ int string_cmp(String str1, String str2) {
       return -str2[len1];
     }
   }
+  if (len1 != 0) {
+    String_metadata_t *meta1 = __cstring_string_to_base(str1);
+    String_metadata_t *meta2 = __cstring_string_to_base(str2);
+    if (meta1->hash_kind != STRING_HASH_NONE &&
+        meta1->hash_kind == meta2->hash_kind && meta1->hash != meta2->hash) {
+      return (meta1->hash < meta2->hash) ? -1 : 1;
+    }
+  }
   for (i = 0; i < len1; ++i) {
     if (str1[i] != str2[i]) {
       return str1[i] - str2[i];
@@ -135,7 +165,7 @@ int string_cmp(String str1, String str2) {
 }
 int string_lex_cmp(String str1, String str2) {
   size_t len1, len2, min;
-  int i;
+  size_t i;
   len1 = string_len(str1);
   len2 = string_len(str2);
 
@@ -150,7 +180,7 @@ int string_lex_cmp(String str1, String str2) {
 
 int string_cpy(String *dest, const String *src) {
   int err;
-  int length;
+  size_t length;
   if (dest == NULL || src == NULL) {
     return DEREFERENCING_NULL_PTR;
   }
@@ -163,12 +193,13 @@ int string_cpy(String *dest, const String *src) {
   }
   memcpy(*dest, *src, length);
   __cstring_string_to_base(*dest)->length = length;
+  __cstring_hash_invalidate(*dest);
   return EXIT_SUCCESS;
 }
 
 int string_cpy_c(String *dest, const char *src) {
   int err;
-  int length = strlen(src);
+  size_t length = strlen(src);
   if (dest == NULL || src == NULL) {
     return DEREFERENCING_NULL_PTR;
   }
@@ -181,12 +212,13 @@ int string_cpy_c(String *dest, const char *src) {
   }
   memcpy(*dest, src, length);
   __cstring_string_to_base(*dest)->length = length;
+  __cstring_hash_invalidate(*dest);
   return EXIT_SUCCESS;
 }
 
 int string_cat(String *dest, const String *src) {
   int err;
-  int length = string_len(*src) + string_len(*dest);
+  size_t length = string_len(*src) + string_len(*dest);
   if (dest == NULL || src == NULL) {
     return DEREFERENCING_NULL_PTR;
   }
@@ -198,12 +230,13 @@ int string_cat(String *dest, const String *src) {
   }
   memcpy(*dest + string_len(*dest), *src, string_len(*src));
   __cstring_string_to_base(*dest)->length = length;
+  __cstring_hash_invalidate(*dest);
   return EXIT_SUCCESS;
 }
 
 int string_cat_c(String *dest, const char *src) {
   int err;
-  int length = strlen(src) + string_len(*dest);
+  size_t length = strlen(src) + string_len(*dest);
   if (dest == NULL || src == NULL) {
     return DEREFERENCING_NULL_PTR;
   }
@@ -216,6 +249,7 @@ int string_cat_c(String *dest, const char *src) {
   }
   memcpy((*dest) + string_len(*dest), src, strlen(src));
   __cstring_string_to_base(*dest)->length = length;
+  __cstring_hash_invalidate(*dest);
 
   return EXIT_SUCCESS;
 }
@@ -314,8 +348,9 @@ int string_grow(String *str, size_t new_size) {
   *str = __cstring_base_to_string(for_realloc);
 
   for_realloc->capacity = new_size;
-  if (new_size < current_size) {
+  if (new_size < for_realloc->length) {
     for_realloc->length = new_size;
+    for_realloc->hash_kind = STRING_HASH_NONE;
   }
 
   return EXIT_SUCCESS;
@@ -331,4 +366,32 @@ void string_fprint(FILE *fout, const String str) {
   }
 }
 
+int string_hash_cached(const String str, int hash_kind,
+                       size_t *hash_placeholder) {
+  if (str == NULL || hash_placeholder == NULL) {
+    return 0;
+  }
+  String_metadata_t *meta = __cstring_string_to_base(str);
+  if (meta->hash_kind == STRING_HASH_NONE || meta->hash_kind != hash_kind) {
+    return 0;
+  }
+  *hash_placeholder = meta->hash;
+  return 1;
+}
+
+void string_hash_store(String str, int hash_kind, size_t hash) {
+  if (str == NULL) {
+    return;
+  }
+  __cstring_string_to_base(str)->hash = hash;
+  __cstring_string_to_base(str)->hash_kind = hash_kind;
+}
+
+void string_hash_reset(String str) {
+  if (str == NULL) {
+    return;
+  }
+  __cstring_hash_invalidate(str);
+}
+
 #endif
@@ -0,0 +1,421 @@
+#ifndef DATETIME_H_
+#define DATETIME_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "errors.h"
+
+// Calendar and local time conversions for the shell's "dd:mm:yyyy hh:mm:ss"
+// dates, without sscanf and mktime. Calendar dates become day numbers with
+// the days-from-civil formulas (proleptic Gregorian, day 0 = 1970-01-01).
+// UTC offsets come from localtime_r, but a datetime_zone remembers every
+// span of UTC time it has seen with a constant offset, so bulk conversions
+// mostly skip libc. Spans are found by probing the offset a day at a time,
+// which assumes no zone changes its offset twice within one day.
+//
+// Local times a DST change skips are taken with the offset before the
+// change (like mktime with tm_isdst = -1, so 02:30 becomes 03:30); times
+// it repeats resolve to the earlier instant. The zone is read once:
+// changing TZ later does not affect a datetime_zone already in use.
+// A zero-initialized datetime_zone is ready to use; it is not thread-safe.
+#define DATETIME_SECONDS_PER_DAY 86400
+#define DATETIME_PROBE_DAYS 366  // longest span found in one go, each way
+
+typedef struct {
+  int64_t year;
+  int64_t month;  // 1..12 once normalized
+  int64_t day;
+  int64_t hour;
+  int64_t minute;
+  int64_t second;
+} datetime_fields;
+
+typedef struct {
+  int64_t start;  // UTC seconds, inclusive
+  int64_t end;    // exclusive
+  int32_t offset;  // seconds east of UTC
+} datetime_span;
+
+typedef struct {
+  datetime_span *spans;  // sorted by start, never overlapping
+  size_t count;
+  size_t capacity;
+  size_t last;  // span of the previous lookup
+  int has_now;
+  int64_t now;  // second the texts below show
+  char time_text[16];  // hh:mm:ss
+  char date_text[32];  // dd:mm:yyyy
+} datetime_zone;
+
+int64_t days_from_civil(int64_t year, int64_t month, int64_t day);
+void civil_from_days(int64_t days, datetime_fields *fields);
+
+// Parses "dd:mm:yyyy hh:mm:ss" after optional blanks, any number of blanks
+// between date and time. Fields out of range are kept as given, to be
+// carried over by datetime_to_utc the way mktime does (32:01 is 01:02).
+// INVALID_INPUT_DATA if the text does not match; *end_placeholder, when
+// given, points after the seconds.
+err_t datetime_parse(const char *text, datetime_fields *fields,
+                     const char **end_placeholder);
+
+// Seconds east of UTC at the instant utc.
+err_t datetime_offset(datetime_zone *zone, int64_t utc,
+                      int32_t *offset_placeholder);
+// Local time to UTC seconds, and back.
+err_t datetime_to_utc(datetime_zone *zone, const datetime_fields *local,
+                      int64_t *utc_placeholder);
+err_t datetime_from_utc(datetime_zone *zone, int64_t utc,
+                        datetime_fields *local);
+// Current local time as "hh:mm:ss" and "dd:mm:yyyy", formatted once per
+// second. Either placeholder may be NULL.
+err_t datetime_now(datetime_zone *zone, const char **time_placeholder,
+                   const char **date_placeholder);
+void datetime_zone_free(datetime_zone *zone);
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+int64_t days_from_civil(int64_t year, int64_t month, int64_t day) {
+  int64_t era = 0;
+  int64_t year_of_era = 0;
+  int64_t day_of_year = 0;
+  int64_t day_of_era = 0;
+
+  year -= month <= 2;
+  era = (year >= 0 ? year : year - 399) / 400;
+  year_of_era = year - era * 400;
+  day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 +
+               day_of_year;
+  return era * 146097 + day_of_era - 719468;
+}
+
+void civil_from_days(int64_t days, datetime_fields *fields) {
+  int64_t era = 0;
+  int64_t day_of_era = 0;
+  int64_t year_of_era = 0;
+  int64_t day_of_year = 0;
+  int64_t month_index = 0;
+
+  days += 719468;
+  era = (days >= 0 ? days : days - 146096) / 146097;
+  day_of_era = days - era * 146097;
+  year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 -
+                 day_of_era / 146096) /
+                365;
+  day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 -
+                              year_of_era / 100);
+  month_index = (5 * day_of_year + 2) / 153;
+  fields->day = day_of_year - (153 * month_index + 2) / 5 + 1;
+  fields->month = month_index < 10 ? month_index + 3 : month_index - 9;
+  fields->year = year_of_era + era * 400 + (fields->month <= 2);
+}
+
+// Reads up to 9 digits; 0 if there are none.
+static const char *datetime_number(const char *p, int64_t *value) {
+  const char *start = p;
+  int64_t v = 0;
+
+  while (*p >= '0' && *p <= '9' && p - start < 9) {
+    v = v * 10 + (*p - '0');
+    ++p;
+  }
+  *value = v;
+  return (p == start) ? NULL : p;
+}
+
+err_t datetime_parse(const char *text, datetime_fields *fields,
+                     const char **end_placeholder) {
+  if (text == NULL || fields == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  int64_t *parts[6] = {&fields->day,  &fields->month,  &fields->year,
+                       &fields->hour, &fields->minute, &fields->second};
+  const char *p = text;
+
+  while (*p == ' ' || *p == '\t') {
+    ++p;
+  }
+  for (int i = 0; i < 6; ++i) {
+    if (i == 3) {
+      if (*p != ' ' && *p != '\t') {
+        return INVALID_INPUT_DATA;
+      }
+      while (*p == ' ' || *p == '\t') {
+        ++p;
+      }
+    } else if (i > 0) {
+      if (*p != ':') {
+        return INVALID_INPUT_DATA;
+      }
+      ++p;
+    }
+    p = datetime_number(p, parts[i]);
+    if (p == NULL) {
+      return INVALID_INPUT_DATA;
+    }
+  }
+  if (end_placeholder != NULL) {
+    *end_placeholder = p;
+  }
+  return EXIT_SUCCESS;
+}
+
+// Local wall-clock seconds as if the zone were UTC, with months, days and
+// times outside their ranges carried over.
+static int64_t datetime_wall_seconds(const datetime_fields *f) {
+  int64_t months = f->year * 12 + (f->month - 1);
+  int64_t year = (months >= 0 ? months : months - 11) / 12;
+  int64_t days = days_from_civil(year, months - year * 12 + 1, 1) + f->day - 1;
+  return days * DATETIME_SECONDS_PER_DAY + f->hour * 3600 + f->minute * 60 +
+         f->second;
+}
+
+static int datetime_libc_offset(int64_t utc, int32_t *offset) {
+  time_t t = (time_t)utc;
+  struct tm tm;
+
+  if (localtime_r(&t, &tm) == NULL) {
+    return 0;
+  }
+  *offset = (int32_t)tm.tm_gmtoff;
+  return 1;
+}
+
+// Whether the offset changes within (from, from + step], looking only at
+// the end; if so, *change is the first second with another offset.
+static int datetime_change_after(int64_t from, int64_t step, int32_t offset,
+                                 int64_t *change) {
+  int64_t low = from;  // known to have offset
+  int64_t high = from + step;
+  int32_t probe = 0;
+
+  if (datetime_libc_offset(high, &probe) && probe == offset) {
+    return 0;
+  }
+  while (high - low > 1) {
+    int64_t mid = low + (high - low) / 2;
+    if (datetime_libc_offset(mid, &probe) && probe == offset) {
+      low = mid;
+    } else {
+      high = mid;
+    }
+  }
+  *change = high;
+  return 1;
+}
+
+// Looks up utc among the spans, or probes its span and inserts it.
+static err_t datetime_span_of(datetime_zone *zone, int64_t utc,
+                              size_t *index_placeholder) {
+  size_t low = 0;
+  size_t high = zone->count;
+  datetime_span span;
+  int64_t lower_bound = INT64_MIN;
+  int64_t upper_bound = INT64_MAX;
+
+  if (zone->last < zone->count && zone->spans[zone->last].start <= utc &&
+      utc < zone->spans[zone->last].end) {
+    *index_placeholder = zone->last;
+    return EXIT_SUCCESS;
+  }
+  while (low < high) {  // first span starting after utc
+    size_t mid = low + (high - low) / 2;
+    if (zone->spans[mid].start <= utc) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  if (low > 0 && utc < zone->spans[low - 1].end) {
+    zone->last = low - 1;
+    *index_placeholder = zone->last;
+    return EXIT_SUCCESS;
+  }
+  if (low > 0) {
+    lower_bound = zone->spans[low - 1].end;
+  }
+  if (low < zone->count) {
+    upper_bound = zone->spans[low].start;
+  }
+
+  if (!datetime_libc_offset(utc, &span.offset)) {
+    return INVALID_INPUT_DATA;
+  }
+  span.end = utc + 1;
+  for (int day = 0; day < DATETIME_PROBE_DAYS && span.end < upper_bound;
+       ++day) {
+    if (datetime_change_after(span.end - 1, DATETIME_SECONDS_PER_DAY,
+                              span.offset, &span.end)) {
+      break;
+    }
+    span.end += DATETIME_SECONDS_PER_DAY;
+  }
+  span.start = utc;
+  for (int day = 0; day < DATETIME_PROBE_DAYS && span.start > lower_bound;
+       ++day) {
+    int64_t from = span.start - DATETIME_SECONDS_PER_DAY;
+    int32_t probe = 0;
+    if (!datetime_libc_offset(from, &probe)) {
+      break;
+    }
+    if (probe != span.offset) {
+      datetime_change_after(from, DATETIME_SECONDS_PER_DAY, probe,
+                            &span.start);
+      break;
+    }
+    span.start = from;
+  }
+  if (span.start < lower_bound) {
+    span.start = lower_bound;
+  }
+  if (span.end > upper_bound) {
+    span.end = upper_bound;
+  }
+
+  if (zone->count == zone->capacity) {
+    size_t capacity = zone->capacity ? zone->capacity * 2 : 16;
+    datetime_span *spans = (datetime_span *)realloc(
+        zone->spans, capacity * sizeof(*spans));
+    if (spans == NULL) {
+      return MEMORY_ALLOCATION_ERROR;
+    }
+    zone->spans = spans;
+    zone->capacity = capacity;
+  }
+  memmove(zone->spans + low + 1, zone->spans + low,
+          (zone->count - low) * sizeof(*zone->spans));
+  zone->spans[low] = span;
+  ++zone->count;
+  zone->last = low;
+  *index_placeholder = low;
+  return EXIT_SUCCESS;
+}
+
+err_t datetime_offset(datetime_zone *zone, int64_t utc,
+                      int32_t *offset_placeholder) {
+  if (zone == NULL || offset_placeholder == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  size_t index = 0;
+  err_t err = datetime_span_of(zone, utc, &index);
+  if (err != 0) {
+    return err;
+  }
+  *offset_placeholder = zone->spans[index].offset;
+  return EXIT_SUCCESS;
+}
+
+err_t datetime_to_utc(datetime_zone *zone, const datetime_fields *local,
+                      int64_t *utc_placeholder) {
+  if (zone == NULL || local == NULL || utc_placeholder == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  int64_t wall = datetime_wall_seconds(local);
+  int32_t before = 0;
+  int32_t after = 0;
+  int32_t check = 0;
+  int valid_before = 0;
+  err_t err = 0;
+
+  // Offsets a day either side bracket any change affecting this wall time.
+  err = datetime_offset(zone, wall - DATETIME_SECONDS_PER_DAY, &before);
+  if (err == 0) {
+    err = datetime_offset(zone, wall + DATETIME_SECONDS_PER_DAY, &after);
+  }
+  if (err != 0) {
+    return err;
+  }
+  if (before == after) {
+    *utc_placeholder = wall - before;
+    return EXIT_SUCCESS;
+  }
+
+  // Near a change: a reading is valid if its instant really has that
+  // offset. Both are in a repeated hour, take the earlier; neither is in a
+  // skipped one, take the offset from before.
+  err = datetime_offset(zone, wall - before, &check);
+  valid_before = err == 0 && check == before;
+  if (err == 0) {
+    err = datetime_offset(zone, wall - after, &check);
+  }
+  if (err != 0) {
+    return err;
+  }
+  if (check == after && (!valid_before || after > before)) {
+    *utc_placeholder = wall - after;
+  } else {
+    *utc_placeholder = wall - before;
+  }
+  return EXIT_SUCCESS;
+}
+
+err_t datetime_from_utc(datetime_zone *zone, int64_t utc,
+                        datetime_fields *local) {
+  if (zone == NULL || local == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  int32_t offset = 0;
+  int64_t wall = 0;
+  int64_t days = 0;
+  int64_t seconds = 0;
+  err_t err = datetime_offset(zone, utc, &offset);
+  if (err != 0) {
+    return err;
+  }
+  wall = utc + offset;
+  days = (wall >= 0 ? wall : wall - (DATETIME_SECONDS_PER_DAY - 1)) /
+         DATETIME_SECONDS_PER_DAY;
+  seconds = wall - days * DATETIME_SECONDS_PER_DAY;
+  civil_from_days(days, local);
+  local->hour = seconds / 3600;
+  local->minute = seconds / 60 % 60;
+  local->second = seconds % 60;
+  return EXIT_SUCCESS;
+}
+
+err_t datetime_now(datetime_zone *zone, const char **time_placeholder,
+                   const char **date_placeholder) {
+  if (zone == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  int64_t now = (int64_t)time(NULL);
+  if (!zone->has_now || zone->now != now) {
+    datetime_fields local;
+    err_t err = datetime_from_utc(zone, now, &local);
+    if (err != 0) {
+      return err;
+    }
+    snprintf(zone->time_text, sizeof(zone->time_text), "%02d:%02d:%02d",
+             (int)local.hour, (int)local.minute, (int)local.second);
+    snprintf(zone->date_text, sizeof(zone->date_text), "%02d:%02d:%lld",
+             (int)local.day, (int)local.month, (long long)local.year);
+    zone->now = now;
+    zone->has_now = 1;
+  }
+  if (time_placeholder != NULL) {
+    *time_placeholder = zone->time_text;
+  }
+  if (date_placeholder != NULL) {
+    *date_placeholder = zone->date_text;
+  }
+  return EXIT_SUCCESS;
+}
+
+void datetime_zone_free(datetime_zone *zone) {
+  if (zone == NULL) {
+    return;
+  }
+  free(zone->spans);
+  memset(zone, 0, sizeof(*zone));
+}
+
+#endif  // DATETIME_H_
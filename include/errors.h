@@ -26,5 +26,6 @@ typedef int err_t;
 #define INVALID_INPUT_DATA (20)
 #define INVALID_CLI_ARGUMENT (21)
 #define ZERO_DIVISION (22)
+#define MEMORY_MAPPING_ERROR (23)
 
 #endif
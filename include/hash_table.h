@@ -8,6 +8,11 @@
 #define HASH_TABLE_GROWTH_FACTOR (2)
 #define HASH_TABLE_SHRINK_FACTOR (2)
 
+// Tags for the hash cached in String_metadata_t, one per example function.
+#define HASH_KIND_DJB2 (1)
+#define HASH_KIND_MURMUR (2)
+#define HASH_KIND_SHA256 (3)
+
 typedef struct hash_table_bucket {
   void *key;
   void *value;
@@ -116,7 +121,6 @@ void hash_table_free(hash_table *ht) {
   }
 
   size_t i = 0;
-  hash_table_bucket *bucket = NULL, *temp = NULL;
 
   for (i = 0; i < ht->capacity; ++i) {
     u_list_free(ht->buckets[i]);
@@ -233,7 +237,6 @@ err_t hash_table_dispose(hash_table *ht, const void *key) {
   size_t index = ht->hash(key, ht->key_size, ht->capacity);
   err_t err;
   hash_table_bucket search;
-  u_list_node *node = NULL;
   u_list *bucket = ht->buckets[index];
   double load_factor = 0;
 
@@ -312,7 +315,7 @@ err_t hash_table_resize(hash_table *ht, int size_modifier) {
     while (node != NULL) {
       entry = node->data;
       new_index = ht->hash(entry->key, ht->key_size, new_capacity);
-      err = u_list_insert(new_buckets[i], 0, entry);
+      err = u_list_insert(new_buckets[new_index], 0, entry);
       if (err) {
         for (j = 0; j < new_capacity; ++j) {
           u_list_free(new_buckets[j]);
@@ -377,12 +380,17 @@ size_t djb2_to_decimal(const String str) {
 }
 
 size_t djb2_hash(const void *key, size_t key_size, size_t capacity) {
+  (void)key_size;  // keys are Strings, which carry their length
   if (key == NULL || capacity == 0) {
     return 0;
   }
 
   const String *string_key = (const String *)key;
-  size_t hash_value = djb2_to_decimal(*string_key);
+  size_t hash_value = 0;
+  if (!string_hash_cached(*string_key, HASH_KIND_DJB2, &hash_value)) {
+    hash_value = djb2_to_decimal(*string_key);
+    string_hash_store(*string_key, HASH_KIND_DJB2, hash_value);
+  }
 
   return hash_value % capacity;
 }
@@ -416,12 +424,17 @@ size_t murmur_to_decimal(const String str, size_t seed) {
 }
 
 size_t murmur_hash(const void *key, size_t key_size, size_t capacity) {
+  (void)key_size;  // keys are Strings, which carry their length
   if (key == NULL || capacity == 0) {
     return 0;
   }
 
   const String *string_key = (const String *)key;
-  size_t hash_value = murmur_to_decimal(*string_key, 42);
+  size_t hash_value = 0;
+  if (!string_hash_cached(*string_key, HASH_KIND_MURMUR, &hash_value)) {
+    hash_value = murmur_to_decimal(*string_key, 42);
+    string_hash_store(*string_key, HASH_KIND_MURMUR, hash_value);
+  }
   return hash_value % capacity;
 }
 
@@ -522,17 +535,21 @@ void sha256_to_string(const String str, unsigned char output[32]) {
 }
 
 size_t sha256_hash(const void *key, size_t key_size, size_t capacity) {
+  (void)key_size;  // keys are Strings, which carry their length
   if (key == NULL || capacity == 0) {
     return 0;
   }
 
   const String *string_key = (const String *)key;
   unsigned char sha_output[32];
-  sha256_to_string(*string_key, sha_output);
-
   size_t hash_value = 0;
-  for (size_t i = 0; i < sizeof(size_t); i++) {
-    hash_value = (hash_value << 8) | sha_output[i];
+
+  if (!string_hash_cached(*string_key, HASH_KIND_SHA256, &hash_value)) {
+    sha256_to_string(*string_key, sha_output);
+    for (size_t i = 0; i < sizeof(size_t); i++) {
+      hash_value = (hash_value << 8) | sha_output[i];
+    }
+    string_hash_store(*string_key, HASH_KIND_SHA256, hash_value);
   }
 
   return hash_value % capacity;
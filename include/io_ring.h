@@ -0,0 +1,169 @@
+#ifndef IO_RING_H_
+#define IO_RING_H_
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+
+#include "errors.h"
+
+// Minimal io_uring wrapper over the raw syscalls, for systems without
+// liburing: one submission and one completion ring, no SQPOLL, no
+// registered buffers. Callers fill SQEs from io_ring_get_sqe, submit them in
+// batches with io_ring_submit_and_wait and drain io_ring_peek_cqe /
+// io_ring_cqe_seen.
+typedef struct {
+  int fd;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_ring;
+  void *cq_ring;
+  size_t sq_ring_size;
+  size_t cq_ring_size;
+  size_t sqes_size;
+  unsigned sq_entries;
+  unsigned pending;  // SQEs filled since the last submit
+} io_ring;
+
+// Fails with INVALID_FLAG when the kernel has no io_uring or forbids it
+// (ENOSYS, EPERM under seccomp or io_uring_disabled), so callers can fall
+// back to blocking I/O.
+err_t io_ring_init(io_ring *ring, unsigned entries);
+void io_ring_free(io_ring *ring);
+
+// Zeroed SQE, or NULL when the submission ring is full.
+struct io_uring_sqe *io_ring_get_sqe(io_ring *ring);
+// Submits everything filled so far and waits for at least wait_nr
+// completions. Returns 0 or a negative errno.
+int io_ring_submit_and_wait(io_ring *ring, unsigned wait_nr);
+struct io_uring_cqe *io_ring_peek_cqe(io_ring *ring);
+void io_ring_cqe_seen(io_ring *ring);
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+err_t io_ring_init(io_ring *ring, unsigned entries) {
+  if (ring == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  struct io_uring_params params;
+  unsigned char *sq = NULL;
+  unsigned char *cq = NULL;
+
+  memset(ring, 0, sizeof(*ring));
+  memset(&params, 0, sizeof(params));
+  ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+  if (ring->fd < 0) {
+    ring->fd = -1;
+    return INVALID_FLAG;
+  }
+
+  ring->sq_ring_size =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_ring_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sq_ring =
+      mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  ring->cq_ring =
+      mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED ||
+      ring->sqes == MAP_FAILED) {
+    io_ring_free(ring);
+    return MEMORY_MAPPING_ERROR;
+  }
+
+  sq = (unsigned char *)ring->sq_ring;
+  cq = (unsigned char *)ring->cq_ring;
+  ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+  ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+  ring->sq_entries = params.sq_entries;
+  return EXIT_SUCCESS;
+}
+
+void io_ring_free(io_ring *ring) {
+  if (ring == NULL) {
+    return;
+  }
+  if (ring->sq_ring != NULL && ring->sq_ring != MAP_FAILED) {
+    munmap(ring->sq_ring, ring->sq_ring_size);
+  }
+  if (ring->cq_ring != NULL && ring->cq_ring != MAP_FAILED) {
+    munmap(ring->cq_ring, ring->cq_ring_size);
+  }
+  if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+    munmap(ring->sqes, ring->sqes_size);
+  }
+  if (ring->fd != -1) {
+    close(ring->fd);
+  }
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = -1;
+}
+
+struct io_uring_sqe *io_ring_get_sqe(io_ring *ring) {
+  unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  unsigned tail = *ring->sq_tail + ring->pending;
+  struct io_uring_sqe *sqe = NULL;
+
+  if (tail - head >= ring->sq_entries) {
+    return NULL;
+  }
+  sqe = &ring->sqes[tail & *ring->sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+  ring->pending++;
+  return sqe;
+}
+
+int io_ring_submit_and_wait(io_ring *ring, unsigned wait_nr) {
+  unsigned tail = *ring->sq_tail + ring->pending;
+  long ret = 0;
+
+  __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+  ring->pending = 0;
+  do {
+    // Everything the kernel has not consumed yet, including SQEs a previous
+    // call left behind when it took fewer than offered.
+    unsigned to_submit = tail - __atomic_load_n(ring->sq_head,
+                                                __ATOMIC_ACQUIRE);
+    ret = syscall(__NR_io_uring_enter, ring->fd, to_submit, wait_nr,
+                  wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  } while (ret < 0 && errno == EINTR);
+  return (ret < 0) ? -errno : 0;
+}
+
+struct io_uring_cqe *io_ring_peek_cqe(io_ring *ring) {
+  unsigned head = *ring->cq_head;
+  if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+    return NULL;
+  }
+  return &ring->cqes[head & *ring->cq_mask];
+}
+
+void io_ring_cqe_seen(io_ring *ring) {
+  __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+#endif  // IO_RING_H_
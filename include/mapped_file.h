@@ -0,0 +1,77 @@
+#ifndef MAPPED_FILE_H_
+#define MAPPED_FILE_H_
+
+#include <stddef.h>
+
+#include "errors.h"
+
+// Read-only view of a whole file. Empty files map to data == NULL, size == 0.
+typedef struct {
+  const unsigned char *data;
+  size_t size;
+  int fd;
+} mapped_file;
+
+err_t mapped_file_open(mapped_file *mf, const char *path);
+void mapped_file_close(mapped_file *mf);
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+err_t mapped_file_open(mapped_file *mf, const char *path) {
+  if (mf == NULL || path == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  struct stat st;
+  void *data = NULL;
+
+  mf->data = NULL;
+  mf->size = 0;
+  mf->fd = open(path, O_RDONLY);
+  if (mf->fd == -1) {
+    return OPENING_THE_FILE_ERROR;
+  }
+
+  if (fstat(mf->fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+    close(mf->fd);
+    mf->fd = -1;
+    return MEMORY_MAPPING_ERROR;
+  }
+
+  if (st.st_size == 0) {
+    return EXIT_SUCCESS;
+  }
+
+  data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, mf->fd, 0);
+  if (data == MAP_FAILED) {
+    close(mf->fd);
+    mf->fd = -1;
+    return MEMORY_MAPPING_ERROR;
+  }
+
+  mf->data = (const unsigned char *)data;
+  mf->size = (size_t)st.st_size;
+
+  return EXIT_SUCCESS;
+}
+
+void mapped_file_close(mapped_file *mf) {
+  if (mf == NULL) {
+    return;
+  }
+  if (mf->data != NULL) {
+    munmap((void *)mf->data, mf->size);
+  }
+  if (mf->fd != -1) {
+    close(mf->fd);
+  }
+  mf->data = NULL;
+  mf->size = 0;
+  mf->fd = -1;
+}
+
+#endif  // MAPPED_FILE_H_
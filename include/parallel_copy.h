@@ -0,0 +1,405 @@
+#ifndef PARALLEL_COPY_H_
+#define PARALLEL_COPY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "errors.h"
+
+// Multi-threaded chunked copy for large files on fast devices: workers take
+// chunk_size ranges off a shared counter, pread each one into their own
+// aligned buffer, CRC-32C it while it is still in cache and pwrite it to the
+// same offset of the destination. All-zero chunks are not written and stay
+// holes, the destination having been sized up front.
+//
+// The per-chunk CRCs form a manifest, saved as text:
+//   copy-manifest 1
+//   size <bytes> chunk <chunk_size> crc32c <whole-file crc, hex>
+//   <offset> <length> <crc, hex>        (one line per chunk)
+// A later run recomputes the CRCs of a file with the same chunking (out_fd
+// -1 only checksums) and compares, reporting exactly which chunks differ.
+//
+// The source must be a regular file: its size, taken up front, is the
+// whole job. Chunks are rounded up to PARALLEL_COPY_ALIGN and may not
+// exceed PARALLEL_COPY_MAX_CHUNK, since every worker buffers a whole one.
+// Either violation returns INVALID_FLAG with errno set to EINVAL.
+#define PARALLEL_COPY_DEFAULT_CHUNK ((size_t)8 << 20)
+#define PARALLEL_COPY_MAX_CHUNK ((size_t)1 << 30)
+#define PARALLEL_COPY_ALIGN ((size_t)4096)
+#define COPY_MANIFEST_MAGIC "copy-manifest"
+#define COPY_MANIFEST_VERSION (1)
+
+typedef struct {
+  size_t threads;           // 0: one per online CPU
+  size_t chunk_size;        // 0: PARALLEL_COPY_DEFAULT_CHUNK
+  double progress_seconds;  // <= 0: no progress lines
+  FILE *progress;
+} parallel_copy_options;
+
+typedef struct {
+  uint64_t size;
+  size_t chunk_size;
+  size_t chunks_count;
+  uint32_t *crcs;
+} copy_manifest;
+
+err_t parallel_copy_fd(int in_fd, int out_fd,
+                       const parallel_copy_options *opts,
+                       copy_manifest *manifest);
+
+uint32_t copy_manifest_crc32c(const copy_manifest *manifest);
+err_t copy_manifest_save(const copy_manifest *manifest, const char *path);
+err_t copy_manifest_load(copy_manifest *manifest, const char *path);
+void copy_manifest_free(copy_manifest *manifest);
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "crc32c.h"
+#include "parallel_scan.h"
+
+typedef struct {
+  int in_fd;
+  int out_fd;
+  copy_manifest *manifest;
+  size_t next_chunk;     // shared work queue, bumped atomically
+  uint64_t bytes_done;   // atomic, for progress
+  size_t workers_left;   // guarded by lock, signalled on done
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+  err_t err;             // first error wins
+  int saved_errno;
+} parallel_copy_job;
+
+static double parallel_copy_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void parallel_copy_fail(parallel_copy_job *job, err_t err) {
+  err_t expected = 0;
+  int saved_errno = errno;
+  if (__atomic_compare_exchange_n(&job->err, &expected, err, 0,
+                                  __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    job->saved_errno = saved_errno;
+  }
+}
+
+static int parallel_copy_all_zero(const unsigned char *p, size_t len) {
+  return len == 0 || (p[0] == 0 && memcmp(p, p + 1, len - 1) == 0);
+}
+
+static err_t parallel_copy_chunk(parallel_copy_job *job, unsigned char *buffer,
+                                 size_t chunk) {
+  copy_manifest *manifest = job->manifest;
+  uint64_t offset = (uint64_t)chunk * manifest->chunk_size;
+  size_t len = (manifest->size - offset < manifest->chunk_size)
+                   ? (size_t)(manifest->size - offset)
+                   : manifest->chunk_size;
+  size_t done = 0;
+
+  while (done < len) {
+    ssize_t n = pread(job->in_fd, buffer + done, len - done,
+                      (off_t)(offset + done));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return OPENING_THE_FILE_ERROR;
+    }
+    if (n == 0) {
+      return INVALID_INPUT_DATA;  // the file shrank under us
+    }
+    done += (size_t)n;
+  }
+  manifest->crcs[chunk] = crc32c(buffer, len);
+
+  if (job->out_fd != -1 && !parallel_copy_all_zero(buffer, len)) {
+    for (done = 0; done < len;) {
+      ssize_t n = pwrite(job->out_fd, buffer + done, len - done,
+                         (off_t)(offset + done));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return OPENING_THE_FILE_ERROR;
+      }
+      done += (size_t)n;
+    }
+  }
+  __atomic_fetch_add(&job->bytes_done, len, __ATOMIC_RELAXED);
+  return 0;
+}
+
+static void *parallel_copy_worker_main(void *arg) {
+  parallel_copy_job *job = (parallel_copy_job *)arg;
+  unsigned char *buffer =
+      aligned_alloc(PARALLEL_COPY_ALIGN, job->manifest->chunk_size);
+  size_t chunk = 0;
+
+  if (buffer == NULL) {
+    parallel_copy_fail(job, MEMORY_ALLOCATION_ERROR);
+  }
+  while (buffer != NULL && __atomic_load_n(&job->err, __ATOMIC_RELAXED) == 0 &&
+         (chunk = __atomic_fetch_add(&job->next_chunk, 1, __ATOMIC_RELAXED)) <
+             job->manifest->chunks_count) {
+    err_t err = parallel_copy_chunk(job, buffer, chunk);
+    if (err != 0) {
+      parallel_copy_fail(job, err);
+    }
+  }
+
+  free(buffer);
+  pthread_mutex_lock(&job->lock);
+  if (--job->workers_left == 0) {
+    pthread_cond_signal(&job->done);
+  }
+  pthread_mutex_unlock(&job->lock);
+  return NULL;
+}
+
+static void parallel_copy_report(const parallel_copy_options *opts,
+                                 const parallel_copy_job *job, double start) {
+  uint64_t done = __atomic_load_n(&job->bytes_done, __ATOMIC_RELAXED);
+  uint64_t size = job->manifest->size;
+  double elapsed = parallel_copy_now() - start;
+
+  fprintf(opts->progress,
+          "%5.1f%%  %" PRIu64 " / %" PRIu64 " MiB  %.1f MB/s\n",
+          size ? 100.0 * done / size : 100.0, done >> 20, size >> 20,
+          elapsed > 0 ? done / elapsed / 1e6 : 0.0);
+  fflush(opts->progress);
+}
+
+// Copies the whole of in_fd into out_fd (or only checksums it when out_fd is
+// -1) and fills manifest, which the caller frees with copy_manifest_free.
+err_t parallel_copy_fd(int in_fd, int out_fd,
+                       const parallel_copy_options *opts,
+                       copy_manifest *manifest) {
+  if (opts == NULL || manifest == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  struct stat st;
+  parallel_copy_job job;
+  pthread_t *tids = NULL;
+  size_t threads = parallel_scan_threads(opts->threads);
+  size_t chunk_size =
+      opts->chunk_size ? opts->chunk_size : PARALLEL_COPY_DEFAULT_CHUNK;
+  size_t started = 0;
+  int report = opts->progress_seconds > 0 && opts->progress != NULL;
+  double start = parallel_copy_now();
+  struct timespec next_report;
+
+  manifest->crcs = NULL;
+  if (fstat(in_fd, &st) == -1) {
+    return OPENING_THE_FILE_ERROR;
+  }
+  if (!S_ISREG(st.st_mode) || chunk_size > PARALLEL_COPY_MAX_CHUNK) {
+    errno = EINVAL;
+    return INVALID_FLAG;
+  }
+  chunk_size = (chunk_size + PARALLEL_COPY_ALIGN - 1) / PARALLEL_COPY_ALIGN *
+               PARALLEL_COPY_ALIGN;
+  assert(chunk_size != 0);
+  manifest->size = (uint64_t)st.st_size;
+  manifest->chunk_size = chunk_size;
+  manifest->chunks_count = parallel_scan_chunks(manifest->size, chunk_size);
+  manifest->crcs = (uint32_t *)calloc(manifest->chunks_count + 1,
+                                      sizeof(*manifest->crcs));
+  tids = (pthread_t *)malloc(threads * sizeof(*tids));
+  if (manifest->crcs == NULL || tids == NULL) {
+    copy_manifest_free(manifest);
+    free(tids);
+    return MEMORY_ALLOCATION_ERROR;
+  }
+  if (out_fd != -1 && (ftruncate(out_fd, 0) == -1 ||
+                       ftruncate(out_fd, (off_t)manifest->size) == -1)) {
+    copy_manifest_free(manifest);
+    free(tids);
+    return OPENING_THE_FILE_ERROR;
+  }
+  posix_fadvise(in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  job.in_fd = in_fd;
+  job.out_fd = out_fd;
+  job.manifest = manifest;
+  job.next_chunk = 0;
+  job.bytes_done = 0;
+  job.workers_left = threads;
+  job.err = 0;
+  job.saved_errno = 0;
+  pthread_mutex_init(&job.lock, NULL);
+  pthread_cond_init(&job.done, NULL);
+
+  // Workers all run on their own threads so this one is free to report
+  // progress. A failed pthread_create only costs parallelism.
+  for (size_t i = 0; i < threads; ++i) {
+    if (pthread_create(&tids[i], NULL, parallel_copy_worker_main, &job) != 0) {
+      break;
+    }
+    started++;
+  }
+  pthread_mutex_lock(&job.lock);
+  job.workers_left -= threads - started;
+  pthread_mutex_unlock(&job.lock);
+  if (started == 0) {
+    job.workers_left = 1;
+    parallel_copy_worker_main(&job);
+  }
+
+  clock_gettime(CLOCK_REALTIME, &next_report);
+  pthread_mutex_lock(&job.lock);
+  while (job.workers_left > 0) {
+    if (!report) {
+      pthread_cond_wait(&job.done, &job.lock);
+      continue;
+    }
+    next_report.tv_sec += (time_t)opts->progress_seconds;
+    next_report.tv_nsec +=
+        (long)((opts->progress_seconds - (time_t)opts->progress_seconds) *
+               1e9);
+    if (next_report.tv_nsec >= 1000000000L) {
+      next_report.tv_sec++;
+      next_report.tv_nsec -= 1000000000L;
+    }
+    while (job.workers_left > 0 &&
+           pthread_cond_timedwait(&job.done, &job.lock, &next_report) == 0) {
+    }
+    if (job.workers_left > 0) {
+      parallel_copy_report(opts, &job, start);
+    }
+  }
+  pthread_mutex_unlock(&job.lock);
+  for (size_t i = 0; i < started; ++i) {
+    pthread_join(tids[i], NULL);
+  }
+  free(tids);
+  pthread_mutex_destroy(&job.lock);
+  pthread_cond_destroy(&job.done);
+
+  if (job.err != 0) {
+    copy_manifest_free(manifest);
+    errno = job.saved_errno;
+    return job.err;
+  }
+  return EXIT_SUCCESS;
+}
+
+uint32_t copy_manifest_crc32c(const copy_manifest *manifest) {
+  uint32_t crc = 0;
+  for (size_t i = 0; i < manifest->chunks_count; ++i) {
+    uint64_t offset = (uint64_t)i * manifest->chunk_size;
+    uint64_t len = manifest->size - offset;
+    if (len > manifest->chunk_size) {
+      len = manifest->chunk_size;
+    }
+    crc = crc32c_combine(crc, manifest->crcs[i], len);
+  }
+  return crc;
+}
+
+err_t copy_manifest_save(const copy_manifest *manifest, const char *path) {
+  if (manifest == NULL || path == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) {
+    return OPENING_THE_FILE_ERROR;
+  }
+  fprintf(fp, COPY_MANIFEST_MAGIC " %d\n", COPY_MANIFEST_VERSION);
+  fprintf(fp, "size %" PRIu64 " chunk %zu crc32c %08" PRIx32 "\n",
+          manifest->size, manifest->chunk_size,
+          copy_manifest_crc32c(manifest));
+  for (size_t i = 0; i < manifest->chunks_count; ++i) {
+    uint64_t offset = (uint64_t)i * manifest->chunk_size;
+    uint64_t len = manifest->size - offset;
+    if (len > manifest->chunk_size) {
+      len = manifest->chunk_size;
+    }
+    fprintf(fp, "%" PRIu64 " %" PRIu64 " %08" PRIx32 "\n", offset, len,
+            manifest->crcs[i]);
+  }
+  if (fclose(fp) != 0) {
+    return OPENING_THE_FILE_ERROR;
+  }
+  return EXIT_SUCCESS;
+}
+
+// Checks that every line matches the chunking the header announces and that
+// the whole-file CRC agrees with the chunk CRCs.
+err_t copy_manifest_load(copy_manifest *manifest, const char *path) {
+  if (manifest == NULL || path == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  FILE *fp = fopen(path, "r");
+  int version = 0;
+  uint32_t file_crc = 0;
+  err_t err = 0;
+
+  manifest->crcs = NULL;
+  if (fp == NULL) {
+    return OPENING_THE_FILE_ERROR;
+  }
+  if (fscanf(fp,
+             COPY_MANIFEST_MAGIC " %d size %" SCNu64 " chunk %zu crc32c "
+                                 "%" SCNx32,
+             &version, &manifest->size, &manifest->chunk_size,
+             &file_crc) != 4 ||
+      version != COPY_MANIFEST_VERSION || manifest->chunk_size == 0 ||
+      manifest->chunk_size > PARALLEL_COPY_MAX_CHUNK) {
+    fclose(fp);
+    return INVALID_INPUT_DATA;
+  }
+  manifest->chunks_count =
+      parallel_scan_chunks(manifest->size, manifest->chunk_size);
+  manifest->crcs = (uint32_t *)calloc(manifest->chunks_count + 1,
+                                      sizeof(*manifest->crcs));
+  if (manifest->crcs == NULL) {
+    fclose(fp);
+    return MEMORY_ALLOCATION_ERROR;
+  }
+
+  for (size_t i = 0; i < manifest->chunks_count && err == 0; ++i) {
+    uint64_t offset = 0, len = 0;
+    uint64_t expected_len = manifest->size - (uint64_t)i * manifest->chunk_size;
+    if (expected_len > manifest->chunk_size) {
+      expected_len = manifest->chunk_size;
+    }
+    if (fscanf(fp, "%" SCNu64 " %" SCNu64 " %" SCNx32, &offset, &len,
+               &manifest->crcs[i]) != 3 ||
+        offset != (uint64_t)i * manifest->chunk_size || len != expected_len) {
+      err = INVALID_INPUT_DATA;
+    }
+  }
+  fclose(fp);
+  if (err == 0 && copy_manifest_crc32c(manifest) != file_crc) {
+    err = INVALID_INPUT_DATA;
+  }
+  if (err != 0) {
+    copy_manifest_free(manifest);
+  }
+  return err;
+}
+
+void copy_manifest_free(copy_manifest *manifest) {
+  if (manifest == NULL) {
+    return;
+  }
+  free(manifest->crcs);
+  manifest->crcs = NULL;
+  manifest->chunks_count = 0;
+}
+
+#endif  // PARALLEL_COPY_H_
@@ -0,0 +1,169 @@
+#ifndef PARALLEL_SCAN_H_
+#define PARALLEL_SCAN_H_
+
+#include <stddef.h>
+
+#include "errors.h"
+
+#define PARALLEL_SCAN_DEFAULT_CHUNK ((size_t)8 << 20)
+#define PARALLEL_SCAN_CHUNK_ALIGN ((size_t)4096)
+// Thread counts beyond this many per online CPU only add contention.
+#define PARALLEL_SCAN_THREADS_PER_CPU 8
+
+// Called once per chunk. `partial` is the calling thread's own slot, so
+// associative reductions need no locking; order-dependent ones can key their
+// results by chunk_index instead.
+typedef void (*parallel_scan_fn)(const unsigned char *data, size_t len,
+                                 size_t chunk_index, void *partial, void *ctx);
+
+size_t parallel_scan_threads(size_t requested);
+size_t parallel_scan_threads_max(void);
+int parallel_scan_threads_parse(const char *text, size_t *threads_placeholder);
+size_t parallel_scan_chunks(size_t len, size_t chunk_size);
+
+err_t parallel_scan(const unsigned char *data, size_t len, size_t chunk_size,
+                    size_t threads, parallel_scan_fn fn, void *ctx,
+                    void *partials, size_t partial_size);
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct {
+  const unsigned char *data;
+  size_t len;
+  size_t chunk_size;
+  size_t chunks_count;
+  size_t next_chunk;  // shared work queue, bumped atomically
+  parallel_scan_fn fn;
+  void *ctx;
+} parallel_scan_job;
+
+typedef struct {
+  parallel_scan_job *job;
+  void *partial;
+} parallel_scan_worker;
+
+// 0 means one thread per online CPU.
+size_t parallel_scan_threads(size_t requested) {
+  long cpus = 0;
+  if (requested != 0) {
+    return requested;
+  }
+  cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return (cpus > 0) ? (size_t)cpus : 1;
+}
+
+size_t parallel_scan_threads_max(void) {
+  return parallel_scan_threads(0) * PARALLEL_SCAN_THREADS_PER_CPU;
+}
+
+// A decimal thread count from the command line, 0 for one per CPU. Signs,
+// blanks and trailing junk are rejected (strtoull would wrap "-1" to
+// SIZE_MAX), as is anything above parallel_scan_threads_max().
+int parallel_scan_threads_parse(const char *text, size_t *threads_placeholder) {
+  char *end = NULL;
+  unsigned long long value = 0;
+
+  if (text == NULL || threads_placeholder == NULL || *text < '0' ||
+      *text > '9') {
+    return 0;
+  }
+  errno = 0;
+  value = strtoull(text, &end, 10);
+  if (errno != 0 || *end != '\0' || value > parallel_scan_threads_max()) {
+    return 0;
+  }
+  *threads_placeholder = (size_t)value;
+  return 1;
+}
+
+size_t parallel_scan_chunks(size_t len, size_t chunk_size) {
+  return (chunk_size == 0) ? 0 : (len + chunk_size - 1) / chunk_size;
+}
+
+static void *parallel_scan_worker_main(void *arg) {
+  parallel_scan_worker *worker = (parallel_scan_worker *)arg;
+  parallel_scan_job *job = worker->job;
+  size_t chunk = 0;
+
+  while ((chunk = __atomic_fetch_add(&job->next_chunk, 1, __ATOMIC_RELAXED)) <
+         job->chunks_count) {
+    size_t offset = chunk * job->chunk_size;
+    size_t len = job->len - offset;
+    if (len > job->chunk_size) {
+      len = job->chunk_size;
+    }
+    job->fn(job->data + offset, len, chunk, worker->partial, job->ctx);
+  }
+
+  return NULL;
+}
+
+// Splits [data, data + len) into chunk_size pieces (rounded up to a multiple
+// of PARALLEL_SCAN_CHUNK_ALIGN, so word-based reductions never see a word cut
+// in half) and hands them to `threads` workers. partials must hold `threads`
+// slots of partial_size bytes; the caller initializes and combines them.
+err_t parallel_scan(const unsigned char *data, size_t len, size_t chunk_size,
+                    size_t threads, parallel_scan_fn fn, void *ctx,
+                    void *partials, size_t partial_size) {
+  if (fn == NULL || partials == NULL || (data == NULL && len != 0)) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  parallel_scan_job job;
+  parallel_scan_worker *workers = NULL;
+  pthread_t *tids = NULL;
+  size_t i = 0, started = 0;
+
+  if (chunk_size == 0) {
+    chunk_size = PARALLEL_SCAN_DEFAULT_CHUNK;
+  }
+  chunk_size = (chunk_size + PARALLEL_SCAN_CHUNK_ALIGN - 1) /
+               PARALLEL_SCAN_CHUNK_ALIGN * PARALLEL_SCAN_CHUNK_ALIGN;
+  if (threads == 0) {
+    threads = 1;
+  }
+
+  job.data = data;
+  job.len = len;
+  job.chunk_size = chunk_size;
+  job.chunks_count = parallel_scan_chunks(len, chunk_size);
+  job.next_chunk = 0;
+  job.fn = fn;
+  job.ctx = ctx;
+
+  workers = (parallel_scan_worker *)malloc(threads * sizeof(*workers));
+  tids = (pthread_t *)malloc(threads * sizeof(*tids));
+  if (workers == NULL || tids == NULL) {
+    free(workers);
+    free(tids);
+    return MEMORY_ALLOCATION_ERROR;
+  }
+
+  for (i = 0; i < threads; ++i) {
+    workers[i].job = &job;
+    workers[i].partial = (unsigned char *)partials + i * partial_size;
+  }
+
+  // The calling thread is worker 0. A failed pthread_create only costs
+  // parallelism: whoever did start still drains the whole queue.
+  for (i = 1; i < threads; ++i) {
+    if (pthread_create(&tids[i], NULL, parallel_scan_worker_main,
+                       &workers[i]) != 0) {
+      break;
+    }
+    started++;
+  }
+  parallel_scan_worker_main(&workers[0]);
+  for (i = 1; i <= started; ++i) {
+    pthread_join(tids[i], NULL);
+  }
+
+  free(workers);
+  free(tids);
+  return EXIT_SUCCESS;
+}
+
+#endif  // PARALLEL_SCAN_H_
@@ -0,0 +1,738 @@
+#ifndef SCAN_EXPR_H_
+#define SCAN_EXPR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "errors.h"
+#include "scan_kernels.h"
+
+// Ad-hoc word scans for src/4.c:
+//
+//   <width> <agg> [<value>] [where <predicate>]
+//
+//   width      u8 | u16 | u32 | u64, little-endian words as in the other
+//              modes; a trailing partial word is ignored
+//   agg        count (words matching the predicate), xor or sum (of <value>
+//              over matching words; <value> defaults to w)
+//   w          the current word; all arithmetic wraps at the word width
+//              (bytes inside anyb/allb) and constants must fit in it
+//   operators  C precedence: || && | ^ & == != < <= > >= << >> + - * and
+//              unary ~ ! -; "and", "or", "not" spell the logical ones
+//   functions  popcnt(x), prime(x) (x is a prime below 256),
+//              anyb(e) / allb(e): e is evaluated for every byte b of the
+//              word, true if it holds for any / all of them
+//
+//   u32 count where (w & 0xF0) == 0xF0      same as `mask F0`
+//   u32 xor where anyb(prime(b))            same as `xorodd`
+//   u16 sum w >> 8 where w > 1000 and allb(b != 0)
+//
+// The expression is compiled once into register bytecode that runs over a
+// SCAN_EXPR_BATCH-byte batch at a time: every instruction is a loop of vector
+// operations over the whole batch, with lanes as wide as the word (see
+// scan_expr_vm.h), so dispatch is paid per batch, not per word. Expressions
+// that spell a built-in mode run on its SIMD kernel instead.
+
+#define SCAN_EXPR_BATCH (512)  // bytes per batch, a multiple of 8
+#define SCAN_EXPR_MAX_REGS (32)
+#define SCAN_EXPR_MAX_CODE (128)
+#define SCAN_EXPR_ERROR_SIZE (128)
+
+typedef enum { SCAN_EXPR_COUNT, SCAN_EXPR_XOR, SCAN_EXPR_SUM } scan_expr_agg;
+
+typedef enum {
+  SCAN_EXPR_VM,
+  SCAN_EXPR_FAST_XOR8,
+  SCAN_EXPR_FAST_XORODD,
+  SCAN_EXPR_FAST_MASK
+} scan_expr_path;
+
+typedef struct {
+  uint8_t op;
+  uint8_t imm_form;  // second operand is imm rather than register b
+  uint8_t bytes;     // operates on byte lanes (inside anyb/allb)
+  uint8_t dst, a, b;
+  uint64_t imm;
+} scan_expr_insn;
+
+typedef struct {
+  unsigned width;  // bytes per word
+  scan_expr_agg agg;
+  scan_expr_insn code[SCAN_EXPR_MAX_CODE];
+  size_t code_len;
+  size_t regs_count;
+  int value_reg;  // -1: w itself
+  int pred_reg;   // -1: every word
+  scan_expr_path path;
+  uint32_t fast_mask;
+} scan_expr;
+
+err_t scan_expr_compile(const char *src, scan_expr *expr,
+                        char error[SCAN_EXPR_ERROR_SIZE]);
+
+// Folds the words of [data, data + len) into *acc; ranges split at
+// multiples of 8 bytes combine with scan_expr_merge.
+err_t scan_expr_run(const scan_expr *expr, const scan_kernels *kernels,
+                   const unsigned char *data, size_t len, uint64_t *acc);
+uint64_t scan_expr_merge(const scan_expr *expr, uint64_t a, uint64_t b);
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+  SCAN_OP_LOAD_W,
+  SCAN_OP_LOAD_B,
+  SCAN_OP_CONST,
+  SCAN_OP_AND,
+  SCAN_OP_OR,
+  SCAN_OP_XOR,
+  SCAN_OP_ADD,
+  SCAN_OP_SUB,
+  SCAN_OP_MUL,
+  SCAN_OP_SHL,
+  SCAN_OP_SHR,
+  SCAN_OP_EQ,
+  SCAN_OP_NE,
+  SCAN_OP_LT,
+  SCAN_OP_LE,
+  SCAN_OP_GT,
+  SCAN_OP_GE,
+  SCAN_OP_LAND,
+  SCAN_OP_LOR,
+  SCAN_OP_NOT,
+  SCAN_OP_LNOT,
+  SCAN_OP_NEG,
+  SCAN_OP_POPCNT,
+  SCAN_OP_PRIME,
+  SCAN_OP_ANYB,
+  SCAN_OP_ALLB
+};
+
+// ---- parser: source -> tree ----
+
+typedef struct scan_expr_node {
+  int op;  // SCAN_OP_*; LOAD_W / LOAD_B / CONST are leaves
+  uint64_t value;
+  struct scan_expr_node *left, *right;
+} scan_expr_node;
+
+typedef struct {
+  const char *src;
+  const char *pos;
+  int in_bytes;  // inside anyb/allb: b is valid, w is not
+  uint64_t word_mask;
+  char *error;
+} scan_expr_parser;
+
+static scan_expr_node *scan_expr_parse_binary(scan_expr_parser *p, int level);
+
+static void scan_expr_tree_free(scan_expr_node *node) {
+  if (node == NULL) {
+    return;
+  }
+  scan_expr_tree_free(node->left);
+  scan_expr_tree_free(node->right);
+  free(node);
+}
+
+static scan_expr_node *scan_expr_fail(scan_expr_parser *p, const char *what) {
+  if (p->error[0] == '\0') {
+    snprintf(p->error, SCAN_EXPR_ERROR_SIZE, "%s at offset %td", what,
+             p->pos - p->src);
+  }
+  return NULL;
+}
+
+static scan_expr_node *scan_expr_new(scan_expr_parser *p, int op,
+                                     scan_expr_node *left,
+                                     scan_expr_node *right) {
+  scan_expr_node *node = (scan_expr_node *)calloc(1, sizeof(*node));
+  if (node == NULL) {
+    scan_expr_tree_free(left);
+    scan_expr_tree_free(right);
+    return scan_expr_fail(p, "out of memory");
+  }
+  node->op = op;
+  node->left = left;
+  node->right = right;
+  return node;
+}
+
+static void scan_expr_skip_space(scan_expr_parser *p) {
+  while (isspace((unsigned char)*p->pos)) {
+    p->pos++;
+  }
+}
+
+// Consumes `word` if it is the next identifier.
+static int scan_expr_accept_word(scan_expr_parser *p, const char *word) {
+  size_t len = strlen(word);
+  scan_expr_skip_space(p);
+  if (strncmp(p->pos, word, len) == 0 &&
+      !isalnum((unsigned char)p->pos[len]) && p->pos[len] != '_') {
+    p->pos += len;
+    return 1;
+  }
+  return 0;
+}
+
+static int scan_expr_accept(scan_expr_parser *p, const char *symbol) {
+  size_t len = strlen(symbol);
+  scan_expr_skip_space(p);
+  if (strncmp(p->pos, symbol, len) == 0) {
+    p->pos += len;
+    return 1;
+  }
+  return 0;
+}
+
+static scan_expr_node *scan_expr_parse_call(scan_expr_parser *p, int op) {
+  scan_expr_node *arg = NULL;
+  int bytes = op == SCAN_OP_ANYB || op == SCAN_OP_ALLB;
+
+  if (bytes && p->in_bytes) {
+    return scan_expr_fail(p, "anyb/allb cannot nest");
+  }
+  if (!scan_expr_accept(p, "(")) {
+    return scan_expr_fail(p, "expected '('");
+  }
+  p->in_bytes |= bytes;
+  arg = scan_expr_parse_binary(p, 0);
+  p->in_bytes &= !bytes;
+  if (arg == NULL) {
+    return NULL;
+  }
+  if (!scan_expr_accept(p, ")")) {
+    scan_expr_tree_free(arg);
+    return scan_expr_fail(p, "expected ')'");
+  }
+  return scan_expr_new(p, op, arg, NULL);
+}
+
+static scan_expr_node *scan_expr_parse_unary(scan_expr_parser *p) {
+  scan_expr_node *node = NULL;
+  char *end = NULL;
+
+  scan_expr_skip_space(p);
+  if (scan_expr_accept(p, "~")) {
+    node = scan_expr_parse_unary(p);
+    return node ? scan_expr_new(p, SCAN_OP_NOT, node, NULL) : NULL;
+  }
+  if (scan_expr_accept(p, "!") || scan_expr_accept_word(p, "not")) {
+    node = scan_expr_parse_unary(p);
+    return node ? scan_expr_new(p, SCAN_OP_LNOT, node, NULL) : NULL;
+  }
+  if (scan_expr_accept(p, "-")) {
+    node = scan_expr_parse_unary(p);
+    return node ? scan_expr_new(p, SCAN_OP_NEG, node, NULL) : NULL;
+  }
+  if (scan_expr_accept(p, "(")) {
+    node = scan_expr_parse_binary(p, 0);
+    if (node != NULL && !scan_expr_accept(p, ")")) {
+      scan_expr_tree_free(node);
+      return scan_expr_fail(p, "expected ')'");
+    }
+    return node;
+  }
+  if (isdigit((unsigned char)*p->pos)) {
+    uint64_t value = 0;
+    errno = 0;
+    value = strtoull(p->pos, &end, 0);
+    if (errno == ERANGE || value > (p->in_bytes ? 0xff : p->word_mask)) {
+      return scan_expr_fail(p, p->in_bytes ? "constant does not fit a byte"
+                                           : "constant does not fit the word");
+    }
+    node = scan_expr_new(p, SCAN_OP_CONST, NULL, NULL);
+    if (node != NULL) {
+      node->value = value;
+      p->pos = end;
+    }
+    return node;
+  }
+  if (scan_expr_accept_word(p, "w")) {
+    if (p->in_bytes) {
+      return scan_expr_fail(p, "w is not available inside anyb/allb");
+    }
+    return scan_expr_new(p, SCAN_OP_LOAD_W, NULL, NULL);
+  }
+  if (scan_expr_accept_word(p, "b")) {
+    if (!p->in_bytes) {
+      return scan_expr_fail(p, "b is only available inside anyb/allb");
+    }
+    return scan_expr_new(p, SCAN_OP_LOAD_B, NULL, NULL);
+  }
+  if (scan_expr_accept_word(p, "anyb")) {
+    return scan_expr_parse_call(p, SCAN_OP_ANYB);
+  }
+  if (scan_expr_accept_word(p, "allb")) {
+    return scan_expr_parse_call(p, SCAN_OP_ALLB);
+  }
+  if (scan_expr_accept_word(p, "prime")) {
+    return scan_expr_parse_call(p, SCAN_OP_PRIME);
+  }
+  if (scan_expr_accept_word(p, "popcnt")) {
+    return scan_expr_parse_call(p, SCAN_OP_POPCNT);
+  }
+  return scan_expr_fail(p, "expected an operand");
+}
+
+// Binary operators from loosest to tightest binding.
+static const struct {
+  const char *symbols[4];
+  const char *word;
+  int ops[4];
+} scan_expr_levels[] = {
+    {{"||"}, "or", {SCAN_OP_LOR}},
+    {{"&&"}, "and", {SCAN_OP_LAND}},
+    {{"|"}, NULL, {SCAN_OP_OR}},
+    {{"^"}, NULL, {SCAN_OP_XOR}},
+    {{"&"}, NULL, {SCAN_OP_AND}},
+    {{"==", "!="}, NULL, {SCAN_OP_EQ, SCAN_OP_NE}},
+    {{"<=", ">=", "<", ">"},
+     NULL,
+     {SCAN_OP_LE, SCAN_OP_GE, SCAN_OP_LT, SCAN_OP_GT}},
+    {{"<<", ">>"}, NULL, {SCAN_OP_SHL, SCAN_OP_SHR}},
+    {{"+", "-"}, NULL, {SCAN_OP_ADD, SCAN_OP_SUB}},
+    {{"*"}, NULL, {SCAN_OP_MUL}},
+};
+
+#define SCAN_EXPR_LEVELS \
+  ((int)(sizeof(scan_expr_levels) / sizeof(*scan_expr_levels)))
+
+// "|" must not swallow "||", "&" not "&&", "<" not "<<" and so on.
+static int scan_expr_accept_operator(scan_expr_parser *p, const char *symbol) {
+  size_t len = strlen(symbol);
+  char next = 0;
+  scan_expr_skip_space(p);
+  if (strncmp(p->pos, symbol, len) != 0) {
+    return 0;
+  }
+  next = p->pos[len];
+  if (len == 1 && (next == symbol[0] ||
+                   (next == '=' && (symbol[0] == '<' || symbol[0] == '>')))) {
+    return 0;
+  }
+  p->pos += len;
+  return 1;
+}
+
+static scan_expr_node *scan_expr_parse_binary(scan_expr_parser *p,
+                                              int level) {
+  scan_expr_node *left = NULL, *right = NULL;
+  int op = -1;
+
+  if (level == SCAN_EXPR_LEVELS) {
+    return scan_expr_parse_unary(p);
+  }
+  left = scan_expr_parse_binary(p, level + 1);
+  while (left != NULL) {
+    op = -1;
+    for (int i = 0; i < 4 && scan_expr_levels[level].symbols[i]; ++i) {
+      if (scan_expr_accept_operator(p, scan_expr_levels[level].symbols[i])) {
+        op = scan_expr_levels[level].ops[i];
+        break;
+      }
+    }
+    if (op == -1 && scan_expr_levels[level].word != NULL &&
+        scan_expr_accept_word(p, scan_expr_levels[level].word)) {
+      op = scan_expr_levels[level].ops[0];
+    }
+    if (op == -1) {
+      break;
+    }
+    right = scan_expr_parse_binary(p, level + 1);
+    if (right == NULL) {
+      scan_expr_tree_free(left);
+      return NULL;
+    }
+    left = scan_expr_new(p, op, left, right);
+  }
+  return left;
+}
+
+// ---- constant folding and evaluation shared with the VM ----
+
+static inline uint64_t scan_expr_popcount(uint64_t x) {
+  return (uint64_t)__builtin_popcountll(x);
+}
+
+static uint64_t scan_expr_apply(int op, uint64_t x, uint64_t y,
+                                uint64_t mask) {
+  switch (op) {
+    case SCAN_OP_AND: return x & y;
+    case SCAN_OP_OR: return x | y;
+    case SCAN_OP_XOR: return x ^ y;
+    case SCAN_OP_ADD: return (x + y) & mask;
+    case SCAN_OP_SUB: return (x - y) & mask;
+    case SCAN_OP_MUL: return (x * y) & mask;
+    case SCAN_OP_SHL: return (y > 63) ? 0 : (x << y) & mask;
+    case SCAN_OP_SHR: return (y > 63) ? 0 : x >> y;
+    case SCAN_OP_EQ: return x == y;
+    case SCAN_OP_NE: return x != y;
+    case SCAN_OP_LT: return x < y;
+    case SCAN_OP_LE: return x <= y;
+    case SCAN_OP_GT: return x > y;
+    case SCAN_OP_GE: return x >= y;
+    case SCAN_OP_LAND: return x && y;
+    case SCAN_OP_LOR: return x || y;
+    case SCAN_OP_NOT: return ~x & mask;
+    case SCAN_OP_LNOT: return !x;
+    case SCAN_OP_NEG: return (0 - x) & mask;
+    case SCAN_OP_POPCNT: return scan_expr_popcount(x);
+    case SCAN_OP_PRIME: return x < 256 && scan_prime_table[x];
+    default: return 0;
+  }
+}
+
+static uint64_t scan_expr_width_mask(unsigned bytes) {
+  return (bytes == 8) ? ~(uint64_t)0 : ((uint64_t)1 << (8 * bytes)) - 1;
+}
+
+// `mask` is the value range of the context: the word, or a byte inside
+// anyb/allb.
+static void scan_expr_fold(scan_expr_node *node, uint64_t mask) {
+  int bytes = 0;
+  if (node == NULL) {
+    return;
+  }
+  bytes = node->op == SCAN_OP_ANYB || node->op == SCAN_OP_ALLB;
+  scan_expr_fold(node->left, bytes ? 0xff : mask);
+  scan_expr_fold(node->right, mask);
+  if (bytes || node->left == NULL || node->left->op != SCAN_OP_CONST ||
+      (node->right != NULL && node->right->op != SCAN_OP_CONST)) {
+    return;
+  }
+  node->value = scan_expr_apply(node->op, node->left->value,
+                                node->right ? node->right->value : 0, mask);
+  node->op = SCAN_OP_CONST;
+  scan_expr_tree_free(node->left);
+  scan_expr_tree_free(node->right);
+  node->left = node->right = NULL;
+}
+
+// ---- code generation: tree -> register bytecode ----
+
+typedef struct {
+  scan_expr *expr;
+  char *error;
+} scan_expr_codegen;
+
+static int scan_expr_commutes(int op) {
+  return op == SCAN_OP_AND || op == SCAN_OP_OR || op == SCAN_OP_XOR ||
+         op == SCAN_OP_ADD || op == SCAN_OP_MUL || op == SCAN_OP_EQ ||
+         op == SCAN_OP_NE || op == SCAN_OP_LAND || op == SCAN_OP_LOR;
+}
+
+// c < x is x > c and so on, so a constant can always sit on the right.
+static int scan_expr_mirror(int op) {
+  switch (op) {
+    case SCAN_OP_LT: return SCAN_OP_GT;
+    case SCAN_OP_LE: return SCAN_OP_GE;
+    case SCAN_OP_GT: return SCAN_OP_LT;
+    case SCAN_OP_GE: return SCAN_OP_LE;
+    default: return scan_expr_commutes(op) ? op : -1;
+  }
+}
+
+static int scan_expr_emit(scan_expr_codegen *g, scan_expr_insn insn) {
+  if (g->expr->code_len == SCAN_EXPR_MAX_CODE) {
+    snprintf(g->error, SCAN_EXPR_ERROR_SIZE, "expression too long");
+    return -1;
+  }
+  g->expr->code[g->expr->code_len++] = insn;
+  return 0;
+}
+
+// Evaluates node into register `reg`, using only registers >= reg as
+// scratch. Operands go to reg + 1 and reg + 2, never to reg itself, so no
+// instruction writes a register it reads and the VM loops can be restrict.
+static int scan_expr_gen(scan_expr_codegen *g, const scan_expr_node *node,
+                         unsigned reg, int bytes) {
+  scan_expr_insn insn;
+  const scan_expr_node *left = node->left, *right = node->right;
+  int op = node->op;
+
+  if (reg >= SCAN_EXPR_MAX_REGS) {
+    snprintf(g->error, SCAN_EXPR_ERROR_SIZE, "expression nested too deeply");
+    return -1;
+  }
+  if (reg + 1 > g->expr->regs_count) {
+    g->expr->regs_count = reg + 1;
+  }
+
+  memset(&insn, 0, sizeof(insn));
+  insn.dst = (uint8_t)reg;
+  insn.a = (uint8_t)(reg + 1);
+  insn.bytes = (uint8_t)bytes;
+
+  if (op == SCAN_OP_LOAD_W || op == SCAN_OP_LOAD_B || op == SCAN_OP_CONST) {
+    insn.op = (uint8_t)op;
+    insn.imm = node->value;
+    return scan_expr_emit(g, insn);
+  }
+
+  if (op == SCAN_OP_ANYB || op == SCAN_OP_ALLB) {
+    if (scan_expr_gen(g, left, reg + 1, 1) != 0) {
+      return -1;
+    }
+    insn.op = (uint8_t)op;
+    insn.bytes = 0;
+    return scan_expr_emit(g, insn);
+  }
+
+  if (right == NULL) {
+    if (scan_expr_gen(g, left, reg + 1, bytes) != 0) {
+      return -1;
+    }
+    insn.op = (uint8_t)op;
+    return scan_expr_emit(g, insn);
+  }
+
+  if (left->op == SCAN_OP_CONST && scan_expr_mirror(op) != -1) {
+    const scan_expr_node *tmp = left;
+    left = right;
+    right = tmp;
+    op = scan_expr_mirror(op);
+  }
+  if (scan_expr_gen(g, left, reg + 1, bytes) != 0) {
+    return -1;
+  }
+  insn.op = (uint8_t)op;
+  if (right->op == SCAN_OP_CONST) {
+    insn.imm_form = 1;
+    insn.imm = right->value;
+  } else {
+    if (scan_expr_gen(g, right, reg + 2, bytes) != 0) {
+      return -1;
+    }
+    insn.b = (uint8_t)(reg + 2);
+  }
+  return scan_expr_emit(g, insn);
+}
+
+// ---- recognizing the built-in modes ----
+
+static int scan_expr_is(const scan_expr_node *node, int op) {
+  return node != NULL && node->op == op;
+}
+
+static void scan_expr_pick_path(scan_expr *expr, const scan_expr_node *value,
+                                const scan_expr_node *pred) {
+  int value_is_w = value == NULL || scan_expr_is(value, SCAN_OP_LOAD_W);
+
+  expr->path = SCAN_EXPR_VM;
+  if (expr->width == 1 && expr->agg == SCAN_EXPR_XOR && value_is_w &&
+      pred == NULL) {
+    expr->path = SCAN_EXPR_FAST_XOR8;
+  } else if (expr->width == 4 && expr->agg == SCAN_EXPR_XOR && value_is_w &&
+             scan_expr_is(pred, SCAN_OP_ANYB) &&
+             scan_expr_is(pred->left, SCAN_OP_PRIME) &&
+             scan_expr_is(pred->left->left, SCAN_OP_LOAD_B)) {
+    expr->path = SCAN_EXPR_FAST_XORODD;
+  } else if (expr->width == 4 && expr->agg == SCAN_EXPR_COUNT &&
+             scan_expr_is(pred, SCAN_OP_EQ)) {
+    // (w & C) == C, either way round
+    const scan_expr_node *and_node = pred->left, *c = pred->right;
+    if (scan_expr_is(c, SCAN_OP_AND)) {
+      and_node = pred->right;
+      c = pred->left;
+    }
+    if (scan_expr_is(and_node, SCAN_OP_AND) &&
+        scan_expr_is(c, SCAN_OP_CONST) && c->value <= UINT32_MAX) {
+      const scan_expr_node *x = and_node->left, *m = and_node->right;
+      if (scan_expr_is(x, SCAN_OP_CONST)) {
+        x = and_node->right;
+        m = and_node->left;
+      }
+      if (scan_expr_is(x, SCAN_OP_LOAD_W) && scan_expr_is(m, SCAN_OP_CONST) &&
+          m->value == c->value) {
+        expr->path = SCAN_EXPR_FAST_MASK;
+        expr->fast_mask = (uint32_t)c->value;
+      }
+    }
+  }
+}
+
+err_t scan_expr_compile(const char *src, scan_expr *expr,
+                        char error[SCAN_EXPR_ERROR_SIZE]) {
+  if (src == NULL || expr == NULL || error == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  static const char *widths[] = {"u8", "u16", "u32", "u64"};
+  static const char *aggs[] = {"count", "xor", "sum"};
+  scan_expr_parser p = {src, src, 0, 0, error};
+  scan_expr_codegen g = {expr, error};
+  scan_expr_node *value = NULL, *pred = NULL;
+  int known = 0, failed = 0;
+
+  memset(expr, 0, sizeof(*expr));
+  error[0] = '\0';
+  expr->value_reg = expr->pred_reg = -1;
+
+  for (int i = 0; i < 4 && !known; ++i) {
+    if (scan_expr_accept_word(&p, widths[i])) {
+      expr->width = 1u << i;
+      p.word_mask = scan_expr_width_mask(expr->width);
+      known = 1;
+    }
+  }
+  if (!known) {
+    scan_expr_fail(&p, "expected u8, u16, u32 or u64");
+    return INVALID_INPUT_DATA;
+  }
+  known = 0;
+  for (int i = 0; i < 3 && !known; ++i) {
+    if (scan_expr_accept_word(&p, aggs[i])) {
+      expr->agg = (scan_expr_agg)i;
+      known = 1;
+    }
+  }
+  if (!known) {
+    scan_expr_fail(&p, "expected count, xor or sum");
+    return INVALID_INPUT_DATA;
+  }
+
+  scan_expr_skip_space(&p);
+  if (*p.pos != '\0' && !scan_expr_accept_word(&p, "where")) {
+    if (expr->agg == SCAN_EXPR_COUNT) {
+      scan_expr_fail(&p, "count takes no value, expected 'where'");
+      return INVALID_INPUT_DATA;
+    }
+    value = scan_expr_parse_binary(&p, 0);
+    failed = value == NULL;
+    if (!failed && scan_expr_accept_word(&p, "where")) {
+      pred = scan_expr_parse_binary(&p, 0);
+      failed = pred == NULL;
+    }
+  } else if (*p.pos != '\0') {
+    pred = scan_expr_parse_binary(&p, 0);
+    failed = pred == NULL;
+  }
+  if (!failed) {
+    scan_expr_skip_space(&p);
+    if (*p.pos != '\0') {
+      scan_expr_fail(&p, "unexpected input");
+      failed = 1;
+    }
+  }
+
+  if (!failed) {
+    scan_expr_fold(value, p.word_mask);
+    scan_expr_fold(pred, p.word_mask);
+    scan_expr_pick_path(expr, value, pred);
+    if (value != NULL && !scan_expr_is(value, SCAN_OP_LOAD_W)) {
+      expr->value_reg = 0;
+      failed = scan_expr_gen(&g, value, 0, 0) != 0;
+    }
+    if (!failed && pred != NULL) {
+      expr->pred_reg = (expr->value_reg == 0) ? 1 : 0;
+      failed = scan_expr_gen(&g, pred, (unsigned)expr->pred_reg, 0) != 0;
+    }
+  }
+
+  scan_expr_tree_free(value);
+  scan_expr_tree_free(pred);
+  return failed ? INVALID_INPUT_DATA : EXIT_SUCCESS;
+}
+
+// ---- the VM ----
+
+// 32-byte vectors in GCC/Clang vector extensions (one AVX2 register, or two
+// SSE2 ones in the baseline build) with lanes as wide as the word.
+typedef uint8_t scan_expr_vec8 __attribute__((vector_size(32)));
+typedef uint16_t scan_expr_vec16 __attribute__((vector_size(32)));
+typedef uint32_t scan_expr_vec32 __attribute__((vector_size(32)));
+typedef uint64_t scan_expr_vec64 __attribute__((vector_size(32)));
+
+#define SCAN_EXPR_VEC_BYTES (32)
+#define SCAN_EXPR_WORD_VECS (SCAN_EXPR_BATCH / SCAN_EXPR_VEC_BYTES)
+// room for the byte lanes of a batch of u64 words: 8 planes of 64 lanes
+#define SCAN_EXPR_REG_VECS (SCAN_EXPR_WORD_VECS * 8)
+
+#define SCAN_EXPR_LANE uint8_t
+#define SCAN_EXPR_VEC scan_expr_vec8
+#define SCAN_EXPR_ACC scan_expr_vec16
+#define SCAN_EXPR_PAIRED 1
+#define SCAN_EXPR_BATCH_FN scan_expr_batch8
+#include "scan_expr_vm.h"
+#define SCAN_EXPR_LANE uint16_t
+#define SCAN_EXPR_VEC scan_expr_vec16
+#define SCAN_EXPR_ACC scan_expr_vec32
+#define SCAN_EXPR_PAIRED 1
+#define SCAN_EXPR_BATCH_FN scan_expr_batch16
+#include "scan_expr_vm.h"
+#define SCAN_EXPR_LANE uint32_t
+#define SCAN_EXPR_VEC scan_expr_vec32
+#define SCAN_EXPR_ACC scan_expr_vec64
+#define SCAN_EXPR_PAIRED 1
+#define SCAN_EXPR_BATCH_FN scan_expr_batch32
+#include "scan_expr_vm.h"
+#define SCAN_EXPR_LANE uint64_t
+#define SCAN_EXPR_VEC scan_expr_vec64
+#define SCAN_EXPR_ACC scan_expr_vec64
+#define SCAN_EXPR_PAIRED 0
+#define SCAN_EXPR_BATCH_FN scan_expr_batch64
+#include "scan_expr_vm.h"
+
+// Built for AVX2 and for the baseline and picked at load time.
+__attribute__((target_clones("avx2", "default"))) static void scan_expr_batch(
+    const scan_expr *expr, const unsigned char *data, size_t valid,
+    void *regs, uint64_t *acc) {
+  switch (expr->width) {
+    case 1: scan_expr_batch8(expr, data, valid, regs, acc); break;
+    case 2: scan_expr_batch16(expr, data, valid, regs, acc); break;
+    case 4: scan_expr_batch32(expr, data, valid, regs, acc); break;
+    default: scan_expr_batch64(expr, data, valid, regs, acc); break;
+  }
+}
+
+err_t scan_expr_run(const scan_expr *expr, const scan_kernels *kernels,
+                    const unsigned char *data, size_t len, uint64_t *acc) {
+  _Alignas(64) unsigned char tail[SCAN_EXPR_BATCH];
+  const size_t words = SCAN_EXPR_BATCH / expr->width;
+  void *regs = NULL;
+  size_t rest = 0;
+
+  switch (expr->path) {
+    case SCAN_EXPR_FAST_XOR8:
+      *acc ^= kernels->xor8(data, len);
+      return EXIT_SUCCESS;
+    case SCAN_EXPR_FAST_XORODD:
+      *acc ^= kernels->xorodd(data, len);
+      return EXIT_SUCCESS;
+    case SCAN_EXPR_FAST_MASK:
+      *acc += kernels->mask(data, len, expr->fast_mask);
+      return EXIT_SUCCESS;
+    case SCAN_EXPR_VM:
+      break;
+  }
+
+  regs = aligned_alloc(64, (expr->regs_count + 1) * SCAN_EXPR_REG_VECS *
+                               SCAN_EXPR_VEC_BYTES);
+  if (regs == NULL) {
+    return MEMORY_ALLOCATION_ERROR;
+  }
+  for (; len >= SCAN_EXPR_BATCH; len -= SCAN_EXPR_BATCH) {
+    scan_expr_batch(expr, data, words, regs, acc);
+    data += SCAN_EXPR_BATCH;
+  }
+  // the last partial batch runs zero-padded, its padding words masked off
+  rest = len / expr->width;
+  if (rest > 0) {
+    memset(tail, 0, sizeof(tail));
+    memcpy(tail, data, len);
+    scan_expr_batch(expr, tail, rest, regs, acc);
+  }
+  free(regs);
+  return EXIT_SUCCESS;
+}
+
+uint64_t scan_expr_merge(const scan_expr *expr, uint64_t a, uint64_t b) {
+  return (expr->agg == SCAN_EXPR_XOR) ? a ^ b : a + b;
+}
+
+#endif  // SCAN_EXPR_H_
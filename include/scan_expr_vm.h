@@ -0,0 +1,223 @@
+// The scan_expr bytecode VM for one word width. scan_expr.h includes this
+// once per width after defining
+//
+//   SCAN_EXPR_LANE      the word type, uint8_t .. uint64_t
+//   SCAN_EXPR_VEC       a 32-byte vector of SCAN_EXPR_LANE
+//   SCAN_EXPR_ACC       a 32-byte vector of lanes twice as wide (of uint64_t
+//                       for u64 words), where a batch's sum always fits
+//   SCAN_EXPR_PAIRED    1 if SCAN_EXPR_ACC lanes hold two words, 0 for u64
+//   SCAN_EXPR_BATCH_FN  the name of the function to define
+//
+// so every word gets a lane of its own size: 32 u8 words per vector, 4 u64
+// ones. Deliberately without an include guard.
+
+#define SCAN_EXPR_LANES (SCAN_EXPR_VEC_BYTES / sizeof(SCAN_EXPR_LANE))
+#define SCAN_EXPR_BITS (8 * sizeof(SCAN_EXPR_LANE))
+#define SCAN_EXPR_TRUTH(v) ((SCAN_EXPR_VEC)(v) & 1)
+
+// Word instructions cover SCAN_EXPR_WORD_VECS vectors; byte-lane ones
+// (inside anyb/allb) cover `width` planes of that many, plane j holding
+// byte j of every word, so anyb/allb fold whole vectors together.
+#define SCAN_EXPR_LOOP(expression)                                   \
+  do {                                                               \
+    const size_t vecs = in->bytes ? byte_vecs : SCAN_EXPR_WORD_VECS; \
+    const SCAN_EXPR_LANE mask = in->bytes ? 0xff : word_mask;        \
+    (void)mask;                                                      \
+    if (in->imm_form) {                                              \
+      const SCAN_EXPR_VEC y = zero + (SCAN_EXPR_LANE)in->imm;        \
+      for (size_t i = 0; i < vecs; ++i) {                            \
+        const SCAN_EXPR_VEC x = ra[i];                               \
+        d[i] = (expression);                                         \
+      }                                                              \
+    } else {                                                         \
+      for (size_t i = 0; i < vecs; ++i) {                            \
+        const SCAN_EXPR_VEC x = ra[i], y = rb[i];                    \
+        d[i] = (expression);                                         \
+      }                                                              \
+    }                                                                \
+  } while (0)
+
+#define SCAN_EXPR_UNARY(expression)                                  \
+  do {                                                               \
+    const size_t vecs = in->bytes ? byte_vecs : SCAN_EXPR_WORD_VECS; \
+    const SCAN_EXPR_LANE mask = in->bytes ? 0xff : word_mask;        \
+    (void)mask;                                                      \
+    for (size_t i = 0; i < vecs; ++i) {                              \
+      const SCAN_EXPR_VEC x = ra[i];                                 \
+      (void)x;                                                       \
+      d[i] = (expression);                                           \
+    }                                                                \
+  } while (0)
+
+// A shift by a constant stays a single uniform shift; a shift by the word
+// width or more gives 0.
+#define SCAN_EXPR_SHIFT(op)                                               \
+  do {                                                                    \
+    if (in->imm_form && in->imm >= SCAN_EXPR_BITS) {                      \
+      SCAN_EXPR_UNARY(zero);                                              \
+    } else if (in->imm_form) {                                            \
+      const unsigned count = (unsigned)in->imm;                           \
+      SCAN_EXPR_UNARY((x op count) & mask);                               \
+    } else {                                                              \
+      SCAN_EXPR_LOOP((x op (y & (SCAN_EXPR_BITS - 1))) & mask &           \
+                     ~(SCAN_EXPR_VEC)(y >= SCAN_EXPR_BITS));              \
+    }                                                                     \
+  } while (0)
+
+// popcnt and prime have no vector form worth having; they go lane by lane.
+#define SCAN_EXPR_SCALAR(expression)                                 \
+  do {                                                               \
+    const size_t vecs = in->bytes ? byte_vecs : SCAN_EXPR_WORD_VECS; \
+    for (size_t i = 0; i < vecs; ++i) {                              \
+      for (size_t k = 0; k < SCAN_EXPR_LANES; ++k) {                 \
+        const uint64_t x = ra[i][k];                                 \
+        d[i][k] = (SCAN_EXPR_LANE)(expression);                      \
+      }                                                              \
+    }                                                                \
+  } while (0)
+
+// Runs the program over one SCAN_EXPR_BATCH-byte batch and folds its first
+// `valid` words into *acc.
+static inline __attribute__((always_inline)) void SCAN_EXPR_BATCH_FN(
+    const scan_expr *expr, const unsigned char *data, size_t valid,
+    void *regs_raw, uint64_t *acc) {
+  const size_t width = sizeof(SCAN_EXPR_LANE);
+  const size_t byte_vecs = SCAN_EXPR_WORD_VECS * width;
+  const SCAN_EXPR_LANE word_mask = (SCAN_EXPR_LANE)~(SCAN_EXPR_LANE)0;
+  const SCAN_EXPR_VEC zero = (SCAN_EXPR_VEC){0};
+  SCAN_EXPR_VEC *regs = (SCAN_EXPR_VEC *)regs_raw;
+  const SCAN_EXPR_VEC *pred = NULL, *value = NULL;
+  SCAN_EXPR_VEC folded = zero;
+  SCAN_EXPR_ACC sum = (SCAN_EXPR_ACC){0};
+  uint64_t a = 0;
+
+  for (size_t pc = 0; pc < expr->code_len; ++pc) {
+    const scan_expr_insn *in = &expr->code[pc];
+    SCAN_EXPR_VEC *restrict d = regs + in->dst * SCAN_EXPR_REG_VECS;
+    const SCAN_EXPR_VEC *restrict ra = regs + in->a * SCAN_EXPR_REG_VECS;
+    const SCAN_EXPR_VEC *restrict rb = regs + in->b * SCAN_EXPR_REG_VECS;
+
+    switch (in->op) {
+      case SCAN_OP_LOAD_W:
+        memcpy(d, data, SCAN_EXPR_BATCH);  // little-endian host
+        break;
+      case SCAN_OP_LOAD_B:
+        for (size_t i = 0; i < SCAN_EXPR_WORD_VECS; ++i) {
+          SCAN_EXPR_VEC w;
+          memcpy(&w, data + i * SCAN_EXPR_VEC_BYTES, sizeof(w));
+          for (size_t j = 0; j < width; ++j) {
+            d[j * SCAN_EXPR_WORD_VECS + i] = (w >> (8 * j)) & 0xff;
+          }
+        }
+        break;
+      case SCAN_OP_CONST:
+        SCAN_EXPR_UNARY(zero + (SCAN_EXPR_LANE)in->imm);
+        break;
+      case SCAN_OP_AND: SCAN_EXPR_LOOP(x & y); break;
+      case SCAN_OP_OR: SCAN_EXPR_LOOP(x | y); break;
+      case SCAN_OP_XOR: SCAN_EXPR_LOOP(x ^ y); break;
+      case SCAN_OP_ADD: SCAN_EXPR_LOOP((x + y) & mask); break;
+      case SCAN_OP_SUB: SCAN_EXPR_LOOP((x - y) & mask); break;
+      case SCAN_OP_MUL: SCAN_EXPR_LOOP((x * y) & mask); break;
+      case SCAN_OP_SHL: SCAN_EXPR_SHIFT(<<); break;
+      case SCAN_OP_SHR: SCAN_EXPR_SHIFT(>>); break;
+      case SCAN_OP_EQ: SCAN_EXPR_LOOP(SCAN_EXPR_TRUTH(x == y)); break;
+      case SCAN_OP_NE: SCAN_EXPR_LOOP(SCAN_EXPR_TRUTH(x != y)); break;
+      case SCAN_OP_LT: SCAN_EXPR_LOOP(SCAN_EXPR_TRUTH(x < y)); break;
+      case SCAN_OP_LE: SCAN_EXPR_LOOP(SCAN_EXPR_TRUTH(x <= y)); break;
+      case SCAN_OP_GT: SCAN_EXPR_LOOP(SCAN_EXPR_TRUTH(x > y)); break;
+      case SCAN_OP_GE: SCAN_EXPR_LOOP(SCAN_EXPR_TRUTH(x >= y)); break;
+      case SCAN_OP_LAND:
+        SCAN_EXPR_LOOP(SCAN_EXPR_TRUTH((x != 0) & (y != 0)));
+        break;
+      case SCAN_OP_LOR: SCAN_EXPR_LOOP(SCAN_EXPR_TRUTH((x | y) != 0)); break;
+      case SCAN_OP_NOT: SCAN_EXPR_UNARY(~x & mask); break;
+      case SCAN_OP_LNOT: SCAN_EXPR_UNARY(SCAN_EXPR_TRUTH(x == 0)); break;
+      case SCAN_OP_NEG: SCAN_EXPR_UNARY((zero - x) & mask); break;
+      case SCAN_OP_POPCNT: SCAN_EXPR_SCALAR(scan_expr_popcount(x)); break;
+      case SCAN_OP_PRIME:
+        SCAN_EXPR_SCALAR(x < 256 && scan_prime_table[x & 0xff]);
+        break;
+      case SCAN_OP_ANYB:
+        for (size_t i = 0; i < SCAN_EXPR_WORD_VECS; ++i) {
+          SCAN_EXPR_VEC any = zero;
+          for (size_t j = 0; j < width; ++j) {
+            any |= ra[j * SCAN_EXPR_WORD_VECS + i];
+          }
+          d[i] = SCAN_EXPR_TRUTH(any != 0);
+        }
+        break;
+      case SCAN_OP_ALLB:
+        for (size_t i = 0; i < SCAN_EXPR_WORD_VECS; ++i) {
+          SCAN_EXPR_VEC all = zero + 1;
+          for (size_t j = 0; j < width; ++j) {
+            all &= SCAN_EXPR_TRUTH(ra[j * SCAN_EXPR_WORD_VECS + i] != 0);
+          }
+          d[i] = all;
+        }
+        break;
+    }
+  }
+
+  if (expr->pred_reg >= 0) {
+    pred = regs + expr->pred_reg * SCAN_EXPR_REG_VECS;
+  }
+  if (expr->value_reg >= 0) {
+    value = regs + expr->value_reg * SCAN_EXPR_REG_VECS;
+  }
+  // count and xor fold in word-sized lanes (a lane counts at most
+  // SCAN_EXPR_WORD_VECS words per batch), sum adds the even and odd words
+  // into lanes twice as wide; lanes are added up once per batch
+  for (size_t i = 0; i < SCAN_EXPR_WORD_VECS; ++i) {
+    SCAN_EXPR_VEC keep = ~zero, v;
+    size_t first = i * SCAN_EXPR_LANES;
+    if (pred != NULL) {
+      keep = (SCAN_EXPR_VEC)(pred[i] != 0);
+    }
+    for (size_t k = (valid > first) ? valid - first : 0; k < SCAN_EXPR_LANES;
+         ++k) {
+      keep[k] = 0;  // only in the zero-padded last batch
+    }
+    if (value != NULL) {
+      v = value[i];
+    } else {
+      memcpy(&v, data + i * SCAN_EXPR_VEC_BYTES, sizeof(v));
+    }
+    switch (expr->agg) {
+      case SCAN_EXPR_COUNT: folded += keep & 1; break;
+      case SCAN_EXPR_XOR: folded ^= v & keep; break;
+      case SCAN_EXPR_SUM:
+#if SCAN_EXPR_PAIRED
+        sum += ((SCAN_EXPR_ACC)(v & keep) & word_mask) +
+               ((SCAN_EXPR_ACC)(v & keep) >> SCAN_EXPR_BITS);
+#else
+        sum += v & keep;
+#endif
+        break;
+    }
+  }
+  for (size_t k = 0; k < SCAN_EXPR_LANES; ++k) {
+    if (expr->agg == SCAN_EXPR_XOR) {
+      a ^= folded[k];
+    } else if (expr->agg == SCAN_EXPR_COUNT) {
+      a += folded[k];
+    }
+  }
+  for (size_t k = 0; k < sizeof(sum) / sizeof(sum[0]); ++k) {
+    a += sum[k];  // zero unless summing
+  }
+  *acc = (expr->agg == SCAN_EXPR_XOR) ? *acc ^ a : *acc + a;
+}
+
+#undef SCAN_EXPR_SCALAR
+#undef SCAN_EXPR_SHIFT
+#undef SCAN_EXPR_UNARY
+#undef SCAN_EXPR_LOOP
+#undef SCAN_EXPR_TRUTH
+#undef SCAN_EXPR_BITS
+#undef SCAN_EXPR_LANES
+#undef SCAN_EXPR_BATCH_FN
+#undef SCAN_EXPR_PAIRED
+#undef SCAN_EXPR_ACC
+#undef SCAN_EXPR_VEC
+#undef SCAN_EXPR_LANE
@@ -0,0 +1,588 @@
+#ifndef SCAN_KERNELS_H_
+#define SCAN_KERNELS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Reductions behind src/4.c. Every kernel takes a byte range; the word modes
+// (xorodd, mask) look at the floor(len / 4) little-endian 32-bit words in it,
+// so a range split at multiples of 4 can be reduced piecewise and combined
+// with ^ (xor8, xorodd) or + (mask).
+
+typedef enum {
+  SCAN_ISA_SCALAR = 0,
+  SCAN_ISA_SSE2,  // xorodd additionally needs SSSE3 (pshufb)
+  SCAN_ISA_AVX2,
+  SCAN_ISA_COUNT
+} scan_isa;
+
+#define SCAN_MAX_MASKS (16)
+
+// What a fused pass computes. xor8..xor64 come from the same XOR
+// accumulator, so asking for one width costs the same as asking for all.
+typedef struct {
+  int xor_widths;
+  int xorodd;
+  size_t masks_count;
+  uint32_t masks[SCAN_MAX_MASKS];
+} scan_plan;
+
+// xorN covers the floor(len / (N / 8)) full N-bit words of the range; ranges
+// split at multiples of 8 bytes combine with scan_totals_merge.
+typedef struct {
+  uint8_t xor8;
+  uint16_t xor16;
+  uint32_t xor32;
+  uint64_t xor64;
+  uint32_t xorodd;
+  uint64_t mask_counts[SCAN_MAX_MASKS];
+} scan_totals;
+
+typedef struct {
+  scan_isa isa;
+  const char *name;
+  uint8_t (*xor8)(const unsigned char *data, size_t len);
+  uint32_t (*xorodd)(const unsigned char *data, size_t len);
+  uint64_t (*mask)(const unsigned char *data, size_t len, uint32_t mask);
+  // every query of the plan in one pass, accumulated into *totals
+  void (*fused)(const scan_plan *plan, const unsigned char *data, size_t len,
+                scan_totals *totals);
+} scan_kernels;
+
+int is_prime_byte(unsigned char b);
+
+void scan_totals_merge(scan_totals *into, const scan_totals *from);
+
+void scan_histogram(const unsigned char *data, size_t len,
+                    uint64_t histogram[256]);
+double scan_entropy(const uint64_t histogram[256]);
+uint64_t scan_prime_count(const uint64_t histogram[256]);
+
+scan_isa scan_isa_detect(void);
+const scan_kernels *scan_kernels_select(scan_isa isa);
+const char *scan_isa_name(scan_isa isa);
+int scan_isa_from_name(const char *name, scan_isa *isa_placeholder);
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+static const unsigned char scan_prime_table[256] = {
+    [2] = 1,   [3] = 1,   [5] = 1,   [7] = 1,   [11] = 1,  [13] = 1,
+    [17] = 1,  [19] = 1,  [23] = 1,  [29] = 1,  [31] = 1,  [37] = 1,
+    [41] = 1,  [43] = 1,  [47] = 1,  [53] = 1,  [59] = 1,  [61] = 1,
+    [67] = 1,  [71] = 1,  [73] = 1,  [79] = 1,  [83] = 1,  [89] = 1,
+    [97] = 1,  [101] = 1, [103] = 1, [107] = 1, [109] = 1, [113] = 1,
+    [127] = 1, [131] = 1, [137] = 1, [139] = 1, [149] = 1, [151] = 1,
+    [157] = 1, [163] = 1, [167] = 1, [173] = 1, [179] = 1, [181] = 1,
+    [191] = 1, [193] = 1, [197] = 1, [199] = 1, [211] = 1, [223] = 1,
+    [227] = 1, [229] = 1, [233] = 1, [239] = 1, [241] = 1, [251] = 1};
+
+// The same table as a 256-bit set: bit (b & 7) of byte (b >> 3), which is
+// what the pshufb kernels look up 16/32 bytes at a time.
+static const unsigned char scan_prime_bits[32] = {
+    0xac, 0x28, 0x8a, 0xa0, 0x20, 0x8a, 0x20, 0x28, 0x88, 0x82, 0x08, 0x02,
+    0xa2, 0x28, 0x02, 0x80, 0x08, 0x0a, 0xa0, 0x20, 0x88, 0x20, 0x28, 0x80,
+    0xa2, 0x00, 0x08, 0x80, 0x28, 0x82, 0x02, 0x08};
+
+int is_prime_byte(unsigned char b) { return scan_prime_table[b]; }
+
+static inline uint32_t scan_load_u32(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t scan_load_u64(const unsigned char *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline int scan_word_has_prime(uint32_t word) {
+  return scan_prime_table[word & 0xff] | scan_prime_table[(word >> 8) & 0xff] |
+         scan_prime_table[(word >> 16) & 0xff] | scan_prime_table[word >> 24];
+}
+
+/* ------------------------------ scalar ------------------------------ */
+
+static uint8_t scan_xor8_scalar(const unsigned char *data, size_t len) {
+  uint64_t acc = 0;
+  size_t i = 0;
+  uint8_t result = 0;
+
+  for (; i + 8 <= len; i += 8) {
+    acc ^= scan_load_u64(data + i);
+  }
+  acc ^= acc >> 32;
+  acc ^= acc >> 16;
+  acc ^= acc >> 8;
+  result = (uint8_t)acc;
+  for (; i < len; ++i) {
+    result ^= data[i];
+  }
+  return result;
+}
+
+static uint32_t scan_xorodd_scalar(const unsigned char *data, size_t len) {
+  uint32_t result = 0;
+  for (size_t i = 0; i + 4 <= len; i += 4) {
+    uint32_t word = scan_load_u32(data + i);
+    if (scan_word_has_prime(word)) {
+      result ^= word;
+    }
+  }
+  return result;
+}
+
+static uint64_t scan_mask_scalar(const unsigned char *data, size_t len,
+                                 uint32_t mask) {
+  uint64_t count = 0;
+  for (size_t i = 0; i + 4 <= len; i += 4) {
+    count += (scan_load_u32(data + i) & mask) == mask;
+  }
+  return count;
+}
+
+void scan_totals_merge(scan_totals *into, const scan_totals *from) {
+  into->xor8 ^= from->xor8;
+  into->xor16 ^= from->xor16;
+  into->xor32 ^= from->xor32;
+  into->xor64 ^= from->xor64;
+  into->xorodd ^= from->xorodd;
+  for (size_t i = 0; i < SCAN_MAX_MASKS; ++i) {
+    into->mask_counts[i] += from->mask_counts[i];
+  }
+}
+
+// Bytes per round of 32-bit sub-histograms: each of the four tables sees at
+// most a quarter of them, far below UINT32_MAX.
+#define SCAN_HISTOGRAM_BATCH ((size_t)1 << 30)
+
+#define SCAN_HISTOGRAM_WORD(sub, w)  \
+  do {                               \
+    sub[0][(w) & 0xff]++;            \
+    sub[1][((w) >> 8) & 0xff]++;     \
+    sub[2][((w) >> 16) & 0xff]++;    \
+    sub[3][((w) >> 24) & 0xff]++;    \
+    sub[0][((w) >> 32) & 0xff]++;    \
+    sub[1][((w) >> 40) & 0xff]++;    \
+    sub[2][((w) >> 48) & 0xff]++;    \
+    sub[3][(w) >> 56]++;             \
+  } while (0)
+
+// Adds the byte frequencies of the range to histogram. With one counter
+// table, runs of equal bytes serialize on store-to-load forwarding (every
+// increment waits for the previous store to the same counter), which is
+// exactly what zero-filled or low-entropy regions look like. Spreading
+// consecutive bytes over four tables, fed from 8-byte loads, keeps up to
+// four increments of the same counter in flight.
+void scan_histogram(const unsigned char *data, size_t len,
+                    uint64_t histogram[256]) {
+  uint32_t sub[4][256];
+
+  while (len > 0) {
+    size_t n = (len < SCAN_HISTOGRAM_BATCH) ? len : SCAN_HISTOGRAM_BATCH;
+    size_t i = 0;
+    uint64_t a = 0, b = 0;
+
+    memset(sub, 0, sizeof(sub));
+    for (; i + 16 <= n; i += 16) {
+      memcpy(&a, data + i, 8);
+      memcpy(&b, data + i + 8, 8);
+      SCAN_HISTOGRAM_WORD(sub, a);
+      SCAN_HISTOGRAM_WORD(sub, b);
+    }
+    for (; i < n; ++i) {
+      sub[i & 3][data[i]]++;
+    }
+    for (int c = 0; c < 256; ++c) {
+      histogram[c] += (uint64_t)sub[0][c] + sub[1][c] + sub[2][c] + sub[3][c];
+    }
+
+    data += n;
+    len -= n;
+  }
+}
+
+// Shannon entropy in bits per byte: 0 for constant data, 8 for uniform
+// noise. Compressed or encrypted regions sit just under 8.
+double scan_entropy(const uint64_t histogram[256]) {
+  uint64_t total = 0;
+  double entropy = 0;
+
+  for (int c = 0; c < 256; ++c) {
+    total += histogram[c];
+  }
+  if (total == 0) {
+    return 0;
+  }
+  for (int c = 0; c < 256; ++c) {
+    if (histogram[c] != 0) {
+      double p = (double)histogram[c] / (double)total;
+      entropy -= p * log2(p);
+    }
+  }
+  return entropy;
+}
+
+uint64_t scan_prime_count(const uint64_t histogram[256]) {
+  uint64_t count = 0;
+  for (int c = 0; c < 256; ++c) {
+    count += scan_prime_table[c] ? histogram[c] : 0;
+  }
+  return count;
+}
+
+// Folds the XOR of a run of whole 64-bit words into every width.
+static inline void scan_totals_add_xor64(scan_totals *totals, uint64_t acc) {
+  uint32_t x32 = (uint32_t)(acc ^ (acc >> 32));
+  uint16_t x16 = (uint16_t)(x32 ^ (x32 >> 16));
+  totals->xor64 ^= acc;
+  totals->xor32 ^= x32;
+  totals->xor16 ^= x16;
+  totals->xor8 ^= (uint8_t)(x16 ^ (x16 >> 8));
+}
+
+static inline void scan_fused_word(const scan_plan *plan, uint32_t word,
+                                   scan_totals *totals) {
+  if (plan->xorodd && scan_word_has_prime(word)) {
+    totals->xorodd ^= word;
+  }
+  for (size_t j = 0; j < plan->masks_count; ++j) {
+    totals->mask_counts[j] += (word & plan->masks[j]) == plan->masks[j];
+  }
+}
+
+static void scan_fused_scalar(const scan_plan *plan, const unsigned char *data,
+                              size_t len, scan_totals *totals) {
+  uint64_t acc = 0;
+  size_t i = 0;
+  int words = plan->xorodd || plan->masks_count > 0;
+
+  for (; i + 8 <= len; i += 8) {
+    uint64_t word = scan_load_u64(data + i);
+    acc ^= word;
+    if (words) {
+      scan_fused_word(plan, (uint32_t)word, totals);
+      scan_fused_word(plan, (uint32_t)(word >> 32), totals);
+    }
+  }
+  if (plan->xor_widths) {
+    scan_totals_add_xor64(totals, acc);
+  }
+
+  // fewer than 8 bytes left: at most one 32-bit word, three 16-bit words
+  if (i + 4 <= len) {
+    uint32_t word = scan_load_u32(data + i);
+    totals->xor32 ^= word;
+    if (words) {
+      scan_fused_word(plan, word, totals);
+    }
+  }
+  for (size_t j = i; j + 2 <= len; j += 2) {
+    totals->xor16 ^= (uint16_t)(data[j] | (data[j + 1] << 8));
+  }
+  for (size_t j = i; j < len; ++j) {
+    totals->xor8 ^= data[j];
+  }
+}
+
+#ifdef SCAN_KERNELS_X86
+
+/* ------------------------------- SSE -------------------------------- */
+
+__attribute__((target("sse2"))) static uint8_t scan_xor8_sse2(
+    const unsigned char *data, size_t len) {
+  __m128i acc0 = _mm_setzero_si128(), acc1 = _mm_setzero_si128();
+  __m128i acc2 = _mm_setzero_si128(), acc3 = _mm_setzero_si128();
+  size_t i = 0;
+
+  for (; i + 64 <= len; i += 64) {
+    acc0 = _mm_xor_si128(acc0, _mm_loadu_si128((const __m128i *)(data + i)));
+    acc1 = _mm_xor_si128(acc1, _mm_loadu_si128((const __m128i *)(data + i + 16)));
+    acc2 = _mm_xor_si128(acc2, _mm_loadu_si128((const __m128i *)(data + i + 32)));
+    acc3 = _mm_xor_si128(acc3, _mm_loadu_si128((const __m128i *)(data + i + 48)));
+  }
+  acc0 = _mm_xor_si128(_mm_xor_si128(acc0, acc1), _mm_xor_si128(acc2, acc3));
+  acc0 = _mm_xor_si128(acc0, _mm_srli_si128(acc0, 8));
+
+  return (uint8_t)(scan_xor8_scalar((const unsigned char *)&acc0, 8) ^
+                   scan_xor8_scalar(data + i, len - i));
+}
+
+__attribute__((target("sse2"))) static uint64_t scan_mask_sse2(
+    const unsigned char *data, size_t len, uint32_t mask) {
+  const __m128i m = _mm_set1_epi32((int)mask);
+  size_t words = len / 4, i = 0;
+  uint64_t count = 0;
+
+  while (words - i >= 4) {
+    // per-lane counters, flushed before they can overflow
+    size_t block_end = i + ((words - i) & ~(size_t)3);
+    if (block_end - i > ((size_t)1 << 30)) {
+      block_end = i + ((size_t)1 << 30);
+    }
+    __m128i lanes = _mm_setzero_si128();
+    for (; i < block_end; i += 4) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(data + i * 4));
+      lanes = _mm_sub_epi32(lanes, _mm_cmpeq_epi32(_mm_and_si128(v, m), m));
+    }
+    uint32_t partial[4];
+    _mm_storeu_si128((__m128i *)partial, lanes);
+    count += (uint64_t)partial[0] + partial[1] + partial[2] + partial[3];
+  }
+
+  return count + scan_mask_scalar(data + i * 4, len - i * 4, mask);
+}
+
+__attribute__((target("ssse3"))) static uint32_t scan_xorodd_ssse3(
+    const unsigned char *data, size_t len) {
+  const __m128i lut_lo = _mm_loadu_si128((const __m128i *)scan_prime_bits);
+  const __m128i lut_hi = _mm_loadu_si128((const __m128i *)(scan_prime_bits + 16));
+  const __m128i bit_lut = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, (char)128, 1, 2,
+                                        4, 8, 16, 32, 64, (char)128);
+  const __m128i low3 = _mm_set1_epi8(0x07), low4 = _mm_set1_epi8(0x0f);
+  const __m128i bit4 = _mm_set1_epi8(0x10), zero = _mm_setzero_si128();
+  __m128i acc = _mm_setzero_si128();
+  size_t i = 0;
+
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+    __m128i idx = _mm_and_si128(_mm_srli_epi16(v, 3), _mm_set1_epi8(0x1f));
+    __m128i lo = _mm_shuffle_epi8(lut_lo, _mm_and_si128(idx, low4));
+    __m128i hi = _mm_shuffle_epi8(lut_hi, _mm_and_si128(idx, low4));
+    __m128i use_hi = _mm_cmpeq_epi8(_mm_and_si128(idx, bit4), bit4);
+    __m128i row = _mm_or_si128(_mm_and_si128(use_hi, hi),
+                               _mm_andnot_si128(use_hi, lo));
+    __m128i bit = _mm_shuffle_epi8(bit_lut, _mm_and_si128(v, low3));
+    __m128i not_prime = _mm_cmpeq_epi8(_mm_and_si128(row, bit), zero);
+    __m128i no_prime_word =
+        _mm_cmpeq_epi32(not_prime, _mm_cmpeq_epi32(zero, zero));
+    acc = _mm_xor_si128(acc, _mm_andnot_si128(no_prime_word, v));
+  }
+
+  uint32_t lanes[4];
+  _mm_storeu_si128((__m128i *)lanes, acc);
+  return lanes[0] ^ lanes[1] ^ lanes[2] ^ lanes[3] ^
+         scan_xorodd_scalar(data + i, len - i);
+}
+
+/* ------------------------------- AVX2 ------------------------------- */
+
+__attribute__((target("avx2"))) static uint8_t scan_xor8_avx2(
+    const unsigned char *data, size_t len) {
+  __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+  __m256i acc2 = _mm256_setzero_si256(), acc3 = _mm256_setzero_si256();
+  size_t i = 0;
+
+  for (; i + 128 <= len; i += 128) {
+    acc0 = _mm256_xor_si256(acc0, _mm256_loadu_si256((const __m256i *)(data + i)));
+    acc1 = _mm256_xor_si256(acc1, _mm256_loadu_si256((const __m256i *)(data + i + 32)));
+    acc2 = _mm256_xor_si256(acc2, _mm256_loadu_si256((const __m256i *)(data + i + 64)));
+    acc3 = _mm256_xor_si256(acc3, _mm256_loadu_si256((const __m256i *)(data + i + 96)));
+  }
+  acc0 = _mm256_xor_si256(_mm256_xor_si256(acc0, acc1), _mm256_xor_si256(acc2, acc3));
+  __m128i folded = _mm_xor_si128(_mm256_castsi256_si128(acc0),
+                                 _mm256_extracti128_si256(acc0, 1));
+  folded = _mm_xor_si128(folded, _mm_srli_si128(folded, 8));
+
+  return (uint8_t)(scan_xor8_scalar((const unsigned char *)&folded, 8) ^
+                   scan_xor8_scalar(data + i, len - i));
+}
+
+__attribute__((target("avx2"))) static uint64_t scan_mask_avx2(
+    const unsigned char *data, size_t len, uint32_t mask) {
+  const __m256i m = _mm256_set1_epi32((int)mask);
+  size_t words = len / 4, i = 0;
+  uint64_t count = 0;
+
+  while (words - i >= 8) {
+    size_t block_end = i + ((words - i) & ~(size_t)7);
+    if (block_end - i > ((size_t)1 << 30)) {
+      block_end = i + ((size_t)1 << 30);
+    }
+    __m256i lanes = _mm256_setzero_si256();
+    for (; i < block_end; i += 8) {
+      __m256i v = _mm256_loadu_si256((const __m256i *)(data + i * 4));
+      lanes = _mm256_sub_epi32(lanes,
+                               _mm256_cmpeq_epi32(_mm256_and_si256(v, m), m));
+    }
+    uint32_t partial[8];
+    _mm256_storeu_si256((__m256i *)partial, lanes);
+    for (int j = 0; j < 8; ++j) {
+      count += partial[j];
+    }
+  }
+
+  return count + scan_mask_scalar(data + i * 4, len - i * 4, mask);
+}
+
+__attribute__((target("avx2"))) static inline __m256i scan_prime_words_avx2(
+    __m256i v) {
+  const __m256i lut_lo = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i *)scan_prime_bits));
+  const __m256i lut_hi = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i *)(scan_prime_bits + 16)));
+  const __m256i bit_lut = _mm256_setr_epi8(
+      1, 2, 4, 8, 16, 32, 64, (char)128, 1, 2, 4, 8, 16, 32, 64, (char)128, 1,
+      2, 4, 8, 16, 32, 64, (char)128, 1, 2, 4, 8, 16, 32, 64, (char)128);
+  const __m256i zero = _mm256_setzero_si256();
+
+  __m256i idx = _mm256_and_si256(_mm256_srli_epi16(v, 3), _mm256_set1_epi8(0x1f));
+  __m256i lo4 = _mm256_and_si256(idx, _mm256_set1_epi8(0x0f));
+  __m256i row = _mm256_blendv_epi8(
+      _mm256_shuffle_epi8(lut_lo, lo4), _mm256_shuffle_epi8(lut_hi, lo4),
+      _mm256_slli_epi16(idx, 3));  // bit 4 of idx moved into the sign bit
+  __m256i bit =
+      _mm256_shuffle_epi8(bit_lut, _mm256_and_si256(v, _mm256_set1_epi8(0x07)));
+  __m256i not_prime = _mm256_cmpeq_epi8(_mm256_and_si256(row, bit), zero);
+  // all-ones in the 32-bit lanes whose four bytes are all non-prime
+  return _mm256_cmpeq_epi32(not_prime, _mm256_cmpeq_epi32(zero, zero));
+}
+
+__attribute__((target("avx2"))) static uint32_t scan_xorodd_avx2(
+    const unsigned char *data, size_t len) {
+  __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+  size_t i = 0;
+
+  for (; i + 64 <= len; i += 64) {
+    __m256i v0 = _mm256_loadu_si256((const __m256i *)(data + i));
+    __m256i v1 = _mm256_loadu_si256((const __m256i *)(data + i + 32));
+    acc0 = _mm256_xor_si256(acc0, _mm256_andnot_si256(scan_prime_words_avx2(v0), v0));
+    acc1 = _mm256_xor_si256(acc1, _mm256_andnot_si256(scan_prime_words_avx2(v1), v1));
+  }
+  acc0 = _mm256_xor_si256(acc0, acc1);
+
+  uint32_t lanes[8];
+  uint32_t result = 0;
+  _mm256_storeu_si256((__m256i *)lanes, acc0);
+  for (int j = 0; j < 8; ++j) {
+    result ^= lanes[j];
+  }
+  return result ^ scan_xorodd_scalar(data + i, len - i);
+}
+
+// One load per 32 bytes feeds the XOR accumulator, the xorodd accumulator
+// and every mask counter, so each cache line is read exactly once whatever
+// the number of queries.
+__attribute__((target("avx2"))) static void scan_fused_avx2(
+    const scan_plan *plan, const unsigned char *data, size_t len,
+    scan_totals *totals) {
+  __m256i masks[SCAN_MAX_MASKS];
+  __m256i counters[SCAN_MAX_MASKS];
+  __m256i acc = _mm256_setzero_si256(), odd = _mm256_setzero_si256();
+  const size_t masks_count = plan->masks_count;
+  const int xorodd = plan->xorodd;
+  size_t i = 0, j = 0;
+
+  for (j = 0; j < masks_count; ++j) {
+    masks[j] = _mm256_set1_epi32((int)plan->masks[j]);
+  }
+
+  while (len - i >= 32) {
+    // lane counters are flushed before they could wrap
+    size_t block_end = i + ((len - i) & ~(size_t)31);
+    if (block_end - i > ((size_t)1 << 34)) {
+      block_end = i + ((size_t)1 << 34);
+    }
+    for (j = 0; j < masks_count; ++j) {
+      counters[j] = _mm256_setzero_si256();
+    }
+    for (; i < block_end; i += 32) {
+      __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+      acc = _mm256_xor_si256(acc, v);
+      if (xorodd) {
+        odd = _mm256_xor_si256(odd,
+                               _mm256_andnot_si256(scan_prime_words_avx2(v), v));
+      }
+      for (j = 0; j < masks_count; ++j) {
+        counters[j] = _mm256_sub_epi32(
+            counters[j],
+            _mm256_cmpeq_epi32(_mm256_and_si256(v, masks[j]), masks[j]));
+      }
+    }
+    for (j = 0; j < masks_count; ++j) {
+      uint32_t lanes[8];
+      _mm256_storeu_si256((__m256i *)lanes, counters[j]);
+      for (int l = 0; l < 8; ++l) {
+        totals->mask_counts[j] += lanes[l];
+      }
+    }
+  }
+
+  uint64_t acc_lanes[4];
+  uint32_t odd_lanes[8];
+  _mm256_storeu_si256((__m256i *)acc_lanes, acc);
+  _mm256_storeu_si256((__m256i *)odd_lanes, odd);
+  if (plan->xor_widths) {
+    scan_totals_add_xor64(totals, acc_lanes[0] ^ acc_lanes[1] ^ acc_lanes[2] ^
+                                      acc_lanes[3]);
+  }
+  for (int l = 0; l < 8; ++l) {
+    totals->xorodd ^= odd_lanes[l];
+  }
+
+  scan_fused_scalar(plan, data + i, len - i, totals);
+}
+
+#endif  // SCAN_KERNELS_X86
+
+/* ----------------------------- dispatch ----------------------------- */
+
+static const scan_kernels scan_kernels_table[SCAN_ISA_COUNT] = {
+    {SCAN_ISA_SCALAR, "scalar", scan_xor8_scalar, scan_xorodd_scalar,
+     scan_mask_scalar, scan_fused_scalar},
+#ifdef SCAN_KERNELS_X86
+    {SCAN_ISA_SSE2, "sse2", scan_xor8_sse2, scan_xorodd_ssse3, scan_mask_sse2,
+     scan_fused_scalar},
+    {SCAN_ISA_AVX2, "avx2", scan_xor8_avx2, scan_xorodd_avx2, scan_mask_avx2,
+     scan_fused_avx2},
+#endif
+};
+
+scan_isa scan_isa_detect(void) {
+#ifdef SCAN_KERNELS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return SCAN_ISA_AVX2;
+  }
+  if (__builtin_cpu_supports("ssse3")) {
+    return SCAN_ISA_SSE2;
+  }
+#endif
+  return SCAN_ISA_SCALAR;
+}
+
+// Requests above what the CPU supports fall back to the best available set.
+const scan_kernels *scan_kernels_select(scan_isa isa) {
+  scan_isa best = scan_isa_detect();
+  if (isa > best) {
+    isa = best;
+  }
+  return &scan_kernels_table[isa];
+}
+
+const char *scan_isa_name(scan_isa isa) {
+  static const char *names[SCAN_ISA_COUNT] = {"scalar", "sse2", "avx2"};
+  return (isa < SCAN_ISA_COUNT) ? names[isa] : "unknown";
+}
+
+int scan_isa_from_name(const char *name, scan_isa *isa_placeholder) {
+  if (name == NULL || isa_placeholder == NULL) {
+    return 0;
+  }
+  for (int i = 0; i < SCAN_ISA_COUNT; ++i) {
+    if (strcmp(name, scan_isa_name((scan_isa)i)) == 0) {
+      *isa_placeholder = (scan_isa)i;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+#endif  // SCAN_KERNELS_H_
@@ -0,0 +1,703 @@
+#ifndef SHELL_COMMANDS_H_
+#define SHELL_COMMANDS_H_
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "audit_log.h"
+#include "ban_bitmap.h"
+#include "datetime.h"
+#include "errors.h"
+#include "user_journal.h"
+#include "user_store.h"
+
+// Commands of the 2.c shell, independent of where the input comes from and
+// where the output goes: handlers append their replies to a shell_output
+// instead of printing them, and shell_session runs the login, registration
+// and command dialogue for one user as a line-at-a-time state machine, so
+// one process can hold many sessions (2_server.c) as well as the terminal
+// one (2.c).
+#define MAX_INPUT_LENGTH 256
+
+// Shell error codes; MEMORY_ALLOCATION_ERROR (1) comes from errors.h
+#define DEREFERENCING_NULL_ERROR 2
+#define PARSING_ERROR 3
+#define FILE_PARSING_ERROR 4
+#define INCORRECT_PASSWORD_ERROR 5
+#define FILE_OPENING_ERROR 6
+#define NO_SUCH_USERNAME_ERROR 7
+#define SELF_BAN_ERROR 8
+
+#define ADMIN_PASSWORD 52
+#define MAX_PIN 100000
+
+#define PROMPT_LOGIN "shell login: "
+#define PROMPT_PASSWORD "Password: "
+#define PROMPT_REGISTER \
+  "To register in shell enter PIN-code number between 0 and 100000: "
+#define PROMPT_CONFIRM "Enter PIN-code again for confirmation: "
+#define PROMPT_SHELL "shell -> "
+#define PROMPT_ADMIN "Enter admin password to process: "
+
+typedef struct {
+  char *data;
+  size_t len;
+  size_t capacity;
+} shell_output;
+
+// Appends formatted text; MEMORY_ALLOCATION_ERROR if it cannot grow.
+int shell_printf(shell_output *out, const char *format, ...);
+// Drops the first len bytes, e.g. once they were written out.
+void shell_output_consume(shell_output *out, size_t len);
+void shell_output_free(shell_output *out);
+
+int trim_string(char *s);
+// Maps user_store.h, user_journal.h and ban_bitmap.h errors onto the
+// shell's codes.
+int store_error(err_t err);
+const char *shell_error_message(int err);
+
+// Time, Date and Howmuch read the local zone through one datetime_zone
+// (datetime.h) for the whole process.
+int handle_time(shell_output *out);
+int handle_date(shell_output *out);
+int handle_howmuch(char *user_input, shell_output *out);
+// Record a "Sanctions <login>" line asks to ban.
+int sanctions_target(char *user_input, user_store *users,
+                     unsigned int current_uid, size_t *record_placeholder);
+
+typedef enum {
+  SESSION_LOGIN,
+  SESSION_PASSWORD,
+  SESSION_REGISTER,
+  SESSION_CONFIRM,
+  SESSION_COMMIT,  // registration queued, waiting for the journal commit
+  SESSION_SHELL,
+  SESSION_ADMIN_PASSWORD,
+} shell_session_state;
+
+typedef struct {
+  user_store *users;
+  user_journal *journal;  // registrations are queued, the owner commits
+  ban_bitmap *bans;
+  audit_log *audit;  // every command and its result, or NULL
+} shell_context;
+
+typedef struct {
+  shell_session_state state;
+  int batch;  // replies only, no prompts
+  char login[USER_LOGIN_MAX + 1];
+  size_t record;  // user logging in, or the one being banned
+  unsigned int current_uid;
+  unsigned int pin;  // first entry while registering
+  err_t registration;  // its user_journal_add result, set by the commit
+  char command[MAX_INPUT_LENGTH];  // Sanctions awaiting the admin password
+} shell_session;
+
+// Resets the session and, unless batch, appends the login prompt.
+void shell_session_start(shell_session *session, int batch,
+                         shell_output *out);
+// Feeds one line without its newline, appending the replies and the next
+// prompt. Returns 0, or an error that should end the process.
+int shell_session_input(shell_context *ctx, shell_session *session,
+                        char *line, shell_output *out);
+// Whether the session has queued a registration and waits for its reply.
+// Its owner commits ctx->journal, calls shell_session_resume and holds the
+// next lines back until then, so nobody is told "Success!" before the
+// record is durable, or when another shell took the login first.
+int shell_session_waiting(const shell_session *session);
+// Once the commit settled it, appends the registration's reply and the
+// next prompt. Returns 0 for a session that was not waiting.
+int shell_session_resume(shell_session *session, shell_output *out);
+
+// Commands of a logged in session. shell_commands is the one list of them:
+// completion in 2.c walks it, and dispatch goes through a perfect hash
+// table built from it the first time a command is looked up. A line's
+// first word picks the command; takes_args says whether more may follow.
+typedef enum {
+  SHELL_TIME,
+  SHELL_DATE,
+  SHELL_HOWMUCH,
+  SHELL_SANCTIONS,
+  SHELL_LOGOUT,
+} shell_command_id;
+
+typedef int (*shell_command_fn)(shell_context *ctx, shell_session *session,
+                                char *line, shell_output *out);
+
+typedef struct {
+  const char *name;
+  shell_command_id id;
+  int takes_args;
+  shell_command_fn run;
+} shell_command;
+
+extern const shell_command shell_commands[];  // ends with a NULL name
+
+// The command a trimmed line starts, or NULL for "Incorrect command".
+const shell_command *shell_command_find(const char *line);
+// Appends the message for a command's PARSING_ERROR, NO_SUCH_USERNAME_ERROR
+// or SELF_BAN_ERROR; any other error is returned as is.
+int shell_command_reply(int err, shell_output *out);
+// Adds a command of the logged in user and its result (0, or the shell
+// error code; PARSING_ERROR for unknown commands) to ctx->audit, if any.
+void shell_audit(shell_context *ctx, const char *login, unsigned int uid,
+                 const char *command, int result);
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+int shell_printf(shell_output *out, const char *format, ...) {
+  va_list args;
+  int n = 0;
+
+  va_start(args, format);
+  n = vsnprintf(out->data + out->len, out->capacity - out->len, format, args);
+  va_end(args);
+  if (n < 0) {
+    return PARSING_ERROR;
+  }
+  if (out->len + (size_t)n >= out->capacity) {
+    size_t capacity = out->capacity ? out->capacity : 256;
+    char *data = NULL;
+    while (capacity <= out->len + (size_t)n) {
+      capacity *= 2;
+    }
+    data = (char *)realloc(out->data, capacity);
+    if (data == NULL) {
+      return MEMORY_ALLOCATION_ERROR;
+    }
+    out->data = data;
+    out->capacity = capacity;
+    va_start(args, format);
+    vsnprintf(out->data + out->len, out->capacity - out->len, format, args);
+    va_end(args);
+  }
+  out->len += (size_t)n;
+  return 0;
+}
+
+void shell_output_consume(shell_output *out, size_t len) {
+  if (len >= out->len) {
+    out->len = 0;
+    return;
+  }
+  memmove(out->data, out->data + len, out->len - len);
+  out->len -= len;
+}
+
+void shell_output_free(shell_output *out) {
+  free(out->data);
+  out->data = NULL;
+  out->len = 0;
+  out->capacity = 0;
+}
+
+int trim_string(char *s) {
+  if (s == NULL) {
+    return 0;
+  }
+  size_t len = strlen(s);
+  while (len > 0 && isspace((unsigned char)s[len - 1])) {
+    s[len - 1] = '\0';
+    --len;
+  }
+  return len;
+}
+
+int store_error(err_t err) {
+  switch (err) {
+    case 0:
+      return 0;
+    case MEMORY_ALLOCATION_ERROR:
+      return MEMORY_ALLOCATION_ERROR;
+    case OPENING_THE_FILE_ERROR:
+    case MEMORY_MAPPING_ERROR:
+      return FILE_OPENING_ERROR;
+    default:
+      return FILE_PARSING_ERROR;
+  }
+}
+
+const char *shell_error_message(int err) {
+  switch (err) {
+    case MEMORY_ALLOCATION_ERROR:
+      return "Memory allocation failed.";
+    case DEREFERENCING_NULL_ERROR:
+      return "Attempted to dereference a null pointer.";
+    case PARSING_ERROR:
+      return "Parsing failed.";
+    case FILE_PARSING_ERROR:
+      return "Failed to parse the file.";
+    case INCORRECT_PASSWORD_ERROR:
+      return "Incorrect password.";
+    case FILE_OPENING_ERROR:
+      return "Could not open the file.";
+    case NO_SUCH_USERNAME_ERROR:
+      return "Username does not exist.";
+    default:
+      return NULL;
+  }
+}
+
+static datetime_zone shell_zone;
+
+int handle_time(shell_output *out) {
+  const char *text = NULL;
+  int err = datetime_now(&shell_zone, &text, NULL);
+  if (err != 0) {
+    return PARSING_ERROR;
+  }
+  return shell_printf(out, "%s\n", text);
+}
+
+int handle_date(shell_output *out) {
+  const char *text = NULL;
+  int err = datetime_now(&shell_zone, NULL, &text);
+  if (err != 0) {
+    return PARSING_ERROR;
+  }
+  return shell_printf(out, "%s\n", text);
+}
+
+int handle_howmuch(char *user_input, shell_output *out) {
+  if (user_input == NULL || out == NULL) {
+    return DEREFERENCING_NULL_ERROR;
+  }
+
+  const char *flag_str = NULL;
+  datetime_fields fields;
+  int64_t input_time = 0;
+  double diff = 0;
+
+  if (datetime_parse(user_input + 8, &fields, &flag_str) != 0 ||
+      !isspace((unsigned char)*flag_str) ||
+      datetime_to_utc(&shell_zone, &fields, &input_time) != 0) {
+    return PARSING_ERROR;
+  }
+  while (isspace((unsigned char)*flag_str)) {
+    ++flag_str;
+  }
+
+  diff = (double)((int64_t)time(NULL) - input_time);
+
+  if (strcmp(flag_str, "-s") == 0) {
+    return shell_printf(out, "%.0f seconds\n", diff);
+  } else if (strcmp(flag_str, "-m") == 0) {
+    return shell_printf(out, "%.0f minutes\n", diff / 60);
+  } else if (strcmp(flag_str, "-h") == 0) {
+    return shell_printf(out, "%.0f hours\n", diff / 3600);
+  } else if (strcmp(flag_str, "-y") == 0) {
+    return shell_printf(out, "%.2f years\n", diff / (365.25 * 24 * 3600));
+  }
+  return PARSING_ERROR;
+}
+
+int sanctions_target(char *user_input, user_store *users,
+                     unsigned int current_uid, size_t *record_placeholder) {
+  if (user_input == NULL || users == NULL || record_placeholder == NULL) {
+    return DEREFERENCING_NULL_ERROR;
+  }
+
+  size_t len = 0;
+  size_t found = 0;
+  int err = 0;
+  char *username = strchr(user_input, ' ');
+  if (username == NULL) {
+    return PARSING_ERROR;
+  }
+
+  while (isspace((unsigned char)*username)) {
+    username++;
+  }
+
+  len = trim_string(username);
+
+  if (len > USER_LOGIN_MAX) {
+    return PARSING_ERROR;
+  }
+
+  err = user_store_find(users, username, &found);
+  if (err == KEY_NOT_FOUND) {
+    return NO_SUCH_USERNAME_ERROR;
+  }
+  if (err != 0) {
+    return store_error(err);
+  }
+
+  if (found == current_uid - 1) {
+    return SELF_BAN_ERROR;
+  }
+
+  *record_placeholder = found;
+  return 0;
+}
+
+static int shell_run_time(shell_context *ctx, shell_session *session,
+                          char *line, shell_output *out) {
+  (void)ctx, (void)session, (void)line;
+  return handle_time(out);
+}
+
+static int shell_run_date(shell_context *ctx, shell_session *session,
+                          char *line, shell_output *out) {
+  (void)ctx, (void)session, (void)line;
+  return handle_date(out);
+}
+
+static int shell_run_howmuch(shell_context *ctx, shell_session *session,
+                             char *line, shell_output *out) {
+  (void)ctx, (void)session;
+  return handle_howmuch(line, out);
+}
+
+// Asks for the admin password as the session's next line.
+static int shell_run_sanctions(shell_context *ctx, shell_session *session,
+                               char *line, shell_output *out) {
+  (void)out;
+  int err = sanctions_target(line, ctx->users, session->current_uid,
+                             &session->record);
+  if (err == 0) {
+    session->state = SESSION_ADMIN_PASSWORD;
+  }
+  return err;
+}
+
+static int shell_run_logout(shell_context *ctx, shell_session *session,
+                            char *line, shell_output *out) {
+  (void)ctx, (void)line, (void)out;
+  int batch = session->batch;
+  memset(session, 0, sizeof(*session));
+  session->state = SESSION_LOGIN;
+  session->batch = batch;
+  return 0;
+}
+
+const shell_command shell_commands[] = {
+    {"Time", SHELL_TIME, 0, shell_run_time},
+    {"Date", SHELL_DATE, 0, shell_run_date},
+    {"Howmuch", SHELL_HOWMUCH, 1, shell_run_howmuch},
+    {"Sanctions", SHELL_SANCTIONS, 1, shell_run_sanctions},
+    {"Logout", SHELL_LOGOUT, 0, shell_run_logout},
+    {NULL, 0, 0, NULL},
+};
+
+// Slots hold a shell_commands index + 1 and the name's length. A word is
+// hashed by its first and last bytes and its length, which tell all the
+// names apart; the multiplier is searched for once so that every name gets
+// a slot of its own, and a lookup is then one multiplication, a length
+// check and one memcmp.
+#define SHELL_COMMAND_SLOT_BITS 4
+#define SHELL_COMMAND_SLOTS (1u << SHELL_COMMAND_SLOT_BITS)
+
+static unsigned char shell_command_slots[SHELL_COMMAND_SLOTS];
+static unsigned char shell_command_lengths[SHELL_COMMAND_SLOTS];
+static uint32_t shell_command_seed = 0;
+
+// Hashes the first word of line, the part before any space, and stores its
+// length.
+static uint32_t shell_command_hash(const char *line, uint32_t seed,
+                                   size_t *len_placeholder) {
+  size_t len = 0;
+  uint32_t key = 0;
+
+  while (line[len] != '\0' && line[len] != ' ') {
+    ++len;
+  }
+  key = (uint32_t)len << 16;
+  if (len > 0) {
+    key |= (uint32_t)(unsigned char)line[0] << 8 |
+           (unsigned char)line[len - 1];
+  }
+  *len_placeholder = len;
+  return (key * seed) >> (32 - SHELL_COMMAND_SLOT_BITS);
+}
+
+static void shell_command_table_build(void) {
+  for (uint32_t seed = 0x9e3779b1u;; seed += 2) {
+    size_t i = 0;
+    size_t len = 0;
+    memset(shell_command_slots, 0, sizeof(shell_command_slots));
+    for (i = 0; shell_commands[i].name != NULL; ++i) {
+      uint32_t slot = shell_command_hash(shell_commands[i].name, seed, &len);
+      if (shell_command_slots[slot] != 0) {
+        break;
+      }
+      shell_command_slots[slot] = (unsigned char)(i + 1);
+      shell_command_lengths[slot] = (unsigned char)len;
+    }
+    if (shell_commands[i].name == NULL) {
+      shell_command_seed = seed;
+      return;
+    }
+  }
+}
+
+const shell_command *shell_command_find(const char *line) {
+  const shell_command *command = NULL;
+  size_t len = 0;
+  uint32_t slot = 0;
+
+  if (shell_command_seed == 0) {
+    shell_command_table_build();
+  }
+  slot = shell_command_hash(line, shell_command_seed, &len);
+  if (shell_command_slots[slot] == 0 || shell_command_lengths[slot] != len) {
+    return NULL;
+  }
+  command = &shell_commands[shell_command_slots[slot] - 1];
+  if (memcmp(command->name, line, len) != 0 ||
+      (line[len] == ' ') != command->takes_args) {
+    return NULL;
+  }
+  return command;
+}
+
+int shell_command_reply(int err, shell_output *out) {
+  switch (err) {
+    case PARSING_ERROR:
+      return shell_printf(out, "Failed to parse input data. Try again\n");
+    case NO_SUCH_USERNAME_ERROR:
+      return shell_printf(out, "This user doesn't exists. Try again.\n");
+    case SELF_BAN_ERROR:
+      return shell_printf(out, "You can not ban yourself.\n");
+    default:
+      return err;
+  }
+}
+
+void shell_audit(shell_context *ctx, const char *login, unsigned int uid,
+                 const char *command, int result) {
+  if (ctx->audit != NULL) {
+    audit_log_record(ctx->audit, login, uid, command, result);
+  }
+}
+
+static const char *shell_session_prompt(shell_session_state state) {
+  switch (state) {
+    case SESSION_LOGIN:
+      return PROMPT_LOGIN;
+    case SESSION_PASSWORD:
+      return PROMPT_PASSWORD;
+    case SESSION_REGISTER:
+      return PROMPT_REGISTER;
+    case SESSION_CONFIRM:
+      return PROMPT_CONFIRM;
+    case SESSION_COMMIT:
+      return "";
+    case SESSION_SHELL:
+      return PROMPT_SHELL;
+    case SESSION_ADMIN_PASSWORD:
+      return PROMPT_ADMIN;
+  }
+  return "";
+}
+
+void shell_session_start(shell_session *session, int batch,
+                         shell_output *out) {
+  memset(session, 0, sizeof(*session));
+  session->state = SESSION_LOGIN;
+  session->batch = batch;
+  if (!batch) {
+    shell_printf(out, PROMPT_LOGIN);
+  }
+}
+
+// Parses a whole line as a number no greater than max.
+static int shell_parse_pin(const char *line, unsigned int max,
+                           unsigned int *pin_placeholder) {
+  char *end = NULL;
+  unsigned long value = 0;
+
+  while (isspace((unsigned char)*line)) {
+    ++line;
+  }
+  if (!isdigit((unsigned char)*line)) {
+    return PARSING_ERROR;
+  }
+  value = strtoul(line, &end, 10);
+  while (isspace((unsigned char)*end)) {
+    ++end;
+  }
+  if (*end != '\0' || value > max) {
+    return PARSING_ERROR;
+  }
+  *pin_placeholder = (unsigned int)value;
+  return 0;
+}
+
+static int shell_session_login(shell_context *ctx, shell_session *session,
+                               char *line, shell_output *out) {
+  size_t len = trim_string(line);
+  int err = 0;
+
+  if (len == 0) {
+    return 0;
+  }
+  if (len > USER_LOGIN_MAX) {
+    return shell_printf(out,
+                        "Login can not be longer than 6 symbols. Try "
+                        "again.\n");
+  }
+  strcpy(session->login, line);
+  err = user_store_find(ctx->users, line, &session->record);
+  if (err == KEY_NOT_FOUND) {
+    session->state = SESSION_REGISTER;
+    return 0;
+  }
+  if (err != 0) {
+    return store_error(err);
+  }
+  if (ban_bitmap_test(ctx->bans, session->record)) {
+    return shell_printf(out,
+                        "You are banned until the next reboot. How sad!\n");
+  }
+  session->state = SESSION_PASSWORD;
+  return 0;
+}
+
+static int shell_session_register(shell_context *ctx, shell_session *session,
+                                  char *line, shell_output *out) {
+  unsigned int pin = 0;
+  int err = 0;
+
+  if (session->state == SESSION_REGISTER) {
+    if (shell_parse_pin(line, MAX_PIN, &session->pin) != 0) {
+      session->state = SESSION_LOGIN;
+      return shell_printf(out, "Incorrect PIN format, try again.\n");
+    }
+    session->state = SESSION_CONFIRM;
+    return 0;
+  }
+
+  session->state = SESSION_LOGIN;
+  if (shell_parse_pin(line, MAX_PIN, &pin) != 0 || pin != session->pin) {
+    return shell_printf(out, "Incorrect PIN format, try again.\n");
+  }
+  err = user_journal_add(ctx->journal, session->login, pin,
+                         &session->registration);
+  if (err == REPEATING_KEY) {
+    return shell_printf(out,
+                        "This login has just been taken, try another one.\n");
+  }
+  if (err != 0) {
+    return store_error(err);
+  }
+  session->state = SESSION_COMMIT;  // the reply waits for the commit
+  return 0;
+}
+
+static int shell_session_command(shell_context *ctx, shell_session *session,
+                                 char *line, shell_output *out) {
+  const shell_command *command = NULL;
+  char login[USER_LOGIN_MAX + 1];
+  unsigned int uid = session->current_uid;
+  int err = 0;
+
+  if (trim_string(line) == 0) {
+    return 0;
+  }
+  command = shell_command_find(line);
+  if (command == NULL) {
+    shell_audit(ctx, session->login, uid, line, PARSING_ERROR);
+    return shell_printf(out, "Incorrect command. Try again.\n");
+  }
+  if (command->id == SHELL_SANCTIONS) {
+    strcpy(session->command, line);  // audited once the password is in
+  }
+  memcpy(login, session->login, sizeof(login));  // Logout clears it
+  err = command->run(ctx, session, line, out);
+  if (command->id != SHELL_SANCTIONS || err != 0) {
+    shell_audit(ctx, login, uid, line, err);
+  }
+  return shell_command_reply(err, out);
+}
+
+static int shell_session_step(shell_context *ctx, shell_session *session,
+                              char *line, shell_output *out) {
+  unsigned int pin = 0;
+  int err = 0;
+
+  switch (session->state) {
+    case SESSION_LOGIN:
+      return shell_session_login(ctx, session, line, out);
+    case SESSION_PASSWORD:
+      if (shell_parse_pin(line, UINT_MAX, &pin) != 0 ||
+          pin != ctx->users->users[session->record].pin) {
+        session->state = SESSION_LOGIN;
+        return shell_printf(out, "Incorrect PIN, try again.\n");
+      }
+      session->state = SESSION_SHELL;
+      session->current_uid = (unsigned int)session->record + 1;
+      return 0;
+    case SESSION_REGISTER:
+    case SESSION_CONFIRM:
+      return shell_session_register(ctx, session, line, out);
+    case SESSION_COMMIT:
+      return 0;  // the owner holds lines back until shell_session_resume
+    case SESSION_SHELL:
+      return shell_session_command(ctx, session, line, out);
+    case SESSION_ADMIN_PASSWORD:
+      session->state = SESSION_SHELL;
+      if (shell_parse_pin(line, UINT_MAX, &pin) != 0 ||
+          pin != ADMIN_PASSWORD) {
+        shell_audit(ctx, session->login, session->current_uid,
+                    session->command, INCORRECT_PASSWORD_ERROR);
+        return shell_printf(out, "Incorrect password. Try again\n");
+      }
+      err = store_error(ban_bitmap_set(ctx->bans, session->record));
+      shell_audit(ctx, session->login, session->current_uid, session->command,
+                  err);
+      if (err != 0) {
+        return err;
+      }
+      return shell_printf(out, "Success!\n");
+  }
+  return PARSING_ERROR;
+}
+
+int shell_session_input(shell_context *ctx, shell_session *session,
+                        char *line, shell_output *out) {
+  if (ctx == NULL || session == NULL || line == NULL || out == NULL) {
+    return DEREFERENCING_NULL_ERROR;
+  }
+
+  int err = shell_session_step(ctx, session, line, out);
+  if (err != 0 || session->batch) {
+    return err;
+  }
+  return shell_printf(out, "%s", shell_session_prompt(session->state));
+}
+
+int shell_session_waiting(const shell_session *session) {
+  return session->state == SESSION_COMMIT;
+}
+
+int shell_session_resume(shell_session *session, shell_output *out) {
+  err_t result = session->registration;
+  int err = 0;
+
+  if (session->state != SESSION_COMMIT || result == USER_JOURNAL_QUEUED) {
+    return 0;
+  }
+  session->state = SESSION_LOGIN;
+  if (result == REPEATING_KEY) {
+    err = shell_printf(out,
+                       "This login has just been taken, try another one.\n");
+  } else if (result != 0) {
+    return store_error(result);
+  } else {
+    err = shell_printf(out, "Success!\n");
+  }
+  if (err != 0 || session->batch) {
+    return err;
+  }
+  return shell_printf(out, "%s", shell_session_prompt(session->state));
+}
+
+#endif  // SHELL_COMMANDS_H_
@@ -0,0 +1,254 @@
+#ifndef STRING_VIEW_H_
+#define STRING_VIEW_H_
+
+#include <stddef.h>
+
+#include "cstring.h"
+
+#define SV_NPOS ((size_t)-1)
+#define SV_NUMBER_MAX_LENGTH (64)
+
+// Non-owning (ptr, len) slice. The viewed memory (a String, a literal, an
+// mmap'd file...) must outlive the view; nothing here allocates except
+// sv_to_string.
+typedef struct {
+  const char *data;
+  size_t len;
+} string_view;
+
+string_view sv_from_parts(const char *data, size_t len);
+string_view sv_from_c(const char *str);
+string_view sv_from_string(const String str);
+
+string_view sv_sub(string_view sv, size_t pos, size_t len);
+string_view sv_trim(string_view sv);
+
+int sv_eq(string_view a, string_view b);
+int sv_cmp(string_view a, string_view b);
+int sv_starts_with(string_view sv, string_view prefix);
+
+size_t sv_find_char(string_view haystack, char c, size_t from);
+size_t sv_find(string_view haystack, string_view needle, size_t from);
+size_t sv_count(string_view haystack, string_view needle);
+
+int sv_split_next(string_view *rest, char delim, string_view *token);
+
+size_t sv_hash(string_view sv);
+
+err_t sv_to_long(string_view sv, long *value_placeholder);
+err_t sv_to_double(string_view sv, double *value_placeholder);
+
+String sv_to_string(string_view sv);
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+string_view sv_from_parts(const char *data, size_t len) {
+  string_view sv;
+  sv.data = data;
+  sv.len = (data == NULL) ? 0 : len;
+  return sv;
+}
+
+string_view sv_from_c(const char *str) {
+  return sv_from_parts(str, (str == NULL) ? 0 : strlen(str));
+}
+
+string_view sv_from_string(const String str) {
+  return sv_from_parts(str, string_len(str));
+}
+
+string_view sv_sub(string_view sv, size_t pos, size_t len) {
+  if (pos > sv.len) {
+    pos = sv.len;
+  }
+  if (len > sv.len - pos) {
+    len = sv.len - pos;
+  }
+  return sv_from_parts(sv.data + pos, len);
+}
+
+string_view sv_trim(string_view sv) {
+  while (sv.len > 0 && isspace((unsigned char)sv.data[0])) {
+    sv.data++;
+    sv.len--;
+  }
+  while (sv.len > 0 && isspace((unsigned char)sv.data[sv.len - 1])) {
+    sv.len--;
+  }
+  return sv;
+}
+
+int sv_eq(string_view a, string_view b) {
+  return a.len == b.len && (a.len == 0 || memcmp(a.data, b.data, a.len) == 0);
+}
+
+int sv_cmp(string_view a, string_view b) {
+  size_t min = (a.len < b.len) ? a.len : b.len;
+  int res = (min == 0) ? 0 : memcmp(a.data, b.data, min);
+  if (res != 0) {
+    return res;
+  }
+  if (a.len == b.len) {
+    return 0;
+  }
+  return (a.len < b.len) ? -1 : 1;
+}
+
+int sv_starts_with(string_view sv, string_view prefix) {
+  return prefix.len <= sv.len &&
+         (prefix.len == 0 || memcmp(sv.data, prefix.data, prefix.len) == 0);
+}
+
+size_t sv_find_char(string_view haystack, char c, size_t from) {
+  const char *found = NULL;
+  if (from >= haystack.len) {
+    return SV_NPOS;
+  }
+  found = memchr(haystack.data + from, c, haystack.len - from);
+  return (found == NULL) ? SV_NPOS : (size_t)(found - haystack.data);
+}
+
+size_t sv_find(string_view haystack, string_view needle, size_t from) {
+  size_t pos = from;
+  if (needle.len == 0) {
+    return (from <= haystack.len) ? from : SV_NPOS;
+  }
+  while (pos + needle.len <= haystack.len) {
+    pos = sv_find_char(haystack, needle.data[0], pos);
+    if (pos == SV_NPOS || pos + needle.len > haystack.len) {
+      return SV_NPOS;
+    }
+    if (memcmp(haystack.data + pos + 1, needle.data + 1, needle.len - 1) ==
+        0) {
+      return pos;
+    }
+    pos++;
+  }
+  return SV_NPOS;
+}
+
+// Non-overlapping occurrences, same as advancing past each strstr match.
+size_t sv_count(string_view haystack, string_view needle) {
+  size_t count = 0, pos = 0;
+  if (needle.len == 0) {
+    return 0;
+  }
+  while ((pos = sv_find(haystack, needle, pos)) != SV_NPOS) {
+    count++;
+    pos += needle.len;
+  }
+  return count;
+}
+
+// Pops the next delimiter-separated token off the front of *rest. Unlike
+// strtok, empty tokens are kept. Returns 0 once *rest is exhausted.
+int sv_split_next(string_view *rest, char delim, string_view *token) {
+  size_t pos = 0;
+  if (rest == NULL || token == NULL || rest->data == NULL) {
+    return 0;
+  }
+
+  pos = sv_find_char(*rest, delim, 0);
+  if (pos == SV_NPOS) {
+    *token = *rest;
+    rest->data = NULL;
+    rest->len = 0;
+    return 1;
+  }
+
+  *token = sv_from_parts(rest->data, pos);
+  rest->data += pos + 1;
+  rest->len -= pos + 1;
+  return 1;
+}
+
+// Same value djb2_to_decimal gives for a String with the same bytes.
+size_t sv_hash(string_view sv) {
+  size_t hash = 5381;
+  for (size_t i = 0; i < sv.len; i++) {
+    hash = ((hash << 5) + hash) + sv.data[i];
+  }
+  return hash;
+}
+
+err_t sv_to_long(string_view sv, long *value_placeholder) {
+  if (value_placeholder == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  size_t i = 0;
+  int negative = 0;
+  unsigned long value = 0;
+  unsigned long limit = LONG_MAX;
+
+  sv = sv_trim(sv);
+  if (sv.len > 0 && (sv.data[0] == '-' || sv.data[0] == '+')) {
+    negative = sv.data[0] == '-';
+    limit += negative;
+    i++;
+  }
+  if (i == sv.len) {
+    return INVALID_NUMBER;
+  }
+
+  for (; i < sv.len; ++i) {
+    unsigned digit = (unsigned char)sv.data[i] - '0';
+    if (digit > 9 || value > (limit - digit) / 10) {
+      return INVALID_NUMBER;
+    }
+    value = value * 10 + digit;
+  }
+
+  *value_placeholder = negative ? (long)(0 - value) : (long)value;
+  return EXIT_SUCCESS;
+}
+
+// strtod needs a terminator, so the (short) number is copied to the stack.
+err_t sv_to_double(string_view sv, double *value_placeholder) {
+  if (value_placeholder == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  char buffer[SV_NUMBER_MAX_LENGTH + 1];
+  char *endptr = NULL;
+  double value = 0;
+
+  sv = sv_trim(sv);
+  if (sv.len == 0 || sv.len > SV_NUMBER_MAX_LENGTH) {
+    return INVALID_NUMBER;
+  }
+  memcpy(buffer, sv.data, sv.len);
+  buffer[sv.len] = '\0';
+
+  errno = 0;
+  value = strtod(buffer, &endptr);
+  if (errno != 0 || endptr != buffer + sv.len) {
+    return INVALID_NUMBER;
+  }
+
+  *value_placeholder = value;
+  return EXIT_SUCCESS;
+}
+
+String sv_to_string(string_view sv) {
+  String str = string_init();
+  if (str == NULL) {
+    return NULL;
+  }
+  if (sv.len > 0) {
+    if (sv.len > string_cap(str) &&
+        string_grow(&str, sv.len) != EXIT_SUCCESS) {
+      string_free(str);
+      return NULL;
+    }
+    memcpy(str, sv.data, sv.len);
+    __cstring_string_to_base(str)->length = sv.len;
+  }
+  return str;
+}
+
+#endif  // STRING_VIEW_H_
@@ -0,0 +1,275 @@
+#ifndef SUBSTRING_SEARCH_H_
+#define SUBSTRING_SEARCH_H_
+
+#include <stddef.h>
+
+#include "errors.h"
+#include "scan_kernels.h"
+
+// Counts non-overlapping occurrences of one needle in large byte ranges,
+// strstr-style (after a match the search resumes past its end), over a
+// whole mapped file or a stream of blocks.
+//
+// The vector kernels compare the needle's first and last bytes against 32
+// (AVX2) or 16 (SSE2) positions at once and only memcmp the middle where
+// both agree, so on ordinary text nearly every byte costs one compare and
+// the scan runs at memory bandwidth.
+#define SUBSTRING_BLOCK_SIZE ((size_t)1 << 20)
+
+// Counts non-overlapping matches from the start of [data, data + len),
+// stopping after limit of them; *end gets the offset just past the last
+// match, 0 if none.
+typedef size_t (*substring_count_fn)(const unsigned char *needle,
+                                     size_t needle_len,
+                                     const unsigned char *data, size_t len,
+                                     size_t limit, size_t *end);
+
+typedef struct {
+  const unsigned char *needle;
+  size_t len;
+  scan_isa isa;
+  substring_count_fn count;
+} substring_searcher;
+
+// isa above what the CPU supports falls back to the best available kernel.
+void substring_searcher_init(substring_searcher *s, const void *needle,
+                             size_t len, scan_isa isa);
+
+// First occurrence in [data, data + len), NULL if none.
+const unsigned char *substring_find(const substring_searcher *s,
+                                    const unsigned char *data, size_t len);
+
+// Matches in [data, data + len); *end_placeholder (may be NULL) gets the
+// offset just past the last one, 0 if there was none. An empty needle
+// matches nothing.
+size_t substring_count(const substring_searcher *s, const unsigned char *data,
+                       size_t len, size_t *end_placeholder);
+
+// The same over everything read from fd, SUBSTRING_BLOCK_SIZE at a time.
+// The tail of each block that could still start a match is carried into
+// the next one, so matches across block boundaries are found once.
+err_t substring_count_fd(const substring_searcher *s, int fd,
+                         size_t *count_placeholder);
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static size_t substring_count_scalar(const unsigned char *needle,
+                                     size_t needle_len,
+                                     const unsigned char *data, size_t len,
+                                     size_t limit, size_t *end) {
+  const unsigned char *p = data;
+  const unsigned char *stop = data + len;
+  size_t count = 0;
+
+  *end = 0;
+  while (count < limit && (size_t)(stop - p) >= needle_len) {
+    p = (const unsigned char *)memchr(p, needle[0],
+                                      (size_t)(stop - p) - needle_len + 1);
+    if (p == NULL) {
+      break;
+    }
+    if (memcmp(p + 1, needle + 1, needle_len - 1) == 0) {
+      ++count;
+      p += needle_len;
+      *end = (size_t)(p - data);
+    } else {
+      ++p;
+    }
+  }
+  return count;
+}
+
+// Vector kernels: from the candidates the compares leave, the ones inside
+// the previous match are skipped, the rest are verified with memcmp. The
+// tail shorter than one round goes to the next narrower kernel.
+#define SUBSTRING_VERIFY(mask, ctz)                                     \
+  while ((mask) != 0) {                                                 \
+    size_t pos = i + (size_t)ctz(mask);                                 \
+    (mask) &= (mask) - 1;                                               \
+    if (pos >= next && memcmp(data + pos + 1, needle + 1, middle) == 0) { \
+      next = pos + needle_len;                                          \
+      if (++count == limit) {                                           \
+        *end = next;                                                    \
+        return count;                                                   \
+      }                                                                 \
+    }                                                                   \
+  }
+
+#define SUBSTRING_TAIL(narrower)                                          \
+  do {                                                                    \
+    size_t from = (i > next) ? i : next;                                  \
+    size_t tail_end = 0;                                                  \
+    if (from < len) {                                                     \
+      count += narrower(needle, needle_len, data + from, len - from,      \
+                        limit - count, &tail_end);                        \
+      if (tail_end != 0) {                                                \
+        next = from + tail_end;                                           \
+      }                                                                   \
+    }                                                                     \
+    *end = next;                                                          \
+    return count;                                                         \
+  } while (0)
+
+#ifdef SCAN_KERNELS_X86
+
+// Bytes of the needle between the first and the last, which the vector
+// compares do not cover.
+static inline size_t substring_middle_len(size_t needle_len) {
+  return (needle_len > 2) ? needle_len - 2 : 0;
+}
+
+__attribute__((target("sse2"))) static size_t substring_count_sse2(
+    const unsigned char *needle, size_t needle_len, const unsigned char *data,
+    size_t len, size_t limit, size_t *end) {
+  const __m128i first = _mm_set1_epi8((char)needle[0]);
+  const __m128i last = _mm_set1_epi8((char)needle[needle_len - 1]);
+  const size_t middle = substring_middle_len(needle_len);
+  size_t count = 0;
+  size_t next = 0;
+  size_t i = 0;
+
+  for (; i + needle_len - 1 + 16 <= len; i += 16) {
+    __m128i block_first = _mm_loadu_si128((const __m128i *)(data + i));
+    __m128i block_last =
+        _mm_loadu_si128((const __m128i *)(data + i + needle_len - 1));
+    unsigned int mask = (unsigned int)_mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(first, block_first),
+                      _mm_cmpeq_epi8(last, block_last)));
+    SUBSTRING_VERIFY(mask, __builtin_ctz)
+  }
+  SUBSTRING_TAIL(substring_count_scalar);
+}
+
+// Two vectors per round, tested together, so the common no-candidate case
+// is four loads, four compares and one branch per 64 bytes.
+__attribute__((target("avx2"))) static size_t substring_count_avx2(
+    const unsigned char *needle, size_t needle_len, const unsigned char *data,
+    size_t len, size_t limit, size_t *end) {
+  const __m256i first = _mm256_set1_epi8((char)needle[0]);
+  const __m256i last = _mm256_set1_epi8((char)needle[needle_len - 1]);
+  const size_t middle = substring_middle_len(needle_len);
+  size_t count = 0;
+  size_t next = 0;
+  size_t i = 0;
+
+  for (; i + needle_len - 1 + 64 <= len; i += 64) {
+    const unsigned char *p = data + i;
+    const unsigned char *q = p + needle_len - 1;
+    __m256i eq0 = _mm256_and_si256(
+        _mm256_cmpeq_epi8(first, _mm256_loadu_si256((const __m256i *)p)),
+        _mm256_cmpeq_epi8(last, _mm256_loadu_si256((const __m256i *)q)));
+    __m256i eq1 = _mm256_and_si256(
+        _mm256_cmpeq_epi8(first,
+                          _mm256_loadu_si256((const __m256i *)(p + 32))),
+        _mm256_cmpeq_epi8(last,
+                          _mm256_loadu_si256((const __m256i *)(q + 32))));
+    __m256i any = _mm256_or_si256(eq0, eq1);
+    if (_mm256_testz_si256(any, any)) {
+      continue;
+    }
+    uint64_t mask = (uint32_t)_mm256_movemask_epi8(eq0) |
+                    (uint64_t)(uint32_t)_mm256_movemask_epi8(eq1) << 32;
+    SUBSTRING_VERIFY(mask, __builtin_ctzll)
+  }
+  SUBSTRING_TAIL(substring_count_sse2);
+}
+
+#endif  // SCAN_KERNELS_X86
+
+#undef SUBSTRING_VERIFY
+#undef SUBSTRING_TAIL
+
+void substring_searcher_init(substring_searcher *s, const void *needle,
+                             size_t len, scan_isa isa) {
+  scan_isa best = scan_isa_detect();
+
+  s->needle = (const unsigned char *)needle;
+  s->len = len;
+  s->isa = (isa > best) ? best : isa;
+  s->count = substring_count_scalar;
+#ifdef SCAN_KERNELS_X86
+  if (s->isa == SCAN_ISA_AVX2) {
+    s->count = substring_count_avx2;
+  } else if (s->isa == SCAN_ISA_SSE2) {
+    s->count = substring_count_sse2;
+  }
+#endif
+}
+
+const unsigned char *substring_find(const substring_searcher *s,
+                                    const unsigned char *data, size_t len) {
+  size_t end = 0;
+
+  if (s->len == 0 || len < s->len ||
+      s->count(s->needle, s->len, data, len, 1, &end) == 0) {
+    return NULL;
+  }
+  return data + end - s->len;
+}
+
+size_t substring_count(const substring_searcher *s, const unsigned char *data,
+                       size_t len, size_t *end_placeholder) {
+  size_t count = 0;
+  size_t end = 0;
+
+  if (s->len != 0 && len >= s->len) {
+    count = s->count(s->needle, s->len, data, len, (size_t)-1, &end);
+  }
+  if (end_placeholder != NULL) {
+    *end_placeholder = end;
+  }
+  return count;
+}
+
+err_t substring_count_fd(const substring_searcher *s, int fd,
+                         size_t *count_placeholder) {
+  if (s == NULL || count_placeholder == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  // Room for a whole block behind the carried tail, which is shorter than
+  // the needle.
+  size_t capacity = SUBSTRING_BLOCK_SIZE + s->len;
+  unsigned char *window = (unsigned char *)malloc(capacity);
+  size_t used = 0;
+  size_t count = 0;
+
+  if (window == NULL) {
+    return MEMORY_ALLOCATION_ERROR;
+  }
+  while (1) {
+    ssize_t n = read(fd, window + used, SUBSTRING_BLOCK_SIZE);
+    size_t end = 0;
+    size_t keep = 0;
+
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      free(window);
+      return OPENING_THE_FILE_ERROR;
+    }
+    if (n == 0) {
+      break;
+    }
+    used += (size_t)n;
+    count += substring_count(s, window, used, &end);
+    // Every start before used - (len - 1) has been tried; later ones, past
+    // the last match, may still complete in the next block.
+    keep = (s->len > 0) ? s->len - 1 : 0;
+    if (keep > used - end) {
+      keep = used - end;
+    }
+    memmove(window, window + used - keep, keep);
+    used = keep;
+  }
+
+  free(window);
+  *count_placeholder = count;
+  return EXIT_SUCCESS;
+}
+
+#endif  // SUBSTRING_SEARCH_H_
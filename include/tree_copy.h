@@ -0,0 +1,779 @@
+#ifndef TREE_COPY_H_
+#define TREE_COPY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "errors.h"
+
+// Recursive directory copy that keeps many small files in flight at once.
+//
+// The walk is synchronous and cheap on metadata: entries are fstatat()ed
+// relative to their open directory, directories are created as they are
+// found and their final modes and timestamps are applied in one pass at the
+// end, children before parents so creating entries cannot disturb them.
+// Symlinks are recreated as symlinks; other special files are skipped.
+//
+// Regular files then go through io_uring when the kernel allows it: up to
+// `depth` files at a time, each a chain of OPENAT, READ/WRITE and CLOSE
+// requests, all submitted and reaped in batches by one thread. Without
+// io_uring, `depth` threads copy a file each, through a private buffer or,
+// past TREE_COPY_BUFFER_SIZE, with copy_engine.h. Either way files are
+// created with their exact mode (umask is cleared for the duration, so do
+// not create files from other threads meanwhile), and only pre-existing
+// destination files need an extra fchmod.
+//
+// Sparse files (fewer blocks allocated than their size) skip both paths and
+// are copied extent by extent like copy_engine_fd does, so their holes stay
+// holes; the io_uring engine does that synchronously, between batches.
+#define TREE_COPY_DEFAULT_DEPTH 64
+#define TREE_COPY_MAX_DEPTH 1024
+#define TREE_COPY_BUFFER_SIZE ((size_t)128 << 10)
+#define TREE_COPY_MAX_PATH 4096
+
+typedef enum {
+  TREE_ENGINE_AUTO,
+  TREE_ENGINE_URING,
+  TREE_ENGINE_THREADS
+} tree_engine;
+
+typedef struct {
+  size_t depth;  // files in flight: ring slots or pool threads
+  tree_engine engine;
+} tree_copy_options;
+
+typedef struct {
+  tree_engine engine;  // the one that copied the files
+  size_t files;
+  size_t dirs;
+  size_t symlinks;
+  size_t skipped;  // sockets, FIFOs, devices
+  size_t failed;
+  uint64_t bytes;
+  int first_errno;
+  char first_failure[TREE_COPY_MAX_PATH];
+} tree_copy_stats;
+
+const char *tree_engine_name(tree_engine engine);
+err_t tree_engine_parse(const char *name, tree_engine *engine_placeholder);
+
+// Copies the tree under src into dst, creating dst if needed (an existing
+// dst is merged into, like cp -rT). Per-file failures are counted in stats
+// and do not stop the copy; the result is INVALID_INPUT_DATA if any occurred.
+err_t tree_copy(const char *src, const char *dst,
+                const tree_copy_options *opts, tree_copy_stats *stats);
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "copy_engine.h"
+#include "io_ring.h"
+
+typedef struct {
+  size_t path;  // offset in the names arena, relative to the roots
+  mode_t mode;
+  uint64_t size;
+  int sparse;  // fewer blocks allocated than size: copy extent by extent
+  struct timespec times[2];  // atime, mtime
+} tree_entry;
+
+typedef struct {
+  tree_entry *items;
+  size_t count;
+  size_t capacity;
+} tree_entries;
+
+typedef struct {
+  const char *src_root;
+  const char *dst_root;
+  char *names;
+  size_t names_len;
+  size_t names_capacity;
+  tree_entries files;
+  tree_entries dirs;
+  tree_copy_stats *stats;
+  pthread_mutex_t lock;  // stats, for the thread pool
+  size_t next_file;      // thread pool work queue, bumped atomically
+} tree_copy_job;
+
+static const char *const tree_engine_names[] = {"auto", "uring", "threads"};
+
+const char *tree_engine_name(tree_engine engine) {
+  return (engine <= TREE_ENGINE_THREADS) ? tree_engine_names[engine]
+                                         : "unknown";
+}
+
+err_t tree_engine_parse(const char *name, tree_engine *engine_placeholder) {
+  if (name == NULL || engine_placeholder == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+  for (int engine = TREE_ENGINE_AUTO; engine <= TREE_ENGINE_THREADS;
+       ++engine) {
+    if (strcmp(name, tree_engine_names[engine]) == 0) {
+      *engine_placeholder = (tree_engine)engine;
+      return EXIT_SUCCESS;
+    }
+  }
+  return INVALID_CLI_ARGUMENT;
+}
+
+static err_t tree_join(char *out, const char *root, const char *rel) {
+  int n = (*rel == '\0') ? snprintf(out, TREE_COPY_MAX_PATH, "%s", root)
+                         : snprintf(out, TREE_COPY_MAX_PATH, "%s/%s", root,
+                                    rel);
+  return (n < 0 || n >= TREE_COPY_MAX_PATH) ? INDEX_OUT_OF_BOUNDS : 0;
+}
+
+static void tree_fail(tree_copy_job *job, const char *path, int error) {
+  pthread_mutex_lock(&job->lock);
+  if (job->stats->failed++ == 0) {
+    snprintf(job->stats->first_failure, TREE_COPY_MAX_PATH, "%s", path);
+    job->stats->first_errno = error;
+  }
+  pthread_mutex_unlock(&job->lock);
+}
+
+static err_t tree_push(tree_copy_job *job, tree_entries *entries,
+                       const char *rel, const struct stat *st) {
+  size_t rel_len = strlen(rel) + 1;
+  tree_entry *entry = NULL;
+
+  if (job->names_len + rel_len > job->names_capacity) {
+    size_t capacity = job->names_capacity ? job->names_capacity * 2 : 65536;
+    char *names = NULL;
+    while (capacity < job->names_len + rel_len) {
+      capacity *= 2;
+    }
+    names = (char *)realloc(job->names, capacity);
+    if (names == NULL) {
+      return MEMORY_ALLOCATION_ERROR;
+    }
+    job->names = names;
+    job->names_capacity = capacity;
+  }
+  if (entries->count == entries->capacity) {
+    size_t capacity = entries->capacity ? entries->capacity * 2 : 1024;
+    tree_entry *items =
+        (tree_entry *)realloc(entries->items, capacity * sizeof(*items));
+    if (items == NULL) {
+      return MEMORY_ALLOCATION_ERROR;
+    }
+    entries->items = items;
+    entries->capacity = capacity;
+  }
+
+  entry = &entries->items[entries->count++];
+  entry->path = job->names_len;
+  entry->mode = st->st_mode;
+  entry->size = (uint64_t)st->st_size;
+  entry->sparse = S_ISREG(st->st_mode) &&
+                  (uint64_t)st->st_blocks * 512 < (uint64_t)st->st_size;
+  entry->times[0] = st->st_atim;
+  entry->times[1] = st->st_mtim;
+  memcpy(job->names + job->names_len, rel, rel_len);
+  job->names_len += rel_len;
+  return 0;
+}
+
+static void tree_copy_symlink(tree_copy_job *job, int dir_fd, const char *name,
+                              const char *dst, const struct stat *st) {
+  char target[TREE_COPY_MAX_PATH];
+  struct timespec times[2] = {st->st_atim, st->st_mtim};
+  ssize_t len = readlinkat(dir_fd, name, target, sizeof(target) - 1);
+
+  if (len < 0) {
+    tree_fail(job, dst, errno);
+    return;
+  }
+  target[len] = '\0';
+  if (symlink(target, dst) != 0 &&
+      (errno != EEXIST || unlink(dst) != 0 || symlink(target, dst) != 0)) {
+    tree_fail(job, dst, errno);
+    return;
+  }
+  utimensat(AT_FDCWD, dst, times, AT_SYMLINK_NOFOLLOW);
+  job->stats->symlinks++;
+}
+
+// rel holds the directory's path relative to the roots ("" for the roots
+// themselves) and is extended in place for each child.
+static err_t tree_walk(tree_copy_job *job, char *rel, size_t rel_len) {
+  char src[TREE_COPY_MAX_PATH];
+  char dst[TREE_COPY_MAX_PATH];
+  struct dirent *dirent = NULL;
+  struct stat st;
+  DIR *dir = NULL;
+  err_t err = 0;
+
+  if (tree_join(src, job->src_root, rel) != 0) {
+    tree_fail(job, rel, ENAMETOOLONG);
+    return 0;
+  }
+  dir = opendir(src);
+  if (dir == NULL) {
+    tree_fail(job, src, errno);
+    return 0;
+  }
+
+  while (err == 0 && (dirent = readdir(dir)) != NULL) {
+    const char *name = dirent->d_name;
+    size_t name_len = strlen(name);
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+      continue;
+    }
+    if (rel_len + 1 + name_len >= TREE_COPY_MAX_PATH) {
+      tree_fail(job, name, ENAMETOOLONG);
+      continue;
+    }
+    if (rel_len > 0) {
+      rel[rel_len] = '/';
+    }
+    memcpy(rel + rel_len + (rel_len > 0), name, name_len + 1);
+
+    if (tree_join(dst, job->dst_root, rel) != 0) {
+      tree_fail(job, rel, ENAMETOOLONG);
+    } else if (fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+      tree_fail(job, rel, errno);
+    } else if (S_ISDIR(st.st_mode)) {
+      // Owner rwx until the final pass so the walk can fill it in.
+      if (mkdir(dst, 0700) != 0 && errno != EEXIST) {
+        tree_fail(job, dst, errno);
+      } else if ((err = tree_push(job, &job->dirs, rel, &st)) == 0) {
+        err = tree_walk(job, rel, strlen(rel));
+      }
+    } else if (S_ISREG(st.st_mode)) {
+      err = tree_push(job, &job->files, rel, &st);
+    } else if (S_ISLNK(st.st_mode)) {
+      tree_copy_symlink(job, dirfd(dir), name, dst, &st);
+    } else {
+      job->stats->skipped++;
+    }
+    rel[rel_len] = '\0';
+  }
+
+  closedir(dir);
+  return err;
+}
+
+static void tree_finish_dirs(tree_copy_job *job) {
+  char dst[TREE_COPY_MAX_PATH];
+  for (size_t i = job->dirs.count; i-- > 0;) {
+    const tree_entry *entry = &job->dirs.items[i];
+    if (tree_join(dst, job->dst_root, job->names + entry->path) != 0) {
+      continue;
+    }
+    if (chmod(dst, entry->mode & 07777) != 0 ||
+        utimensat(AT_FDCWD, dst, entry->times, 0) != 0) {
+      tree_fail(job, dst, errno);
+    }
+  }
+  job->stats->dirs = job->dirs.count;
+}
+
+// Both ends are open; the data has been copied.
+static int tree_set_file_metadata(int out_fd, const tree_entry *entry,
+                                  int existed) {
+  if (existed && fchmod(out_fd, entry->mode & 07777) != 0) {
+    return errno;
+  }
+  return (futimens(out_fd, entry->times) != 0) ? errno : 0;
+}
+
+// ---- thread pool -----------------------------------------------------------
+
+// Small files go through the worker's buffer: for them a read and a write
+// beat copy_file_range, whose in-kernel setup costs more than the copy.
+// Returns 0 or an errno.
+static int tree_pool_copy_data(int in_fd, int out_fd, const tree_entry *entry,
+                               unsigned char *buffer, uint64_t *copied) {
+  copy_stats stats;
+  size_t len = 0;
+
+  if (entry->sparse) {
+    if (copy_engine_extents(in_fd, out_fd, entry->size,
+                            COPY_PATH_COPY_FILE_RANGE, &stats) != 0) {
+      return errno;
+    }
+    *copied = stats.bytes;
+    return 0;
+  }
+  if (entry->size > TREE_COPY_BUFFER_SIZE) {
+    if (copy_engine_range(in_fd, 0, out_fd, 0, entry->size,
+                          COPY_PATH_COPY_FILE_RANGE, &stats) != 0) {
+      return errno;
+    }
+    *copied = stats.bytes;
+    return 0;
+  }
+  while (len < entry->size) {
+    ssize_t n = read(in_fd, buffer + len, (size_t)entry->size - len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return errno;
+    }
+    if (n == 0) {
+      break;  // shrank: copy what was there
+    }
+    len += (size_t)n;
+  }
+  for (size_t done = 0; done < len;) {
+    ssize_t n = write(out_fd, buffer + done, len - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return n ? errno : EIO;
+    }
+    done += (size_t)n;
+  }
+  *copied = len;
+  return 0;
+}
+
+static void tree_pool_copy(tree_copy_job *job, const tree_entry *entry,
+                           unsigned char *buffer) {
+  char src[TREE_COPY_MAX_PATH];
+  char dst[TREE_COPY_MAX_PATH];
+  uint64_t copied = 0;
+  int in_fd = -1, out_fd = -1, existed = 0, error = 0;
+
+  if (tree_join(src, job->src_root, job->names + entry->path) != 0 ||
+      tree_join(dst, job->dst_root, job->names + entry->path) != 0) {
+    tree_fail(job, job->names + entry->path, ENAMETOOLONG);
+    return;
+  }
+  in_fd = open(src, O_RDONLY | O_CLOEXEC);
+  if (in_fd == -1) {
+    tree_fail(job, src, errno);
+    return;
+  }
+  out_fd = open(dst, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                entry->mode & 07777);
+  if (out_fd == -1 && errno == EEXIST) {
+    existed = 1;
+    out_fd = open(dst, O_WRONLY | O_TRUNC | O_CLOEXEC);
+  }
+  if (out_fd == -1) {
+    error = errno;
+  } else if ((error = tree_pool_copy_data(in_fd, out_fd, entry, buffer,
+                                          &copied)) == 0) {
+    error = tree_set_file_metadata(out_fd, entry, existed);
+  }
+  close(in_fd);
+  if (out_fd != -1 && close(out_fd) != 0 && error == 0) {
+    error = errno;
+  }
+
+  if (error != 0) {
+    tree_fail(job, dst, error);
+    return;
+  }
+  pthread_mutex_lock(&job->lock);
+  job->stats->files++;
+  job->stats->bytes += copied;
+  pthread_mutex_unlock(&job->lock);
+}
+
+static void *tree_pool_worker_main(void *arg) {
+  tree_copy_job *job = (tree_copy_job *)arg;
+  unsigned char *buffer = (unsigned char *)malloc(TREE_COPY_BUFFER_SIZE);
+  size_t i = 0;
+
+  if (buffer == NULL) {
+    return NULL;  // the other workers, or the calling thread, take over
+  }
+  while ((i = __atomic_fetch_add(&job->next_file, 1, __ATOMIC_RELAXED)) <
+         job->files.count) {
+    tree_pool_copy(job, &job->files.items[i], buffer);
+  }
+  free(buffer);
+  return NULL;
+}
+
+static err_t tree_copy_files_pool(tree_copy_job *job, size_t threads) {
+  pthread_t *tids = (pthread_t *)malloc(threads * sizeof(*tids));
+  size_t started = 0;
+
+  if (tids == NULL) {
+    return MEMORY_ALLOCATION_ERROR;
+  }
+  job->next_file = 0;
+  // The calling thread works too; a failed pthread_create only costs
+  // parallelism.
+  for (size_t i = 1; i < threads; ++i) {
+    if (pthread_create(&tids[i], NULL, tree_pool_worker_main, job) != 0) {
+      break;
+    }
+    started++;
+  }
+  tree_pool_worker_main(job);
+  for (size_t i = 1; i <= started; ++i) {
+    pthread_join(tids[i], NULL);
+  }
+  free(tids);
+  return 0;
+}
+
+// ---- io_uring --------------------------------------------------------------
+
+enum { TREE_OP_OPEN_IN, TREE_OP_OPEN_OUT, TREE_OP_READ, TREE_OP_WRITE,
+       TREE_OP_CLOSE };
+
+typedef struct {
+  const tree_entry *entry;
+  int in_fd;
+  int out_fd;
+  int pending;  // requests in flight
+  int closing;
+  int existed;
+  int error;  // first errno
+  uint64_t offset;
+  size_t write_len;
+  size_t write_done;
+  unsigned char *buffer;
+  char src[TREE_COPY_MAX_PATH];  // read by OPENAT after submission
+  char dst[TREE_COPY_MAX_PATH];
+} tree_slot;
+
+typedef struct {
+  io_ring ring;
+  tree_slot *slots;
+  size_t *free_slots;
+  size_t free_count;
+  unsigned char *buffers;
+} tree_uring;
+
+// The ring has two SQEs per slot and a slot never has more than two
+// requests in flight, so this cannot run out.
+static struct io_uring_sqe *tree_sqe(tree_uring *u, size_t slot, int op) {
+  struct io_uring_sqe *sqe = io_ring_get_sqe(&u->ring);
+  sqe->user_data = ((uint64_t)slot << 3) | (uint64_t)op;
+  u->slots[slot].pending++;
+  return sqe;
+}
+
+static void tree_prep_open(tree_uring *u, size_t slot, int op,
+                           const char *path, int flags, mode_t mode) {
+  struct io_uring_sqe *sqe = tree_sqe(u, slot, op);
+  sqe->opcode = IORING_OP_OPENAT;
+  sqe->fd = AT_FDCWD;
+  sqe->addr = (uint64_t)(uintptr_t)path;
+  sqe->len = mode;
+  sqe->open_flags = (uint32_t)flags;
+}
+
+static void tree_prep_rw(tree_uring *u, size_t slot, int op, int fd,
+                         void *buffer, size_t len, uint64_t offset) {
+  struct io_uring_sqe *sqe = tree_sqe(u, slot, op);
+  sqe->opcode = (op == TREE_OP_READ) ? IORING_OP_READ : IORING_OP_WRITE;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)buffer;
+  sqe->len = (uint32_t)len;
+  sqe->off = offset;
+}
+
+static void tree_prep_close(tree_uring *u, size_t slot, int fd) {
+  struct io_uring_sqe *sqe = tree_sqe(u, slot, TREE_OP_CLOSE);
+  sqe->opcode = IORING_OP_CLOSE;
+  sqe->fd = fd;
+}
+
+static int tree_uring_start(tree_copy_job *job, tree_uring *u, size_t slot,
+                            const tree_entry *entry) {
+  tree_slot *s = &u->slots[slot];
+  const char *rel = job->names + entry->path;
+
+  if (entry->sparse) {
+    tree_pool_copy(job, entry, s->buffer);  // keeps the holes
+    return 0;
+  }
+  if (tree_join(s->src, job->src_root, rel) != 0 ||
+      tree_join(s->dst, job->dst_root, rel) != 0) {
+    tree_fail(job, rel, ENAMETOOLONG);
+    return 0;
+  }
+  s->entry = entry;
+  s->in_fd = -1;
+  s->out_fd = -1;
+  s->pending = 0;
+  s->closing = 0;
+  s->existed = 0;
+  s->error = 0;
+  s->offset = 0;
+  tree_prep_open(u, slot, TREE_OP_OPEN_IN, s->src, O_RDONLY | O_CLOEXEC, 0);
+  tree_prep_open(u, slot, TREE_OP_OPEN_OUT, s->dst,
+                 O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, entry->mode & 07777);
+  return 1;
+}
+
+static void tree_uring_read_next(tree_uring *u, size_t slot) {
+  tree_slot *s = &u->slots[slot];
+  uint64_t left = s->entry->size - s->offset;
+  size_t len = (left < TREE_COPY_BUFFER_SIZE) ? (size_t)left
+                                              : TREE_COPY_BUFFER_SIZE;
+  tree_prep_rw(u, slot, TREE_OP_READ, s->in_fd, s->buffer, len, s->offset);
+}
+
+// Queues the closes; returns 0 when there was nothing left to close and the
+// slot is already free.
+static int tree_uring_close(tree_uring *u, size_t slot) {
+  tree_slot *s = &u->slots[slot];
+  s->closing = 1;
+  if (s->in_fd != -1) {
+    tree_prep_close(u, slot, s->in_fd);
+  }
+  if (s->out_fd != -1) {
+    tree_prep_close(u, slot, s->out_fd);
+  }
+  return s->pending > 0;
+}
+
+// Returns 1 while the slot is still busy.
+static int tree_uring_complete(tree_copy_job *job, tree_uring *u, size_t slot,
+                               int op, int res) {
+  tree_slot *s = &u->slots[slot];
+
+  s->pending--;
+  switch (op) {
+    case TREE_OP_OPEN_IN:
+      if (res >= 0) {
+        s->in_fd = res;
+      } else if (s->error == 0) {
+        s->error = -res;
+      }
+      break;
+    case TREE_OP_OPEN_OUT:
+      if (res >= 0) {
+        s->out_fd = res;
+      } else if (res == -EEXIST && !s->existed) {
+        s->existed = 1;
+        tree_prep_open(u, slot, TREE_OP_OPEN_OUT, s->dst,
+                       O_WRONLY | O_TRUNC | O_CLOEXEC, 0);
+      } else if (s->error == 0) {
+        s->error = -res;
+      }
+      break;
+    case TREE_OP_READ:
+      if (res < 0) {
+        s->error = -res;
+      } else if (res == 0) {
+        s->offset = s->entry->size;  // shrank: copy what was there
+      } else {
+        s->write_len = (size_t)res;
+        s->write_done = 0;
+        tree_prep_rw(u, slot, TREE_OP_WRITE, s->out_fd, s->buffer, res,
+                     s->offset);
+      }
+      break;
+    case TREE_OP_WRITE:
+      if (res <= 0) {
+        s->error = res ? -res : EIO;
+      } else if ((s->write_done += (size_t)res) < s->write_len) {
+        tree_prep_rw(u, slot, TREE_OP_WRITE, s->out_fd,
+                     s->buffer + s->write_done, s->write_len - s->write_done,
+                     s->offset + s->write_done);
+      } else {
+        s->offset += s->write_len;
+      }
+      break;
+    case TREE_OP_CLOSE:
+      if (res < 0 && s->error == 0) {
+        s->error = -res;
+      }
+      break;
+  }
+  if (s->pending > 0) {
+    return 1;
+  }
+
+  if (s->closing) {
+    if (s->error != 0) {
+      tree_fail(job, s->dst, s->error);
+    } else {
+      job->stats->files++;
+      job->stats->bytes += s->offset;
+    }
+    return 0;
+  }
+  if (s->error == 0 && s->offset < s->entry->size) {
+    tree_uring_read_next(u, slot);
+    return 1;
+  }
+  if (s->error == 0) {
+    s->error = tree_set_file_metadata(s->out_fd, s->entry, s->existed);
+  }
+  if (!tree_uring_close(u, slot)) {
+    if (s->error != 0) {
+      tree_fail(job, s->dst, s->error);
+    }
+    return 0;
+  }
+  return 1;
+}
+
+static void tree_uring_free(tree_uring *u) {
+  io_ring_free(&u->ring);
+  free(u->slots);
+  free(u->free_slots);
+  free(u->buffers);
+}
+
+// Returns INVALID_FLAG without copying anything when io_uring is unusable.
+static err_t tree_copy_files_uring(tree_copy_job *job, size_t depth) {
+  tree_uring u;
+  size_t next = 0, active = 0;
+  err_t err = io_ring_init(&u.ring, (unsigned)(2 * depth));
+
+  if (err != 0) {
+    return err;
+  }
+  u.slots = (tree_slot *)malloc(depth * sizeof(*u.slots));
+  u.free_slots = (size_t *)malloc(depth * sizeof(*u.free_slots));
+  u.buffers = (unsigned char *)aligned_alloc(COPY_ENGINE_ALIGN,
+                                             depth * TREE_COPY_BUFFER_SIZE);
+  if (u.slots == NULL || u.free_slots == NULL || u.buffers == NULL) {
+    tree_uring_free(&u);
+    return MEMORY_ALLOCATION_ERROR;
+  }
+  for (size_t i = 0; i < depth; ++i) {
+    u.slots[i].buffer = u.buffers + i * TREE_COPY_BUFFER_SIZE;
+    u.free_slots[i] = depth - 1 - i;
+  }
+  u.free_count = depth;
+
+  while (next < job->files.count || active > 0) {
+    struct io_uring_cqe *cqe = NULL;
+    int ret = 0;
+
+    while (u.free_count > 0 && next < job->files.count) {
+      size_t slot = u.free_slots[u.free_count - 1];
+      if (tree_uring_start(job, &u, slot, &job->files.items[next++])) {
+        u.free_count--;
+        active++;
+      }
+    }
+    if (active == 0) {
+      break;
+    }
+    ret = io_ring_submit_and_wait(&u.ring, 1);
+    if (ret < 0 && ret != -EAGAIN && ret != -EBUSY) {
+      errno = -ret;
+      err = OPENING_THE_FILE_ERROR;
+      break;
+    }
+    while ((cqe = io_ring_peek_cqe(&u.ring)) != NULL) {
+      size_t slot = (size_t)(cqe->user_data >> 3);
+      int op = (int)(cqe->user_data & 7);
+      int res = cqe->res;
+      io_ring_cqe_seen(&u.ring);
+      if (!tree_uring_complete(job, &u, slot, op, res)) {
+        u.free_slots[u.free_count++] = slot;
+        active--;
+      }
+    }
+  }
+
+  tree_uring_free(&u);
+  return err;
+}
+
+// ---- driver ----------------------------------------------------------------
+
+static int tree_contains(const char *dir, const char *path) {
+  char dir_real[PATH_MAX];
+  char path_real[PATH_MAX];
+  size_t len = 0;
+
+  if (realpath(dir, dir_real) == NULL || realpath(path, path_real) == NULL) {
+    return 0;
+  }
+  len = strlen(dir_real);
+  return strncmp(dir_real, path_real, len) == 0 &&
+         (path_real[len] == '/' || path_real[len] == '\0' ||
+          strcmp(dir_real, "/") == 0);
+}
+
+err_t tree_copy(const char *src, const char *dst,
+                const tree_copy_options *opts, tree_copy_stats *stats) {
+  if (src == NULL || dst == NULL || opts == NULL || stats == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  tree_copy_job job;
+  struct stat st;
+  char rel[TREE_COPY_MAX_PATH] = "";
+  size_t depth = opts->depth ? opts->depth : TREE_COPY_DEFAULT_DEPTH;
+  mode_t old_umask = 0;
+  int created = 0;
+  err_t err = 0;
+
+  memset(stats, 0, sizeof(*stats));
+  if (depth > TREE_COPY_MAX_DEPTH) {
+    depth = TREE_COPY_MAX_DEPTH;
+  }
+  if (stat(src, &st) != 0) {
+    return OPENING_THE_FILE_ERROR;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    errno = ENOTDIR;
+    return OPENING_THE_FILE_ERROR;
+  }
+  created = mkdir(dst, 0700) == 0;
+  if (!created && errno != EEXIST) {
+    return OPENING_THE_FILE_ERROR;
+  }
+  if (tree_contains(src, dst)) {
+    if (created) {
+      rmdir(dst);
+    }
+    errno = EINVAL;
+    return INVALID_INPUT_DATA;  // the walk would copy the copy forever
+  }
+
+  memset(&job, 0, sizeof(job));
+  job.src_root = src;
+  job.dst_root = dst;
+  job.stats = stats;
+  pthread_mutex_init(&job.lock, NULL);
+  old_umask = umask(0);
+
+  err = tree_push(&job, &job.dirs, "", &st);
+  if (err == 0) {
+    err = tree_walk(&job, rel, 0);
+  }
+  if (err == 0 && opts->engine != TREE_ENGINE_THREADS) {
+    stats->engine = TREE_ENGINE_URING;
+    err = tree_copy_files_uring(&job, depth);
+  }
+  if ((err == 0 && opts->engine == TREE_ENGINE_THREADS) ||
+      (err == INVALID_FLAG && opts->engine == TREE_ENGINE_AUTO)) {
+    stats->engine = TREE_ENGINE_THREADS;
+    err = tree_copy_files_pool(&job, depth);
+  }
+  if (err == 0) {
+    tree_finish_dirs(&job);
+  }
+
+  umask(old_umask);
+  pthread_mutex_destroy(&job.lock);
+  free(job.names);
+  free(job.files.items);
+  free(job.dirs.items);
+  if (err == 0 && stats->failed > 0) {
+    errno = stats->first_errno;
+    err = INVALID_INPUT_DATA;
+  }
+  return err;
+}
+
+#endif  // TREE_COPY_H_
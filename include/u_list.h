@@ -284,7 +284,7 @@ err_t u_list_delete_by_index(u_list *l, size_t index) {
 }
 err_t u_list_delete_by_value(u_list *l, const void *target,
                              int (*comp)(const void *, const void *)) {
-  u_list_node *item, *father;
+  u_list_node *item;
 
   if (l == NULL) {
     return DEREFERENCING_NULL_PTR;
@@ -0,0 +1,507 @@
+#ifndef USER_JOURNAL_H_
+#define USER_JOURNAL_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "errors.h"
+#include "user_store.h"
+
+// Durable registrations for a user_store. Registrations are queued in
+// memory and committed in groups: one write of the whole group to a
+// write-ahead log (records path + ".wal"), one fdatasync, then the records
+// go into the records file without waiting for the disk. A background
+// checkpointer syncs the records file and empties the log once it reaches
+// checkpoint_bytes, and on close. Opening replays whatever a crash left in
+// the log, so a committed registration survives even when the records file
+// lost it.
+//
+// Log frames carry the record number they were written at and a CRC-32C;
+// replay stops at the first torn frame. Commits and checkpoints of every
+// process sharing the store are serialised with flock() on the log.
+#define USER_JOURNAL_MAGIC (0x4c4a5355u)  // "USJL"
+#define USER_JOURNAL_DEFAULT_BATCH ((size_t)4096)
+#define USER_JOURNAL_DEFAULT_CHECKPOINT ((uint64_t)1 << 20)
+#define USER_JOURNAL_QUEUED (-1)  // a registration's result before commit
+
+typedef struct {
+  uint32_t magic;
+  uint32_t crc;     // crc32c of record and entry
+  uint64_t record;  // position in the records file
+  user_entry entry;
+} user_journal_frame;
+
+typedef struct {
+  size_t batch;               // queued registrations that force a commit
+  uint64_t checkpoint_bytes;  // log size that wakes the checkpointer
+} user_journal_options;
+
+typedef struct {
+  uint64_t records;  // registrations committed
+  uint64_t commits;  // group commits, one log write and fdatasync each
+  uint64_t syncs;    // fdatasync calls on the log and the records file
+  uint64_t checkpoints;
+  uint64_t replayed;  // records recovered from the log when opening
+} user_journal_stats;
+
+typedef struct {
+  user_store *store;
+  user_journal_options opts;
+  int wal_fd;
+  int records_fd;  // positional writes; the store's descriptor only reads
+  char *wal_path;
+  user_entry *pending;
+  err_t **pending_results;  // where each one's outcome goes, or NULL
+  size_t pending_count;
+  size_t pending_capacity;
+  uint32_t *pending_set;  // pending index + 1 by login hash, 0 = empty
+  user_journal_frame *frames;
+  pthread_t checkpointer;
+  int has_checkpointer;
+  pthread_mutex_t lock;  // log and records file writes
+  pthread_cond_t wake;
+  int checkpoint_requested;
+  int stop;
+  err_t checkpoint_error;
+  user_journal_stats stats;
+} user_journal;
+
+// opts may be NULL for the defaults. The store must stay open until the
+// journal is closed.
+err_t user_journal_open(user_journal *journal, user_store *store,
+                        const user_journal_options *opts);
+// Queues a registration, committing the group once it reaches opts.batch.
+// REPEATING_KEY if the login is taken or already queued. Otherwise
+// *result_placeholder (may be NULL) is USER_JOURNAL_QUEUED until the commit
+// that settles it sets 0, REPEATING_KEY if another shell registered the
+// login first, or the commit's error; it must stay valid until then.
+err_t user_journal_add(user_journal *journal, const char *login,
+                       unsigned int pin, err_t *result_placeholder);
+// Makes every queued registration durable and visible in the store.
+// Logins other shells registered meanwhile are dropped from the group and
+// reported through their results; the return value only covers the rest.
+err_t user_journal_commit(user_journal *journal);
+// Commits, checkpoints and stops the checkpointer.
+err_t user_journal_close(user_journal *journal);
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "crc32c.h"
+
+static uint32_t user_journal_frame_crc(const user_journal_frame *frame) {
+  return crc32c(&frame->record,
+                sizeof(*frame) - offsetof(user_journal_frame, record));
+}
+
+static err_t user_journal_write_all(int fd, const void *data, size_t len,
+                                    off_t offset) {
+  const unsigned char *p = (const unsigned char *)data;
+  while (len > 0) {
+    ssize_t n = (offset < 0) ? write(fd, p, len) : pwrite(fd, p, len, offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      if (n == 0) {
+        errno = EIO;
+      }
+      return OPENING_THE_FILE_ERROR;
+    }
+    p += n;
+    len -= (size_t)n;
+    offset += (offset < 0) ? 0 : n;
+  }
+  return EXIT_SUCCESS;
+}
+
+// Both files synced, then the log emptied. Called with the mutex and the
+// flock held.
+static err_t user_journal_checkpoint_locked(user_journal *journal) {
+  ++journal->stats.syncs;
+  if (fdatasync(journal->records_fd) == -1 ||
+      ftruncate(journal->wal_fd, 0) == -1) {
+    return OPENING_THE_FILE_ERROR;
+  }
+  ++journal->stats.checkpoints;
+  return EXIT_SUCCESS;
+}
+
+static err_t user_journal_checkpoint(user_journal *journal) {
+  struct stat st;
+  err_t err = 0;
+
+  if (fstat(journal->wal_fd, &st) == 0 && st.st_size == 0) {
+    return EXIT_SUCCESS;
+  }
+  // The bulk of the write-back happens here, without blocking commits; the
+  // sync under the lock only covers what they added meanwhile.
+  fdatasync(journal->records_fd);
+  pthread_mutex_lock(&journal->lock);
+  ++journal->stats.syncs;
+  flock(journal->wal_fd, LOCK_EX);
+  err = user_journal_checkpoint_locked(journal);
+  flock(journal->wal_fd, LOCK_UN);
+  pthread_mutex_unlock(&journal->lock);
+  return err;
+}
+
+static void *user_journal_checkpointer_main(void *arg) {
+  user_journal *journal = (user_journal *)arg;
+
+  pthread_mutex_lock(&journal->lock);
+  while (!journal->stop) {
+    if (!journal->checkpoint_requested) {
+      pthread_cond_wait(&journal->wake, &journal->lock);
+      continue;
+    }
+    journal->checkpoint_requested = 0;
+    pthread_mutex_unlock(&journal->lock);
+    err_t err = user_journal_checkpoint(journal);
+    pthread_mutex_lock(&journal->lock);
+    if (err != 0 && journal->checkpoint_error == 0) {
+      journal->checkpoint_error = err;
+    }
+  }
+  pthread_mutex_unlock(&journal->lock);
+  return NULL;
+}
+
+// Rewrites every intact frame at its record number, in order, until the
+// first torn frame or a gap past the end of the records file.
+static err_t user_journal_replay(user_journal *journal) {
+  struct stat st;
+  user_journal_frame frame;
+  uint64_t count = 0;
+  off_t offset = 0;
+  err_t err = 0;
+
+  if (fstat(journal->records_fd, &st) == -1) {
+    return OPENING_THE_FILE_ERROR;
+  }
+  count = (uint64_t)st.st_size / sizeof(user_entry);
+  while (pread(journal->wal_fd, &frame, sizeof(frame), offset) ==
+         (ssize_t)sizeof(frame)) {
+    if (frame.magic != USER_JOURNAL_MAGIC ||
+        frame.crc != user_journal_frame_crc(&frame) || frame.record > count) {
+      break;
+    }
+    err = user_journal_write_all(journal->records_fd, &frame.entry,
+                                 sizeof(frame.entry),
+                                 (off_t)(frame.record * sizeof(user_entry)));
+    if (err != 0) {
+      return err;
+    }
+    if (frame.record == count) {
+      ++count;
+      ++journal->stats.replayed;
+    }
+    offset += (off_t)sizeof(frame);
+  }
+  if (offset > 0) {
+    err = user_journal_checkpoint_locked(journal);
+  }
+  return err;
+}
+
+err_t user_journal_open(user_journal *journal, user_store *store,
+                        const user_journal_options *opts) {
+  if (journal == NULL || store == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  size_t len = strlen(store->path) + sizeof(".wal");
+  err_t err = 0;
+
+  memset(journal, 0, sizeof(*journal));
+  journal->store = store;
+  journal->wal_fd = -1;
+  journal->records_fd = -1;
+  journal->opts.batch = USER_JOURNAL_DEFAULT_BATCH;
+  journal->opts.checkpoint_bytes = USER_JOURNAL_DEFAULT_CHECKPOINT;
+  if (opts != NULL && opts->batch != 0) {
+    journal->opts.batch = opts->batch;
+  }
+  if (opts != NULL && opts->checkpoint_bytes != 0) {
+    journal->opts.checkpoint_bytes = opts->checkpoint_bytes;
+  }
+  pthread_mutex_init(&journal->lock, NULL);
+  pthread_cond_init(&journal->wake, NULL);
+
+  journal->wal_path = (char *)malloc(len);
+  if (journal->wal_path == NULL) {
+    user_journal_close(journal);
+    return MEMORY_ALLOCATION_ERROR;
+  }
+  snprintf(journal->wal_path, len, "%s.wal", store->path);
+  journal->wal_fd = open(journal->wal_path,
+                         O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  journal->records_fd = open(store->path, O_WRONLY | O_CLOEXEC);
+  if (journal->wal_fd == -1 || journal->records_fd == -1) {
+    user_journal_close(journal);
+    return OPENING_THE_FILE_ERROR;
+  }
+
+  flock(journal->wal_fd, LOCK_EX);
+  err = user_journal_replay(journal);
+  flock(journal->wal_fd, LOCK_UN);
+  if (err == 0) {
+    err = user_store_refresh(store);
+  }
+  if (err == 0 && pthread_create(&journal->checkpointer, NULL,
+                                 user_journal_checkpointer_main,
+                                 journal) == 0) {
+    journal->has_checkpointer = 1;
+  }
+  if (err != 0) {
+    user_journal_close(journal);
+  }
+  return err;
+}
+
+static int user_journal_pending_slot(const user_journal *journal,
+                                     const char *login, size_t *slot) {
+  size_t mask = journal->pending_capacity * 2 - 1;
+  for (size_t i = user_store_hash(login) & mask;; i = (i + 1) & mask) {
+    uint32_t index = journal->pending_set[i];
+    if (index == 0) {
+      *slot = i;
+      return 0;
+    }
+    if (strncmp(journal->pending[index - 1].login, login,
+                USER_LOGIN_MAX + 1) == 0) {
+      *slot = i;
+      return 1;
+    }
+  }
+}
+
+// Doubles the queue (and the results, the frames scratch and the set
+// beside it).
+static err_t user_journal_grow(user_journal *journal) {
+  size_t capacity = journal->pending_capacity ? journal->pending_capacity * 2
+                                              : 64;
+  user_entry *pending = (user_entry *)realloc(journal->pending,
+                                              capacity * sizeof(*pending));
+  err_t **results = NULL;
+  user_journal_frame *frames = NULL;
+  uint32_t *set = NULL;
+  size_t slot = 0;
+
+  if (pending == NULL) {
+    return MEMORY_ALLOCATION_ERROR;
+  }
+  journal->pending = pending;
+  results = (err_t **)realloc(journal->pending_results,
+                              capacity * sizeof(*results));
+  if (results == NULL) {
+    return MEMORY_ALLOCATION_ERROR;
+  }
+  journal->pending_results = results;
+  frames = (user_journal_frame *)realloc(journal->frames,
+                                         capacity * sizeof(*frames));
+  if (frames == NULL) {
+    return MEMORY_ALLOCATION_ERROR;
+  }
+  journal->frames = frames;
+  set = (uint32_t *)calloc(capacity * 2, sizeof(*set));
+  if (set == NULL) {
+    return MEMORY_ALLOCATION_ERROR;
+  }
+  free(journal->pending_set);
+  journal->pending_set = set;
+  journal->pending_capacity = capacity;
+  for (size_t i = 0; i < journal->pending_count; ++i) {
+    user_journal_pending_slot(journal, journal->pending[i].login, &slot);
+    set[slot] = (uint32_t)i + 1;
+  }
+  return EXIT_SUCCESS;
+}
+
+err_t user_journal_add(user_journal *journal, const char *login,
+                       unsigned int pin, err_t *result_placeholder) {
+  if (journal == NULL || login == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+  if (strlen(login) > USER_LOGIN_MAX) {
+    return INVALID_INPUT_DATA;
+  }
+
+  user_entry *entry = NULL;
+  size_t slot = 0;
+  err_t err = 0;
+
+  // Checked against the index as of the last refresh; the commit checks
+  // again under the lock for logins that arrived since.
+  if (journal->store->index != NULL &&
+      user_store_lookup(journal->store, login, &slot)) {
+    return REPEATING_KEY;
+  }
+  if (journal->pending_count == journal->pending_capacity) {
+    err = user_journal_grow(journal);
+    if (err != 0) {
+      return err;
+    }
+  }
+  if (user_journal_pending_slot(journal, login, &slot)) {
+    return REPEATING_KEY;
+  }
+
+  entry = &journal->pending[journal->pending_count];
+  memset(entry, 0, sizeof(*entry));
+  strcpy(entry->login, login);
+  entry->pin = pin;
+  journal->pending_results[journal->pending_count] = result_placeholder;
+  if (result_placeholder != NULL) {
+    *result_placeholder = USER_JOURNAL_QUEUED;
+  }
+  journal->pending_set[slot] = (uint32_t)++journal->pending_count;
+
+  if (journal->pending_count >= journal->opts.batch) {
+    return user_journal_commit(journal);
+  }
+  return EXIT_SUCCESS;
+}
+
+static void user_journal_settle(err_t *result, err_t err) {
+  if (result != NULL) {
+    *result = err;
+  }
+}
+
+err_t user_journal_commit(user_journal *journal) {
+  if (journal == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+  if (journal->pending_count == 0) {
+    return EXIT_SUCCESS;
+  }
+
+  user_store *store = journal->store;
+  struct stat st;
+  size_t n = 0;
+  size_t settled = journal->pending_count;  // all of them if refresh fails
+  size_t record = 0;
+  unsigned int uid = 0;
+  err_t err = 0;
+
+  pthread_mutex_lock(&journal->lock);
+  flock(journal->wal_fd, LOCK_EX);
+  err = user_store_refresh(store);
+  record = store->count;
+  uid = (record == 0) ? 0 : store->users[record - 1].uid;
+  for (size_t i = 0; i < journal->pending_count && err == 0; ++i) {
+    user_journal_frame *frame = &journal->frames[n];
+    size_t existing = 0;
+    if (user_store_lookup(store, journal->pending[i].login, &existing)) {
+      user_journal_settle(journal->pending_results[i], REPEATING_KEY);
+      continue;
+    }
+    frame->magic = USER_JOURNAL_MAGIC;
+    frame->record = record + n;
+    frame->entry = journal->pending[i];
+    frame->entry.uid = ++uid;
+    frame->crc = user_journal_frame_crc(frame);
+    journal->pending_results[n] = journal->pending_results[i];
+    journal->pending[n++] = frame->entry;
+  }
+  if (err == 0) {
+    settled = n;
+  }
+
+  if (err == 0 && n > 0) {
+    err = user_journal_write_all(journal->wal_fd, journal->frames,
+                                 n * sizeof(*journal->frames), -1);
+    ++journal->stats.syncs;
+    if (err == 0 && fdatasync(journal->wal_fd) == -1) {
+      err = OPENING_THE_FILE_ERROR;
+    }
+    // Durable from here on: the records file may lag until the next
+    // checkpoint, replay catches it up.
+    if (err == 0) {
+      err = user_journal_write_all(journal->records_fd, journal->pending,
+                                   n * sizeof(user_entry),
+                                   (off_t)(record * sizeof(user_entry)));
+    }
+    if (err == 0) {
+      ++journal->stats.commits;
+      journal->stats.records += n;
+    }
+  }
+  for (size_t i = 0; i < settled; ++i) {
+    user_journal_settle(journal->pending_results[i], err);
+  }
+  if (err == 0 && fstat(journal->wal_fd, &st) == 0 &&
+      (uint64_t)st.st_size >= journal->opts.checkpoint_bytes) {
+    journal->checkpoint_requested = 1;
+    pthread_cond_signal(&journal->wake);
+  }
+  flock(journal->wal_fd, LOCK_UN);
+  if (err == 0 && journal->checkpoint_error != 0) {
+    err = journal->checkpoint_error;
+  }
+  pthread_mutex_unlock(&journal->lock);
+
+  memset(journal->pending_set, 0,
+         journal->pending_capacity * 2 * sizeof(*journal->pending_set));
+  journal->pending_count = 0;
+  if (err == 0) {
+    err = user_store_refresh(store);
+  }
+  return err;
+}
+
+err_t user_journal_close(user_journal *journal) {
+  if (journal == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  err_t err = 0;
+
+  if (journal->wal_fd != -1 && journal->records_fd != -1) {
+    err = user_journal_commit(journal);
+  }
+  if (journal->has_checkpointer) {
+    pthread_mutex_lock(&journal->lock);
+    journal->stop = 1;
+    pthread_cond_signal(&journal->wake);
+    pthread_mutex_unlock(&journal->lock);
+    pthread_join(journal->checkpointer, NULL);
+    journal->has_checkpointer = 0;
+    if (err == 0) {
+      err = (journal->checkpoint_error != 0)
+                ? journal->checkpoint_error
+                : user_journal_checkpoint(journal);
+    }
+  }
+  if (journal->wal_fd != -1) {
+    close(journal->wal_fd);
+  }
+  if (journal->records_fd != -1) {
+    close(journal->records_fd);
+  }
+  pthread_mutex_destroy(&journal->lock);
+  pthread_cond_destroy(&journal->wake);
+  free(journal->wal_path);
+  free(journal->pending);
+  free(journal->pending_results);
+  free(journal->pending_set);
+  free(journal->frames);
+  journal->wal_path = NULL;
+  journal->pending = NULL;
+  journal->pending_results = NULL;
+  journal->pending_set = NULL;
+  journal->frames = NULL;
+  journal->wal_fd = -1;
+  journal->records_fd = -1;
+  return err;
+}
+
+#endif  // USER_JOURNAL_H_
@@ -0,0 +1,411 @@
+#ifndef USER_STORE_H_
+#define USER_STORE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "errors.h"
+
+// User accounts of the 2.c shell. The records file keeps its historical
+// format, a plain array of user_entry, and is mapped read-only instead of
+// loaded: pages are touched only by the records a lookup lands on. A
+// sidecar hash index (records path + ".idx") maps logins to record
+// numbers. It is a cache: a missing, damaged or stale index is rebuilt, and
+// records appended by older builds or other shells are indexed the next time
+// the store is opened or refreshed. New records are only ever written
+// through user_journal.h, which numbers them under its lock.
+//
+// On disk the index is a user_index_header followed by `capacity` slots of
+// open addressing with linear probing, kept at most half full. Each slot
+// holds the record number + 1 (0 = empty) and the login's hash, so probes
+// only touch records whose hash matches. Updates take flock() on the index,
+// and growth writes a new index and renames it over the old one. Native
+// byte order, like the records themselves.
+#define USER_LOGIN_MAX (6)
+#define USER_INDEX_MAGIC "USERIDX1"
+#define USER_INDEX_VERSION (1)
+#define USER_INDEX_MIN_CAPACITY ((uint64_t)1024)
+#define USER_STORE_MIN_MAPPING ((size_t)1 << 20)
+
+typedef struct {
+  unsigned int uid;
+  char login[USER_LOGIN_MAX + 1];
+  unsigned int pin;
+} user_entry;
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t capacity;  // slots, a power of two
+  uint64_t records;   // records of the file already indexed
+} user_index_header;
+
+typedef struct {
+  uint32_t record;  // record number + 1, 0 for an empty slot
+  uint32_t hash;
+} user_index_slot;
+
+typedef struct {
+  int fd;
+  const user_entry *users;  // records [0, count) of the mapping
+  size_t count;
+  size_t mapped;  // bytes reserved for the mapping, beyond the file end
+  int index_fd;
+  user_index_header *index;
+  size_t index_size;
+  char *path;
+  char *index_path;
+} user_store;
+
+// Opens or creates the records file at path and its index.
+err_t user_store_open(user_store *store, const char *path);
+void user_store_close(user_store *store);
+
+// Picks up records other processes appended since the last call.
+err_t user_store_refresh(user_store *store);
+// Record number of login, or KEY_NOT_FOUND. Refreshes once on a miss.
+err_t user_store_find(user_store *store, const char *login,
+                      size_t *record_placeholder);
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint32_t user_store_hash(const char *login) {
+  uint32_t hash = 2166136261u;  // FNV-1a
+  for (size_t i = 0; i <= USER_LOGIN_MAX && login[i] != '\0'; ++i) {
+    hash = (hash ^ (unsigned char)login[i]) * 16777619u;
+  }
+  return hash;
+}
+
+static user_index_slot *user_index_slots(user_index_header *index) {
+  return (user_index_slot *)(index + 1);
+}
+
+static void user_index_insert(user_index_header *index,
+                              const user_entry *users, size_t record) {
+  user_index_slot *slots = user_index_slots(index);
+  uint64_t mask = index->capacity - 1;
+  uint32_t hash = user_store_hash(users[record].login);
+
+  for (uint64_t i = hash & mask;; i = (i + 1) & mask) {
+    if (slots[i].record == 0) {
+      slots[i].record = (uint32_t)record + 1;
+      slots[i].hash = hash;
+      return;
+    }
+  }
+}
+
+// Maps a fresh index file of the given capacity; the caller fills it.
+static err_t user_index_map(int fd, uint64_t capacity,
+                            user_index_header **index_placeholder,
+                            size_t *size_placeholder) {
+  size_t size = sizeof(user_index_header) + capacity * sizeof(user_index_slot);
+  void *data = NULL;
+
+  if (ftruncate(fd, 0) == -1 || ftruncate(fd, (off_t)size) == -1) {
+    return OPENING_THE_FILE_ERROR;
+  }
+  data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    return MEMORY_MAPPING_ERROR;
+  }
+  *index_placeholder = (user_index_header *)data;
+  *size_placeholder = size;
+  return EXIT_SUCCESS;
+}
+
+static void user_store_unmap_index(user_store *store) {
+  if (store->index != NULL) {
+    munmap(store->index, store->index_size);
+  }
+  store->index = NULL;
+  store->index_size = 0;
+}
+
+// Writes a complete index of the current records to a temporary file and
+// renames it into place, so other shells never see a half-built table.
+static err_t user_store_rebuild(user_store *store) {
+  size_t tmp_len = strlen(store->index_path) + sizeof(".tmp");
+  char *tmp_path = (char *)malloc(tmp_len);
+  uint64_t capacity = USER_INDEX_MIN_CAPACITY;
+  user_index_header *index = NULL;
+  size_t size = 0;
+  int fd = -1;
+  err_t err = 0;
+
+  if (tmp_path == NULL) {
+    return MEMORY_ALLOCATION_ERROR;
+  }
+  snprintf(tmp_path, tmp_len, "%s.tmp", store->index_path);
+  while (capacity < (uint64_t)store->count * 2 + 2) {
+    capacity <<= 1;
+  }
+
+  // Locked before it becomes visible, so the caller's unlock covers it.
+  fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    free(tmp_path);
+    return OPENING_THE_FILE_ERROR;
+  }
+  flock(fd, LOCK_EX);
+  err = user_index_map(fd, capacity, &index, &size);
+  if (err == 0) {
+    memcpy(index->magic, USER_INDEX_MAGIC, sizeof(index->magic));
+    index->version = USER_INDEX_VERSION;
+    index->record_size = sizeof(user_entry);
+    index->capacity = capacity;
+    for (size_t i = 0; i < store->count; ++i) {
+      user_index_insert(index, store->users, i);
+    }
+    index->records = store->count;
+    if (rename(tmp_path, store->index_path) == -1) {
+      munmap(index, size);
+      err = OPENING_THE_FILE_ERROR;
+    }
+  }
+  if (err != 0) {
+    unlink(tmp_path);
+    close(fd);
+    free(tmp_path);
+    return err;
+  }
+  free(tmp_path);
+
+  // Shells waiting on the old, now unlinked, file see the path change once
+  // they get its lock and move over to the new one.
+  user_store_unmap_index(store);
+  if (store->index_fd != -1) {
+    close(store->index_fd);
+  }
+  store->index_fd = fd;
+  store->index = index;
+  store->index_size = size;
+  return EXIT_SUCCESS;
+}
+
+static int user_index_valid(const user_index_header *index, size_t size,
+                            size_t records_count) {
+  return size >= sizeof(user_index_header) &&
+         memcmp(index->magic, USER_INDEX_MAGIC, sizeof(index->magic)) == 0 &&
+         index->version == USER_INDEX_VERSION &&
+         index->record_size == sizeof(user_entry) && index->capacity != 0 &&
+         (index->capacity & (index->capacity - 1)) == 0 &&
+         size == sizeof(user_index_header) +
+                     index->capacity * sizeof(user_index_slot) &&
+         index->records <= records_count;
+}
+
+// (Re)opens the index at index_path and locks it, unless the descriptor we
+// hold still names the file there.
+static err_t user_store_lock_index(user_store *store) {
+  struct stat path_st;
+  struct stat fd_st;
+
+  while (1) {
+    if (store->index_fd != -1 && stat(store->index_path, &path_st) == 0 &&
+        fstat(store->index_fd, &fd_st) == 0 && path_st.st_ino == fd_st.st_ino &&
+        path_st.st_dev == fd_st.st_dev) {
+      if (flock(store->index_fd, LOCK_EX) == -1) {
+        return OPENING_THE_FILE_ERROR;
+      }
+      // Renamed away while we waited for the lock?
+      if (stat(store->index_path, &path_st) == 0 &&
+          path_st.st_ino == fd_st.st_ino && path_st.st_dev == fd_st.st_dev) {
+        break;
+      }
+      flock(store->index_fd, LOCK_UN);
+    }
+    user_store_unmap_index(store);
+    if (store->index_fd != -1) {
+      close(store->index_fd);
+    }
+    store->index_fd =
+        open(store->index_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (store->index_fd == -1) {
+      return OPENING_THE_FILE_ERROR;
+    }
+  }
+
+  if (fstat(store->index_fd, &fd_st) == -1) {
+    flock(store->index_fd, LOCK_UN);
+    return OPENING_THE_FILE_ERROR;
+  }
+  if (store->index != NULL && store->index_size == (size_t)fd_st.st_size) {
+    return EXIT_SUCCESS;
+  }
+  user_store_unmap_index(store);
+  if (fd_st.st_size >= (off_t)sizeof(user_index_header)) {
+    void *data = mmap(NULL, (size_t)fd_st.st_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, store->index_fd, 0);
+    if (data != MAP_FAILED) {
+      store->index = (user_index_header *)data;
+      store->index_size = (size_t)fd_st.st_size;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+// Maps the records file again if it outgrew the reserved window. The
+// window is reserved past the end of the file and doubles each time, so
+// appends rarely remap.
+static err_t user_store_map_records(user_store *store) {
+  struct stat st;
+  size_t size = 0;
+  void *data = NULL;
+
+  if (fstat(store->fd, &st) == -1) {
+    return OPENING_THE_FILE_ERROR;
+  }
+  size = (size_t)st.st_size;
+  if (store->users == NULL || size > store->mapped) {
+    size_t mapped = USER_STORE_MIN_MAPPING;
+    while (mapped < size * 2) {
+      mapped <<= 1;
+    }
+    data = mmap(NULL, mapped, PROT_READ, MAP_SHARED, store->fd, 0);
+    if (data == MAP_FAILED) {
+      return MEMORY_MAPPING_ERROR;
+    }
+    if (store->users != NULL) {
+      munmap((void *)store->users, store->mapped);
+    }
+    store->users = (const user_entry *)data;
+    store->mapped = mapped;
+  }
+  store->count = size / sizeof(user_entry);  // a torn last record is ignored
+  return EXIT_SUCCESS;
+}
+
+err_t user_store_refresh(user_store *store) {
+  if (store == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  err_t err = user_store_map_records(store);
+
+  if (err != 0) {
+    return err;
+  }
+  if (store->index != NULL && store->index->records == store->count) {
+    return EXIT_SUCCESS;
+  }
+
+  err = user_store_lock_index(store);
+  if (err != 0) {
+    return err;
+  }
+  if (store->index == NULL ||
+      !user_index_valid(store->index, store->index_size, store->count) ||
+      store->count * 2 >= store->index->capacity) {
+    err = user_store_rebuild(store);
+  } else {
+    for (size_t i = store->index->records; i < store->count; ++i) {
+      user_index_insert(store->index, store->users, i);
+    }
+    store->index->records = store->count;
+  }
+  flock(store->index_fd, LOCK_UN);
+  return err;
+}
+
+err_t user_store_open(user_store *store, const char *path) {
+  if (store == NULL || path == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  size_t len = strlen(path);
+  err_t err = 0;
+
+  memset(store, 0, sizeof(*store));
+  store->fd = -1;
+  store->index_fd = -1;
+  store->path = (char *)malloc(len + 1);
+  store->index_path = (char *)malloc(len + sizeof(".idx"));
+  if (store->path == NULL || store->index_path == NULL) {
+    user_store_close(store);
+    return MEMORY_ALLOCATION_ERROR;
+  }
+  memcpy(store->path, path, len + 1);
+  snprintf(store->index_path, len + sizeof(".idx"), "%s.idx", path);
+
+  store->fd = open(path, O_RDONLY | O_CREAT | O_CLOEXEC, 0644);
+  if (store->fd == -1) {
+    user_store_close(store);
+    return OPENING_THE_FILE_ERROR;
+  }
+  err = user_store_refresh(store);
+  if (err != 0) {
+    user_store_close(store);
+  }
+  return err;
+}
+
+void user_store_close(user_store *store) {
+  if (store == NULL) {
+    return;
+  }
+  user_store_unmap_index(store);
+  if (store->users != NULL) {
+    munmap((void *)store->users, store->mapped);
+  }
+  if (store->index_fd != -1) {
+    close(store->index_fd);
+  }
+  if (store->fd != -1) {
+    close(store->fd);
+  }
+  free(store->path);
+  free(store->index_path);
+  memset(store, 0, sizeof(*store));
+  store->fd = -1;
+  store->index_fd = -1;
+}
+
+static int user_store_lookup(const user_store *store, const char *login,
+                             size_t *record_placeholder) {
+  const user_index_slot *slots = user_index_slots(store->index);
+  uint64_t mask = store->index->capacity - 1;
+  uint32_t hash = user_store_hash(login);
+
+  for (uint64_t i = hash & mask; slots[i].record != 0; i = (i + 1) & mask) {
+    size_t record = slots[i].record - 1;
+    if (slots[i].hash == hash && record < store->count &&
+        strncmp(store->users[record].login, login, USER_LOGIN_MAX + 1) ==
+            0) {
+      *record_placeholder = record;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+err_t user_store_find(user_store *store, const char *login,
+                      size_t *record_placeholder) {
+  if (store == NULL || login == NULL || record_placeholder == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+  if (store->index != NULL &&
+      user_store_lookup(store, login, record_placeholder)) {
+    return EXIT_SUCCESS;
+  }
+
+  err_t err = user_store_refresh(store);
+
+  if (err != 0) {
+    return err;
+  }
+  return user_store_lookup(store, login, record_placeholder) ? EXIT_SUCCESS
+                                                             : KEY_NOT_FOUND;
+}
+
+#endif  // USER_STORE_H_
@@ -0,0 +1,155 @@
+#ifndef XXHASH_H_
+#define XXHASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// XXH64 (xxHash, 64-bit variant), bit-compatible with the reference
+// implementation. The streaming state accepts input in pieces of any size;
+// unlike CRC-32C, digests of separate pieces cannot be combined afterwards.
+typedef struct {
+  uint64_t total_len;
+  uint64_t v[4];
+  unsigned char buffer[32];
+  size_t buffered;
+} xxh64_state;
+
+void xxh64_reset(xxh64_state *state, uint64_t seed);
+void xxh64_update(xxh64_state *state, const void *data, size_t len);
+uint64_t xxh64_digest(const xxh64_state *state);
+uint64_t xxh64(const void *data, size_t len, uint64_t seed);
+
+#include <string.h>
+
+#define XXH64_PRIME1 (0x9E3779B185EBCA87ull)
+#define XXH64_PRIME2 (0xC2B2AE3D27D4EB4Full)
+#define XXH64_PRIME3 (0x165667B19E3779F9ull)
+#define XXH64_PRIME4 (0x85EBCA77C2B2AE63ull)
+#define XXH64_PRIME5 (0x27D4EB2F165667C5ull)
+
+static inline uint64_t xxh64_rotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh64_read64(const unsigned char *p) {
+  uint64_t v = 0;
+  memcpy(&v, p, 8);
+  return v;  // little-endian hosts only, like the rest of the scanners
+}
+
+static inline uint32_t xxh64_read32(const unsigned char *p) {
+  uint32_t v = 0;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+  acc += input * XXH64_PRIME2;
+  acc = xxh64_rotl(acc, 31);
+  return acc * XXH64_PRIME1;
+}
+
+static inline uint64_t xxh64_merge_round(uint64_t acc, uint64_t val) {
+  acc ^= xxh64_round(0, val);
+  return acc * XXH64_PRIME1 + XXH64_PRIME4;
+}
+
+// Consumes whole 32-byte stripes, returns the bytes used.
+static size_t xxh64_stripes(uint64_t v[4], const unsigned char *p,
+                            size_t len) {
+  uint64_t v1 = v[0], v2 = v[1], v3 = v[2], v4 = v[3];
+  size_t used = len & ~(size_t)31;
+  const unsigned char *end = p + used;
+  for (; p < end; p += 32) {
+    v1 = xxh64_round(v1, xxh64_read64(p));
+    v2 = xxh64_round(v2, xxh64_read64(p + 8));
+    v3 = xxh64_round(v3, xxh64_read64(p + 16));
+    v4 = xxh64_round(v4, xxh64_read64(p + 24));
+  }
+  v[0] = v1;
+  v[1] = v2;
+  v[2] = v3;
+  v[3] = v4;
+  return used;
+}
+
+void xxh64_reset(xxh64_state *state, uint64_t seed) {
+  memset(state, 0, sizeof(*state));
+  state->v[0] = seed + XXH64_PRIME1 + XXH64_PRIME2;
+  state->v[1] = seed + XXH64_PRIME2;
+  state->v[2] = seed;
+  state->v[3] = seed - XXH64_PRIME1;
+}
+
+void xxh64_update(xxh64_state *state, const void *data, size_t len) {
+  const unsigned char *p = (const unsigned char *)data;
+  size_t used = 0;
+
+  state->total_len += len;
+  if (state->buffered + len < 32) {
+    memcpy(state->buffer + state->buffered, p, len);
+    state->buffered += len;
+    return;
+  }
+
+  if (state->buffered > 0) {
+    size_t fill = 32 - state->buffered;
+    memcpy(state->buffer + state->buffered, p, fill);
+    xxh64_stripes(state->v, state->buffer, 32);
+    p += fill;
+    len -= fill;
+    state->buffered = 0;
+  }
+
+  used = xxh64_stripes(state->v, p, len);
+  memcpy(state->buffer, p + used, len - used);
+  state->buffered = len - used;
+}
+
+uint64_t xxh64_digest(const xxh64_state *state) {
+  const unsigned char *p = state->buffer;
+  size_t len = state->buffered;
+  uint64_t h = 0;
+
+  if (state->total_len >= 32) {
+    h = xxh64_rotl(state->v[0], 1) + xxh64_rotl(state->v[1], 7) +
+        xxh64_rotl(state->v[2], 12) + xxh64_rotl(state->v[3], 18);
+    for (int i = 0; i < 4; ++i) {
+      h = xxh64_merge_round(h, state->v[i]);
+    }
+  } else {
+    h = state->v[2] + XXH64_PRIME5;  // v[2] is the seed
+  }
+  h += state->total_len;
+
+  for (; len >= 8; len -= 8, p += 8) {
+    h ^= xxh64_round(0, xxh64_read64(p));
+    h = xxh64_rotl(h, 27) * XXH64_PRIME1 + XXH64_PRIME4;
+  }
+  if (len >= 4) {
+    h ^= (uint64_t)xxh64_read32(p) * XXH64_PRIME1;
+    h = xxh64_rotl(h, 23) * XXH64_PRIME2 + XXH64_PRIME3;
+    p += 4;
+    len -= 4;
+  }
+  while (len-- > 0) {
+    h ^= (*p++) * XXH64_PRIME5;
+    h = xxh64_rotl(h, 11) * XXH64_PRIME1;
+  }
+
+  h ^= h >> 33;
+  h *= XXH64_PRIME2;
+  h ^= h >> 29;
+  h *= XXH64_PRIME3;
+  h ^= h >> 32;
+  return h;
+}
+
+uint64_t xxh64(const void *data, size_t len, uint64_t seed) {
+  xxh64_state state;
+  xxh64_reset(&state, seed);
+  xxh64_update(&state, data, len);
+  return xxh64_digest(&state);
+}
+
+#endif  // XXHASH_H_
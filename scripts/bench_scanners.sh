@@ -0,0 +1,60 @@
+#!/bin/sh
+# Generates seeded corpora with gen_corpus and reports throughput, CPU time,
+# page faults, storage I/O and peak RSS of 4 (checksums/queries), 3 (copy,
+# dense and sparse) and 23 (search) over them, warm and cold. Cold runs need
+# root to drop the whole page cache; otherwise only the corpus files are
+# evicted.
+#
+# Usage: scripts/bench_scanners.sh [size]   (default 256M; K/M/G/T suffixes)
+# Environment: WORK (corpus dir), RUNS, SEED, CC, SPARSE_SIZE (apparent size
+# of the 1%-data sparse image, default 50G).
+set -eu
+
+SIZE=${1:-256M}
+WORK=${WORK:-/tmp/scan_corpus}
+RUNS=${RUNS:-3}
+SEED=${SEED:-1}
+SPARSE_SIZE=${SPARSE_SIZE:-50G}
+BUILD=build
+
+make -s -B "$BUILD/gen_corpus" "$BUILD/bench_scanners" "$BUILD/4" "$BUILD/3" \
+  "$BUILD/23" CC="${CC:-cc}" CFLAGS="-Wall -Wextra -O2"
+
+mkdir -p "$WORK"
+BIN="$WORK/corpus.bin"
+TEXT="$WORK/text"
+COPY="$WORK/copy.bin"
+SPARSE="$WORK/sparse.img"
+"$BUILD/gen_corpus" binary "$BIN" "$SIZE" --seed "$SEED" --mask F0 \
+  --density 0.01
+rm -rf "$TEXT"
+"$BUILD/gen_corpus" text "$TEXT" "$SIZE" --seed "$SEED" --needle hello \
+  --density 0.05 --files 16
+"$BUILD/gen_corpus" sparse "$SPARSE" "$SPARSE_SIZE" --seed "$SEED" \
+  --density 0.01
+
+bench() {
+  label=$1
+  bytes_of=$2
+  shift 2
+  for mode in "" --cold; do
+    "$BUILD/bench_scanners" --runs "$RUNS" $mode --evict "$bytes_of" \
+      --evict "$WORK" --bytes-of "$bytes_of" --label "$label" -- "$@"
+  done
+}
+
+echo
+"$BUILD/bench_scanners" --header
+bench "4 xor32" "$BIN" "$BUILD/4" "$BIN" xor32
+bench "4 mask F0" "$BIN" "$BUILD/4" "$BIN" mask F0
+bench "4 crc32c" "$BIN" "$BUILD/4" "$BIN" crc32c
+bench "4 expr u32 count" "$BIN" "$BUILD/4" "$BIN" \
+  expr "u32 count where (w & 0xf0) == 0xf0"
+bench "4 xor32 mask crc32c" "$BIN" "$BUILD/4" "$BIN" xor32 mask F0 crc32c
+bench "4 xor32 --threads 0" "$BIN" "$BUILD/4" "$BIN" xor32 --threads 0
+bench "3 copy" "$BIN" "$BUILD/3" "$BIN" "$COPY"
+bench "3 copy sparse $SPARSE_SIZE" "$SPARSE" "$BUILD/3" "$SPARSE" "$COPY"
+echo "sparse copy allocates $(du -k "$COPY" | cut -f1) KiB of" \
+  "$(du -k --apparent-size "$COPY" | cut -f1) KiB"
+bench "23 search hello" "$TEXT" "$BUILD/23" "$TEXT/file_list.txt" hello
+rm -f "$COPY" "$SPARSE"
@@ -0,0 +1,134 @@
+#!/bin/sh
+# Regression checks for 4 and 3 that compare against an independent result:
+# a block index refreshed after the file changed must agree with a fresh
+# scan, and copies (from pipes too, through every path, and whole trees
+# with sparse files) must match their source byte for byte, holes kept.
+# Prints one line per case and exits non-zero if any case fails.
+#
+# Usage: scripts/check_scanners.sh
+# Environment: WORK (scratch dir), CC.
+set -eu
+
+WORK=${WORK:-/tmp/scan_check}
+BUILD=build
+QUERIES="xor8 xor64 xorodd crc32c mask F0F0 mask 0F"
+failed=0
+
+make -s -B "$BUILD/4" "$BUILD/3" CC="${CC:-cc}" CFLAGS="-Wall -Wextra -O2"
+
+rm -rf "$WORK"
+mkdir -p "$WORK"
+
+pass() { echo "ok   $1"; }
+fail() {
+  echo "FAIL $1"
+  failed=1
+}
+
+# index_case LABEL OLD_SIZE NEW_SIZE [--ranges SPEC]: indexes a random file
+# of OLD_SIZE bytes in 64 KiB blocks, changes it to NEW_SIZE (truncating,
+# or appending fresh random bytes) and checks --reverify against a scan
+# without the index.
+index_case() {
+  label=$1
+  old_size=$2
+  new_size=$3
+  shift 3
+  file="$WORK/index.bin"
+  rm -f "$file" "$file.idx"
+  head -c "$old_size" /dev/urandom >"$file"
+  # shellcheck disable=SC2086
+  "$BUILD/4" "$file" $QUERIES --index --block-size 65536 >/dev/null 2>&1
+  if [ "$new_size" -lt "$old_size" ]; then
+    truncate -s "$new_size" "$file"
+  else
+    head -c $((new_size - old_size)) /dev/urandom >>"$file"
+  fi
+  # shellcheck disable=SC2086
+  "$BUILD/4" "$file" $QUERIES --reverify "$@" 2>/dev/null |
+    grep -v "blocks recomputed" >"$WORK/reverify.out"
+  rm -f "$file.idx"
+  # shellcheck disable=SC2086
+  "$BUILD/4" "$file" $QUERIES >"$WORK/fresh.out"
+  if cmp -s "$WORK/reverify.out" "$WORK/fresh.out"; then
+    pass "$label"
+  else
+    fail "$label"
+    diff "$WORK/reverify.out" "$WORK/fresh.out" || true
+  fi
+}
+
+index_case "index: shrink to a partial tail" 1000000 150001
+index_case "index: shrink to a partial tail, --ranges" 1000000 150001 \
+  --ranges 0-4096
+index_case "index: shrink to a block multiple, --ranges" 1000000 131072 \
+  --ranges 0-4096
+index_case "index: shrink within the tail block, --ranges" 1000000 999000 \
+  --ranges 0-4096
+index_case "index: grow, --ranges" 150001 1000000 --ranges 0-4096
+index_case "index: shrink to empty" 1000000 0
+
+# copy_case LABEL ARGS...: copies $WORK/copy.bin to $WORK/copy.out with 3,
+# reading it through a pipe when ARGS start with --pipe.
+copy_case() {
+  label=$1
+  shift
+  rm -f "$WORK/copy.out"
+  if [ "$1" = --pipe ]; then
+    shift
+    cat "$WORK/copy.bin" |
+      "$BUILD/3" /dev/stdin "$WORK/copy.out" "$@" >/dev/null || true
+  else
+    "$BUILD/3" "$WORK/copy.bin" "$WORK/copy.out" "$@" >/dev/null || true
+  fi
+  if cmp -s "$WORK/copy.bin" "$WORK/copy.out"; then
+    pass "$label"
+  else
+    fail "$label"
+  fi
+}
+
+head -c 3000000 /dev/urandom >"$WORK/copy.bin"
+for via in reflink copy_file_range splice buffer; do
+  copy_case "copy: file, --via $via" --via "$via"
+  copy_case "copy: pipe input, --via $via" --pipe --via "$via"
+done
+
+# --parallel sizes the job from the source, so a pipe must be refused
+# rather than copied as empty.
+rm -f "$WORK/copy.out"
+if cat "$WORK/copy.bin" |
+  "$BUILD/3" /dev/stdin "$WORK/copy.out" --parallel 2 >/dev/null 2>&1; then
+  fail "copy: pipe input, --parallel 2 is refused"
+else
+  pass "copy: pipe input, --parallel 2 is refused"
+fi
+
+# tree_case ENGINE: copies a tree holding a 64 MiB file with two written
+# blocks and checks it matches and stays sparse.
+tree_case() {
+  label="tree copy: sparse file, --engine $1"
+  rm -rf "$WORK/tree.out"
+  "$BUILD/3" -r "$WORK/tree" "$WORK/tree.out" --engine "$1" >/dev/null ||
+    true
+  if diff -r "$WORK/tree" "$WORK/tree.out" >/dev/null &&
+    [ "$(du -k "$WORK/tree.out/sparse.img" | cut -f1)" -lt 1024 ]; then
+    pass "$label"
+  else
+    fail "$label"
+  fi
+}
+
+mkdir -p "$WORK/tree"
+cp "$WORK/copy.bin" "$WORK/tree/dense.bin"
+truncate -s 64M "$WORK/tree/sparse.img"
+printf data | dd of="$WORK/tree/sparse.img" bs=1 seek=40000000 \
+  conv=notrunc 2>/dev/null
+printf tail | dd of="$WORK/tree/sparse.img" bs=1 seek=67108860 \
+  conv=notrunc 2>/dev/null
+for engine in uring threads; do
+  tree_case "$engine"
+done
+
+rm -rf "$WORK"
+exit "$failed"
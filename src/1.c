@@ -1,106 +1,127 @@
+#define _GNU_SOURCE
+
+#include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/bufio.h"
+
+// Writes a few bytes to <file>, reads them back one at a time and then
+// reads 4 bytes from offset 3, showing after each step what the buffered
+// reader (bufio.h) holds and which system calls it needed. A small
+// --buffer-size makes the refills visible.
+void dump_reader(const bufio_reader *r);
+
+static int parse_options(int argc, char *argv[], bufio_options *opts) {
+  char *end = NULL;
 
-void dump_file_struct(FILE *f);
+  for (int i = 2; i < argc; ++i) {
+    if (strcmp(argv[i], "--direct") == 0) {
+      opts->direct = 1;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      return INVALID_CLI_ARGUMENT;
+    }
+    end = NULL;
+    if (strcmp(argv[i], "--buffer-size") == 0) {
+      opts->buffer_size = strtoull(argv[++i], &end, 0);
+    } else if (strcmp(argv[i], "--alignment") == 0) {
+      opts->alignment = strtoull(argv[++i], &end, 0);
+    } else if (strcmp(argv[i], "--readahead") == 0) {
+      opts->readahead = strtoull(argv[++i], &end, 0);
+    } else {
+      return INVALID_CLI_ARGUMENT;
+    }
+    if (*end != '\0' || argv[i][0] == '-') {
+      return INVALID_CLI_ARGUMENT;
+    }
+  }
+  return 0;
+}
 
 int main(int argc, char *argv[]) {
-  unsigned char byte = 0;
+  bufio_options opts = {0};
+  bufio_reader fin;
+  bufio_writer to_write;
   unsigned char buffer[4];
-  FILE *fin = NULL;
-  FILE *to_write = NULL;
-  int i = 0;
+  size_t got = 0;
+  int byte = 0;
+  size_t i = 0;
   unsigned char data[] = {3, 1, 4, 1, 5, 9, 2, 6, 5, 3, 5, 138};
 
-  if (argc != 2) {
-    fprintf(stderr, "incorrect cli args\n");
+  if (argc < 2 || parse_options(argc, argv, &opts) != 0) {
+    fprintf(stderr,
+            "Usage: %s <file> [--buffer-size BYTES] [--alignment BYTES] "
+            "[--direct] [--readahead BYTES]\n",
+            argv[0]);
     return 1;
   }
 
-  to_write = fopen(argv[1], "wb");
-  if (to_write == NULL) {
+  if (bufio_writer_open(&to_write, argv[1], &opts) != 0) {
     fprintf(stderr, "error opening the file\n");
     return 1;
   }
+  bufio_write(&to_write, data, sizeof(data));
+  printf("Writer: %" PRIu64 " syscalls, %" PRIu64 " bytes buffered, %" PRIu64
+         " flushes before close\n",
+         to_write.counters.syscalls, to_write.counters.bytes_buffered,
+         to_write.counters.flushes);
+  if (bufio_writer_close(&to_write) != 0) {
+    fprintf(stderr, "error writing the file\n");
+    return 1;
+  }
 
-  fwrite(data, sizeof(unsigned char), sizeof(data), to_write);
-
-  fclose(to_write);
-
-  fin = fopen(argv[1], "rb");
-  if (fin == NULL) {
+  if (bufio_reader_open(&fin, argv[1], &opts) != 0) {
     fprintf(stderr, "error opening the file\n");
     return 1;
   }
 
-  while (fread(&byte, 1, 1, fin) == 1) {
-    printf("Byte: %u\n", byte);
-    dump_file_struct(fin);
+  while ((byte = bufio_getc(&fin)) != BUFIO_EOF) {
+    printf("Byte: %d\n", byte);
+    dump_reader(&fin);
+  }
+  if (fin.error != 0) {
+    fprintf(stderr, "error reading the file\n");
+    bufio_reader_close(&fin);
+    return 1;
   }
 
-  fclose(fin);
-  fin = NULL;
+  bufio_reader_close(&fin);
 
-  fin = fopen(argv[1], "rb");
-  if (fin == NULL) {
+  if (bufio_reader_open(&fin, argv[1], &opts) != 0) {
     fprintf(stderr, "error opening the file\n");
     return 1;
   }
 
-  fseek(fin, 3, SEEK_SET);
-  fread(buffer, 1, 4, fin);
+  bufio_reader_seek(&fin, 3);
+  bufio_read(&fin, buffer, sizeof(buffer), &got);
 
   printf("Buffer content:");
-  for (i = 0; i < 4; i++) {
+  for (i = 0; i < got; i++) {
     printf(" %u", buffer[i]);
-    if (i < 3) {
+    if (i + 1 < got) {
       printf(",");
     }
   }
   printf("\n");
-}
-
-void dump_file_struct(FILE *f) {
-  printf("_IO_write_base:  %s\n", f->_IO_write_base);
-  printf("_IO_write_ptr:   %p\n", f->_IO_write_ptr);
-  printf("_IO_write_end:   %s\n", f->_IO_write_end);
-
-  printf("_IO_read_base:   %s\n", f->_IO_read_base);
-  printf("_IO_read_ptr:    %p\n", f->_IO_read_ptr);
-  printf("_IO_read_end:    %s\n", f->_IO_read_end);
-
-  printf("_IO_buf_base:    %s\n", f->_IO_buf_base);
-  printf("_IO_buf_end:     %s\n", f->_IO_buf_end);
-
-  printf("_IO_save_base:   %s\n", f->_IO_save_base);
-  printf("_IO_save_end:    %s\n", f->_IO_save_end);
-  printf("_IO_backup_base: %s\n", f->_IO_backup_base);
+  dump_reader(&fin);
 
-  printf("_offset:         %ld\n", f->_offset);
-  printf("_old_offset:     %ld\n", f->_old_offset);
-
-  printf("_fileno:         %d\n", f->_fileno);
-  printf("_mode:           %d\n", f->_mode);
-  printf("_flags:          %d\n", f->_flags);
-  printf("_flags2:         %d\n", f->_flags2);
-
-  printf("_shortbuf:       %d\n", *f->_shortbuf);
-  printf("_short_backupbuf:%d\n", *f->_short_backupbuf);
-
-  printf("_total_written:  %lu\n", f->_total_written);
-  printf("_cur_column:     %hu\n", f->_cur_column);
-
-  printf("_lock:           %p\n", f->_lock);
-  printf("_markers:        %p\n", f->_markers);
-  printf("_codecvt:        %p\n", f->_codecvt);
-  printf("_wide_data:      %p\n", f->_wide_data);
-
-  printf("_chain:          %p\n", f->_chain);
-  printf("_prevchain:      %p\n", f->_prevchain);
-  printf("_freeres_buf:    %p\n", f->_freeres_buf);
-  printf("_freeres_list:   %p\n", f->_freeres_list);
-
-  printf("_vtable_offset:  %hhd\n", f->_vtable_offset);
-  printf("_unused2:        %d, %d\n", f->_unused2[0], f->_unused2[1]);
-  printf("_unused3:        %d\n", f->_unused3);
+  bufio_reader_close(&fin);
+  return 0;
+}
 
+void dump_reader(const bufio_reader *r) {
+  printf("buffer:          %p (%zu bytes, aligned to %zu%s)\n",
+         (void *)r->buffer, r->capacity, r->alignment,
+         r->direct ? ", direct" : "");
+  printf("file offset:     %" PRIu64 "\n", r->offset);
+  printf("read position:   %zu of %zu buffered\n", r->start, r->end);
+  printf("readahead until: %" PRIu64 "\n", r->advised);
+  printf("eof:             %d\n", r->eof);
+  printf("syscalls:        %" PRIu64 "\n", r->counters.syscalls);
+  printf("bytes buffered:  %" PRIu64 "\n", r->counters.bytes_buffered);
+  printf("refills:         %" PRIu64 "\n", r->counters.refills);
   printf("\n");
 }
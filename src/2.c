@@ -1,6 +1,9 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 //
 #include <ctype.h>
+#include <errno.h>
 #include <readline/history.h>
 #include <readline/readline.h>
 #include <signal.h>
@@ -10,44 +13,35 @@
 #include <time.h>
 #include <unistd.h>
 
-#define MAX_INPUT_LENGTH 256
-
-#define MEMORY_ALLOCATION_ERROR 1
-#define DEREFERENCING_NULL_ERROR 2
-#define PARSING_ERROR 3
-#define FILE_PARSING_ERROR 4
-#define INCORRECT_PASSWORD_ERROR 5
-#define FILE_OPENING_ERROR 6
-#define NO_SUCH_USERNAME_ERROR 7
-#define SELF_BAN_ERROR 8
-
-#define ADMIN_PASSWORD 52
-
+#include "../include/audit_log.h"
+#include "../include/ban_bitmap.h"
+#include "../include/bufio.h"
+#include "../include/shell_commands.h"
+#include "../include/user_journal.h"
+#include "../include/user_store.h"
+
+// Records are user_entry (user_store.h), indexed in USERS_FILENAME ".idx";
+// registrations go through the log in USERS_FILENAME ".wal"
+// (user_journal.h). Bans are shared by all shells on the same records
+// (ban_bitmap.h). The commands themselves are in shell_commands.h, shared
+// with the multi-session server (2_server.c).
 #define USERS_FILENAME ".users"
-
-typedef struct {
-  unsigned int uid;
-  char login[7];
-  unsigned int pin;
-} user_entry;
+// Commands are audited asynchronously (audit_log.h); read it with 2_audit.
+#define AUDIT_FILENAME ".shell_audit"
 
 struct termios saved_term;
 
-int trim_string(char *s);
-
-int get_users_from_file(user_entry **users, size_t *users_count);
+int import_users(user_journal *journal, const char *path);
+int run_script(shell_context *ctx, const char *path);
 int login_user(user_entry const *user);
 int register_user(char const *username, unsigned int *pin_placeholder);
 
-int shell_main_loop(user_entry const *users, int *users_bans,
-                    size_t users_count, unsigned int current_uid);
-int handle_time();
-int handle_date();
-int handle_howmuch(char *user_input);
-int handle_sanctions(char *user_input, user_entry const *users, int *users_bans,
-                     size_t users_count, unsigned int current_uid);
+int shell_main_loop(shell_context *ctx, const char *login,
+                    unsigned int current_uid);
+int handle_sanctions(char *user_input, user_store *users, ban_bitmap *bans,
+                     unsigned int current_uid, shell_output *out);
 
-void print_error(int errno);
+void print_error(int err);
 
 void ignore_sigint(int sig);
 void disable_echo();
@@ -57,35 +51,109 @@ char *command_generator(const char *text, int state);
 
 char **completion(const char *text, int start, int end);
 
-int main(void) {
+int main(int argc, char *argv[]) {
   int err = 0;
-  user_entry *users = NULL;
-  void *for_realloc = NULL;
-  size_t users_count = 0;
-  size_t i = 0;
+  user_store users;
+  user_journal journal;
+  user_journal_options journal_opts = {0};
+  const char *import_path = NULL;
+  const char *script_path = NULL;
+  char *end = NULL;
+  size_t record = 0;
   int found = 0;
   size_t len = 0;
   unsigned int pin = 0;
   int retry = 0;
-  FILE *fapp = NULL;
-  int *users_bans = NULL;  // better to use bitfield idk
+  ban_bitmap bans;
   unsigned int current_uid = 0;
+  audit_log audit;
+  audit_options audit_opts = {0};
+  shell_context ctx = {0};
 
   char *user_input = NULL;
 
-  err = get_users_from_file(&users, &users_count);
+  if (argc > 1) {
+    if (argc >= 3 && strcmp(argv[1], "--import") == 0) {
+      import_path = argv[2];
+    }
+    if (argc == 3 && strcmp(argv[1], "--script") == 0) {
+      script_path = argv[2];
+    }
+    // strtoull would wrap "-3" around to a batch of nearly 2^64.
+    if (argc == 5 && strcmp(argv[3], "--batch") == 0 &&
+        isdigit((unsigned char)argv[4][0])) {
+      errno = 0;
+      journal_opts.batch = strtoull(argv[4], &end, 10);
+    }
+    if ((import_path == NULL && script_path == NULL) ||
+        (argc != 3 && (end == NULL || *end != '\0' || errno != 0 ||
+                       journal_opts.batch == 0))) {
+      fprintf(stderr,
+              "Usage: %s [--import <file> [--batch N] | --script <file|->]\n",
+              argv[0]);
+      return PARSING_ERROR;
+    }
+  }
+
+  err = user_store_open(&users, USERS_FILENAME);
+  if (err == 0) {
+    err = user_journal_open(&journal, &users, &journal_opts);
+    if (err != 0) {
+      user_store_close(&users);
+    }
+  }
   if (err != 0) {
+    err = store_error(err);
     print_error(err);
     return err;
   }
-  users_bans = (int *)malloc(users_count * sizeof(int));
-  if (users_bans == NULL) {
-    free(users);
-    print_error(MEMORY_ALLOCATION_ERROR);
-    return MEMORY_ALLOCATION_ERROR;
+  if (import_path != NULL) {
+    err = import_users(&journal, import_path);
+    if (err == 0) {
+      err = store_error(user_journal_close(&journal));
+    } else {
+      user_journal_close(&journal);
+    }
+    user_store_close(&users);
+    if (err != 0) {
+      print_error(err);
+    }
+    return err;
+  }
+  err = ban_bitmap_open(&bans, USERS_FILENAME);
+  if (err == 0) {
+    audit_opts.overflow = AUDIT_OVERFLOW_COUNT;
+    err = audit_log_open(&audit, AUDIT_FILENAME, &audit_opts);
+    if (err != 0) {
+      ban_bitmap_close(&bans);
+    }
+  }
+  if (err != 0) {
+    user_journal_close(&journal);
+    user_store_close(&users);
+    err = store_error(err);
+    print_error(err);
+    return err;
+  }
+  ctx.users = &users;
+  ctx.journal = &journal;
+  ctx.bans = &bans;
+  ctx.audit = &audit;
+  if (script_path != NULL) {
+    err = run_script(&ctx, script_path);
+    if (err == 0) {
+      err = store_error(user_journal_close(&journal));
+    } else {
+      user_journal_close(&journal);
+    }
+    user_store_close(&users);
+    ban_bitmap_close(&bans);
+    audit_log_close(&audit);
+    if (err != 0) {
+      print_error(err);
+    }
+    return err;
   }
-
-  memset(users_bans, 0, users_count * sizeof(int));
 
   while (1) {
     rl_attempted_completion_function = NULL;
@@ -110,27 +178,44 @@ int main(void) {
       continue;
     }
 
-    for (i = 0; i < users_count; i++) {
-      if (strcmp(users[i].login, user_input) == 0) {
-        if (users_bans[users[i].uid - 1] == 1) {
-          printf("You got banned for current session. How sad!\n");
-          retry = 1;
-          break;
-        }
-        err = login_user(users + i);
+    err = user_store_find(&users, user_input, &record);
+    if (err == KEY_NOT_FOUND) {
+      err = 0;
+      record = users.count;
+    } else {
+      err = store_error(err);
+    }
+    if (err != 0) {
+      print_error(err);
+      free(user_input);
+      user_journal_close(&journal);
+      user_store_close(&users);
+      ban_bitmap_close(&bans);
+      audit_log_close(&audit);
+      return err;
+    }
+
+    if (record < users.count) {
+      if (ban_bitmap_test(&bans, record)) {
+        printf("You are banned until the next reboot. How sad!\n");
+        retry = 1;
+      } else {
+        err = login_user(users.users + record);
         if (err == INCORRECT_PASSWORD_ERROR) {
           printf("Incorrect PIN, try again.\n");
           retry = 1;
-          break;
         } else if (err != 0) {
           print_error(err);
           free(user_input);
-          free(users);
-          free(users_bans);
+          user_journal_close(&journal);
+          user_store_close(&users);
+          ban_bitmap_close(&bans);
+          audit_log_close(&audit);
           return err;
+        } else {
+          found = 1;
+          current_uid = record + 1;
         }
-        found = 1;
-        current_uid = i + 1;
       }
     }
 
@@ -146,81 +231,77 @@ int main(void) {
         free(user_input);
         continue;
       }
+      if (err == 0) {
+        err_t registration = 0;
+        err = user_journal_add(&journal, user_input, pin, &registration);
+        if (err == 0) {
+          err = user_journal_commit(&journal);
+        }
+        if (err == 0) {
+          err = registration;  // another shell may have taken the login
+        }
+        if (err == REPEATING_KEY) {
+          printf("This login has just been taken, try another one.\n");
+          free(user_input);
+          continue;
+        }
+        err = store_error(err);
+        if (err == 0) {
+          printf("Success!\n");
+        }
+      }
       if (err != 0) {
         print_error(err);
-        free(users);
+        user_journal_close(&journal);
+        user_store_close(&users);
         free(user_input);
-        free(users_bans);
+        ban_bitmap_close(&bans);
+        audit_log_close(&audit);
         return err;
       }
-      for_realloc =
-          (user_entry *)realloc(users, (users_count + 1) * sizeof(user_entry));
-      if (for_realloc == NULL) {
-        print_error(MEMORY_ALLOCATION_ERROR);
-        free(users);
-        free(user_input);
-        free(users_bans);
-        return MEMORY_ALLOCATION_ERROR;
-      }
-      users = for_realloc;
-      for_realloc = NULL;
-      strcpy(users[users_count].login, user_input);
-      users[users_count].pin = pin;
-      users[users_count].uid =
-          (users_count == 0) ? 1 : users[users_count - 1].uid + 1;
-
-      for_realloc = realloc(users_bans, (users_count + 1) * sizeof(int));
-      if (for_realloc == NULL) {
-        print_error(MEMORY_ALLOCATION_ERROR);
-        free(users);
-        free(user_input);
-        free(users_bans);
-        return MEMORY_ALLOCATION_ERROR;
-      }
-      users_bans = for_realloc;
-      users_bans[users_count] = 0;
-      for_realloc = NULL;
 
-      fapp = fopen(USERS_FILENAME, "ab");
-      if (fapp == NULL) {
-        print_error(FILE_OPENING_ERROR);
-        free(user_input);
-        free(users);
-        free(users_bans);
-        return FILE_OPENING_ERROR;
-      }
-      fwrite(users + users_count, sizeof(user_entry), 1, fapp);
-      fclose(fapp);
-
-      users_count++;
       free(user_input);
       continue;
     }
 
+    err = shell_main_loop(&ctx, user_input, current_uid);
     free(user_input);
-    err = shell_main_loop(users, users_bans, users_count, current_uid);
     signal(SIGINT, SIG_DFL);
     if (err != 0) {
       print_error(err);
-      free(users);
-      free(user_input);
-      free(users_bans);
+      user_journal_close(&journal);
+      user_store_close(&users);
+      ban_bitmap_close(&bans);
+      audit_log_close(&audit);
       return err;
     }
   }
-  free(users);
-  free(users_bans);
+  err = store_error(user_journal_close(&journal));
+  user_store_close(&users);
+  ban_bitmap_close(&bans);
+  if (audit_log_close(&audit) != 0 && err == 0) {
+    err = FILE_OPENING_ERROR;
+  }
+  if (err != 0) {
+    print_error(err);
+  }
+  return err;
 }
 
-int shell_main_loop(user_entry const *users, int *users_bans,
-                    size_t users_count, unsigned int current_uid) {
-  if (users == NULL || users_bans == NULL) {
+int shell_main_loop(shell_context *ctx, const char *login,
+                    unsigned int current_uid) {
+  if (ctx == NULL || login == NULL) {
     return DEREFERENCING_NULL_ERROR;
   }
   char *user_input = NULL;
   int err = 0;
   size_t len = 0;
+  shell_output out = {0};
+  shell_session session = {0};
+  const shell_command *command = NULL;
 
+  session.state = SESSION_SHELL;
+  session.current_uid = current_uid;
   signal(SIGINT, ignore_sigint);
   rl_attempted_completion_function = completion;
 
@@ -243,201 +324,55 @@ int shell_main_loop(user_entry const *users, int *users_bans,
 
     add_history(user_input);
 
-    if (strcmp(user_input, "Logout") == 0) {
+    command = shell_command_find(user_input);
+    if (command == NULL) {
+      shell_audit(ctx, login, current_uid, user_input, PARSING_ERROR);
+      err = shell_printf(&out, "Incorrect command. Try again.\n");
+    } else if (command->id == SHELL_LOGOUT) {
+      shell_audit(ctx, login, current_uid, user_input, 0);
       clear_history();
       free(user_input);
       break;
-    }
-
-    if (strcmp(user_input, "Time") == 0) {
-      err = handle_time();
-      if (err != 0) {
-        free(user_input);
-        return err;
-      }
-    } else if (strcmp(user_input, "Date") == 0) {
-      err = handle_date();
-      if (err != 0) {
-        free(user_input);
-        return err;
-      }
-    } else if (strncmp(user_input, "Howmuch ", 8) == 0) {
-      err = handle_howmuch(user_input);
-      if (err == PARSING_ERROR) {
-        printf("Failed to parse input data. Try again\n");
-        free(user_input);
-        continue;
-      }
-      if (err != 0) {
-        free(user_input);
-        return err;
+    } else {
+      if (command->id == SHELL_SANCTIONS) {
+        err = handle_sanctions(user_input, ctx->users, ctx->bans, current_uid,
+                               &out);
+      } else {
+        err = command->run(ctx, &session, user_input, &out);
       }
-    } else if (strncmp(user_input, "Sanctions ", 10) == 0) {
-      err = handle_sanctions(user_input, users, users_bans, users_count,
-                             current_uid);
-      if (err == PARSING_ERROR) {
-        printf("Failed to parse input data. Try again\n");
-        free(user_input);
-        continue;
-      } else if (err == INCORRECT_PASSWORD_ERROR) {
-        printf("Incorrect password. Try again\n");
-        free(user_input);
-        continue;
-      } else if (err == NO_SUCH_USERNAME_ERROR) {
-        printf("This user doesn't exists. Try again.\n");
-        free(user_input);
-        continue;
-      } else if (err == SELF_BAN_ERROR) {
-        printf("You can not ban yourself.\n");
-        free(user_input);
-        continue;
-      } else if (err != 0) {
-        free(user_input);
-        return err;
+      shell_audit(ctx, login, current_uid, user_input, err);
+      if (err == INCORRECT_PASSWORD_ERROR) {
+        err = shell_printf(&out, "Incorrect password. Try again\n");
       }
-    } else {
-      printf("Incorrect command. Try again.\n");
+      err = shell_command_reply(err, &out);
     }
 
     free(user_input);
+    fwrite(out.data, 1, out.len, stdout);
+    shell_output_consume(&out, out.len);
+    if (err != 0) {
+      shell_output_free(&out);
+      return err;
+    }
   }
 
+  shell_output_free(&out);
   return 0;
 }
 
-int handle_time() {
-  time_t current_time;
-  struct tm *time_info;
-
-  time(&current_time);
-  time_info = localtime(&current_time);
-
-  printf("%02d:%02d:%02d\n", time_info->tm_hour, time_info->tm_min,
-         time_info->tm_sec);
-
-  return 0;
-}
-int handle_date() {
-  time_t current_time;
-  struct tm *time_info;
-
-  time(&current_time);
-  time_info = localtime(&current_time);
-
-  printf("%02d:%02d:%d\n", time_info->tm_mday, time_info->tm_mon + 1,
-         time_info->tm_year + 1900);
-
-  return 0;
-}
-
-int handle_howmuch(char *user_input) {
-  if (user_input == NULL) {
-    return DEREFERENCING_NULL_ERROR;
-  }
-
-  char *time_str = user_input + 8;
-  char *flag_str = NULL;
-  char *p = time_str;
-  struct tm tm_time = {0};
-  time_t input_time = 0;
-  time_t now = 0;
-  double diff = 0;
-
-  while (*p != '\0' && !isspace((unsigned char)*p)) {
-    ++p;
-  }
-  if (*p == '\0') {
-    return PARSING_ERROR;
-  }
-
-  while (*p != '\0' && isspace((unsigned char)*p)) {
-    ++p;
-  }
-  if (*p == '\0') {
-    return PARSING_ERROR;
-  }
-
-  flag_str = p;
-
-  p = flag_str;
-  while (*p != '\0' && !isspace((unsigned char)*p)) {
-    ++p;
-  }
-  if (*p != '\0') {
-    *p = '\0';
-    ++p;
-  }
-  flag_str = p;
-
-  if (sscanf(time_str, "%d:%d:%d %d:%d:%d", &tm_time.tm_mday, &tm_time.tm_mon,
-             &tm_time.tm_year, &tm_time.tm_hour, &tm_time.tm_min,
-             &tm_time.tm_sec) != 6) {
-    return PARSING_ERROR;
-  }
-
-  tm_time.tm_year -= 1900;
-  tm_time.tm_mon -= 1;
-
-  input_time = mktime(&tm_time);
-  if (input_time == -1) {
-    return PARSING_ERROR;
-  }
-
-  now = time(NULL);
-  diff = difftime(now, input_time);
-
-  if (strcmp(flag_str, "-s") == 0) {
-    printf("%.0f seconds\n", diff);
-  } else if (strcmp(flag_str, "-m") == 0) {
-    printf("%.0f minutes\n", diff / 60);
-  } else if (strcmp(flag_str, "-h") == 0) {
-    printf("%.0f hours\n", diff / 3600);
-  } else if (strcmp(flag_str, "-y") == 0) {
-    printf("%.2f years\n", diff / (365.25 * 24 * 3600));
-  } else {
-    return PARSING_ERROR;
-  }
-
-  return 0;
-}
-
-int handle_sanctions(char *user_input, user_entry const *users, int *users_bans,
-                     size_t users_count, unsigned int current_uid) {
-  if (user_input == NULL) {
+// Asks for the admin password with echo off before banning; the server
+// (shell_commands.h) takes it as the next line of the session instead.
+int handle_sanctions(char *user_input, user_store *users, ban_bitmap *bans,
+                     unsigned int current_uid, shell_output *out) {
+  if (user_input == NULL || out == NULL) {
     return DEREFERENCING_NULL_ERROR;
   }
 
-  size_t len = 0;
   size_t i = 0;
-  int found = -1;
-  char *username = strchr(user_input, ' ');
-  if (username == NULL) {
-    return PARSING_ERROR;
-  }
-
-  while (isspace(*username)) {
-    username++;
-  }
-
-  len = trim_string(username);
-
-  if (len > 6) {
-    return PARSING_ERROR;
-  }
-
-  for (i = 0; i < users_count; i++) {
-    if (strcmp(users[i].login, username) == 0) {
-      found = i;
-      break;
-    }
-  }
-
-  if (found == current_uid - 1) {
-    return SELF_BAN_ERROR;
-  }
-
-  if (found == -1) {
-    return NO_SUCH_USERNAME_ERROR;
+  size_t found = 0;
+  int err = sanctions_target(user_input, users, current_uid, &found);
+  if (err != 0) {
+    return err;
   }
 
   printf("Enter admin password to process: ");
@@ -454,55 +389,149 @@ int handle_sanctions(char *user_input, user_entry const *users, int *users_bans,
     return INCORRECT_PASSWORD_ERROR;
   }
 
-  users_bans[found] = 1;
-  printf("Success!\n");
-
-  return 0;
+  err = ban_bitmap_set(bans, found);
+  if (err != 0) {
+    return store_error(err);
+  }
+  return shell_printf(out, "Success!\n");
 }
 
-int get_users_from_file(user_entry **users, size_t *users_count) {
-  FILE *fin;
-  long file_size = 0;
-  size_t read_users_count = 0;
-
-  fin = fopen(USERS_FILENAME, "rb");
-  if (!fin) {
-    *users = NULL;
-    *users_count = 0;
-    return 0;
+// Registers "<login> <pin>" lines in bulk. Taken logins and malformed lines
+// are skipped; everything else is committed in groups (user_journal.h).
+int import_users(user_journal *journal, const char *path) {
+  if (journal == NULL || path == NULL) {
+    return DEREFERENCING_NULL_ERROR;
   }
 
-  if (fseek(fin, 0, SEEK_END) != 0) {
-    fclose(fin);
-    return FILE_PARSING_ERROR;
+  FILE *fin = fopen(path, "r");
+  char line[MAX_INPUT_LENGTH];
+  char login[MAX_INPUT_LENGTH];
+  unsigned int pin = 0;
+  size_t queued = 0;
+  size_t skipped = 0;
+  size_t imported = 0;
+  struct timespec start;
+  struct timespec stop;
+  double seconds = 0;
+  err_t err = 0;
+
+  if (fin == NULL) {
+    return FILE_OPENING_ERROR;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  while (err == 0 && fgets(line, sizeof(line), fin) != NULL) {
+    if (sscanf(line, "%255s %u", login, &pin) != 2 || pin > 100000) {
+      ++skipped;
+      continue;
+    }
+    err = user_journal_add(journal, login, pin, NULL);
+    if (err == REPEATING_KEY || err == INVALID_INPUT_DATA) {
+      ++skipped;
+      err = 0;
+    } else if (err == 0) {
+      ++queued;
+    }
+  }
+  if (err == 0) {
+    err = user_journal_commit(journal);
   }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  fclose(fin);
+  if (err != 0) {
+    return store_error(err);
+  }
+
+  // Logins another shell took while they were queued were dropped at commit
+  // time, so the journal's count is what actually landed.
+  imported = (size_t)journal->stats.records;
+  skipped += queued - imported;
+  seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+  printf("imported %zu users, skipped %zu, %llu commits, %llu syncs, "
+         "%.3f s (%.0f users/s)\n",
+         imported, skipped, (unsigned long long)journal->stats.commits,
+         (unsigned long long)journal->stats.syncs, seconds,
+         (seconds > 0) ? imported / seconds : 0.0);
+  return 0;
+}
 
-  file_size = ftell(fin);
-  if (file_size < 0) {
-    fclose(fin);
-    return FILE_PARSING_ERROR;
+// Runs the lines of path ("-" for stdin) as one session, the way a user
+// would type them (login, PIN, commands, ...), but without prompts. Replies
+// go to stdout through a bufio.h writer; the rate goes to stderr.
+int run_script(shell_context *ctx, const char *path) {
+  if (ctx == NULL || path == NULL) {
+    return DEREFERENCING_NULL_ERROR;
   }
 
-  *users_count = file_size / sizeof(user_entry);
+  bufio_reader in;
+  bufio_writer to_stdout;
+  shell_session session;
+  shell_output out = {0};
+  char line[MAX_INPUT_LENGTH];
+  size_t len = 0;
+  size_t lines = 0;
+  struct timespec start;
+  struct timespec stop;
+  double seconds = 0;
+  int c = 0;
+  int err = 0;
 
-  *users = malloc(*users_count * sizeof(user_entry));
-  if (!*users) {
-    fclose(fin);
-    return MEMORY_ALLOCATION_ERROR;
+  if (strcmp(path, "-") == 0) {
+    err = bufio_reader_fd(&in, STDIN_FILENO, NULL);
+  } else {
+    err = bufio_reader_open(&in, path, NULL);
+  }
+  if (err != 0) {
+    return FILE_OPENING_ERROR;
+  }
+  if (bufio_writer_fd(&to_stdout, STDOUT_FILENO, NULL) != 0) {
+    bufio_reader_close(&in);
+    return FILE_OPENING_ERROR;
   }
 
-  fseek(fin, 0, SEEK_SET);
-
-  read_users_count = fread(*users, sizeof(user_entry), *users_count, fin);
-  if (read_users_count != *users_count) {
-    free(*users);
-    fclose(fin);
-    printf("%zu %zu\n", *users_count, read_users_count);
-    return FILE_PARSING_ERROR;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  shell_session_start(&session, 1, &out);
+  while (err == 0 && c != BUFIO_EOF) {
+    c = bufio_getc(&in);
+    if (c != '\n' && c != BUFIO_EOF) {
+      if (len < sizeof(line) - 1) {
+        line[len++] = (char)c;
+      }
+      continue;
+    }
+    if (c == BUFIO_EOF && len == 0) {
+      break;
+    }
+    line[len] = '\0';
+    len = 0;
+    ++lines;
+    err = shell_session_input(ctx, &session, line, &out);
+    // A registration is answered once it is committed, before the next
+    // line can try to log in with it.
+    if (err == 0 && shell_session_waiting(&session)) {
+      err = store_error(user_journal_commit(ctx->journal));
+      if (err == 0) {
+        err = shell_session_resume(&session, &out);
+      }
+    }
+    if (bufio_write(&to_stdout, out.data, out.len) != 0 && err == 0) {
+      err = FILE_OPENING_ERROR;
+    }
+    shell_output_consume(&out, out.len);
+  }
+  if (in.error != 0 && err == 0) {
+    err = FILE_OPENING_ERROR;
+  }
+  if (bufio_writer_close(&to_stdout) != 0 && err == 0) {
+    err = FILE_OPENING_ERROR;
   }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  bufio_reader_close(&in);
+  shell_output_free(&out);
 
-  fclose(fin);
-  return 0;
+  seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+  fprintf(stderr, "%zu lines in %.3f s (%.0f lines/s)\n", lines, seconds,
+          (seconds > 0) ? lines / seconds : 0.0);
+  return err;
 }
 
 int login_user(user_entry const *user) {
@@ -565,48 +594,16 @@ int register_user(char const *username, unsigned int *pin_placeholder) {
   }
 
   *pin_placeholder = (unsigned int)user_pin;
-  printf("Success!\n");
   return 0;
 }
 
-int trim_string(char *s) {
-  if (s == NULL) {
-    return 0;
-  }
-  size_t len = strlen(s);
-  while (len > 0 && isspace((unsigned char)s[len - 1])) {
-    s[len - 1] = '\0';
-    --len;
-  }
-  return len;
-}
+void print_error(int err) {
+  const char *message = shell_error_message(err);
 
-void print_error(int errno) {
-  switch (errno) {
-    case MEMORY_ALLOCATION_ERROR:
-      printf("Error: Memory allocation failed.\n");
-      break;
-    case DEREFERENCING_NULL_ERROR:
-      printf("Error: Attempted to dereference a null pointer.\n");
-      break;
-    case PARSING_ERROR:
-      printf("Error: Parsing failed.\n");
-      break;
-    case FILE_PARSING_ERROR:
-      printf("Error: Failed to parse the file.\n");
-      break;
-    case INCORRECT_PASSWORD_ERROR:
-      printf("Error: Incorrect password.\n");
-      break;
-    case FILE_OPENING_ERROR:
-      printf("Error: Could not open the file.\n");
-      break;
-    case NO_SUCH_USERNAME_ERROR:
-      printf("Error: Username does not exist.\n");
-      break;
-    default:
-      printf("Error: Unknown error code %d.\n", errno);
-      break;
+  if (message != NULL) {
+    printf("Error: %s\n", message);
+  } else {
+    printf("Error: Unknown error code %d.\n", err);
   }
 }
 
@@ -623,8 +620,6 @@ void disable_echo() {
 void restore_terminal() { tcsetattr(STDIN_FILENO, TCSANOW, &saved_term); }
 
 char *command_generator(const char *text, int state) {
-  const char *local_commands[] = {"Time",      "Date",   "Howmuch",
-                                  "Sanctions", "Logout", NULL};
   static int list_index = 0;
   static int len = 0;
   const char *name = NULL;
@@ -634,7 +629,7 @@ char *command_generator(const char *text, int state) {
     len = strlen(text);
   }
 
-  while ((name = local_commands[list_index++])) {
+  while ((name = shell_commands[list_index++].name)) {
     if (strncmp(name, text, len) == 0) {
       return strdup(name);
     }
@@ -1,90 +1,234 @@
+#include <fcntl.h>
 #include <linux/limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "../include/aho_corasick.h"
+#include "../include/mapped_file.h"
+#include "../include/parallel_scan.h"
+#include "../include/substring_search.h"
+
 #define MAX_PATH_LEN 1025
+#define PATTERNS_BASE_CAPACITY 16
+#define PATHS_BASE_CAPACITY 1024
 
 typedef struct {
   char filename[MAX_PATH_LEN];
+  int pattern;  // index into the pattern file, 0 for a single search string
   int count;
 } result;
 
+// Paths from the file list, NUL-terminated back to back in one buffer.
+typedef struct {
+  char *data;
+  size_t size;
+  size_t capacity;
+  size_t *offsets;
+  size_t count;
+  size_t offsets_capacity;
+} path_list;
+
+typedef struct {
+  size_t files;
+  size_t bytes;
+  double seconds;
+} worker_stats;
+
+// Lives in a MAP_SHARED mapping, so the forked workers and the parent see
+// the same queue cursor and each worker's counters.
+typedef struct {
+  size_t next_path;  // shared work queue, bumped atomically
+  worker_stats workers[];
+} pool_shared;
+
+typedef struct {
+  const path_list *paths;
+  const char *str;         // single search string, or
+  const aho_corasick *ac;  // a pattern set
+  size_t *counts;
+  size_t patterns_count;
+  pool_shared *shared;
+  int fd;  // write end of the results pipe
+} search_job;
+
 int search_string_in_file(const char *filename, const char *str);
+int search_patterns_in_file(const char *filename, const aho_corasick *ac,
+                            size_t *counts);
+int load_patterns(const char *path, mapped_file *mf, string_view **patterns,
+                  size_t *patterns_count);
+int load_paths(FILE *list_file, path_list *paths);
+void path_list_free(path_list *paths);
+void run_worker(const search_job *job, size_t id);
+void report_workers(const pool_shared *shared, size_t workers,
+                    double seconds);
 void fork_bomb(int height, int level);
 
 int main(int argc, char *argv[]) {
   printf("%d\n", PIPE_BUF);
-  if (argc != 3) {
-    fprintf(stderr, "Usage: %s <file_list.txt> <search_string>\n", argv[0]);
+  size_t workers = 0;
+  if (argc >= 5 && strcmp(argv[argc - 2], "-j") == 0 &&
+      parallel_scan_threads_parse(argv[argc - 1], &workers)) {
+    argc -= 2;
+  }
+  if (argc != 3 && !(argc == 4 && strcmp(argv[2], "-f") == 0)) {
+    fprintf(stderr,
+            "Usage: %s <file_list.txt> <search_string> [-j workers]\n"
+            "       %s <file_list.txt> -f <patterns.txt> [-j workers]\n",
+            argv[0], argv[0]);
     return EXIT_FAILURE;
   }
 
   const char *list_path = argv[1];
   const char *search_str = argv[2];
+  int multi = argc == 4;
+  mapped_file patterns_file = {NULL, 0, -1};
+  string_view *patterns = NULL;
+  size_t patterns_count = 0;
+  aho_corasick *ac = NULL;
+  size_t *counts = NULL, *totals = NULL;
+  size_t p = 0;
+
+  if (multi) {
+    if (load_patterns(argv[3], &patterns_file, &patterns, &patterns_count) !=
+            0 ||
+        ac_init(&ac, patterns, patterns_count) != 0) {
+      fprintf(stderr, "failed to load patterns from %s\n", argv[3]);
+      free(patterns);
+      mapped_file_close(&patterns_file);
+      return EXIT_FAILURE;
+    }
+    counts = (size_t *)calloc(patterns_count + 1, sizeof(size_t));
+    totals = (size_t *)calloc(patterns_count + 1, sizeof(size_t));
+    if (counts == NULL || totals == NULL) {
+      fprintf(stderr, "calloc failed\n");
+      free(counts);
+      free(totals);
+      ac_free(ac);
+      free(patterns);
+      mapped_file_close(&patterns_file);
+      return EXIT_FAILURE;
+    }
+  }
+
   FILE *list_file = fopen(list_path, "r");
   if (!list_file) {
     fprintf(stderr, "fopen failed\n");
     return EXIT_FAILURE;
   }
 
-  char filepath[MAX_PATH_LEN];
+  path_list paths = {0};
+  if (load_paths(list_file, &paths) != 0) {
+    fprintf(stderr, "failed to read %s\n", list_path);
+    fclose(list_file);
+    return EXIT_FAILURE;
+  }
+  fclose(list_file);
+
+  // A fixed pool of worker processes, default one per CPU, never more than
+  // there are files. Each one pulls the next path off the shared cursor
+  // until the list runs out.
+  workers = parallel_scan_threads(workers);
+  if (workers > paths.count) {
+    workers = (paths.count > 0) ? paths.count : 1;
+  }
+  size_t shared_size = sizeof(pool_shared) + workers * sizeof(worker_stats);
+  pool_shared *shared =
+      (pool_shared *)mmap(NULL, shared_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    fprintf(stderr, "mmap failed\n");
+    path_list_free(&paths);
+    return EXIT_FAILURE;
+  }
+
   int found_any = 0;
 
   int pipefd[2];
   if (pipe(pipefd) == -1) {
     fprintf(stderr, "pipe failed\n");
+    munmap(shared, shared_size);
+    path_list_free(&paths);
     return EXIT_FAILURE;
   }
 
-  while (fgets(filepath, sizeof(filepath), list_file)) {
-    filepath[strcspn(filepath, "\n")] = '\0';
-
-    printf("filepath: %s\n", filepath);
+  search_job job = {&paths,         search_str, ac,        counts,
+                    patterns_count, shared,     pipefd[1]};
+  struct timespec start, end;
+  size_t started = 0;
 
+  // Whatever is buffered would otherwise be printed again by every child.
+  fflush(stdout);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (started = 0; started < workers; ++started) {
     pid_t pid = fork();
     if (pid < 0) {
-      fprintf(stderr, "fork failed\n");
-      close(pipefd[0]);
-      close(pipefd[1]);
-
-      return EXIT_FAILURE;
+      break;
     }
-
     if (pid == 0) {
       close(pipefd[0]);
-      result r;
-      // printf("from fork: %s\n", filepath);
-      sleep(1);
-      strncpy(r.filename, filepath, MAX_PATH_LEN - 1);
-      r.count = search_string_in_file(r.filename, search_str);
-
-      write(pipefd[1], &r, sizeof(result));
+      run_worker(&job, started);
       close(pipefd[1]);
-      fclose(list_file);
-      exit(0);
+      _exit(0);
     }
   }
-
   close(pipefd[1]);
+  if (started == 0) {
+    fprintf(stderr, "fork failed\n");
+    close(pipefd[0]);
+    munmap(shared, shared_size);
+    path_list_free(&paths);
+    return EXIT_FAILURE;
+  }
+
   result r;
   int status = 0;
-  int i = 0;
 
   while (read(pipefd[0], &r, sizeof(result)) == sizeof(result)) {
-    if (r.count > 0) {
+    if (r.count <= 0) {
+      continue;
+    }
+    found_any = 1;
+    if (multi) {
+      printf("%s: %.*s: %d\n", r.filename, (int)patterns[r.pattern].len,
+             patterns[r.pattern].data, r.count);
+      totals[r.pattern] += r.count;
+    } else {
       printf("%s: %d\n", r.filename, r.count);
-      found_any = 1;
     }
   }
 
   while (wait(&status) > 0);
+  clock_gettime(CLOCK_MONOTONIC, &end);
 
   close(pipefd[0]);
 
-  fclose(list_file);
+  report_workers(shared, started,
+                 (end.tv_sec - start.tv_sec) +
+                     (end.tv_nsec - start.tv_nsec) / 1e9);
+  munmap(shared, shared_size);
+  path_list_free(&paths);
+
+  if (multi) {
+    for (p = 0; p < patterns_count; ++p) {
+      printf("total %.*s: %zu\n", (int)patterns[p].len, patterns[p].data,
+             totals[p]);
+    }
+    free(counts);
+    free(totals);
+    ac_free(ac);
+    free(patterns);
+    mapped_file_close(&patterns_file);
+    if (!found_any) {
+      fprintf(stderr, "No pattern from '%s' found in any file\n", argv[3]);
+    }
+    return 0;
+  }
 
   if (!found_any) {
     fprintf(stderr, "String '%s' not found in any file\n", search_str);
@@ -94,29 +238,238 @@ int main(int argc, char *argv[]) {
   return 0;
 }
 
+// Non-overlapping occurrences of str in the whole file, mapped when it is
+// a regular file and read in large blocks otherwise (pipes, devices).
 int search_string_in_file(const char *filename, const char *str) {
   if (filename == NULL || str == NULL) {
     return 0;
   }
-  FILE *fin = fopen(filename, "r");
-  if (fin == NULL) {
+
+  substring_searcher searcher;
+  mapped_file mf;
+  size_t count = 0;
+  int err = 0;
+
+  substring_searcher_init(&searcher, str, strlen(str), SCAN_ISA_AVX2);
+  err = mapped_file_open(&mf, filename);
+  if (err == 0) {
+    if (mf.data != NULL) {
+      madvise((void *)mf.data, mf.size, MADV_SEQUENTIAL);
+    }
+    count = substring_count(&searcher, mf.data, mf.size, NULL);
+    mapped_file_close(&mf);
+  } else if (err == MEMORY_MAPPING_ERROR) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1 || substring_count_fd(&searcher, fd, &count) != 0) {
+      count = 0;
+    }
+    if (fd != -1) {
+      close(fd);
+    }
+  }
+
+  return (int)count;
+}
+
+// Occurrences of every pattern in the whole file, mapped or streamed like
+// search_string_in_file does.
+int search_patterns_in_file(const char *filename, const aho_corasick *ac,
+                            size_t *counts) {
+  if (filename == NULL || ac == NULL || counts == NULL) {
     return 0;
   }
 
-  char line[BUFSIZ];
-  int count = 0;
-  size_t len = strlen(str);
+  mapped_file mf;
+  int err = 0;
+
+  memset(counts, 0, ac->patterns_count * sizeof(size_t));
+  err = mapped_file_open(&mf, filename);
+  if (err == 0) {
+    err = ac_count(ac, mf.data, mf.size, counts);
+    mapped_file_close(&mf);
+  } else if (err == MEMORY_MAPPING_ERROR) {
+    int fd = open(filename, O_RDONLY);
+    err = (fd == -1) ? OPENING_THE_FILE_ERROR : ac_count_fd(ac, fd, counts);
+    if (fd != -1) {
+      close(fd);
+    }
+  }
+
+  return err;
+}
+
+// One pattern per line, views point into the mapped file. Empty lines and
+// trailing '\r' are dropped.
+int load_patterns(const char *path, mapped_file *mf, string_view **patterns,
+                  size_t *patterns_count) {
+  if (path == NULL || mf == NULL || patterns == NULL ||
+      patterns_count == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  string_view rest, line;
+  string_view *for_realloc = NULL;
+  size_t capacity = PATTERNS_BASE_CAPACITY;
+  int err = 0;
+
+  err = mapped_file_open(mf, path);
+  if (err) {
+    return err;
+  }
+
+  *patterns_count = 0;
+  *patterns = (string_view *)malloc(capacity * sizeof(string_view));
+  if (*patterns == NULL) {
+    mapped_file_close(mf);
+    return MEMORY_ALLOCATION_ERROR;
+  }
+
+  rest = sv_from_parts((const char *)mf->data, mf->size);
+  while (sv_split_next(&rest, '\n', &line)) {
+    if (line.len > 0 && line.data[line.len - 1] == '\r') {
+      line.len--;
+    }
+    if (line.len == 0) {
+      continue;
+    }
+    if (*patterns_count == capacity) {
+      capacity *= 2;
+      for_realloc = realloc(*patterns, capacity * sizeof(string_view));
+      if (for_realloc == NULL) {
+        free(*patterns);
+        *patterns = NULL;
+        mapped_file_close(mf);
+        return MEMORY_ALLOCATION_ERROR;
+      }
+      *patterns = for_realloc;
+    }
+    (*patterns)[(*patterns_count)++] = line;
+  }
+
+  return 0;
+}
+
+// Reads the whole list up front, one path per line; the workers only index
+// into it. Paths longer than MAX_PATH_LEN - 1 are cut, as fgets used to.
+int load_paths(FILE *list_file, path_list *paths) {
+  if (list_file == NULL || paths == NULL) {
+    return DEREFERENCING_NULL_PTR;
+  }
+
+  char filepath[MAX_PATH_LEN];
 
-  while (fgets(line, sizeof(line), fin)) {
-    char *p = line;
-    while ((p = strstr(p, str)) != NULL) {
-      count++;
-      p += len;
+  while (fgets(filepath, sizeof(filepath), list_file)) {
+    size_t len = strcspn(filepath, "\n");
+    filepath[len] = '\0';
+
+    printf("filepath: %s\n", filepath);
+
+    if (paths->size + len + 1 > paths->capacity) {
+      size_t capacity = (paths->capacity == 0)
+                            ? PATHS_BASE_CAPACITY * MAX_PATH_LEN
+                            : paths->capacity * 2;
+      char *for_realloc = realloc(paths->data, capacity);
+      if (for_realloc == NULL) {
+        path_list_free(paths);
+        return MEMORY_ALLOCATION_ERROR;
+      }
+      paths->data = for_realloc;
+      paths->capacity = capacity;
+    }
+    if (paths->count == paths->offsets_capacity) {
+      size_t capacity = (paths->offsets_capacity == 0)
+                            ? PATHS_BASE_CAPACITY
+                            : paths->offsets_capacity * 2;
+      size_t *for_realloc = realloc(paths->offsets, capacity * sizeof(size_t));
+      if (for_realloc == NULL) {
+        path_list_free(paths);
+        return MEMORY_ALLOCATION_ERROR;
+      }
+      paths->offsets = for_realloc;
+      paths->offsets_capacity = capacity;
     }
+    memcpy(paths->data + paths->size, filepath, len + 1);
+    paths->offsets[paths->count++] = paths->size;
+    paths->size += len + 1;
   }
 
-  fclose(fin);
-  return count;
+  return ferror(list_file) ? OPENING_THE_FILE_ERROR : 0;
+}
+
+void path_list_free(path_list *paths) {
+  if (paths == NULL) {
+    return;
+  }
+  free(paths->data);
+  free(paths->offsets);
+  memset(paths, 0, sizeof(*paths));
+}
+
+// Runs in a forked worker: takes paths off the shared cursor until none are
+// left and sends each file's results down the pipe.
+void run_worker(const search_job *job, size_t id) {
+  worker_stats *stats = &job->shared->workers[id];
+  struct timespec start, end;
+  size_t i = 0;
+  size_t p = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  while ((i = __atomic_fetch_add(&job->shared->next_path, 1,
+                                 __ATOMIC_RELAXED)) < job->paths->count) {
+    const char *path = job->paths->data + job->paths->offsets[i];
+    struct stat st;
+    result r;
+
+    memset(&r, 0, sizeof(result));
+    strncpy(r.filename, path, MAX_PATH_LEN - 1);
+    if (job->ac != NULL) {
+      // one record per pattern keeps every write below PIPE_BUF (atomic)
+      search_patterns_in_file(r.filename, job->ac, job->counts);
+      for (p = 0; p < job->patterns_count; ++p) {
+        if (job->counts[p] > 0) {
+          r.pattern = (int)p;
+          r.count = (int)job->counts[p];
+          write(job->fd, &r, sizeof(result));
+        }
+      }
+    } else {
+      r.count = search_string_in_file(r.filename, job->str);
+      write(job->fd, &r, sizeof(result));
+    }
+    ++stats->files;
+    if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+      stats->bytes += (size_t)st.st_size;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  stats->seconds =
+      (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+void report_workers(const pool_shared *shared, size_t workers,
+                    double seconds) {
+  size_t files = 0;
+  size_t bytes = 0;
+
+  for (size_t i = 0; i < workers; ++i) {
+    const worker_stats *stats = &shared->workers[i];
+    double busy = (stats->seconds > 0) ? stats->seconds : 1e-9;
+    fprintf(stderr,
+            "worker %zu: %zu files, %.1f MB in %.3f s (%.0f files/s, "
+            "%.1f MB/s)\n",
+            i, stats->files, stats->bytes / 1e6, stats->seconds,
+            stats->files / busy, stats->bytes / 1e6 / busy);
+    files += stats->files;
+    bytes += stats->bytes;
+  }
+  if (seconds <= 0) {
+    seconds = 1e-9;
+  }
+  fprintf(stderr,
+          "%zu workers: %zu files, %.1f MB in %.3f s (%.0f files/s, "
+          "%.1f MB/s)\n",
+          workers, files, bytes / 1e6, seconds, files / seconds,
+          bytes / 1e6 / seconds);
 }
 
 void fork_bomb(int height, int level) {
@@ -0,0 +1,96 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/audit_log.h"
+#include "../include/datetime.h"
+#include "../include/mapped_file.h"
+
+// Prints the audit log the 2.c shell and 2_server.c write (audit_log.h),
+// one command per line in local time, optionally only those of one login,
+// and a summary. Stops at the first record that does not check out.
+int print_log(const mapped_file *mf, const char *login);
+
+int main(int argc, char *argv[]) {
+  mapped_file mf;
+  const char *login = NULL;
+  int err = 0;
+
+  if (argc == 4 && strcmp(argv[2], "--login") == 0) {
+    login = argv[3];
+  }
+  if (argc != 2 && login == NULL) {
+    fprintf(stderr, "Usage: %s <audit log> [--login NAME]\n", argv[0]);
+    return INVALID_CLI_ARGUMENT;
+  }
+
+  err = mapped_file_open(&mf, argv[1]);
+  if (err != 0) {
+    perror(argv[1]);
+    return err;
+  }
+  err = print_log(&mf, login);
+  mapped_file_close(&mf);
+  return err;
+}
+
+int print_log(const mapped_file *mf, const char *login) {
+  datetime_zone zone = {0};
+  audit_log_header header;
+  size_t offset = sizeof(header);
+  uint64_t commands = 0;
+  uint64_t failed = 0;
+  uint64_t lost = 0;
+
+  if (mf->size < sizeof(header)) {
+    fprintf(stderr, "not an audit log\n");
+    return INVALID_INPUT_DATA;
+  }
+  memcpy(&header, mf->data, sizeof(header));
+  if (memcmp(header.magic, AUDIT_LOG_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != AUDIT_LOG_VERSION) {
+    fprintf(stderr, "not an audit log\n");
+    return INVALID_INPUT_DATA;
+  }
+
+  while (offset < mf->size) {
+    audit_record record;
+    datetime_fields local = {0};
+    size_t size = audit_record_check(mf->data + offset, mf->size - offset);
+    if (size == 0) {
+      fprintf(stderr, "stopped at a torn record, offset %zu of %zu\n", offset,
+              mf->size);
+      break;
+    }
+    memcpy(&record, mf->data + offset, sizeof(record));
+    datetime_from_utc(&zone, record.time_ns / 1000000000, &local);
+
+    if (record.type == AUDIT_LOST) {
+      lost += record.value;
+      printf("%02d.%02d.%04lld %02d:%02d:%02d  -- %" PRIu64
+             " events lost --\n",
+             (int)local.day, (int)local.month, (long long)local.year,
+             (int)local.hour, (int)local.minute, (int)local.second,
+             record.value);
+    } else if (login == NULL ||
+               strncmp(record.login, login, AUDIT_LOGIN_MAX) == 0) {
+      ++commands;
+      failed += record.result != 0;
+      printf("%02d.%02d.%04lld %02d:%02d:%02d.%06d  %-6.*s (uid %" PRIu32
+             ")  %-4d %.*s\n",
+             (int)local.day, (int)local.month, (long long)local.year,
+             (int)local.hour, (int)local.minute, (int)local.second,
+             (int)(record.time_ns % 1000000000 / 1000), AUDIT_LOGIN_MAX,
+             record.login, record.uid, (int)record.result,
+             (int)record.length,
+             (const char *)(mf->data + offset + sizeof(record)));
+    }
+    offset += size;
+  }
+
+  printf("%" PRIu64 " commands, %" PRIu64 " failed, %" PRIu64 " lost\n",
+         commands, failed, lost);
+  datetime_zone_free(&zone);
+  return 0;
+}
@@ -0,0 +1,279 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/shell_commands.h"
+
+// Load generator for 2_server.c. Keeps up to --concurrency sessions open
+// at once from a single epoll loop; each one logs in (registering first if
+// its login is new), runs --commands commands timing every reply, logs out
+// and hangs up. Logins are derived from the session number, so a second
+// run logs the same users in instead of registering them again.
+#define CLIENT_EVENTS 256
+#define CLIENT_BUFFER 1024
+
+typedef enum {
+  CLIENT_LOGIN,     // login not sent yet, or registration just finished
+  CLIENT_COMMANDS,  // logged in
+  CLIENT_LOGOUT,    // Logout sent, waiting for the login prompt
+} client_state;
+
+typedef struct {
+  int fd;
+  size_t id;
+  client_state state;
+  char login[USER_LOGIN_MAX + 1];
+  unsigned int pin;
+  size_t commands;  // commands sent so far
+  uint64_t sent_at;
+  char input[CLIENT_BUFFER];
+  size_t input_len;
+} client;
+
+typedef struct {
+  const char *path;
+  int epoll_fd;
+  size_t sessions;
+  size_t commands;
+  size_t concurrency;
+  size_t started;
+  size_t finished;
+  size_t failed;
+  size_t registered;
+  uint64_t *latencies;  // ns per command
+  size_t latency_count;
+} load;
+
+static const char *const kCommands[] = {
+    "Time", "Date", "Howmuch 01:01:2020 00:00:00 -h"};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static int ends_with(const client *c, const char *suffix) {
+  size_t len = strlen(suffix);
+  return c->input_len >= len &&
+         memcmp(c->input + c->input_len - len, suffix, len) == 0;
+}
+
+static int client_send(client *c, const char *line) {
+  char buffer[MAX_INPUT_LENGTH + 1];
+  int len = snprintf(buffer, sizeof(buffer), "%s\n", line);
+  // Replies are short and we wait for each one, so the socket buffer
+  // always has room.
+  return send(c->fd, buffer, (size_t)len, MSG_NOSIGNAL) == len ? 0 : -1;
+}
+
+int client_start(load *lg);
+void client_finish(load *lg, client *c, int ok);
+int client_react(load *lg, client *c);
+
+int main(int argc, char *argv[]) {
+  load lg = {0};
+  struct epoll_event events[CLIENT_EVENTS];
+  uint64_t start = 0;
+  double seconds = 0;
+  int usage = argc < 2;
+
+  lg.sessions = 1000;
+  lg.commands = 10;
+  lg.concurrency = 100;
+  for (int i = 2; i < argc && !usage; i += 2) {
+    char *end = NULL;
+    size_t value = 0;
+    if (i + 1 >= argc) {
+      usage = 1;
+      break;
+    }
+    value = strtoull(argv[i + 1], &end, 10);
+    usage = *end != '\0' || argv[i + 1][0] == '-';
+    if (strcmp(argv[i], "--sessions") == 0) {
+      lg.sessions = value;
+    } else if (strcmp(argv[i], "--commands") == 0) {
+      lg.commands = value;
+    } else if (strcmp(argv[i], "--concurrency") == 0) {
+      lg.concurrency = value;
+    } else {
+      usage = 1;
+    }
+  }
+  if (usage || lg.sessions == 0 || lg.concurrency == 0 ||
+      lg.sessions > 0xfffff) {
+    fprintf(stderr,
+            "Usage: %s <socket> [--sessions N] [--commands M] "
+            "[--concurrency C]\n",
+            argv[0]);
+    return PARSING_ERROR;
+  }
+  lg.path = argv[1];
+
+  lg.latencies = (uint64_t *)malloc((lg.sessions * lg.commands + 1) *
+                                    sizeof(*lg.latencies));
+  lg.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (lg.latencies == NULL || lg.epoll_fd < 0) {
+    perror("Client");
+    free(lg.latencies);
+    return MEMORY_ALLOCATION_ERROR;
+  }
+
+  start = now_ns();
+  while (lg.started < lg.sessions &&
+         lg.started - lg.finished < lg.concurrency) {
+    if (client_start(&lg) != 0) {
+      break;
+    }
+  }
+  while (lg.finished < lg.started) {
+    int n = epoll_wait(lg.epoll_fd, events, CLIENT_EVENTS, -1);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      perror("Client: epoll_wait");
+      break;
+    }
+    for (int i = 0; i < n; ++i) {
+      client *c = (client *)events[i].data.ptr;
+      int done = client_react(&lg, c);
+      if (done != 0) {
+        client_finish(&lg, c, done > 0);
+      }
+    }
+    while (lg.started < lg.sessions &&
+           lg.started - lg.finished < lg.concurrency) {
+      if (client_start(&lg) != 0) {
+        break;
+      }
+    }
+  }
+  seconds = (now_ns() - start) / 1e9;
+  close(lg.epoll_fd);
+
+  qsort(lg.latencies, lg.latency_count, sizeof(*lg.latencies), compare_u64);
+  printf("%zu sessions (%zu registered, %zu failed) in %.3f s: "
+         "%.0f sessions/s, %.0f commands/s\n",
+         lg.finished - lg.failed, lg.registered, lg.failed, seconds,
+         (lg.finished - lg.failed) / seconds, lg.latency_count / seconds);
+  if (lg.latency_count > 0) {
+    printf("command latency us: p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+           lg.latencies[lg.latency_count * 50 / 100] / 1e3,
+           lg.latencies[lg.latency_count * 90 / 100] / 1e3,
+           lg.latencies[lg.latency_count * 99 / 100] / 1e3,
+           lg.latencies[lg.latency_count - 1] / 1e3);
+  }
+  free(lg.latencies);
+  return lg.failed == 0 ? 0 : PARSING_ERROR;
+}
+
+int client_start(load *lg) {
+  struct sockaddr_un addr = {0};
+  struct epoll_event ev = {0};
+  client *c = (client *)calloc(1, sizeof(*c));
+
+  if (c == NULL) {
+    return MEMORY_ALLOCATION_ERROR;
+  }
+  c->id = lg->started++;
+  snprintf(c->login, sizeof(c->login), "c%05zx", c->id);
+  c->pin = (unsigned int)(c->id % MAX_PIN);
+  c->state = CLIENT_LOGIN;
+
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", lg->path);
+  c->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (c->fd < 0 ||
+      connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror("Client: connect");
+    if (c->fd >= 0) {
+      close(c->fd);
+    }
+    free(c);
+    ++lg->finished;
+    ++lg->failed;
+    return FILE_OPENING_ERROR;
+  }
+  ev.events = EPOLLIN;
+  ev.data.ptr = c;
+  epoll_ctl(lg->epoll_fd, EPOLL_CTL_ADD, c->fd, &ev);
+  return 0;
+}
+
+void client_finish(load *lg, client *c, int ok) {
+  epoll_ctl(lg->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  if (!ok) {
+    fprintf(stderr, "Client: session %s failed after: %.*s\n", c->login,
+            (int)c->input_len, c->input);
+    ++lg->failed;
+  }
+  ++lg->finished;
+  free(c);
+}
+
+// Answers whatever prompt the server ended its output with. 1 once the
+// session logged out, -1 if it failed, 0 while it goes on.
+int client_react(load *lg, client *c) {
+  ssize_t got = recv(c->fd, c->input + c->input_len,
+                     sizeof(c->input) - c->input_len, 0);
+  if (got < 0 && errno == EINTR) {
+    return 0;
+  }
+  if (got <= 0) {
+    return -1;
+  }
+  c->input_len += (size_t)got;
+
+  if (ends_with(c, PROMPT_LOGIN)) {
+    if (c->state == CLIENT_LOGOUT) {
+      return 1;
+    }
+    if (memmem(c->input, c->input_len, "Success!", 8) != NULL) {
+      ++lg->registered;
+    }
+    c->input_len = 0;
+    return client_send(c, c->login);
+  }
+  if (ends_with(c, PROMPT_REGISTER) || ends_with(c, PROMPT_CONFIRM) ||
+      ends_with(c, PROMPT_PASSWORD)) {
+    char pin[16];
+    snprintf(pin, sizeof(pin), "%u", c->pin);
+    c->input_len = 0;
+    return client_send(c, pin);
+  }
+  if (ends_with(c, PROMPT_SHELL)) {
+    if (c->state == CLIENT_COMMANDS) {
+      lg->latencies[lg->latency_count++] = now_ns() - c->sent_at;
+    }
+    c->state = CLIENT_COMMANDS;
+    c->input_len = 0;
+    if (c->commands == lg->commands) {
+      c->state = CLIENT_LOGOUT;
+      return client_send(c, "Logout");
+    }
+    c->sent_at = now_ns();
+    return client_send(
+        c, kCommands[c->commands++ % (sizeof(kCommands) / sizeof(*kCommands))]);
+  }
+  if (c->input_len == sizeof(c->input)) {
+    return -1;  // not a dialogue we know
+  }
+  return 0;
+}
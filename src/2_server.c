@@ -0,0 +1,438 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../include/audit_log.h"
+#include "../include/ban_bitmap.h"
+#include "../include/shell_commands.h"
+#include "../include/user_journal.h"
+#include "../include/user_store.h"
+
+// The 2.c shell for many users at once: every connection to a Unix stream
+// socket gets its own session (shell_commands.h), all driven by one thread
+// from an epoll loop. Sessions share the records, the journal and the bans
+// with each other and with any interactive 2.c running in the same
+// directory. Registrations made during one pass of the loop are committed
+// together before any reply of that pass is sent, so one fdatasync covers
+// them all. A session that queued one is not fed again until the commit
+// has settled it (shell_session_resume): nobody is told "Success!" before
+// the record is durable, or when another shell took the login first. What
+// its peer sent meanwhile waits in the connection and is fed on the next
+// pass.
+//
+// A pass feeds each connection at most SERVER_LINES_PER_PASS lines, so a
+// client pipelining commands cannot starve the others, and a connection
+// whose unsent replies reach SERVER_OUTPUT_LIMIT is not read at all until
+// its peer takes them.
+#define USERS_FILENAME ".users"
+#define AUDIT_FILENAME ".shell_audit"
+#define SERVER_DEFAULT_MAX_SESSIONS 1024
+#define SERVER_EVENTS 256
+#define SERVER_READ_SIZE 4096
+#define SERVER_LINES_PER_PASS 64
+#define SERVER_OUTPUT_LIMIT ((size_t)64 << 10)  // bytes of unsent replies
+
+typedef struct connection {
+  int fd;
+  shell_session session;
+  char input[MAX_INPUT_LENGTH];
+  size_t input_len;
+  char received[SERVER_READ_SIZE];  // [received_pos, received_len) not fed
+  size_t received_pos;
+  size_t received_len;
+  size_t lines_fed;  // this pass
+  shell_output output;
+  int reading;  // EPOLLIN is registered
+  int writing;  // EPOLLOUT is registered
+  int closing;  // peer is gone, or we are done with it
+  struct connection *next_dirty;
+  int dirty;
+  struct connection *next_ready;
+  int ready;
+} connection;
+
+typedef struct {
+  int epoll_fd;
+  int listen_fd;
+  shell_context ctx;
+  size_t sessions;
+  size_t max_sessions;
+  connection *dirty;  // connections with replies to send after the commit
+  connection *ready;  // connections with received lines left to feed
+  unsigned long long accepted;
+  unsigned long long lines;
+} server;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int sig) {
+  (void)sig;
+  stop_requested = 1;
+}
+
+int server_listen(server *srv, const char *path);
+int server_run(server *srv);
+void server_accept(server *srv);
+int server_read(server *srv, connection *conn);
+void server_flush(server *srv, connection *conn);
+void server_drop(server *srv, connection *conn);
+
+int main(int argc, char *argv[]) {
+  server srv = {0};
+  user_store users;
+  user_journal journal;
+  ban_bitmap bans;
+  audit_log audit;
+  audit_options audit_opts = {0};
+  struct rlimit limit;
+  struct sigaction sa = {0};
+  char *end = NULL;
+  int err = 0;
+
+  srv.max_sessions = SERVER_DEFAULT_MAX_SESSIONS;
+  if (argc == 4 && strcmp(argv[2], "--max-sessions") == 0) {
+    srv.max_sessions = strtoull(argv[3], &end, 10);
+  }
+  if ((argc != 2 && argc != 4) || (end != NULL && *end != '\0') ||
+      srv.max_sessions == 0) {
+    fprintf(stderr, "Usage: %s <socket> [--max-sessions N]\n", argv[0]);
+    return PARSING_ERROR;
+  }
+
+  // One descriptor per session plus a few of our own.
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+      limit.rlim_cur < srv.max_sessions + 16) {
+    limit.rlim_cur = srv.max_sessions + 16;
+    if (limit.rlim_cur > limit.rlim_max) {
+      limit.rlim_cur = limit.rlim_max;
+    }
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+
+  err = user_store_open(&users, USERS_FILENAME);
+  if (err == 0) {
+    err = user_journal_open(&journal, &users, NULL);
+    if (err != 0) {
+      user_store_close(&users);
+    } else {
+      err = ban_bitmap_open(&bans, USERS_FILENAME);
+      if (err == 0) {
+        audit_opts.overflow = AUDIT_OVERFLOW_COUNT;
+        err = audit_log_open(&audit, AUDIT_FILENAME, &audit_opts);
+        if (err != 0) {
+          ban_bitmap_close(&bans);
+        }
+      }
+      if (err != 0) {
+        user_journal_close(&journal);
+        user_store_close(&users);
+      }
+    }
+  }
+  if (err != 0) {
+    err = store_error(err);
+    fprintf(stderr, "Server: %s\n", shell_error_message(err));
+    return err;
+  }
+  srv.ctx.users = &users;
+  srv.ctx.journal = &journal;
+  srv.ctx.bans = &bans;
+  srv.ctx.audit = &audit;
+
+  sa.sa_handler = request_stop;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  err = server_listen(&srv, argv[1]);
+  if (err == 0) {
+    printf("Server: listening on %s, up to %zu sessions\n", argv[1],
+           srv.max_sessions);
+    fflush(stdout);
+    err = server_run(&srv);
+    close(srv.listen_fd);
+    close(srv.epoll_fd);
+    unlink(argv[1]);
+  }
+
+  if (err == 0) {
+    err = store_error(user_journal_close(&journal));
+  } else {
+    user_journal_close(&journal);
+  }
+  user_store_close(&users);
+  ban_bitmap_close(&bans);
+  if (audit_log_close(&audit) != 0 && err == 0) {
+    err = FILE_OPENING_ERROR;
+  }
+  printf("Server: %llu sessions served, %llu lines, %llu registrations "
+         "in %llu commits, %llu audit records in %llu writes (%llu lost)\n",
+         srv.accepted, srv.lines, (unsigned long long)journal.stats.records,
+         (unsigned long long)journal.stats.commits,
+         (unsigned long long)audit.stats.written,
+         (unsigned long long)audit.stats.writes,
+         (unsigned long long)audit.stats.dropped);
+  if (err != 0) {
+    fprintf(stderr, "Server: %s\n", shell_error_message(err));
+  }
+  return err;
+}
+
+int server_listen(server *srv, const char *path) {
+  struct sockaddr_un addr = {0};
+  struct epoll_event ev = {0};
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Server: socket path is too long\n");
+    return PARSING_ERROR;
+  }
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  srv->listen_fd =
+      socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (srv->listen_fd < 0) {
+    perror("Server: socket");
+    return FILE_OPENING_ERROR;
+  }
+  if (bind(srv->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(srv->listen_fd, SOMAXCONN) < 0) {
+    perror("Server: bind");
+    close(srv->listen_fd);
+    return FILE_OPENING_ERROR;
+  }
+
+  srv->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (srv->epoll_fd < 0) {
+    perror("Server: epoll_create1");
+    close(srv->listen_fd);
+    unlink(path);
+    return FILE_OPENING_ERROR;
+  }
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;  // the listening socket
+  epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, srv->listen_fd, &ev);
+  return 0;
+}
+
+static void server_mark_dirty(server *srv, connection *conn) {
+  if (!conn->dirty) {
+    conn->dirty = 1;
+    conn->next_dirty = srv->dirty;
+    srv->dirty = conn;
+  }
+}
+
+static void server_mark_ready(server *srv, connection *conn) {
+  if (!conn->ready) {
+    conn->ready = 1;
+    conn->next_ready = srv->ready;
+    srv->ready = conn;
+  }
+}
+
+int server_run(server *srv) {
+  struct epoll_event events[SERVER_EVENTS];
+  int err = 0;
+
+  while (!stop_requested && err == 0) {
+    // Lines left over from the last pass are fed without waiting.
+    int n = epoll_wait(srv->epoll_fd, events, SERVER_EVENTS,
+                       srv->ready != NULL ? 0 : -1);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("Server: epoll_wait");
+      return FILE_OPENING_ERROR;
+    }
+
+    while (srv->ready != NULL && err == 0) {
+      connection *conn = srv->ready;
+      srv->ready = conn->next_ready;
+      conn->ready = 0;
+      err = server_read(srv, conn);
+      server_mark_dirty(srv, conn);
+    }
+    for (int i = 0; i < n && err == 0; ++i) {
+      connection *conn = (connection *)events[i].data.ptr;
+      if (conn == NULL) {
+        server_accept(srv);
+        continue;
+      }
+      if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        err = server_read(srv, conn);
+      }
+      server_mark_dirty(srv, conn);
+    }
+
+    // Group commit for every registration of this pass, then the replies.
+    if (err == 0) {
+      err = store_error(user_journal_commit(srv->ctx.journal));
+    }
+    while (srv->dirty != NULL) {
+      connection *conn = srv->dirty;
+      srv->dirty = conn->next_dirty;
+      conn->dirty = 0;
+      conn->lines_fed = 0;
+      if (err == 0) {
+        err = shell_session_resume(&conn->session, &conn->output);
+      }
+      server_flush(srv, conn);
+      // Whatever the peer did not take before hanging up is lost.
+      if (conn->closing) {
+        server_drop(srv, conn);
+      } else if (conn->received_pos < conn->received_len && conn->reading) {
+        server_mark_ready(srv, conn);
+      }
+    }
+  }
+  return err;
+}
+
+void server_accept(server *srv) {
+  while (1) {
+    struct epoll_event ev = {0};
+    connection *conn = NULL;
+    int fd = accept4(srv->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        perror("Server: accept");
+      }
+      return;
+    }
+    if (srv->sessions >= srv->max_sessions) {
+      static const char busy[] = "Too many sessions, try again later.\n";
+      send(fd, busy, sizeof(busy) - 1, MSG_NOSIGNAL);
+      close(fd);
+      continue;
+    }
+    conn = (connection *)calloc(1, sizeof(*conn));
+    if (conn == NULL) {
+      close(fd);
+      continue;
+    }
+    conn->fd = fd;
+    conn->reading = 1;
+    ev.events = EPOLLIN;
+    ev.data.ptr = conn;
+    if (epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+      close(fd);
+      free(conn);
+      continue;
+    }
+    ++srv->sessions;
+    ++srv->accepted;
+    shell_session_start(&conn->session, 0, &conn->output);
+    server_mark_dirty(srv, conn);
+  }
+}
+
+// Whether the connection has had its share of this pass: it waits for a
+// commit, used up its lines, or has too many replies unsent.
+static int server_paused(const connection *conn) {
+  return shell_session_waiting(&conn->session) ||
+         conn->lines_fed >= SERVER_LINES_PER_PASS ||
+         conn->output.len >= SERVER_OUTPUT_LIMIT;
+}
+
+// Feeds the complete lines received so far to the session until it is
+// paused. A line longer than MAX_INPUT_LENGTH is cut there, as readline's
+// buffer would be in 2.c.
+static int server_feed(server *srv, connection *conn) {
+  while (conn->received_pos < conn->received_len && !server_paused(conn)) {
+    char c = conn->received[conn->received_pos++];
+    int err = 0;
+    if (c != '\n') {
+      if (conn->input_len < MAX_INPUT_LENGTH - 1) {
+        conn->input[conn->input_len++] = c;
+      }
+      continue;
+    }
+    conn->input[conn->input_len] = '\0';
+    conn->input_len = 0;
+    ++conn->lines_fed;
+    ++srv->lines;
+    err = shell_session_input(&srv->ctx, &conn->session, conn->input,
+                              &conn->output);
+    if (err != 0) {
+      return err;
+    }
+  }
+  return 0;
+}
+
+// Feeds what is left from the last pass, then reads what the peer sent
+// and feeds that, until the socket is drained or the connection is paused.
+// Only an empty buffer is refilled: a paused one keeps its rest.
+int server_read(server *srv, connection *conn) {
+  int err = server_feed(srv, conn);
+
+  while (err == 0 && !conn->closing && !server_paused(conn)) {
+    ssize_t got = recv(conn->fd, conn->received, sizeof(conn->received), 0);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    if (got <= 0) {
+      conn->closing = 1;
+      break;
+    }
+    conn->received_pos = 0;
+    conn->received_len = (size_t)got;
+    err = server_feed(srv, conn);
+  }
+  return err;
+}
+
+void server_flush(server *srv, connection *conn) {
+  while (conn->output.len > 0) {
+    ssize_t sent =
+        send(conn->fd, conn->output.data, conn->output.len, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    if (sent < 0) {
+      conn->closing = 1;
+      conn->output.len = 0;
+      break;
+    }
+    shell_output_consume(&conn->output, (size_t)sent);
+  }
+
+  if (conn->closing) {
+    return;
+  }
+  // Past the limit only EPOLLOUT is wanted; reading resumes below it.
+  if ((conn->output.len < SERVER_OUTPUT_LIMIT) != conn->reading ||
+      (conn->output.len > 0) != conn->writing) {
+    struct epoll_event ev = {0};
+    conn->reading = conn->output.len < SERVER_OUTPUT_LIMIT;
+    conn->writing = conn->output.len > 0;
+    ev.events = (conn->reading ? EPOLLIN : 0) | (conn->writing ? EPOLLOUT : 0);
+    ev.data.ptr = conn;
+    epoll_ctl(srv->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+  }
+}
+
+void server_drop(server *srv, connection *conn) {
+  epoll_ctl(srv->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+  close(conn->fd);
+  shell_output_free(&conn->output);
+  free(conn);
+  --srv->sessions;
+}
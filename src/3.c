@@ -1,33 +1,345 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
-int main(int argc, char *argv[]) {
-  unsigned char data[BUFSIZ];
-  FILE *fin = NULL;
-  FILE *fout = NULL;
-  size_t bytes_read = 0;
+#include "../include/copy_engine.h"
+#include "../include/parallel_copy.h"
+#include "../include/tree_copy.h"
+
+// Copies <src> to <dst> through the fastest path the kernel accepts (see
+// copy_engine.h) and reports which one moved the data. --via starts the
+// fallback chain further down, e.g. to compare against the buffered loop.
+//
+// --parallel N copies chunks on N threads with pread/pwrite instead and
+// checksums every chunk on the way (parallel_copy.h); --manifest saves those
+// checksums so `--verify <file> <manifest>` can later re-check the copy, or
+// the source, and name the chunks that changed.
+//
+// -r copies a whole directory tree, keeping --depth files in flight through
+// io_uring, or through a thread pool (--engine threads, or when io_uring is
+// unavailable), and preserving modes and timestamps (tree_copy.h).
+#define PROGRESS_SECONDS 1.0
+
+typedef struct {
+  copy_path first;
+  int parallel;
+  size_t threads;
+  size_t chunk_size;
+  const char *manifest_path;
+  int recursive;
+  tree_copy_options tree;
+} copy_options;
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "Usage: %s <src> <dst> [--via reflink|copy_file_range|splice|buffer]"
+          "\n"
+          "       %s <src> <dst> --parallel N [--chunk-size BYTES] "
+          "[--manifest PATH]\n"
+          "       %s --verify <file> <manifest> [--parallel N]\n"
+          "       %s -r <src_dir> <dst_dir> [--depth N] "
+          "[--engine auto|uring|threads]\n"
+          "--parallel 0 runs one thread per CPU; it and --verify need a "
+          "regular file\n"
+          "--chunk-size is 1..%zu\n",
+          name, name, name, name, PARALLEL_COPY_MAX_CHUNK);
+}
+
+static int parse_options(int argc, char *argv[], int first_option,
+                         copy_options *opts) {
+  char *end = NULL;
+
+  for (int i = first_option; i < argc; i += 2) {
+    if (i + 1 >= argc) {
+      return INVALID_CLI_ARGUMENT;
+    }
+    errno = 0;
+    end = NULL;
+    if (strcmp(argv[i], "--via") == 0) {
+      if (copy_path_parse(argv[i + 1], &opts->first) != 0) {
+        return INVALID_CLI_ARGUMENT;
+      }
+      continue;
+    } else if (strcmp(argv[i], "--parallel") == 0) {
+      opts->parallel = 1;
+      if (!parallel_scan_threads_parse(argv[i + 1], &opts->threads)) {
+        return INVALID_CLI_ARGUMENT;
+      }
+      continue;
+    } else if (strcmp(argv[i], "--chunk-size") == 0) {
+      opts->chunk_size = strtoull(argv[i + 1], &end, 10);
+      if (opts->chunk_size == 0 ||
+          opts->chunk_size > PARALLEL_COPY_MAX_CHUNK) {
+        return INVALID_CLI_ARGUMENT;
+      }
+    } else if (strcmp(argv[i], "--manifest") == 0) {
+      opts->manifest_path = argv[i + 1];
+      continue;
+    } else if (strcmp(argv[i], "--depth") == 0 && opts->recursive) {
+      opts->tree.depth = strtoull(argv[i + 1], &end, 10);
+    } else if (strcmp(argv[i], "--engine") == 0 && opts->recursive) {
+      if (tree_engine_parse(argv[i + 1], &opts->tree.engine) != 0) {
+        return INVALID_CLI_ARGUMENT;
+      }
+      continue;
+    } else {
+      return INVALID_CLI_ARGUMENT;
+    }
+    if (errno != 0 || *end != '\0' || argv[i + 1][0] == '-') {
+      return INVALID_CLI_ARGUMENT;
+    }
+  }
+  return 0;
+}
+
+static int copy_single(const char *src, const char *dst,
+                       const copy_options *opts) {
+  copy_stats stats = {0};
+  struct stat dst_st;
+  struct stat out_st;
+  err_t err = copy_engine_file(src, dst, opts->first, &stats);
+
+  if (err == INVALID_INPUT_DATA) {
+    fprintf(stderr, "%s and %s are the same file\n", src, dst);
+    return 1;
+  }
+  if (err != 0) {
+    fprintf(stderr, "Error copying %s to %s: %s\n", src, dst,
+            strerror(errno));
+    return 1;
+  }
+
+  // Copying to /dev/stdout: keep the report out of the copied data.
+  if (stat(dst, &dst_st) == 0 && fstat(STDOUT_FILENO, &out_st) == 0 &&
+      dst_st.st_dev == out_st.st_dev && dst_st.st_ino == out_st.st_ino) {
+    return 0;
+  }
+  printf("copied %llu bytes via %s, skipped %llu bytes of holes\n",
+         (unsigned long long)stats.bytes, copy_path_name(stats.path),
+         (unsigned long long)stats.holes);
+  return 0;
+}
+
+static int copy_parallel(const char *src, const char *dst,
+                         const copy_options *opts) {
+  parallel_copy_options popts = {opts->threads, opts->chunk_size,
+                                 PROGRESS_SECONDS, stderr};
+  copy_manifest manifest;
+  struct stat in_st;
+  struct stat out_st;
+  double start = now_seconds(), elapsed = 0;
+  int in_fd = -1, out_fd = -1;
+  err_t err = 0;
+
+  in_fd = open(src, O_RDONLY | O_CLOEXEC);
+  if (in_fd == -1 || fstat(in_fd, &in_st) == -1) {
+    fprintf(stderr, "Error opening %s: %s\n", src, strerror(errno));
+    return 1;
+  }
+  // Its size is the whole job, so a pipe would copy as empty.
+  if (!S_ISREG(in_st.st_mode)) {
+    fprintf(stderr, "--parallel needs a regular file, %s is not one\n", src);
+    close(in_fd);
+    return 1;
+  }
+  out_fd = open(dst, O_WRONLY | O_CREAT | O_CLOEXEC, in_st.st_mode & 07777);
+  if (out_fd == -1 || fstat(out_fd, &out_st) == -1) {
+    fprintf(stderr, "Error opening %s: %s\n", dst, strerror(errno));
+    close(in_fd);
+    return 1;
+  }
+  if (in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino) {
+    fprintf(stderr, "%s and %s are the same file\n", src, dst);
+    close(in_fd);
+    close(out_fd);
+    return 1;
+  }
+
+  err = parallel_copy_fd(in_fd, out_fd, &popts, &manifest);
+  close(in_fd);
+  if (close(out_fd) == -1 && err == 0) {
+    copy_manifest_free(&manifest);
+    err = OPENING_THE_FILE_ERROR;
+  }
+  if (err == INVALID_INPUT_DATA) {
+    fprintf(stderr, "%s shrank while it was being copied\n", src);
+    return 1;
+  }
+  if (err != 0) {
+    fprintf(stderr, "Error copying %s to %s: %s\n", src, dst,
+            strerror(errno));
+    return 1;
+  }
+  elapsed = now_seconds() - start;
 
-  if (argc != 3) {
-    fprintf(stderr, "Incorrect usage\n");
+  printf("copied %" PRIu64 " bytes in %zu chunks on %zu threads, %.3f s "
+         "(%.1f MB/s), crc32c %08" PRIx32 "\n",
+         manifest.size, manifest.chunks_count,
+         parallel_scan_threads(opts->threads), elapsed,
+         elapsed > 0 ? manifest.size / elapsed / 1e6 : 0.0,
+         copy_manifest_crc32c(&manifest));
+  if (opts->manifest_path != NULL &&
+      copy_manifest_save(&manifest, opts->manifest_path) != 0) {
+    fprintf(stderr, "Error writing manifest %s: %s\n", opts->manifest_path,
+            strerror(errno));
+    copy_manifest_free(&manifest);
+    return 1;
   }
+  copy_manifest_free(&manifest);
+  return 0;
+}
 
-  fin = fopen(argv[1], "rb");
-  if (fin == NULL) {
-    fprintf(stderr, "Error opening a file\n");
+static int copy_tree(const char *src, const char *dst,
+                     const copy_options *opts) {
+  tree_copy_stats stats;
+  double start = now_seconds(), elapsed = 0;
+  err_t err = tree_copy(src, dst, &opts->tree, &stats);
+
+  elapsed = now_seconds() - start;
+  if (err != 0 && err != INVALID_INPUT_DATA) {
+    fprintf(stderr, "Error copying %s to %s: %s\n", src, dst,
+            err == INVALID_FLAG ? "io_uring is not available"
+                                : strerror(errno));
+    return 1;
+  }
+  if (err == INVALID_INPUT_DATA && stats.failed == 0) {
+    fprintf(stderr, "%s is inside %s\n", dst, src);
     return 1;
   }
 
-  fout = fopen(argv[2], "wb");
-  if (fin == NULL) {
-    fprintf(stderr, "Error opening a file\n");
-    fclose(fin);
+  printf("copied %zu files (%" PRIu64 " bytes), %zu directories, %zu "
+         "symlinks via %s, depth %zu, %.3f s (%.0f files/s)\n",
+         stats.files, stats.bytes, stats.dirs, stats.symlinks,
+         tree_engine_name(stats.engine),
+         opts->tree.depth ? opts->tree.depth : TREE_COPY_DEFAULT_DEPTH,
+         elapsed, elapsed > 0 ? stats.files / elapsed : 0.0);
+  if (stats.skipped > 0) {
+    printf("skipped %zu special files\n", stats.skipped);
+  }
+  if (stats.failed > 0) {
+    fprintf(stderr, "%zu entries failed, first %s: %s\n", stats.failed,
+            stats.first_failure, strerror(stats.first_errno));
+    return 1;
+  }
+  return 0;
+}
+
+static int verify(const char *path, const char *manifest_path,
+                  const copy_options *opts) {
+  parallel_copy_options popts = {opts->threads, 0, PROGRESS_SECONDS, stderr};
+  copy_manifest expected;
+  copy_manifest actual;
+  struct stat st;
+  size_t mismatches = 0;
+  int fd = -1;
+  err_t err = copy_manifest_load(&expected, manifest_path);
+
+  if (err != 0) {
+    fprintf(stderr, "Error reading manifest %s: %s\n", manifest_path,
+            err == INVALID_INPUT_DATA ? "malformed" : strerror(errno));
+    return 1;
+  }
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1 || fstat(fd, &st) == -1) {
+    fprintf(stderr, "Error opening %s: %s\n", path, strerror(errno));
+    copy_manifest_free(&expected);
+    return 1;
+  }
+  if (!S_ISREG(st.st_mode)) {
+    fprintf(stderr, "--verify needs a regular file, %s is not one\n", path);
+    close(fd);
+    copy_manifest_free(&expected);
+    return 1;
+  }
+  popts.chunk_size = expected.chunk_size;
+  err = parallel_copy_fd(fd, -1, &popts, &actual);
+  close(fd);
+  if (err == 0 && actual.chunk_size != expected.chunk_size) {
+    fprintf(stderr, "manifest chunk size %zu is not a multiple of %zu\n",
+            expected.chunk_size, PARALLEL_COPY_ALIGN);
+    copy_manifest_free(&actual);
+    err = INVALID_INPUT_DATA;
+  }
+  if (err != 0) {
+    if (err != INVALID_INPUT_DATA) {
+      fprintf(stderr, "Error reading %s: %s\n", path, strerror(errno));
+    }
+    copy_manifest_free(&expected);
     return 1;
   }
 
-  do {
-    bytes_read = fread(data, 1, BUFSIZ, fin);
-    fwrite(data, 1, bytes_read, fout);
-  } while (bytes_read != 0);
+  if (actual.size != expected.size) {
+    printf("size: expected %" PRIu64 " got %" PRIu64 "\n", expected.size,
+           actual.size);
+    mismatches++;
+  }
+  // With different sizes the last chunk of the shorter file is cut short,
+  // so only chunks whole in both files can compare equal.
+  for (size_t i = 0; i < expected.chunks_count; ++i) {
+    uint64_t offset = (uint64_t)i * expected.chunk_size;
+    int comparable =
+        i < actual.chunks_count &&
+        (actual.size == expected.size ||
+         offset + expected.chunk_size <=
+             (actual.size < expected.size ? actual.size : expected.size));
+    if (!comparable || actual.crcs[i] != expected.crcs[i]) {
+      printf("chunk at %" PRIu64 ": expected %08" PRIx32 " got %08" PRIx32
+             "\n",
+             offset, expected.crcs[i],
+             i < actual.chunks_count ? actual.crcs[i] : 0);
+      mismatches++;
+    }
+  }
+  printf("%s: %zu chunks, %zu mismatches, crc32c %08" PRIx32 "\n", path,
+         expected.chunks_count, mismatches, copy_manifest_crc32c(&actual));
+
+  copy_manifest_free(&expected);
+  copy_manifest_free(&actual);
+  return mismatches == 0 ? 0 : 1;
+}
 
-  fclose(fin);
-  fclose(fout);
+int main(int argc, char *argv[]) {
+  copy_options opts = {COPY_PATH_REFLINK, 0, 0, 0, NULL, 0,
+                       {TREE_COPY_DEFAULT_DEPTH, TREE_ENGINE_AUTO}};
+  int verifying = argc > 1 && strcmp(argv[1], "--verify") == 0;
+  int first_option = verifying ? 4 : 3;
+
+  opts.recursive = argc > 1 && strcmp(argv[1], "-r") == 0;
+  if (opts.recursive) {
+    first_option = 4;
+  }
+  if (argc < first_option ||
+      parse_options(argc, argv, first_option, &opts) != 0 ||
+      (opts.parallel && opts.first != COPY_PATH_REFLINK) ||
+      ((verifying || opts.recursive) &&
+       (opts.chunk_size != 0 || opts.manifest_path != NULL ||
+        opts.first != COPY_PATH_REFLINK)) ||
+      (opts.recursive && opts.parallel) ||
+      (!verifying && !opts.parallel &&
+       (opts.chunk_size != 0 || opts.manifest_path != NULL))) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (verifying) {
+    return verify(argv[2], argv[3], &opts);
+  }
+  if (opts.recursive) {
+    return copy_tree(argv[2], argv[3], &opts);
+  }
+  if (opts.parallel) {
+    return copy_parallel(argv[1], argv[2], &opts);
+  }
+  return copy_single(argv[1], argv[2], &opts);
 }
@@ -1,78 +1,1135 @@
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
-int is_prime_byte(unsigned char b) {
-  static const unsigned char prime_table[256] = {
-      [2] = 1,   [3] = 1,   [5] = 1,   [7] = 1,   [11] = 1,  [13] = 1,
-      [17] = 1,  [19] = 1,  [23] = 1,  [29] = 1,  [31] = 1,  [37] = 1,
-      [41] = 1,  [43] = 1,  [47] = 1,  [53] = 1,  [59] = 1,  [61] = 1,
-      [67] = 1,  [71] = 1,  [73] = 1,  [79] = 1,  [83] = 1,  [89] = 1,
-      [97] = 1,  [101] = 1, [103] = 1, [107] = 1, [109] = 1, [113] = 1,
-      [127] = 1, [131] = 1, [137] = 1, [139] = 1, [149] = 1, [151] = 1,
-      [157] = 1, [163] = 1, [167] = 1, [173] = 1, [179] = 1, [181] = 1,
-      [191] = 1, [193] = 1, [197] = 1, [199] = 1, [211] = 1, [223] = 1,
-      [227] = 1, [229] = 1, [233] = 1, [239] = 1, [241] = 1, [251] = 1};
-  return prime_table[b];
-}
+#include "../include/block_index.h"
+#include "../include/crc32c.h"
+#include "../include/mapped_file.h"
+#include "../include/parallel_scan.h"
+#include "../include/scan_expr.h"
+#include "../include/scan_kernels.h"
+#include "../include/xxhash.h"
+
+#define READ_BLOCK_SIZE (1 << 20)  // multiple of 8, so words never straddle
+#define READ_BLOCK_ALIGN (4096)
+#define SCAN_SLICE_SIZE (256 << 10)  // L2-sized, multiple of 8
+#define BENCH_REPEATS 5
+#define MAX_QUERIES 64
+#define MAX_EXPRS 8
+#define INDEX_SUFFIX ".idx"
+#define MAX_PATH_LEN 4096
+
+typedef enum {
+  QUERY_XOR8,
+  QUERY_XOR16,
+  QUERY_XOR32,
+  QUERY_XOR64,
+  QUERY_XORODD,
+  QUERY_MASK,
+  QUERY_CRC32C,
+  QUERY_XXH64,
+  QUERY_HISTOGRAM,
+  QUERY_ENTROPY,
+  QUERY_PRIMES,
+  QUERY_BLOCK_ENTROPY,
+  QUERY_EXPR
+} query_kind;
+
+typedef struct {
+  query_kind kind;
+  size_t slot;  // index into plan.masks (QUERY_MASK) or exprs (QUERY_EXPR)
+} query;
+
+typedef struct {
+  query queries[MAX_QUERIES];
+  size_t queries_count;
+  scan_plan plan;
+  int crc32c;
+  int xxh64;
+  int histogram;        // histogram, entropy, primes and blockentropy
+  size_t entropy_block;  // block size for blockentropy, 0 if not asked
+  scan_expr exprs[MAX_EXPRS];
+  const char *expr_sources[MAX_EXPRS];
+  size_t exprs_count;
+} query_set;
+
+// Everything one pass over the input produces.
+typedef struct {
+  scan_totals totals;
+  uint32_t crc32c;
+  xxh64_state xxh64;
+  uint64_t histogram[256];
+  uint64_t block_histogram[256];  // the entropy block in progress
+  size_t block_fill;
+  uint64_t expr_values[MAX_EXPRS];
+  double *block_entropy;
+  size_t blocks_count;
+  size_t blocks_capacity;
+  int owns_blocks;  // parallel chunks write into a shared array instead
+  err_t err;
+} scan_results;
+
+typedef enum { INDEX_OFF, INDEX_BUILD, INDEX_REVERIFY } index_mode;
+
+typedef struct {
+  index_mode mode;
+  size_t block_size;
+  const char *ranges_spec;  // "begin-end[,begin-end...]", end exclusive
+} index_options;
+
+typedef struct {
+  const scan_kernels *kernels;
+  const query_set *qs;
+  uint32_t *chunk_crcs;  // CRCs must be combined in file order
+  double *block_entropy;
+  size_t blocks_per_chunk;
+} scan_context;
+
+typedef struct {
+  scan_totals totals;
+  uint64_t histogram[256];
+  uint64_t expr_values[MAX_EXPRS];
+  err_t err;
+} scan_partial_sums;
+
+// padded to whole cache lines so thread partials never share one
+typedef union {
+  scan_partial_sums sums;
+  unsigned char pad[(sizeof(scan_partial_sums) + 63) / 64 * 64];
+} scan_partial;
+
+static int parse_queries(const char **tokens, size_t count, query_set *qs);
+static void scan_results_init(scan_results *results);
+static void scan_results_finish(const query_set *qs, scan_results *results);
+static void scan_results_free(scan_results *results);
+static err_t scan_results_reserve(scan_results *results, size_t blocks);
+static void scan_range(const scan_kernels *kernels, const query_set *qs,
+                       const unsigned char *data, size_t len,
+                       scan_results *results);
+static int scan_stream(int fd, const scan_kernels *kernels,
+                       const query_set *qs, scan_results *results,
+                       uint64_t *bytes_placeholder);
+static int scan_parallel(const scan_kernels *kernels, const query_set *qs,
+                         const unsigned char *data, size_t len, size_t threads,
+                         scan_results *results);
+static int scan_indexed(const char *path, const index_options *opts,
+                        const scan_kernels *kernels, const query_set *qs,
+                        size_t threads, scan_results *results,
+                        uint64_t *bytes_placeholder);
+static void print_results(const char *path, uint64_t bytes, const query_set *qs,
+                          const scan_results *results, int json);
+static void run_bench(const mapped_file *mf, uint32_t mask, size_t threads);
 
 int main(int argc, char *argv[]) {
-  FILE *fin = NULL;
-  if (argc < 3) {
+  const char *positional[MAX_QUERIES * 2 + 1];
+  size_t positional_count = 0;
+  scan_isa isa = SCAN_ISA_COUNT;  // best available
+  size_t threads = 1;
+  int json = 0;
+  index_options index = {INDEX_OFF, BLOCK_INDEX_DEFAULT_BLOCK, NULL};
+  char *endptr = NULL;
+  const scan_kernels *kernels = NULL;
+  query_set qs;
+  scan_results results;
+  uint64_t bytes = 0;
+  mapped_file mf;
+  int err = 0;
+
+  memset(&qs, 0, sizeof(qs));
+  scan_results_init(&results);
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--isa") == 0) {
+      if (i + 1 >= argc || !scan_isa_from_name(argv[i + 1], &isa)) {
+        fprintf(stderr, "--isa expects scalar, sse2 or avx2\n");
+        return 1;
+      }
+      ++i;
+    } else if (strcmp(argv[i], "--threads") == 0) {
+      if (i + 1 >= argc || !parallel_scan_threads_parse(argv[++i], &threads)) {
+        fprintf(stderr, "--threads expects 0..%zu (0 = all CPUs)\n",
+                parallel_scan_threads_max());
+        return 1;
+      }
+      threads = parallel_scan_threads(threads);
+    } else if (strcmp(argv[i], "--json") == 0) {
+      json = 1;
+    } else if (strcmp(argv[i], "--index") == 0) {
+      index.mode = INDEX_BUILD;
+    } else if (strcmp(argv[i], "--reverify") == 0) {
+      index.mode = INDEX_REVERIFY;
+    } else if (strcmp(argv[i], "--block-size") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "--block-size expects a multiple of 4096\n");
+        return 1;
+      }
+      index.block_size = strtoull(argv[++i], &endptr, 0);
+      if (*endptr != '\0' || index.block_size == 0 ||
+          index.block_size % BLOCK_INDEX_BLOCK_ALIGN != 0) {
+        fprintf(stderr, "--block-size expects a multiple of 4096\n");
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--ranges") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "--ranges expects begin-end[,begin-end...]\n");
+        return 1;
+      }
+      index.ranges_spec = argv[++i];
+    } else if (positional_count < sizeof(positional) / sizeof(*positional)) {
+      positional[positional_count++] = argv[i];
+    } else {
+      fprintf(stderr, "too many queries\n");
+      return 1;
+    }
+  }
+
+  if (positional_count < 2) {
     fprintf(stderr, "incorrect usage\n");
+    fprintf(stderr,
+            "Usage: %s <file> <query>... [--json] [--isa scalar|sse2|avx2] "
+            "[--threads N]\n"
+            "       %s <file> <query>... --index [--block-size N]\n"
+            "       %s <file> <query>... --reverify [--ranges B-E,...]\n"
+            "       %s <file> bench [<hex>] [--threads N]\n"
+            "queries: xor8 xor16 xor32 xor64 xorodd mask <hex> crc32c xxh64\n"
+            "         histogram entropy primes blockentropy [--block-size N]\n"
+            "         expr \"<u8|u16|u32|u64> <count|xor|sum> [value] "
+            "[where pred]\"\n",
+            argv[0], argv[0], argv[0], argv[0]);
     return 1;
   }
 
-  fin = fopen(argv[1], "rb");
-  if (fin == NULL) {
+  kernels = scan_kernels_select(isa);
+
+  if (strcmp(positional[1], "bench") == 0) {
+    uint32_t mask = 0;
+    if (positional_count > 2) {
+      mask = (uint32_t)strtoul(positional[2], NULL, 16);
+    }
+    if (mapped_file_open(&mf, positional[0]) != 0) {
+      fprintf(stderr, "failed to open a file\n");
+      return 1;
+    }
+    run_bench(&mf, mask, threads);
+    mapped_file_close(&mf);
+    return 0;
+  }
+
+  err = parse_queries(positional + 1, positional_count - 1, &qs);
+  if (err) {
+    return 1;
+  }
+  if (qs.entropy_block != 0) {
+    qs.entropy_block = index.block_size;
+  }
+
+  if (index.ranges_spec != NULL && index.mode != INDEX_REVERIFY) {
+    fprintf(stderr, "--ranges only applies to --reverify\n");
+    return 1;
+  }
+  if (index.mode != INDEX_OFF) {
+    if (scan_indexed(positional[0], &index, kernels, &qs, threads, &results,
+                     &bytes) != 0) {
+      return 1;
+    }
+    print_results(positional[0], bytes, &qs, &results, json);
+    return 0;
+  }
+
+  err = mapped_file_open(&mf, positional[0]);
+  if (err == MEMORY_MAPPING_ERROR) {
+    // pipes and other unmappable inputs go through the block reader
+    int fd = open(positional[0], O_RDONLY);
+    if (fd == -1 || scan_stream(fd, kernels, &qs, &results, &bytes) != 0 ||
+        results.err != 0) {
+      fprintf(stderr, "failed to read a file\n");
+      if (fd != -1) {
+        close(fd);
+      }
+      return 1;
+    }
+    close(fd);
+  } else if (err != 0) {
     fprintf(stderr, "failed to open a file\n");
     return 1;
+  } else if (threads > 1) {
+    bytes = mf.size;
+    err = scan_parallel(kernels, &qs, mf.data, mf.size, threads, &results);
+    mapped_file_close(&mf);
+    if (err != 0) {
+      fprintf(stderr, "parallel scan failed\n");
+      return 1;
+    }
+  } else {
+    bytes = mf.size;
+    if (qs.entropy_block != 0) {
+      scan_results_reserve(&results, parallel_scan_chunks(mf.size,
+                                                          qs.entropy_block));
+    }
+    if (mf.data != NULL) {
+      madvise((void *)mf.data, mf.size, MADV_SEQUENTIAL);
+      scan_range(kernels, &qs, mf.data, mf.size, &results);
+    }
+    scan_results_finish(&qs, &results);
+    mapped_file_close(&mf);
+  }
+
+  if (results.err != 0) {
+    fprintf(stderr, "failed to allocate memory\n");
+    scan_results_free(&results);
+    return 1;
   }
+  print_results(positional[0], bytes, &qs, &results, json);
+  scan_results_free(&results);
+
+  return 0;
+}
+
+static int parse_queries(const char **tokens, size_t count, query_set *qs) {
+  static const char *xor_names[] = {"xor8", "xor16", "xor32", "xor64"};
+  size_t i = 0, slot = 0;
+  uint32_t mask = 0;
 
-  if (strcmp(argv[2], "xor8") == 0) {
-    unsigned char byte, result = 0;
-    while (fread(&byte, 1, 1, fin) == 1) {
-      result ^= byte;
-    }
-    printf("%u\n", result);
-  } else if (strcmp(argv[2], "xorodd") == 0) {
-    unsigned int val, result = 0;
-    while (fread(&val, 4, 1, fin) == 1) {
-      unsigned char *bytes = (unsigned char *)&val;
-      int has_prime = 0;
-      for (int i = 0; i < 4; i++) {
-        if (is_prime_byte(bytes[i])) {
-          has_prime = 1;
+  for (i = 0; i < count; ++i) {
+    query *q = &qs->queries[qs->queries_count];
+    int known = 0;
+
+    if (qs->queries_count == MAX_QUERIES) {
+      fprintf(stderr, "too many queries\n");
+      return INVALID_FLAG;
+    }
+
+    for (int w = 0; w < 4; ++w) {
+      if (strcmp(tokens[i], xor_names[w]) == 0) {
+        q->kind = (query_kind)(QUERY_XOR8 + w);
+        qs->plan.xor_widths = 1;
+        known = 1;
+      }
+    }
+    if (strcmp(tokens[i], "xorodd") == 0) {
+      q->kind = QUERY_XORODD;
+      qs->plan.xorodd = 1;
+      known = 1;
+    } else if (strcmp(tokens[i], "crc32c") == 0) {
+      q->kind = QUERY_CRC32C;
+      qs->crc32c = 1;
+      known = 1;
+    } else if (strcmp(tokens[i], "xxh64") == 0) {
+      q->kind = QUERY_XXH64;
+      qs->xxh64 = 1;
+      known = 1;
+    } else if (strcmp(tokens[i], "histogram") == 0) {
+      q->kind = QUERY_HISTOGRAM;
+      qs->histogram = 1;
+      known = 1;
+    } else if (strcmp(tokens[i], "entropy") == 0) {
+      q->kind = QUERY_ENTROPY;
+      qs->histogram = 1;
+      known = 1;
+    } else if (strcmp(tokens[i], "primes") == 0) {
+      q->kind = QUERY_PRIMES;
+      qs->histogram = 1;
+      known = 1;
+    } else if (strcmp(tokens[i], "blockentropy") == 0) {
+      q->kind = QUERY_BLOCK_ENTROPY;
+      qs->histogram = 1;
+      qs->entropy_block = 1;  // real size filled in from --block-size
+      known = 1;
+    } else if (strcmp(tokens[i], "mask") == 0) {
+      if (i + 1 >= count) {
+        fprintf(stderr, "mask mode requires hex mask argument\n");
+        return INVALID_FLAG;
+      }
+      mask = (uint32_t)strtoul(tokens[++i], NULL, 16);
+      for (slot = 0; slot < qs->plan.masks_count; ++slot) {
+        if (qs->plan.masks[slot] == mask) {
           break;
         }
       }
-      if (has_prime) {
-        result ^= val;
+      if (slot == qs->plan.masks_count) {
+        if (slot == SCAN_MAX_MASKS) {
+          fprintf(stderr, "at most %d distinct masks per run\n",
+                  SCAN_MAX_MASKS);
+          return INVALID_FLAG;
+        }
+        qs->plan.masks[qs->plan.masks_count++] = mask;
       }
+      q->kind = QUERY_MASK;
+      q->slot = slot;
+      known = 1;
+    } else if (strcmp(tokens[i], "expr") == 0) {
+      char error[SCAN_EXPR_ERROR_SIZE];
+      if (i + 1 >= count) {
+        fprintf(stderr, "expr requires an expression argument\n");
+        return INVALID_FLAG;
+      }
+      if (qs->exprs_count == MAX_EXPRS) {
+        fprintf(stderr, "at most %d expressions per run\n", MAX_EXPRS);
+        return INVALID_FLAG;
+      }
+      slot = qs->exprs_count;
+      if (scan_expr_compile(tokens[++i], &qs->exprs[slot], error) != 0) {
+        fprintf(stderr, "expr \"%s\": %s\n", tokens[i], error);
+        return INVALID_FLAG;
+      }
+      qs->expr_sources[qs->exprs_count++] = tokens[i];
+      q->kind = QUERY_EXPR;
+      q->slot = slot;
+      known = 1;
     }
-    printf("%X\n", result);
-  } else if (strcmp(argv[2], "mask") == 0) {
-    if (argc < 4) {
-      fprintf(stderr, "mask mode requires hex mask argument\n");
-      fclose(fin);
-      return 1;
+
+    if (!known) {
+      fprintf(stderr, "Invalid flag\n");
+      return INVALID_FLAG;
+    }
+    qs->queries_count++;
+  }
+
+  return 0;
+}
+
+static void scan_results_init(scan_results *results) {
+  memset(results, 0, sizeof(*results));
+  xxh64_reset(&results->xxh64, 0);
+  results->owns_blocks = 1;
+}
+
+static void scan_results_free(scan_results *results) {
+  if (results->owns_blocks) {
+    free(results->block_entropy);
+  }
+  results->block_entropy = NULL;
+  results->blocks_count = 0;
+  results->blocks_capacity = 0;
+}
+
+static err_t scan_results_reserve(scan_results *results, size_t blocks) {
+  double *grown = NULL;
+  if (blocks <= results->blocks_capacity) {
+    return 0;
+  }
+  grown = (double *)realloc(results->block_entropy, blocks * sizeof(double));
+  if (grown == NULL) {
+    results->err = MEMORY_ALLOCATION_ERROR;
+    return MEMORY_ALLOCATION_ERROR;
+  }
+  results->block_entropy = grown;
+  results->blocks_capacity = blocks;
+  return 0;
+}
+
+// Records the entropy of the block in progress and folds its counts into
+// the whole-input histogram.
+static void scan_results_close_block(scan_results *results) {
+  if (results->blocks_count == results->blocks_capacity &&
+      (!results->owns_blocks ||
+       scan_results_reserve(results, results->blocks_capacity * 2 + 16) !=
+           0)) {
+    results->err = MEMORY_ALLOCATION_ERROR;
+  } else {
+    results->block_entropy[results->blocks_count++] =
+        scan_entropy(results->block_histogram);
+  }
+  for (int c = 0; c < 256; ++c) {
+    results->histogram[c] += results->block_histogram[c];
+  }
+  memset(results->block_histogram, 0, sizeof(results->block_histogram));
+  results->block_fill = 0;
+}
+
+// Closes a trailing partial entropy block once the input is exhausted.
+static void scan_results_finish(const query_set *qs, scan_results *results) {
+  if (qs->entropy_block != 0 && results->block_fill > 0) {
+    scan_results_close_block(results);
+  }
+}
+
+static void scan_histogram_range(const query_set *qs,
+                                 const unsigned char *data, size_t len,
+                                 scan_results *results) {
+  if (qs->entropy_block == 0) {
+    scan_histogram(data, len, results->histogram);
+    return;
+  }
+  while (len > 0) {
+    size_t n = qs->entropy_block - results->block_fill;
+    n = (len < n) ? len : n;
+    scan_histogram(data, n, results->block_histogram);
+    results->block_fill += n;
+    data += n;
+    len -= n;
+    if (results->block_fill == qs->entropy_block) {
+      scan_results_close_block(results);
+    }
+  }
+}
+
+// Runs every requested query over [data, data + len) one L2-sized slice at a
+// time: the checksums read each slice from cache right after the fused kernel
+// pulled it in, so all queries together cost one trip to memory. Only the
+// last range of the input may have a length that is not a multiple of 8.
+static void scan_range(const scan_kernels *kernels, const query_set *qs,
+                       const unsigned char *data, size_t len,
+                       scan_results *results) {
+  const scan_plan *plan = &qs->plan;
+  int reduce = plan->xor_widths || plan->xorodd || plan->masks_count > 0;
+  uint32_t (*crc_update)(uint32_t, const void *, size_t) =
+      (kernels->isa == SCAN_ISA_SCALAR) ? crc32c_update_portable
+                                        : crc32c_update;
+
+  for (size_t offset = 0; offset < len; offset += SCAN_SLICE_SIZE) {
+    size_t n =
+        (len - offset < SCAN_SLICE_SIZE) ? len - offset : SCAN_SLICE_SIZE;
+    if (reduce) {
+      kernels->fused(plan, data + offset, n, &results->totals);
+    }
+    if (qs->crc32c) {
+      results->crc32c = crc_update(results->crc32c, data + offset, n);
+    }
+    if (qs->xxh64) {
+      xxh64_update(&results->xxh64, data + offset, n);
+    }
+    if (qs->histogram) {
+      scan_histogram_range(qs, data + offset, n, results);
+    }
+    for (size_t e = 0; e < qs->exprs_count; ++e) {
+      if (scan_expr_run(&qs->exprs[e], kernels, data + offset, n,
+                        &results->expr_values[e]) != 0) {
+        results->err = MEMORY_ALLOCATION_ERROR;
+      }
+    }
+  }
+}
+
+static void scan_chunk(const unsigned char *data, size_t len,
+                       size_t chunk_index, void *partial, void *ctx) {
+  const scan_context *sc = (const scan_context *)ctx;
+  scan_results chunk;
+
+  scan_partial_sums *sums = &((scan_partial *)partial)->sums;
+
+  // chunks start on page boundaries; start readahead for the whole chunk
+  madvise((void *)data, len, MADV_WILLNEED);
+  scan_results_init(&chunk);
+  // chunks hold whole entropy blocks, so this chunk's blocks have fixed slots
+  if (sc->block_entropy != NULL) {
+    chunk.block_entropy =
+        sc->block_entropy + chunk_index * sc->blocks_per_chunk;
+    chunk.blocks_capacity = sc->blocks_per_chunk;
+    chunk.owns_blocks = 0;
+  }
+  scan_range(sc->kernels, sc->qs, data, len, &chunk);
+  scan_results_finish(sc->qs, &chunk);
+
+  scan_totals_merge(&sums->totals, &chunk.totals);
+  for (int c = 0; c < 256; ++c) {
+    sums->histogram[c] += chunk.histogram[c];
+  }
+  for (size_t e = 0; e < sc->qs->exprs_count; ++e) {
+    sums->expr_values[e] = scan_expr_merge(
+        &sc->qs->exprs[e], sums->expr_values[e], chunk.expr_values[e]);
+  }
+  if (chunk.err != 0) {
+    sums->err = chunk.err;
+  }
+  sc->chunk_crcs[chunk_index] = chunk.crc32c;
+}
+
+typedef struct {
+  const unsigned char *data;
+  size_t len;
+  xxh64_state *state;
+} xxh64_job;
+
+static void *xxh64_thread(void *arg) {
+  xxh64_job *job = (xxh64_job *)arg;
+  xxh64_update(job->state, job->data, job->len);
+  return NULL;
+}
+
+// Chunks are page-aligned, hence aligned for every word width, so each word
+// lands in exactly one chunk and the per-thread partials simply merge. CRCs
+// are kept per chunk and joined in order with crc32c_combine. XXH64 is one
+// serial chain that cannot be split, so it gets a thread of its own that
+// streams the whole input while the others work through the chunks. With
+// blockentropy, chunks are a whole number of entropy blocks.
+static int scan_parallel(const scan_kernels *kernels, const query_set *qs,
+                         const unsigned char *data, size_t len, size_t threads,
+                         scan_results *results) {
+  query_set chunk_qs = *qs;
+  scan_context ctx = {kernels, &chunk_qs, NULL, NULL, 0};
+  xxh64_job xxh = {data, len, &results->xxh64};
+  pthread_t xxh_tid;
+  int xxh_threaded = 0;
+  size_t chunk_size = PARALLEL_SCAN_DEFAULT_CHUNK;
+  size_t chunks = 0;
+  scan_partial *partials = NULL;
+  int err = 0;
+
+  if (qs->entropy_block != 0) {
+    chunk_size = (chunk_size + qs->entropy_block - 1) / qs->entropy_block *
+                 qs->entropy_block;
+    ctx.blocks_per_chunk = chunk_size / qs->entropy_block;
+    if (scan_results_reserve(results,
+                             parallel_scan_chunks(len, qs->entropy_block)) !=
+        0) {
+      return MEMORY_ALLOCATION_ERROR;
+    }
+    ctx.block_entropy = results->block_entropy;
+  }
+  chunks = parallel_scan_chunks(len, chunk_size);
+
+  chunk_qs.xxh64 = 0;
+  partials = (scan_partial *)calloc(threads, sizeof(scan_partial));
+  ctx.chunk_crcs = (uint32_t *)calloc(chunks + 1, sizeof(uint32_t));
+  if (partials == NULL || ctx.chunk_crcs == NULL) {
+    free(partials);
+    free(ctx.chunk_crcs);
+    return MEMORY_ALLOCATION_ERROR;
+  }
+
+  if (qs->xxh64 && threads > 1 &&
+      pthread_create(&xxh_tid, NULL, xxh64_thread, &xxh) == 0) {
+    xxh_threaded = 1;
+    threads--;
+  }
+  err = parallel_scan(data, len, chunk_size, threads, scan_chunk, &ctx,
+                      partials, sizeof(scan_partial));
+  if (xxh_threaded) {
+    pthread_join(xxh_tid, NULL);
+  } else if (qs->xxh64) {
+    xxh64_thread(&xxh);
+  }
+
+  if (err == 0) {
+    for (size_t t = 0; t < threads; ++t) {
+      scan_totals_merge(&results->totals, &partials[t].sums.totals);
+      for (int c = 0; c < 256; ++c) {
+        results->histogram[c] += partials[t].sums.histogram[c];
+      }
+      for (size_t e = 0; e < qs->exprs_count; ++e) {
+        results->expr_values[e] =
+            scan_expr_merge(&qs->exprs[e], results->expr_values[e],
+                            partials[t].sums.expr_values[e]);
+      }
+      if (partials[t].sums.err != 0) {
+        results->err = partials[t].sums.err;
+      }
     }
-    unsigned int mask = (unsigned int)strtoul(argv[3], NULL, 16);
-    unsigned int val;
-    unsigned int count = 0;
-    while (fread(&val, 4, 1, fin) == 1) {
-      if ((val & mask) == mask) {
-        count++;
+    if (qs->entropy_block != 0) {
+      results->blocks_count = parallel_scan_chunks(len, qs->entropy_block);
+    }
+    for (size_t c = 0; c < chunks; ++c) {
+      size_t chunk_len = len - c * chunk_size;
+      if (chunk_len > chunk_size) {
+        chunk_len = chunk_size;
       }
+      results->crc32c =
+          crc32c_combine(results->crc32c, ctx.chunk_crcs[c], chunk_len);
     }
-    printf("%u\n", count);
+  }
+
+  free(partials);
+  free(ctx.chunk_crcs);
+  return err;
+}
+
+// Fills whole READ_BLOCK_SIZE blocks before scanning them, so only the final
+// block can end in a partial word (which the word modes ignore, as fread did).
+static int scan_stream(int fd, const scan_kernels *kernels,
+                       const query_set *qs, scan_results *results,
+                       uint64_t *bytes_placeholder) {
+  unsigned char *block = NULL;
+  size_t filled = 0;
+  ssize_t bytes_read = 0;
+
+  if (posix_memalign((void **)&block, READ_BLOCK_ALIGN, READ_BLOCK_SIZE) != 0) {
+    return MEMORY_ALLOCATION_ERROR;
+  }
+
+  *bytes_placeholder = 0;
+  do {
+    bytes_read = read(fd, block + filled, READ_BLOCK_SIZE - filled);
+    if (bytes_read < 0) {
+      free(block);
+      return OPENING_THE_FILE_ERROR;
+    }
+    filled += (size_t)bytes_read;
+    if (filled == READ_BLOCK_SIZE || (bytes_read == 0 && filled > 0)) {
+      scan_range(kernels, qs, block, filled, results);
+      *bytes_placeholder += filled;
+      filled = 0;
+    }
+  } while (bytes_read != 0);
+  scan_results_finish(qs, results);
+
+  free(block);
+  return 0;
+}
+
+static int parse_ranges(const char *spec, block_range **ranges_placeholder,
+                        size_t *count_placeholder) {
+  block_range *ranges = NULL;
+  size_t count = 1;
+  const char *p = spec;
+  char *endptr = NULL;
+
+  for (const char *c = spec; *c != '\0'; ++c) {
+    count += *c == ',';
+  }
+  ranges = (block_range *)malloc(count * sizeof(block_range));
+  if (ranges == NULL) {
+    return MEMORY_ALLOCATION_ERROR;
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    ranges[i].begin = strtoull(p, &endptr, 0);
+    if (endptr == p || *endptr != '-') {
+      free(ranges);
+      return INVALID_CLI_ARGUMENT;
+    }
+    p = endptr + 1;
+    ranges[i].end = strtoull(p, &endptr, 0);
+    if (endptr == p || (*endptr != ',' && *endptr != '\0') ||
+        ranges[i].end < ranges[i].begin) {
+      free(ranges);
+      return INVALID_CLI_ARGUMENT;
+    }
+    p = endptr + 1;
+  }
+
+  *ranges_placeholder = ranges;
+  *count_placeholder = count;
+  return 0;
+}
+
+// --index scans the whole file and writes <file>.idx with per-block results
+// for crc32c, xor8..xor64, xorodd and the plan's masks. --reverify loads it,
+// recomputes only the blocks that changed (or the named ranges), writes the
+// updated records back and answers the queries from the stored partials.
+static int scan_indexed(const char *path, const index_options *opts,
+                        const scan_kernels *kernels, const query_set *qs,
+                        size_t threads, scan_results *results,
+                        uint64_t *bytes_placeholder) {
+  const scan_plan *plan = &qs->plan;
+  char index_path[MAX_PATH_LEN];
+  mapped_file mf;
+  struct stat st;
+  block_index idx;
+  block_range *ranges = NULL;
+  size_t ranges_count = 0, recomputed = 0, slot = 0;
+  size_t slot_map[SCAN_MAX_MASKS];
+  scan_totals stored;
+  int err = 0;
+
+  if (qs->xxh64 || qs->histogram || qs->exprs_count > 0) {
+    fprintf(stderr, "xxh64, expr and the histogram queries are not stored in "
+                    "the index, run them without it\n");
+    return INVALID_CLI_ARGUMENT;
+  }
+  if (snprintf(index_path, sizeof(index_path), "%s" INDEX_SUFFIX, path) >=
+      (int)sizeof(index_path)) {
+    fprintf(stderr, "path too long\n");
+    return INVALID_CLI_ARGUMENT;
+  }
+  if (opts->ranges_spec != NULL &&
+      parse_ranges(opts->ranges_spec, &ranges, &ranges_count) != 0) {
+    fprintf(stderr, "--ranges expects begin-end[,begin-end...]\n");
+    return INVALID_CLI_ARGUMENT;
+  }
+
+  err = mapped_file_open(&mf, path);
+  if (err != 0 || fstat(mf.fd, &st) == -1) {
+    fprintf(stderr, "indexing needs a regular file\n");
+    if (err == 0) {
+      mapped_file_close(&mf);
+    }
+    free(ranges);
+    return OPENING_THE_FILE_ERROR;
+  }
+
+  if (opts->mode == INDEX_BUILD) {
+    err = block_index_build(&idx, kernels, mf.data, &st, opts->block_size,
+                            plan->masks, plan->masks_count, threads);
+    recomputed = idx.blocks_count;
   } else {
-    fprintf(stderr, "Invalid flag\n");
-    fclose(fin);
-    return 1;
+    err = block_index_load(&idx, index_path);
+    if (err != 0) {
+      fprintf(stderr, "no usable %s, build it with --index first\n",
+              index_path);
+      mapped_file_close(&mf);
+      free(ranges);
+      return err;
+    }
+    err = block_index_refresh(&idx, kernels, mf.data, &st, ranges,
+                              ranges_count, threads, &recomputed);
+  }
+  mapped_file_close(&mf);
+  free(ranges);
+  if (err == 0) {
+    err = block_index_save(&idx, index_path);
+  }
+  if (err != 0) {
+    fprintf(stderr, "failed to update %s\n", index_path);
+    block_index_free(&idx);
+    return err;
+  }
+
+  for (size_t m = 0; m < plan->masks_count; ++m) {
+    for (slot = 0; slot < idx.header.masks_count; ++slot) {
+      if (idx.header.masks[slot] == plan->masks[m]) {
+        break;
+      }
+    }
+    if (slot == idx.header.masks_count) {
+      fprintf(stderr, "mask %X is not in %s, rebuild it with --index\n",
+              plan->masks[m], index_path);
+      block_index_free(&idx);
+      return INVALID_CLI_ARGUMENT;
+    }
+    slot_map[m] = slot;
   }
 
-  fclose(fin);
+  block_index_totals(&idx, &stored);
+  results->totals = stored;
+  for (size_t m = 0; m < plan->masks_count; ++m) {
+    results->totals.mask_counts[m] = stored.mask_counts[slot_map[m]];
+  }
+  results->crc32c = block_index_crc32c(&idx);
+  *bytes_placeholder = idx.header.file_size;
+
+  fprintf(stderr, "%zu of %zu blocks recomputed\n", recomputed,
+          idx.blocks_count);
+  block_index_free(&idx);
   return 0;
 }
+
+static void print_json_string(const char *str) {
+  putchar('"');
+  for (; *str != '\0'; ++str) {
+    unsigned char c = (unsigned char)*str;
+    if (c == '"' || c == '\\') {
+      printf("\\%c", c);
+    } else if (c < 0x20) {
+      printf("\\u%04x", c);
+    } else {
+      putchar(c);
+    }
+  }
+  putchar('"');
+}
+
+// histogram and blockentropy produce a list instead of a single value
+static void print_list(const query_set *qs, const scan_results *results,
+                       query_kind kind, int json, int bare) {
+  int histogram = kind == QUERY_HISTOGRAM;
+  size_t count = histogram ? 256 : results->blocks_count;
+
+  if (json) {
+    if (!histogram) {
+      printf(", \"block_size\": %zu", qs->entropy_block);
+    }
+    printf(", \"value\": [");
+    for (size_t i = 0; i < count; ++i) {
+      printf((i == 0) ? "" : ", ");
+      if (histogram) {
+        printf("%" PRIu64, results->histogram[i]);
+      } else {
+        printf("%.4f", results->block_entropy[i]);
+      }
+    }
+    printf("]}");
+    return;
+  }
+
+  if (!bare && histogram) {
+    printf("histogram:\n");
+  } else if (!bare) {
+    printf("blockentropy (%zu-byte blocks):\n", qs->entropy_block);
+  }
+  for (size_t i = 0; i < count; ++i) {
+    if (histogram) {
+      printf("%s%02zX: %" PRIu64 "\n", bare ? "" : "  ", i,
+             results->histogram[i]);
+    } else {
+      printf("%s%" PRIu64 ": %.4f\n", bare ? "" : "  ",
+             (uint64_t)i * qs->entropy_block, results->block_entropy[i]);
+    }
+  }
+}
+
+// A single query in text mode prints the bare value, as 4.c always has.
+static void print_results(const char *path, uint64_t bytes, const query_set *qs,
+                          const scan_results *results, int json) {
+  static const char *names[] = {
+      "xor8",  "xor16",     "xor32",   "xor64",  "xorodd",      "mask",
+      "crc32c", "xxh64", "histogram", "entropy", "primes", "blockentropy",
+      "expr"};
+  const scan_totals *totals = &results->totals;
+  int bare = !json && qs->queries_count == 1;
+  char value[32];
+
+  if (json) {
+    printf("{\"file\": ");
+    print_json_string(path);
+    printf(", \"bytes\": %" PRIu64 ", \"results\": [", bytes);
+  }
+
+  for (size_t i = 0; i < qs->queries_count; ++i) {
+    const query *q = &qs->queries[i];
+    uint32_t mask = qs->plan.masks[q->slot];
+    const scan_expr *expr = &qs->exprs[q->slot];
+    int numeric = q->kind == QUERY_XOR8 || q->kind == QUERY_MASK ||
+                  q->kind == QUERY_ENTROPY || q->kind == QUERY_PRIMES ||
+                  (q->kind == QUERY_EXPR && expr->agg != SCAN_EXPR_XOR);
+
+    if (q->kind == QUERY_HISTOGRAM || q->kind == QUERY_BLOCK_ENTROPY) {
+      if (json) {
+        printf("%s{\"query\": \"%s\"", (i == 0) ? "" : ", ",
+               names[q->kind]);
+      }
+      print_list(qs, results, q->kind, json, bare);
+      continue;
+    }
+
+    switch (q->kind) {
+      case QUERY_XOR8:
+        snprintf(value, sizeof(value), "%u", totals->xor8);
+        break;
+      case QUERY_XOR16:
+        snprintf(value, sizeof(value), "%X", totals->xor16);
+        break;
+      case QUERY_XOR32:
+        snprintf(value, sizeof(value), "%X", totals->xor32);
+        break;
+      case QUERY_XOR64:
+        snprintf(value, sizeof(value), "%" PRIX64, totals->xor64);
+        break;
+      case QUERY_XORODD:
+        snprintf(value, sizeof(value), "%X", totals->xorodd);
+        break;
+      case QUERY_MASK:
+        snprintf(value, sizeof(value), "%" PRIu64,
+                 totals->mask_counts[q->slot]);
+        break;
+      case QUERY_CRC32C:
+        snprintf(value, sizeof(value), "%08X", results->crc32c);
+        break;
+      case QUERY_XXH64:
+        snprintf(value, sizeof(value), "%016" PRIX64,
+                 xxh64_digest(&results->xxh64));
+        break;
+      case QUERY_ENTROPY:
+        snprintf(value, sizeof(value), "%.6f",
+                 scan_entropy(results->histogram));
+        break;
+      case QUERY_PRIMES:
+        snprintf(value, sizeof(value), "%" PRIu64,
+                 scan_prime_count(results->histogram));
+        break;
+      case QUERY_EXPR:
+        snprintf(value, sizeof(value),
+                 (expr->agg == SCAN_EXPR_XOR) ? "%" PRIX64 : "%" PRIu64,
+                 results->expr_values[q->slot]);
+        break;
+      default:
+        break;
+    }
+
+    if (json) {
+      printf("%s{\"query\": \"%s\"", (i == 0) ? "" : ", ", names[q->kind]);
+      if (q->kind == QUERY_MASK) {
+        printf(", \"mask\": \"%X\"", mask);
+      } else if (q->kind == QUERY_EXPR) {
+        printf(", \"expr\": ");
+        print_json_string(qs->expr_sources[q->slot]);
+      }
+      printf(numeric ? ", \"value\": %s}" : ", \"value\": \"%s\"}", value);
+    } else if (bare) {
+      printf("%s\n", value);
+    } else if (q->kind == QUERY_MASK) {
+      printf("mask %X: %s\n", mask, value);
+    } else if (q->kind == QUERY_EXPR) {
+      printf("expr %s: %s\n", qs->expr_sources[q->slot], value);
+    } else {
+      printf("%s: %s\n", names[q->kind], value);
+    }
+  }
+
+  if (json) {
+    printf("]}\n");
+  }
+}
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// one counter table, the baseline scan_histogram is measured against
+static void histogram_naive(const unsigned char *data, size_t len,
+                            uint64_t histogram[256]) {
+  for (size_t i = 0; i < len; ++i) {
+    histogram[data[i]]++;
+  }
+}
+
+static void run_bench(const mapped_file *mf, uint32_t mask, size_t threads) {
+  static const char *mode_names[] = {"xor8", "xorodd", "mask"};
+  static const char *pass_names[] = {"fused", "crc32c"};
+  scan_isa best = scan_isa_detect();
+  const scan_kernels *best_kernels = scan_kernels_select(best);
+  scan_plan all = {1, 1, 4, {mask, 0x80808080u, 0x0000ffffu, 0x1u}};
+  query_set passes[2];
+  volatile uint64_t sink = 0;
+  double separate_time = 0;
+
+  printf("%zu bytes, best of %d runs, detected %s\n", mf->size, BENCH_REPEATS,
+         scan_isa_name(best));
+  if (mf->size == 0) {
+    return;
+  }
+
+  for (int m = 0; m < 3; ++m) {
+    for (int isa = SCAN_ISA_SCALAR; isa <= (int)best; ++isa) {
+      const scan_kernels *kernels = scan_kernels_select((scan_isa)isa);
+      double best_time = 0;
+      for (int run = 0; run < BENCH_REPEATS; ++run) {
+        double start = now_seconds();
+        if (m == 0) {
+          sink += kernels->xor8(mf->data, mf->size);
+        } else if (m == 1) {
+          sink += kernels->xorodd(mf->data, mf->size);
+        } else {
+          sink += kernels->mask(mf->data, mf->size, mask);
+        }
+        double elapsed = now_seconds() - start;
+        if (run == 0 || elapsed < best_time) {
+          best_time = elapsed;
+        }
+      }
+      printf("%-7s %-7s %8.2f GB/s\n", mode_names[m], kernels->name,
+             mf->size / best_time / 1e9);
+      if (isa == (int)best) {
+        separate_time += best_time * (m == 2 ? all.masks_count : 1);
+      }
+    }
+  }
+
+  // crc32c table / hardware, xxh64
+  for (int c = 0; c < 3; ++c) {
+    double best_time = 0;
+    for (int run = 0; run < BENCH_REPEATS; ++run) {
+      double start = now_seconds();
+      if (c == 0) {
+        sink += crc32c_update_portable(0, mf->data, mf->size);
+      } else if (c == 1) {
+        sink += crc32c(mf->data, mf->size);
+      } else {
+        sink += xxh64(mf->data, mf->size, 0);
+      }
+      double elapsed = now_seconds() - start;
+      if (run == 0 || elapsed < best_time) {
+        best_time = elapsed;
+      }
+    }
+    printf("%-7s %-7s %8.2f GB/s\n", (c < 2) ? "crc32c" : "xxh64",
+           (c == 0) ? "table" : (c == 1) ? crc32c_impl_name() : "scalar",
+           mf->size / best_time / 1e9);
+  }
+
+  for (int h = 0; h < 2; ++h) {
+    double best_time = 0;
+    for (int run = 0; run < BENCH_REPEATS; ++run) {
+      uint64_t histogram[256] = {0};
+      double start = now_seconds();
+      if (h == 0) {
+        histogram_naive(mf->data, mf->size, histogram);
+      } else {
+        scan_histogram(mf->data, mf->size, histogram);
+      }
+      double elapsed = now_seconds() - start;
+      sink += histogram[0];
+      if (run == 0 || elapsed < best_time) {
+        best_time = elapsed;
+      }
+    }
+    printf("%-7s %-7s %8.2f GB/s\n", "hist", (h == 0) ? "1-table" : "4-table",
+           mf->size / best_time / 1e9);
+  }
+
+  // the mask query written as an expression, once on the mask kernel it is
+  // recognized as and once forced through the bytecode VM, plus an
+  // expression with no kernel of its own
+  {
+    char source[64];
+    scan_expr exprs[3];
+    char error[SCAN_EXPR_ERROR_SIZE];
+    snprintf(source, sizeof(source), "u32 count where (w & 0x%X) == 0x%X",
+             mask, mask);
+    scan_expr_compile(source, &exprs[0], error);
+    exprs[1] = exprs[0];
+    exprs[1].path = SCAN_EXPR_VM;
+    scan_expr_compile("u16 sum w >> 8 where w > 1000 and allb(b != 0)",
+                      &exprs[2], error);
+    for (int e = 0; e < 3; ++e) {
+      double best_time = 0;
+      for (int run = 0; run < BENCH_REPEATS; ++run) {
+        uint64_t acc = 0;
+        double start = now_seconds();
+        scan_expr_run(&exprs[e], best_kernels, mf->data, mf->size, &acc);
+        double elapsed = now_seconds() - start;
+        sink += acc;
+        if (run == 0 || elapsed < best_time) {
+          best_time = elapsed;
+        }
+      }
+      printf("%-7s %-7s %8.2f GB/s\n", "expr",
+             (e == 0) ? "mask" : (e == 1) ? "mask-vm" : "mixed",
+             mf->size / best_time / 1e9);
+    }
+  }
+
+  // xor8..xor64 + xorodd + 4 masks in one fused pass, and crc32c alone, each
+  // on one thread and on all of them
+  memset(passes, 0, sizeof(passes));
+  passes[0].plan = all;
+  passes[1].crc32c = 1;
+  for (int p = 0; p < 2; ++p) {
+    for (size_t t = 1; t <= threads; t = (t == threads) ? t + 1 : threads) {
+      double best_time = 0;
+      for (int run = 0; run < BENCH_REPEATS; ++run) {
+        scan_results results;
+        scan_results_init(&results);
+        double start = now_seconds();
+        if (t == 1) {
+          scan_range(best_kernels, &passes[p], mf->data, mf->size, &results);
+        } else {
+          scan_parallel(best_kernels, &passes[p], mf->data, mf->size, t,
+                        &results);
+        }
+        double elapsed = now_seconds() - start;
+        sink += results.totals.xor64 + results.crc32c;
+        if (run == 0 || elapsed < best_time) {
+          best_time = elapsed;
+        }
+      }
+      printf("%-7s %s x%-3zu %8.2f GB/s", pass_names[p], best_kernels->name, t,
+             mf->size / best_time / 1e9);
+      if (p == 0) {
+        printf("  (xor8 + xorodd + 4 mask passes: %.2f GB/s)",
+               mf->size / separate_time / 1e9);
+      }
+      printf("\n");
+    }
+  }
+}
@@ -7,6 +7,8 @@
 #include <unistd.h>
 #include <wait.h>
 
+#include "../include/string_view.h"
+
 #define MQ_NAME "/42_mq"
 #define MSG_SIZE 512
 #define ESCAPE_SEQUENCE "\x1B"
@@ -31,24 +33,34 @@ void serialize_custom(const custom_t* c, char* buffer) {
 }
 
 void deserialize_custom(const char* buffer, custom_t* c) {
-  char temp[MSG_SIZE];
-  strncpy(temp, buffer, MSG_SIZE);
-  temp[MSG_SIZE - 1] = '\0';
+  string_view rest = sv_from_parts(buffer, strnlen(buffer, MSG_SIZE));
+  string_view token;
+  long number = 0;
+  double value = 0;
+  size_t name_len = 0;
 
-  char* token = strtok(temp, ";");
-  c->id = atoi(token);
+  memset(c, 0, sizeof(*c));
 
-  token = strtok(NULL, ";");
-  strncpy(c->name, token, sizeof(c->name));
-  c->name[sizeof(c->name) - 1] = '\0';
+  if (sv_split_next(&rest, ';', &token) &&
+      sv_to_long(token, &number) == EXIT_SUCCESS) {
+    c->id = (int)number;
+  }
 
-  token = strtok(NULL, ";");
-  c->values_count = atoi(token);
+  if (sv_split_next(&rest, ';', &token)) {
+    name_len = token.len < sizeof(c->name) - 1 ? token.len : sizeof(c->name) - 1;
+    memcpy(c->name, token.data, name_len);
+  }
+
+  if (sv_split_next(&rest, ';', &token) &&
+      sv_to_long(token, &number) == EXIT_SUCCESS && number > 0) {
+    long capacity = (long)(sizeof(c->values) / sizeof(c->values[0]));
+    c->values_count = (int)(number < capacity ? number : capacity);
+  }
 
   for (int i = 0; i < c->values_count; i++) {
-    token = strtok(NULL, ";");
-    if (token) {
-      c->values[i] = atof(token);
+    if (sv_split_next(&rest, ';', &token) &&
+        sv_to_double(token, &value) == EXIT_SUCCESS) {
+      c->values[i] = (float)value;
     } else {
       c->values[i] = 0.0f;
     }
@@ -157,13 +169,14 @@ int main() {
     snprintf(msgs[3].data, MSG_SIZE, "Another string");
     snprintf(msgs[4].data, MSG_SIZE, ESCAPE_SEQUENCE);
 
-    unsigned int priorities[5] = {1, 2, 3, 1, 1};
+    size_t msgs_count = sizeof(msgs) / sizeof(msgs[0]);
+    unsigned int priorities[sizeof(msgs) / sizeof(msgs[0])] = {1, 2, 3, 1, 1};
 
-    for (int i = 0; i < 5; i++) {
+    for (size_t i = 0; i < msgs_count; i++) {
       if (mq_send(mq, (char*)&msgs[i], sizeof(msgs[i]), priorities[i]) < 0) {
         perror("mq_send");
       } else {
-        if (i < 4) {
+        if (i + 1 < msgs_count) {
           printf("[Writer] Sent with prio %u: %s\n", priorities[i],
                  msgs[i].data);
         } else {
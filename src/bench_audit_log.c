@@ -0,0 +1,159 @@
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/audit_log.h"
+
+// Records events from several threads into a scratch audit log under each
+// overflow policy, reports the time audit_log_record takes on the caller's
+// side and what ended up in the file, and checks every record reads back.
+// The small ring run shows how DROP and COUNT behave when the writer
+// cannot keep up.
+#define DEFAULT_EVENTS_COUNT 1000000
+#define BENCH_THREADS 4
+#define BENCH_LOG_PATH "bench_audit_log.tmp"
+
+typedef struct {
+  audit_log *log;
+  size_t events;
+  unsigned int id;
+} producer;
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *produce(void *arg) {
+  producer *p = (producer *)arg;
+  char login[8];
+
+  snprintf(login, sizeof(login), "u%u", p->id);
+  for (size_t i = 0; i < p->events; ++i) {
+    audit_log_record(p->log, login, p->id, "Howmuch 01:01:2020 00:00:00 -h",
+                     (int32_t)(i & 3));
+  }
+  return NULL;
+}
+
+static size_t count_records(const char *path, uint64_t *lost) {
+  FILE *file = fopen(path, "rb");
+  unsigned char *data = NULL;
+  long size = 0;
+  size_t offset = sizeof(audit_log_header);
+  size_t records = 0;
+
+  *lost = 0;
+  if (file == NULL) {
+    return 0;
+  }
+  fseek(file, 0, SEEK_END);
+  size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  data = (unsigned char *)malloc((size_t)size + 1);
+  if (data == NULL || fread(data, 1, (size_t)size, file) != (size_t)size) {
+    free(data);
+    fclose(file);
+    return 0;
+  }
+  fclose(file);
+  while (offset < (size_t)size) {
+    audit_record record;
+    size_t record_size = audit_record_check(data + offset, size - offset);
+    if (record_size == 0) {
+      break;
+    }
+    memcpy(&record, data + offset, sizeof(record));
+    if (record.type == AUDIT_LOST) {
+      *lost += record.value;
+    } else {
+      ++records;
+    }
+    offset += record_size;
+  }
+  if (offset != (size_t)size) {
+    fprintf(stderr, "torn record at %zu of %ld\n", offset, size);
+  }
+  free(data);
+  return records;
+}
+
+static int run(const char *name, audit_overflow overflow, size_t capacity,
+               size_t events) {
+  audit_log log;
+  audit_options opts = {capacity, overflow, AUDIT_DEFAULT_FLUSH_MS};
+  pthread_t threads[BENCH_THREADS];
+  producer producers[BENCH_THREADS];
+  double start = 0;
+  double seconds = 0;
+  size_t records = 0;
+  uint64_t lost = 0;
+  err_t err = 0;
+
+  remove(BENCH_LOG_PATH);
+  err = audit_log_open(&log, BENCH_LOG_PATH, &opts);
+  if (err != 0) {
+    perror(BENCH_LOG_PATH);
+    return err;
+  }
+  start = now_seconds();
+  for (unsigned int i = 0; i < BENCH_THREADS; ++i) {
+    producers[i].log = &log;
+    producers[i].events = events / BENCH_THREADS;
+    producers[i].id = i;
+    pthread_create(&threads[i], NULL, produce, &producers[i]);
+  }
+  for (unsigned int i = 0; i < BENCH_THREADS; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+  seconds = now_seconds() - start;
+  err = audit_log_close(&log);
+  records = count_records(BENCH_LOG_PATH, &lost);
+
+  printf("%-6s ring %6zu  %7.1f ns/event  %8zu in file  %8" PRIu64
+         " dropped  %8" PRIu64 " reported lost  %6" PRIu64 " writes\n",
+         name, capacity, seconds * 1e9 / events, records, log.stats.dropped,
+         lost, log.stats.writes);
+  remove(BENCH_LOG_PATH);
+  if (err != 0) {
+    return err;
+  }
+  if (records + log.stats.dropped != events / BENCH_THREADS * BENCH_THREADS ||
+      (overflow == AUDIT_OVERFLOW_COUNT && lost != log.stats.dropped)) {
+    fprintf(stderr, "%s: events went missing\n", name);
+    return INVALID_INPUT_DATA;
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  size_t count = DEFAULT_EVENTS_COUNT;
+  int err = 0;
+
+  if (argc > 1) {
+    count = strtoull(argv[1], NULL, 10);
+    if (count == 0) {
+      fprintf(stderr, "Usage: %s [events_count]\n", argv[0]);
+      return INVALID_CLI_ARGUMENT;
+    }
+  }
+
+  err = run("block", AUDIT_OVERFLOW_BLOCK, AUDIT_DEFAULT_CAPACITY, count);
+  if (err == 0) {
+    err = run("drop", AUDIT_OVERFLOW_DROP, AUDIT_DEFAULT_CAPACITY, count);
+  }
+  if (err == 0) {
+    err = run("count", AUDIT_OVERFLOW_COUNT, AUDIT_DEFAULT_CAPACITY, count);
+  }
+  if (err == 0) {
+    err = run("drop", AUDIT_OVERFLOW_DROP, 16, count);
+  }
+  if (err == 0) {
+    err = run("count", AUDIT_OVERFLOW_COUNT, 16, count);
+  }
+  return err;
+}
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/datetime.h"
+
+// Converts random "dd:mm:yyyy hh:mm:ss" local times (1902..2037, biased
+// towards the small hours when DST changes happen) with sscanf + mktime and
+// with datetime.h, checks the results agree, then does the same for UTC ->
+// local with localtime_r. Run under different TZ values to cover zones.
+// Local times mktime may resolve either way (repeated or skipped by a DST
+// change) are counted apart instead of compared.
+#define DEFAULT_DATES_COUNT 1000000
+#define DATE_TEXT_SIZE 32
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static time_t libc_to_utc(const char *text) {
+  struct tm tm_time = {0};
+
+  if (sscanf(text, "%d:%d:%d %d:%d:%d", &tm_time.tm_mday, &tm_time.tm_mon,
+             &tm_time.tm_year, &tm_time.tm_hour, &tm_time.tm_min,
+             &tm_time.tm_sec) != 6) {
+    return -1;
+  }
+  tm_time.tm_year -= 1900;
+  tm_time.tm_mon -= 1;
+  tm_time.tm_isdst = -1;
+  return mktime(&tm_time);
+}
+
+// Whether a wall time is repeated or skipped: the offsets an hour either
+// side differ.
+static int near_change(time_t utc) {
+  struct tm before;
+  struct tm after;
+  time_t t = utc - 3 * 3600;
+
+  localtime_r(&t, &before);
+  t = utc + 3 * 3600;
+  localtime_r(&t, &after);
+  return before.tm_gmtoff != after.tm_gmtoff;
+}
+
+int main(int argc, char *argv[]) {
+  size_t count = DEFAULT_DATES_COUNT;
+  char(*texts)[DATE_TEXT_SIZE] = NULL;
+  time_t *expected = NULL;
+  datetime_zone zone = {0};
+  unsigned int seed = 1;
+  size_t mismatches = 0;
+  size_t ambiguous = 0;
+  double start = 0;
+  double libc_time = 0;
+  double ours_time = 0;
+  long long sum = 0;
+
+  if (argc > 1) {
+    count = strtoull(argv[1], NULL, 10);
+    if (count == 0) {
+      fprintf(stderr, "Usage: %s [dates_count]\n", argv[0]);
+      return INVALID_CLI_ARGUMENT;
+    }
+  }
+
+  texts = malloc(count * sizeof(*texts));
+  expected = (time_t *)malloc(count * sizeof(*expected));
+  if (texts == NULL || expected == NULL) {
+    free(texts);
+    free(expected);
+    return MEMORY_ALLOCATION_ERROR;
+  }
+  tzset();
+  for (size_t i = 0; i < count; ++i) {
+    int r[6];
+    for (int j = 0; j < 6; ++j) {
+      seed = seed * 1103515245u + 12345u;
+      r[j] = (int)(seed >> 8);
+    }
+    snprintf(texts[i], DATE_TEXT_SIZE, "%02d:%02d:%d %02d:%02d:%02d",
+             r[0] % 28 + 1, r[1] % 12 + 1, 1902 + r[2] % 136,
+             (r[3] & 1) ? r[3] % 24 : r[3] % 4, r[4] % 60, r[5] % 60);
+  }
+
+  start = now_seconds();
+  for (size_t i = 0; i < count; ++i) {
+    expected[i] = libc_to_utc(texts[i]);
+    sum += expected[i];
+  }
+  libc_time = now_seconds() - start;
+
+  start = now_seconds();
+  for (size_t i = 0; i < count; ++i) {
+    datetime_fields fields;
+    int64_t utc = -1;
+    if (datetime_parse(texts[i], &fields, NULL) != 0 ||
+        datetime_to_utc(&zone, &fields, &utc) != 0) {
+      utc = -1;
+    }
+    sum -= utc;
+    if (utc != expected[i]) {
+      if (near_change(expected[i])) {
+        ++ambiguous;
+      } else if (mismatches++ < 5) {
+        fprintf(stderr, "%s: mktime %lld, datetime %lld\n", texts[i],
+                (long long)expected[i], (long long)utc);
+      }
+    }
+  }
+  ours_time = now_seconds() - start;
+
+  printf("local -> UTC, %zu dates, TZ=%s, %zu spans cached\n", count,
+         getenv("TZ") ? getenv("TZ") : "(unset)", zone.count);
+  printf("sscanf + mktime  %8.1f ns/date\n", libc_time * 1e9 / count);
+  printf("datetime.h       %8.1f ns/date  (%.1fx)\n", ours_time * 1e9 / count,
+         libc_time / ours_time);
+  printf("%zu mismatches, %zu next to a DST change\n", mismatches, ambiguous);
+
+  start = now_seconds();
+  for (size_t i = 0; i < count; ++i) {
+    struct tm tm;
+    localtime_r(&expected[i], &tm);
+    sum += tm.tm_mday + tm.tm_hour;
+  }
+  libc_time = now_seconds() - start;
+  start = now_seconds();
+  for (size_t i = 0; i < count; ++i) {
+    datetime_fields fields;
+    struct tm tm;
+    datetime_from_utc(&zone, expected[i], &fields);
+    sum -= fields.day + fields.hour;
+    if ((i & 15) == 0) {
+      localtime_r(&expected[i], &tm);
+      if (tm.tm_mday != fields.day || tm.tm_mon + 1 != fields.month ||
+          tm.tm_year + 1900 != fields.year || tm.tm_hour != fields.hour ||
+          tm.tm_min != fields.minute || tm.tm_sec != fields.second) {
+        ++mismatches;
+      }
+    }
+  }
+  ours_time = now_seconds() - start;
+  printf("UTC -> local\n");
+  printf("localtime_r      %8.1f ns/date\n", libc_time * 1e9 / count);
+  printf("datetime.h       %8.1f ns/date  (%.1fx, including checks)\n",
+         ours_time * 1e9 / count, libc_time / ours_time);
+  printf("%zu mismatches in total (checksum %lld)\n", mismatches, sum);
+
+  datetime_zone_free(&zone);
+  free(texts);
+  free(expected);
+  return mismatches == 0 ? 0 : INVALID_INPUT_DATA;
+}
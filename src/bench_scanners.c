@@ -0,0 +1,293 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/errors.h"
+
+// Runs one scanner command several times and prints a row with its wall
+// time, throughput, CPU time, page faults, bytes read from and written to
+// storage (block I/O counts, charged when pages are read or dirtied) and
+// peak RSS, taken from wait4().
+// Warm runs follow an untimed warm-up run; --cold drops the page cache before
+// every run: globally through /proc/sys/vm/drop_caches when allowed (root),
+// otherwise per file with POSIX_FADV_DONTNEED on every --evict path.
+// scripts/bench_scanners.sh drives it over corpora from gen_corpus.
+
+#define MAX_RUNS 64
+#define MAX_EVICT 16
+#define MAX_PATH_LEN 4096
+#define DROP_CACHES_PATH "/proc/sys/vm/drop_caches"
+
+typedef struct {
+  double wall;
+  double user;
+  double sys;
+  long majflt;
+  long minflt;
+  long maxrss_kb;
+  long inblock;  // 512-byte units
+  long oublock;
+} run_stats;
+
+typedef struct {
+  int runs;
+  int cold;
+  int show_output;
+  const char *label;
+  const char *evict[MAX_EVICT];
+  size_t evict_count;
+  uint64_t bytes;
+} bench_options;
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double timeval_seconds(struct timeval tv) {
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Calls fn on path, or on every regular file directly inside it.
+static err_t for_each_file(const char *path,
+                           err_t (*fn)(const char *, void *), void *arg) {
+  char child[MAX_PATH_LEN];
+  struct stat st;
+  struct dirent *entry = NULL;
+  DIR *dir = NULL;
+  err_t err = 0;
+
+  if (stat(path, &st) != 0) {
+    return OPENING_THE_FILE_ERROR;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    return fn(path, arg);
+  }
+  dir = opendir(path);
+  if (dir == NULL) {
+    return OPENING_THE_FILE_ERROR;
+  }
+  while (err == 0 && (entry = readdir(dir)) != NULL) {
+    if (snprintf(child, sizeof(child), "%s/%s", path, entry->d_name) >=
+            (int)sizeof(child) ||
+        stat(child, &st) != 0 || !S_ISREG(st.st_mode)) {
+      continue;
+    }
+    err = fn(child, arg);
+  }
+  closedir(dir);
+  return err;
+}
+
+static err_t add_size(const char *path, void *arg) {
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    return OPENING_THE_FILE_ERROR;
+  }
+  *(uint64_t *)arg += (uint64_t)st.st_size;
+  return 0;
+}
+
+static err_t evict_file(const char *path, void *arg) {
+  int fd = open(path, O_RDONLY);
+  (void)arg;
+  if (fd == -1) {
+    return OPENING_THE_FILE_ERROR;
+  }
+  fdatasync(fd);  // dirty pages cannot be dropped
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+  return 0;
+}
+
+// Returns 1 if the whole page cache was dropped, 0 if only the --evict paths.
+static int drop_caches(const bench_options *opts) {
+  int fd = -1;
+
+  sync();
+  fd = open(DROP_CACHES_PATH, O_WRONLY);
+  if (fd != -1) {
+    ssize_t n = write(fd, "3\n", 2);
+    close(fd);
+    if (n == 2) {
+      return 1;
+    }
+  }
+  for (size_t i = 0; i < opts->evict_count; ++i) {
+    for_each_file(opts->evict[i], evict_file, NULL);
+  }
+  return 0;
+}
+
+static err_t run_once(char *const argv[], int show_output, run_stats *stats) {
+  struct rusage ru;
+  int status = 0;
+  double start = now_seconds();
+  pid_t pid = fork();
+
+  if (pid == -1) {
+    return INVALID_INPUT_DATA;
+  }
+  if (pid == 0) {
+    if (!show_output) {
+      int null_fd = open("/dev/null", O_WRONLY);
+      if (null_fd != -1) {
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+      }
+    }
+    execvp(argv[0], argv);
+    fprintf(stderr, "failed to run %s: %s\n", argv[0], strerror(errno));
+    _exit(127);
+  }
+
+  while (wait4(pid, &status, 0, &ru) == -1) {
+    if (errno != EINTR) {
+      return INVALID_INPUT_DATA;
+    }
+  }
+  stats->wall = now_seconds() - start;
+  stats->user = timeval_seconds(ru.ru_utime);
+  stats->sys = timeval_seconds(ru.ru_stime);
+  stats->majflt = ru.ru_majflt;
+  stats->minflt = ru.ru_minflt;
+  stats->maxrss_kb = ru.ru_maxrss;
+  stats->inblock = ru.ru_inblock;
+  stats->oublock = ru.ru_oublock;
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    return INVALID_INPUT_DATA;
+  }
+  return 0;
+}
+
+static int compare_wall(const void *a, const void *b) {
+  double x = ((const run_stats *)a)->wall, y = ((const run_stats *)b)->wall;
+  return (x > y) - (x < y);
+}
+
+static void print_header(void) {
+  printf("%-32s %-4s %4s %9s %9s %9s %8s %8s %8s %9s %9s %9s %8s\n",
+         "command", "page", "runs", "median_s", "best_s", "MB/s", "user_s",
+         "sys_s", "majflt", "minflt", "read_MB", "write_MB", "rss_MiB");
+}
+
+// Every column but best_s and rss_MiB comes from the median run.
+static void print_row(const bench_options *opts, run_stats *runs, int count) {
+  long maxrss_kb = 0;
+  const run_stats *median = NULL;
+
+  for (int i = 0; i < count; ++i) {
+    if (runs[i].maxrss_kb > maxrss_kb) {
+      maxrss_kb = runs[i].maxrss_kb;
+    }
+  }
+  qsort(runs, count, sizeof(*runs), compare_wall);
+  median = &runs[count / 2];
+  printf("%-32s %-4s %4d %9.3f %9.3f %9.1f %8.3f %8.3f %8ld %9ld %9.1f %9.1f "
+         "%8.1f\n",
+         opts->label, opts->cold ? "cold" : "warm", count, median->wall,
+         runs[0].wall, opts->bytes / median->wall / 1e6, median->user,
+         median->sys, median->majflt, median->minflt,
+         median->inblock * 512 / 1e6, median->oublock * 512 / 1e6,
+         maxrss_kb / 1024.0);
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "Usage: %s [--runs N] [--cold] [--evict PATH]... [--bytes-of PATH]"
+          "...\n"
+          "          [--label NAME] [--show-output] -- <command> [args...]\n"
+          "       %s --header\n",
+          name, name);
+}
+
+int main(int argc, char *argv[]) {
+  bench_options opts = {3, 0, 0, NULL, {NULL}, 0, 0};
+  run_stats runs[MAX_RUNS];
+  run_stats warmup;
+  int i = 1;
+  int dropped_all = 0;
+
+  for (; i < argc && strcmp(argv[i], "--") != 0; ++i) {
+    const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+    if (strcmp(argv[i], "--header") == 0) {
+      print_header();
+      return 0;
+    } else if (strcmp(argv[i], "--cold") == 0) {
+      opts.cold = 1;
+    } else if (strcmp(argv[i], "--show-output") == 0) {
+      opts.show_output = 1;
+    } else if (value == NULL) {
+      usage(argv[0]);
+      return INVALID_CLI_ARGUMENT;
+    } else if (strcmp(argv[i], "--runs") == 0) {
+      opts.runs = atoi(value);
+      if (opts.runs < 1 || opts.runs > MAX_RUNS) {
+        fprintf(stderr, "--runs expects 1..%d\n", MAX_RUNS);
+        return INVALID_CLI_ARGUMENT;
+      }
+      ++i;
+    } else if (strcmp(argv[i], "--evict") == 0) {
+      if (opts.evict_count == MAX_EVICT) {
+        fprintf(stderr, "at most %d --evict paths\n", MAX_EVICT);
+        return INVALID_CLI_ARGUMENT;
+      }
+      opts.evict[opts.evict_count++] = value;
+      ++i;
+    } else if (strcmp(argv[i], "--bytes-of") == 0) {
+      if (for_each_file(value, add_size, &opts.bytes) != 0) {
+        fprintf(stderr, "cannot stat %s\n", value);
+        return OPENING_THE_FILE_ERROR;
+      }
+      ++i;
+    } else if (strcmp(argv[i], "--label") == 0) {
+      opts.label = value;
+      ++i;
+    } else {
+      usage(argv[0]);
+      return INVALID_CLI_ARGUMENT;
+    }
+  }
+  if (i + 1 >= argc) {
+    usage(argv[0]);
+    return INVALID_CLI_ARGUMENT;
+  }
+  char **command = argv + i + 1;
+  if (opts.label == NULL) {
+    opts.label = command[0];
+  }
+
+  if (!opts.cold && run_once(command, opts.show_output, &warmup) != 0) {
+    fprintf(stderr, "%s: command failed\n", opts.label);
+    return INVALID_INPUT_DATA;
+  }
+  for (int r = 0; r < opts.runs; ++r) {
+    if (opts.cold) {
+      dropped_all = drop_caches(&opts);
+    }
+    if (run_once(command, opts.show_output, &runs[r]) != 0) {
+      fprintf(stderr, "%s: command failed\n", opts.label);
+      return INVALID_INPUT_DATA;
+    }
+  }
+  if (opts.cold && !dropped_all) {
+    fprintf(stderr,
+            "%s: cannot write " DROP_CACHES_PATH ", evicted only the "
+            "--evict paths\n",
+            opts.label);
+  }
+
+  print_row(&opts, runs, opts.runs);
+  return 0;
+}
@@ -0,0 +1,98 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/shell_commands.h"
+
+// Looks commands up the way 2.c used to (a strcmp/strncmp chain) and
+// through shell_command_find's perfect hash table, over a mix of valid and
+// invalid lines, and checks both agree.
+#define DEFAULT_LINES_COUNT 10000000
+
+static const char *const kLines[] = {
+    "Time",      "Date",           "Howmuch 01:01:2020 00:00:00 -h",
+    "Logout",    "Sanctions user", "Foo",
+    "Time x",    "Howmuch",        "Sanctionsuser",
+    "Datestamp",
+};
+#define LINES_KINDS (sizeof(kLines) / sizeof(*kLines))
+
+static int chain_find(const char *line) {
+  if (strcmp(line, "Time") == 0) {
+    return SHELL_TIME;
+  } else if (strcmp(line, "Date") == 0) {
+    return SHELL_DATE;
+  } else if (strncmp(line, "Howmuch ", 8) == 0) {
+    return SHELL_HOWMUCH;
+  } else if (strncmp(line, "Sanctions ", 10) == 0) {
+    return SHELL_SANCTIONS;
+  } else if (strcmp(line, "Logout") == 0) {
+    return SHELL_LOGOUT;
+  }
+  return -1;
+}
+
+static int table_find(const char *line) {
+  const shell_command *command = shell_command_find(line);
+  return (command == NULL) ? -1 : (int)command->id;
+}
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run(const char *name, int (*find)(const char *),
+                  const char **lines, size_t count) {
+  double start = now_seconds();
+  double seconds = 0;
+  long long sum = 0;
+
+  for (size_t i = 0; i < count; ++i) {
+    sum += find(lines[i]);
+  }
+  seconds = now_seconds() - start;
+  printf("%-8s %8.2f ns/line  %12.0f lines/s  (checksum %lld)\n", name,
+         seconds * 1e9 / count, count / seconds, sum);
+  return seconds;
+}
+
+int main(int argc, char *argv[]) {
+  size_t count = DEFAULT_LINES_COUNT;
+  const char **lines = NULL;
+  unsigned int seed = 1;
+
+  if (argc > 1) {
+    count = strtoull(argv[1], NULL, 10);
+    if (count == 0) {
+      fprintf(stderr, "Usage: %s [lines_count]\n", argv[0]);
+      return INVALID_CLI_ARGUMENT;
+    }
+  }
+
+  for (size_t i = 0; i < LINES_KINDS; ++i) {
+    if (chain_find(kLines[i]) != table_find(kLines[i])) {
+      fprintf(stderr, "dispatch differs on \"%s\"\n", kLines[i]);
+      return PARSING_ERROR;
+    }
+  }
+
+  lines = (const char **)malloc(count * sizeof(*lines));
+  if (lines == NULL) {
+    return MEMORY_ALLOCATION_ERROR;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    seed = seed * 1103515245u + 12345u;
+    lines[i] = kLines[(seed >> 16) % LINES_KINDS];
+  }
+
+  run("chain", chain_find, lines, count);
+  run("table", table_find, lines, count);
+
+  free(lines);
+  return 0;
+}
@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/hash_table.h"
+
+#define DEFAULT_KEYS_COUNT 200000
+#define KEY_PREFIX "/var/lib/distributed-systems/storage/node-"
+#define EXTRA_RESIZES 3
+
+typedef size_t (*hash_fn)(const void *key, size_t key_size, size_t capacity);
+
+static size_t djb2_hash_uncached(const void *key, size_t key_size,
+                                 size_t capacity) {
+  string_hash_reset(*(const String *)key);
+  return djb2_hash(key, key_size, capacity);
+}
+
+static size_t murmur_hash_uncached(const void *key, size_t key_size,
+                                   size_t capacity) {
+  string_hash_reset(*(const String *)key);
+  return murmur_hash(key, key_size, capacity);
+}
+
+static size_t sha256_hash_uncached(const void *key, size_t key_size,
+                                   size_t capacity) {
+  string_hash_reset(*(const String *)key);
+  return sha256_hash(key, key_size, capacity);
+}
+
+static int string_keys_comparer(const void *a, const void *b) {
+  const hash_table_bucket *ba = a;
+  const hash_table_bucket *bb = b;
+  return string_cmp(*(String *)ba->key, *(String *)bb->key);
+}
+
+static void bucket_destructor(void *data) {
+  hash_table_bucket *bucket = data;
+  free(bucket->key);
+  free(bucket->value);
+  free(bucket);
+}
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int run(const char *name, hash_fn hash, String *keys, size_t count) {
+  hash_table *ht = NULL;
+  double start = 0, insert_time = 0, resize_time = 0, lookup_time = 0;
+  size_t i = 0;
+  void *value = NULL;
+  err_t err = 0;
+
+  for (i = 0; i < count; ++i) {
+    string_hash_reset(keys[i]);
+  }
+
+  err = hash_table_init(&ht, string_keys_comparer, hash, sizeof(String),
+                        sizeof(size_t), bucket_destructor);
+  if (err) {
+    return err;
+  }
+
+  start = now_seconds();
+  for (i = 0; i < count; ++i) {
+    err = hash_table_set(ht, &keys[i], &i);
+    if (err) {
+      hash_table_free(ht);
+      return err;
+    }
+  }
+  insert_time = now_seconds() - start;
+
+  start = now_seconds();
+  for (i = 0; i < EXTRA_RESIZES; ++i) {
+    err = hash_table_resize(ht, HASH_TABLE_GROWTH_FACTOR);
+    if (err) {
+      hash_table_free(ht);
+      return err;
+    }
+  }
+  resize_time = now_seconds() - start;
+
+  start = now_seconds();
+  for (i = 0; i < count; ++i) {
+    err = hash_table_get(ht, &keys[i], &value);
+    if (err || *(size_t *)value != i) {
+      fprintf(stderr, "%s: lookup of key %zu failed\n", name, i);
+      hash_table_free(ht);
+      return err ? err : KEY_NOT_FOUND;
+    }
+  }
+  lookup_time = now_seconds() - start;
+
+  printf("%-16s capacity %8zu | insert %8.3f ms | %d resizes %8.3f ms | "
+         "lookup %8.3f ms\n",
+         name, ht->capacity, insert_time * 1e3, EXTRA_RESIZES,
+         resize_time * 1e3, lookup_time * 1e3);
+
+  hash_table_free(ht);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  size_t count = DEFAULT_KEYS_COUNT;
+  String *keys = NULL;
+  char buffer[128];
+  size_t i = 0;
+  int err = 0;
+
+  if (argc > 1) {
+    count = strtoull(argv[1], NULL, 10);
+    if (count == 0) {
+      fprintf(stderr, "Usage: %s [keys_count]\n", argv[0]);
+      return INVALID_CLI_ARGUMENT;
+    }
+  }
+
+  keys = (String *)malloc(count * sizeof(String));
+  if (keys == NULL) {
+    return MEMORY_ALLOCATION_ERROR;
+  }
+  for (i = 0; i < count; ++i) {
+    snprintf(buffer, sizeof(buffer), KEY_PREFIX "%08zu/chunk.dat", i);
+    keys[i] = string_from(buffer);
+    if (keys[i] == NULL) {
+      while (i-- > 0) {
+        string_free(keys[i]);
+      }
+      free(keys);
+      return MEMORY_ALLOCATION_ERROR;
+    }
+  }
+
+  printf("%zu String keys of %zu bytes\n", count, string_len(keys[0]));
+
+  err = err || run("djb2 uncached", djb2_hash_uncached, keys, count);
+  err = err || run("djb2 cached", djb2_hash, keys, count);
+  err = err || run("murmur uncached", murmur_hash_uncached, keys, count);
+  err = err || run("murmur cached", murmur_hash, keys, count);
+  err = err || run("sha256 uncached", sha256_hash_uncached, keys, count);
+  err = err || run("sha256 cached", sha256_hash, keys, count);
+
+  for (i = 0; i < count; ++i) {
+    string_free(keys[i]);
+  }
+  free(keys);
+
+  return err;
+}
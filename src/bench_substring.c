@@ -0,0 +1,166 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/substring_search.h"
+
+// Counts needles in generated text with every substring_search.h kernel and
+// with a memmem loop, checks they agree, and checks substring_count_fd over
+// a pipe (short reads, so many block boundaries fall inside matches) and a
+// periodic haystack that tells non-overlapping counting from overlapping.
+#define DEFAULT_MEGABYTES 256
+#define BENCH_ROUNDS 3
+
+static const char *const kNeedles[] = {
+    "e", "th", "needle", "the quick brown fox", "zq", "aaaaaaaaaaaaaaaaaa",
+};
+#define NEEDLES_KINDS (sizeof(kNeedles) / sizeof(*kNeedles))
+
+static const char *const kWords[] = {
+    "the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog",
+    "needle", "hay", "stack", "aaaaaaaaa", "\n",
+};
+#define WORDS_KINDS (sizeof(kWords) / sizeof(*kWords))
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t reference_count(const unsigned char *data, size_t len,
+                              const char *needle) {
+  size_t needle_len = strlen(needle);
+  size_t count = 0;
+  const unsigned char *p = data;
+  const unsigned char *end = data + len;
+
+  while ((p = (const unsigned char *)memmem(p, (size_t)(end - p), needle,
+                                            needle_len)) != NULL) {
+    ++count;
+    p += needle_len;
+  }
+  return count;
+}
+
+static size_t pipe_count(const unsigned char *data, size_t len,
+                         const substring_searcher *s) {
+  int fds[2];
+  size_t count = 0;
+  pid_t pid = 0;
+
+  if (pipe(fds) != 0) {
+    return (size_t)-1;
+  }
+  pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    for (size_t off = 0; off < len;) {
+      ssize_t n = write(fds[1], data + off, len - off);
+      if (n <= 0) {
+        _exit(1);
+      }
+      off += (size_t)n;
+    }
+    _exit(0);
+  }
+  close(fds[1]);
+  if (pid < 0 || substring_count_fd(s, fds[0], &count) != 0) {
+    count = (size_t)-1;
+  }
+  close(fds[0]);
+  waitpid(pid, NULL, 0);
+  return count;
+}
+
+int main(int argc, char *argv[]) {
+  size_t megabytes = DEFAULT_MEGABYTES;
+  size_t len = 0;
+  unsigned char *data = NULL;
+  unsigned int seed = 1;
+  int failed = 0;
+
+  if (argc > 1) {
+    megabytes = strtoull(argv[1], NULL, 10);
+    if (megabytes == 0) {
+      fprintf(stderr, "Usage: %s [megabytes]\n", argv[0]);
+      return INVALID_CLI_ARGUMENT;
+    }
+  }
+
+  len = megabytes << 20;
+  data = (unsigned char *)malloc(len);
+  if (data == NULL) {
+    return MEMORY_ALLOCATION_ERROR;
+  }
+  for (size_t i = 0; i < len;) {
+    seed = seed * 1103515245u + 12345u;
+    const char *word = kWords[(seed >> 16) % WORDS_KINDS];
+    size_t n = strlen(word);
+    n = (n < len - i) ? n : len - i;
+    memcpy(data + i, word, n);
+    i += n;
+    if (i < len) {
+      data[i++] = ' ';
+    }
+  }
+
+  printf("%zu MB of text\n", megabytes);
+  for (size_t k = 0; k < NEEDLES_KINDS; ++k) {
+    const char *needle = kNeedles[k];
+    double start = now_seconds();
+    size_t expected = reference_count(data, len, needle);
+    double seconds = now_seconds() - start;
+
+    printf("\"%s\": %zu matches\n  %-7s %6.2f GB/s\n", needle, expected,
+           "memmem", len / seconds / 1e9);
+    for (int isa = 0; isa < SCAN_ISA_COUNT; ++isa) {
+      substring_searcher s;
+      size_t count = 0;
+      double best = 0;
+
+      substring_searcher_init(&s, needle, strlen(needle), (scan_isa)isa);
+      if ((int)s.isa != isa) {
+        continue;
+      }
+      for (int round = 0; round < BENCH_ROUNDS; ++round) {
+        start = now_seconds();
+        count = substring_count(&s, data, len, NULL);
+        seconds = now_seconds() - start;
+        best = (round == 0 || seconds < best) ? seconds : best;
+      }
+      printf("  %-7s %6.2f GB/s%s\n", scan_isa_name(s.isa), len / best / 1e9,
+             count == expected ? "" : "  MISMATCH");
+      failed |= count != expected;
+    }
+
+    substring_searcher s;
+    substring_searcher_init(&s, needle, strlen(needle), SCAN_ISA_AVX2);
+    if (pipe_count(data, len, &s) != expected) {
+      printf("  pipe    MISMATCH\n");
+      failed = 1;
+    }
+  }
+
+  // "aa" occurs 2n - 1 times in 2n a's but only n times without overlaps;
+  // a block boundary in the middle of an odd run must not shift the pairs.
+  memset(data, 'a', len);
+  data[len / 2 + 1] = 'b';
+  substring_searcher pairs;
+  substring_searcher_init(&pairs, "aa", 2, SCAN_ISA_AVX2);
+  size_t expected = (len / 2 + 1) / 2 + (len - len / 2 - 2) / 2;
+  if (substring_count(&pairs, data, len, NULL) != expected ||
+      pipe_count(data, len, &pairs) != expected) {
+    printf("periodic haystack MISMATCH\n");
+    failed = 1;
+  }
+
+  free(data);
+  printf("%s\n", failed ? "FAILED" : "all counts agree");
+  return failed ? INVALID_INPUT_DATA : 0;
+}
@@ -0,0 +1,516 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../include/errors.h"
+
+// Deterministic corpora for the scanners: the same seed and options always
+// give byte-identical files, whatever their size.
+//
+//   binary  random little-endian 32-bit words for 4.c; with --density P a
+//           fraction P of the words (exactly, in expectation) satisfies
+//           (w & mask) == mask and no other word does
+//   text    lines of random lowercase words for 23.c and 3.c, lengths
+//           uniform in [--line-min, --line-max]; a fraction --density of
+//           the lines carries one copy of --needle and no other line does
+//   sparse  a file of apparent size <size> cut into --extent slots; a
+//           fraction --density of them (default 1%) holds random bytes and
+//           the rest are holes, for the sparse-aware copy in 3.c
+//
+// The summary on stdout (words or lines, and matches; extents and data bytes
+// for sparse) is what the scanners should report for the file.
+
+#define WRITE_BUFFER_SIZE (4 << 20)
+#define DEFAULT_MASK (0xF0u)
+#define DEFAULT_NEEDLE "hello"
+#define DEFAULT_LINE_MIN 20
+#define DEFAULT_LINE_MAX 120
+#define DEFAULT_SPARSE_DENSITY 0.01
+#define DEFAULT_EXTENT ((uint64_t)1 << 20)
+#define MAX_EXTENT ((uint64_t)1 << 30)
+#define MAX_LINE_LEN (1 << 16)
+#define MAX_PATH_LEN 4096
+#define FILE_LIST_NAME "file_list.txt"
+
+typedef struct {
+  uint64_t s[4];
+} rng;
+
+typedef struct {
+  uint64_t seed;
+  double density;  // < 0: leave the data as the generator made it
+  uint32_t mask;
+  const char *needle;
+  size_t line_min;
+  size_t line_max;
+  size_t files;
+  uint64_t extent;
+} corpus_options;
+
+typedef struct {
+  int fd;
+  unsigned char *buffer;
+  size_t filled;
+} out_file;
+
+typedef struct {
+  uint64_t units;  // words, lines or data extents
+  uint64_t matches;
+  uint64_t data;  // sparse: bytes outside holes
+} corpus_stats;
+
+typedef enum { CORPUS_BINARY, CORPUS_TEXT, CORPUS_SPARSE } corpus_kind;
+
+static uint64_t splitmix64(uint64_t *state) {
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+static void rng_seed(rng *r, uint64_t seed) {
+  for (int i = 0; i < 4; ++i) {
+    r->s[i] = splitmix64(&seed);
+  }
+}
+
+static inline uint64_t rotl(uint64_t x, int k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+// xoshiro256**
+static inline uint64_t rng_next(rng *r) {
+  uint64_t result = rotl(r->s[1] * 5, 7) * 9;
+  uint64_t t = r->s[1] << 17;
+  r->s[2] ^= r->s[0];
+  r->s[3] ^= r->s[1];
+  r->s[1] ^= r->s[2];
+  r->s[0] ^= r->s[3];
+  r->s[2] ^= t;
+  r->s[3] = rotl(r->s[3], 45);
+  return result;
+}
+
+// uniform in [0, bound)
+static inline uint64_t rng_below(rng *r, uint64_t bound) {
+  return (uint64_t)(((unsigned __int128)rng_next(r) * bound) >> 64);
+}
+
+static inline double rng_unit(rng *r) {
+  return (rng_next(r) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// 4096, 64K, 512M, 2G, 1T (powers of 1024)
+static int parse_size(const char *str, uint64_t *size_placeholder) {
+  char *end = NULL;
+  uint64_t size = 0;
+  int shift = 0;
+
+  errno = 0;
+  size = strtoull(str, &end, 10);
+  if (errno != 0 || end == str) {
+    return INVALID_NUMBER;
+  }
+  switch (*end) {
+    case 'K': case 'k': shift = 10; break;
+    case 'M': case 'm': shift = 20; break;
+    case 'G': case 'g': shift = 30; break;
+    case 'T': case 't': shift = 40; break;
+    case '\0': break;
+    default: return INVALID_NUMBER;
+  }
+  if (*end != '\0' && end[1] != '\0') {
+    return INVALID_NUMBER;
+  }
+  if (shift > 0 && size > (UINT64_MAX >> shift)) {
+    return INVALID_NUMBER;
+  }
+  *size_placeholder = size << shift;
+  return 0;
+}
+
+static err_t out_open(out_file *out, const char *path) {
+  out->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (out->fd == -1) {
+    return OPENING_THE_FILE_ERROR;
+  }
+  out->buffer = (unsigned char *)malloc(WRITE_BUFFER_SIZE);
+  if (out->buffer == NULL) {
+    close(out->fd);
+    return MEMORY_ALLOCATION_ERROR;
+  }
+  out->filled = 0;
+  return 0;
+}
+
+static err_t out_flush(out_file *out) {
+  size_t done = 0;
+  while (done < out->filled) {
+    ssize_t n = write(out->fd, out->buffer + done, out->filled - done);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return OPENING_THE_FILE_ERROR;
+    }
+    done += (size_t)n;
+  }
+  out->filled = 0;
+  return 0;
+}
+
+static err_t out_close(out_file *out) {
+  err_t err = out_flush(out);
+  free(out->buffer);
+  if (close(out->fd) != 0 && err == 0) {
+    err = OPENING_THE_FILE_ERROR;
+  }
+  return err;
+}
+
+// Room for at least `len` more bytes in the buffer.
+static unsigned char *out_reserve(out_file *out, size_t len) {
+  if (WRITE_BUFFER_SIZE - out->filled < len && out_flush(out) != 0) {
+    return NULL;
+  }
+  return out->buffer + out->filled;
+}
+
+static err_t gen_binary(const char *path, uint64_t size,
+                        const corpus_options *opts, corpus_stats *stats) {
+  rng r;
+  out_file out;
+  uint64_t left = size;
+  uint32_t mask = opts->mask;
+  int mask_bits[32];
+  int mask_bits_count = 0;
+  err_t err = out_open(&out, path);
+
+  if (err) {
+    return err;
+  }
+  rng_seed(&r, opts->seed);
+  for (int b = 0; b < 32; ++b) {
+    if (mask & (1u << b)) {
+      mask_bits[mask_bits_count++] = b;
+    }
+  }
+
+  while (left > 0) {
+    size_t n = (left < WRITE_BUFFER_SIZE) ? (size_t)left : WRITE_BUFFER_SIZE;
+    unsigned char *p = out_reserve(&out, n);
+    size_t i = 0;
+    if (p == NULL) {
+      out_close(&out);
+      return OPENING_THE_FILE_ERROR;
+    }
+    for (; i + 8 <= n; i += 8) {
+      uint64_t pair = rng_next(&r);
+      for (int half = 0; half < 2; ++half) {
+        uint32_t w = (uint32_t)(pair >> (32 * half));
+        if (opts->density >= 0 && mask_bits_count > 0) {
+          if (rng_unit(&r) < opts->density) {
+            w |= mask;
+          } else if ((w & mask) == mask) {
+            w &= ~(1u << mask_bits[rng_below(&r, mask_bits_count)]);
+          }
+        }
+        stats->matches += (w & mask) == mask;
+        memcpy(p + i + 4 * half, &w, 4);  // little-endian host
+      }
+    }
+    stats->units += i / 4;
+    if (i < n) {
+      uint64_t tail = rng_next(&r);
+      memcpy(p + i, &tail, n - i);  // the file's last 1..7 bytes
+      stats->units += (n - i) / 4;
+      if (n - i >= 4) {
+        uint32_t w = (uint32_t)tail;
+        stats->matches += (w & mask) == mask;
+      }
+    }
+    out.filled += n;
+    left -= n;
+  }
+  return out_close(&out);
+}
+
+// Filler never contains the needle's first byte, so the only matches are
+// the copies planted on purpose.
+static void fill_words(rng *r, unsigned char *p, size_t len, char avoid) {
+  size_t word_left = 1 + rng_below(r, 10);
+  for (size_t i = 0; i < len; ++i) {
+    char c = 0;
+    if (avoid != ' ' && word_left-- == 0 && i + 1 < len) {
+      p[i] = ' ';
+      word_left = 1 + rng_below(r, 10);
+      continue;
+    }
+    do {
+      c = (char)('a' + rng_below(r, 26));
+    } while (c == avoid);
+    p[i] = (unsigned char)c;
+  }
+}
+
+static err_t gen_text_file(const char *path, uint64_t size, rng *r,
+                           const corpus_options *opts, corpus_stats *stats) {
+  out_file out;
+  size_t needle_len = strlen(opts->needle);
+  uint64_t left = size;
+  err_t err = out_open(&out, path);
+
+  if (err) {
+    return err;
+  }
+  while (left > 0) {
+    size_t len = opts->line_min +
+                 rng_below(r, opts->line_max - opts->line_min + 1);
+    int plant = opts->density > 0 && rng_unit(r) < opts->density;
+    unsigned char *p = NULL;
+
+    if (plant && len < needle_len) {
+      len = needle_len;
+    }
+    if (len + 1 > left) {
+      len = (size_t)left - 1;  // the last line ends exactly at `size`
+      plant = plant && len >= needle_len;
+    }
+    p = out_reserve(&out, len + 1);
+    if (p == NULL) {
+      out_close(&out);
+      return OPENING_THE_FILE_ERROR;
+    }
+    fill_words(r, p, len, opts->needle[0]);
+    if (plant) {
+      memcpy(p + rng_below(r, len - needle_len + 1), opts->needle,
+             needle_len);
+      stats->matches++;
+    }
+    p[len] = '\n';
+    out.filled += len + 1;
+    left -= len + 1;
+    stats->units++;
+  }
+  return out_close(&out);
+}
+
+// One file at `path`, or with --files N the directory `path` holding
+// file_<i>.txt and a file_list.txt naming them, as files/generate_23.sh does.
+static err_t gen_text(const char *path, uint64_t size,
+                      const corpus_options *opts, corpus_stats *stats) {
+  char file_path[MAX_PATH_LEN];
+  char list_path[MAX_PATH_LEN];
+  FILE *list = NULL;
+  rng r;
+  err_t err = 0;
+
+  rng_seed(&r, opts->seed);
+  if (opts->files == 0) {
+    return gen_text_file(path, size, &r, opts, stats);
+  }
+
+  if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+    return OPENING_THE_FILE_ERROR;
+  }
+  if (snprintf(list_path, sizeof(list_path), "%s/" FILE_LIST_NAME, path) >=
+      (int)sizeof(list_path)) {
+    return INVALID_CLI_ARGUMENT;
+  }
+  list = fopen(list_path, "w");
+  if (list == NULL) {
+    return OPENING_THE_FILE_ERROR;
+  }
+  for (size_t i = 0; i < opts->files && err == 0; ++i) {
+    uint64_t file_size = size / opts->files + (i < size % opts->files);
+    if (snprintf(file_path, sizeof(file_path), "%s/file_%zu.txt", path,
+                 i + 1) >= (int)sizeof(file_path)) {
+      err = INVALID_CLI_ARGUMENT;
+      break;
+    }
+    err = gen_text_file(file_path, file_size, &r, opts, stats);
+    fprintf(list, "%s\n", file_path);
+  }
+  if (fclose(list) != 0 && err == 0) {
+    err = OPENING_THE_FILE_ERROR;
+  }
+  return err;
+}
+
+// Data slots are written with pwrite and everything else is never touched,
+// so on filesystems with hole support only the data slots take up space.
+static err_t gen_sparse(const char *path, uint64_t size,
+                        const corpus_options *opts, corpus_stats *stats) {
+  double density = (opts->density < 0) ? DEFAULT_SPARSE_DENSITY : opts->density;
+  unsigned char *buffer = NULL;
+  rng r;
+  err_t err = 0;
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  if (fd == -1) {
+    return OPENING_THE_FILE_ERROR;
+  }
+  buffer = (unsigned char *)malloc(opts->extent + 8);
+  if (buffer == NULL) {
+    close(fd);
+    return MEMORY_ALLOCATION_ERROR;
+  }
+  rng_seed(&r, opts->seed);
+
+  for (uint64_t offset = 0; offset < size && err == 0;
+       offset += opts->extent) {
+    uint64_t len = (size - offset < opts->extent) ? size - offset
+                                                  : opts->extent;
+    if (rng_unit(&r) >= density) {
+      continue;
+    }
+    for (uint64_t i = 0; i < len; i += 8) {
+      uint64_t word = rng_next(&r);
+      memcpy(buffer + i, &word, 8);
+    }
+    for (uint64_t done = 0; done < len;) {
+      ssize_t n = pwrite(fd, buffer + done, len - done, offset + done);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        err = OPENING_THE_FILE_ERROR;
+        break;
+      }
+      done += (uint64_t)n;
+    }
+    stats->units++;
+    stats->data += len;
+  }
+
+  if (err == 0 && ftruncate(fd, (off_t)size) != 0) {
+    err = OPENING_THE_FILE_ERROR;
+  }
+  free(buffer);
+  if (close(fd) != 0 && err == 0) {
+    err = OPENING_THE_FILE_ERROR;
+  }
+  return err;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "Usage: %s binary <out> <size> [--seed N] [--mask HEX] "
+          "[--density P]\n"
+          "       %s text <out> <size> [--seed N] [--needle STR] "
+          "[--density P]\n"
+          "                 [--line-min N] [--line-max N] [--files N]\n"
+          "       %s sparse <out> <size> [--seed N] [--density P] "
+          "[--extent SIZE]\n"
+          "sizes take K, M, G and T suffixes (powers of 1024)\n",
+          name, name, name);
+}
+
+int main(int argc, char *argv[]) {
+  corpus_options opts = {1, -1, DEFAULT_MASK, DEFAULT_NEEDLE,
+                         DEFAULT_LINE_MIN, DEFAULT_LINE_MAX, 0,
+                         DEFAULT_EXTENT};
+  corpus_stats stats = {0, 0, 0};
+  uint64_t size = 0;
+  corpus_kind kind = CORPUS_BINARY;
+  char *end = NULL;
+  err_t err = 0;
+
+  if (argc < 4 || parse_size(argv[3], &size) != 0) {
+    usage(argv[0]);
+    return INVALID_CLI_ARGUMENT;
+  }
+  if (strcmp(argv[1], "binary") == 0) {
+    kind = CORPUS_BINARY;
+  } else if (strcmp(argv[1], "text") == 0) {
+    kind = CORPUS_TEXT;
+  } else if (strcmp(argv[1], "sparse") == 0) {
+    kind = CORPUS_SPARSE;
+  } else {
+    usage(argv[0]);
+    return INVALID_CLI_ARGUMENT;
+  }
+
+  for (int i = 4; i < argc; ++i) {
+    const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+    if (value == NULL) {
+      usage(argv[0]);
+      return INVALID_CLI_ARGUMENT;
+    }
+    errno = 0;
+    if (strcmp(argv[i], "--seed") == 0) {
+      opts.seed = strtoull(value, &end, 0);
+    } else if (strcmp(argv[i], "--mask") == 0) {
+      opts.mask = (uint32_t)strtoul(value, &end, 16);
+    } else if (strcmp(argv[i], "--density") == 0) {
+      opts.density = strtod(value, &end);
+      if (opts.density < 0 || opts.density > 1) {
+        errno = ERANGE;
+      }
+    } else if (strcmp(argv[i], "--needle") == 0) {
+      opts.needle = value;
+      end = (char *)value + strlen(value);
+      if (*value == '\0' || strchr(value, '\n') != NULL) {
+        errno = EINVAL;
+      }
+    } else if (strcmp(argv[i], "--line-min") == 0) {
+      opts.line_min = strtoull(value, &end, 10);
+    } else if (strcmp(argv[i], "--line-max") == 0) {
+      opts.line_max = strtoull(value, &end, 10);
+    } else if (strcmp(argv[i], "--files") == 0) {
+      opts.files = strtoull(value, &end, 10);
+    } else if (strcmp(argv[i], "--extent") == 0) {
+      end = "";
+      if (parse_size(value, &opts.extent) != 0 || opts.extent == 0 ||
+          opts.extent > MAX_EXTENT) {
+        errno = ERANGE;
+      }
+    } else {
+      usage(argv[0]);
+      return INVALID_CLI_ARGUMENT;
+    }
+    if (errno != 0 || *end != '\0') {
+      fprintf(stderr, "invalid value for %s: %s\n", argv[i], value);
+      return INVALID_CLI_ARGUMENT;
+    }
+    ++i;
+  }
+  if (opts.line_min > opts.line_max || opts.line_max > MAX_LINE_LEN ||
+      strlen(opts.needle) > MAX_LINE_LEN) {
+    fprintf(stderr, "line lengths must satisfy min <= max <= %d\n",
+            MAX_LINE_LEN);
+    return INVALID_CLI_ARGUMENT;
+  }
+
+  if (kind == CORPUS_BINARY) {
+    err = gen_binary(argv[2], size, &opts, &stats);
+  } else if (kind == CORPUS_TEXT) {
+    err = gen_text(argv[2], size, &opts, &stats);
+  } else {
+    err = gen_sparse(argv[2], size, &opts, &stats);
+  }
+  if (err) {
+    fprintf(stderr, "failed to write %s\n", argv[2]);
+    return err;
+  }
+
+  if (kind == CORPUS_BINARY) {
+    printf("bytes %" PRIu64 " words %" PRIu64 " mask %X matches %" PRIu64
+           "\n",
+           size, stats.units, opts.mask, stats.matches);
+  } else if (kind == CORPUS_SPARSE) {
+    printf("bytes %" PRIu64 " extents %" PRIu64 " data %" PRIu64 "\n", size,
+           stats.units, stats.data);
+  } else {
+    printf("bytes %" PRIu64 " lines %" PRIu64 " needle %s matches %" PRIu64
+           "\n",
+           size, stats.units, opts.needle, stats.matches);
+  }
+  return 0;
+}